@@ -0,0 +1,206 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+// Allocation helpers for per-tick and per-kernel temporaries.
+//
+// MonotonicArena hands out memory by bumping a pointer and releases all of
+// it at once with reset(). When a pass overflows the current block, the
+// next reset() replaces the blocks with one block of the high-water size, so
+// from the second pass of a steady workload on nothing is allocated.
+// ArenaAllocator lets standard containers draw from an arena.
+//
+// SlotPool recycles the indices of entities stored as structure-of-arrays
+// columns, e.g. vehicles: an entity that leaves frees its slot for the next
+// one to arrive, and the columns only grow when every slot is taken.
+//
+// Defining COUNT_HEAP_ALLOCATIONS before including this header in a
+// program's (single) translation unit replaces the global operator new and
+// delete with counting versions, and heapAllocations() returns the number
+// of C++ heap allocations so far. The OpenMP and MPI runtimes allocate with
+// malloc and are not counted.
+
+#define ARENA_ALIGNMENT 64
+
+inline std::atomic<long> heap_allocation_count{0};
+
+inline long heapAllocations() {
+    return heap_allocation_count.load(std::memory_order_relaxed);
+}
+
+class MonotonicArena {
+public:
+    explicit MonotonicArena(size_t initial_bytes = 0) {
+        if (initial_bytes > 0) {
+            addBlock(initial_bytes);
+        }
+    }
+
+    ~MonotonicArena() {
+        release();
+    }
+
+    MonotonicArena(const MonotonicArena&) = delete;
+    MonotonicArena& operator=(const MonotonicArena&) = delete;
+
+    void* allocate(size_t bytes, size_t align = alignof(std::max_align_t)) {
+        size_t offset = (used + align - 1) & ~(align - 1);
+        if (blocks.empty() || offset + bytes > blocks.back().size) {
+            addBlock(std::max(bytes + align, 2 * capacity()));
+            offset = 0;
+        }
+        used = offset + bytes;
+        total += bytes;
+        high_water = std::max(high_water, total);
+        return blocks.back().data + offset;
+    }
+
+    template <typename T>
+    T* allocate(size_t n) {
+        return static_cast<T*>(allocate(n * sizeof(T), alignof(T)));
+    }
+
+    // Frees everything handed out since the last reset. Blocks added during
+    // the pass are merged into one, so the next pass fits in a single block.
+    void reset() {
+        if (blocks.size() > 1) {
+            size_t size = std::max(high_water + ARENA_ALIGNMENT * blocks.size(), capacity());
+            release();
+            addBlock(size);
+        }
+        used = 0;
+        total = 0;
+    }
+
+    size_t capacity() const {
+        size_t bytes = 0;
+        for (const Block& b : blocks) {
+            bytes += b.size;
+        }
+        return bytes;
+    }
+
+    size_t highWater() const { return high_water; }
+
+private:
+    struct Block {
+        char* data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks;
+    size_t used = 0;       // bytes used in the last block
+    size_t total = 0;      // bytes handed out since the last reset
+    size_t high_water = 0; // largest total of any pass
+
+    void addBlock(size_t size) {
+        size = (size + ARENA_ALIGNMENT - 1) & ~size_t(ARENA_ALIGNMENT - 1);
+        blocks.reserve(8);
+        blocks.push_back({static_cast<char*>(::operator new(size, std::align_val_t(ARENA_ALIGNMENT))), size});
+    }
+
+    void release() {
+        for (Block& b : blocks) {
+            ::operator delete(b.data, std::align_val_t(ARENA_ALIGNMENT));
+        }
+        blocks.clear();
+    }
+};
+
+// Standard allocator over an arena; deallocation is a no-op until reset()
+template <typename T>
+struct ArenaAllocator {
+    typedef T value_type;
+
+    MonotonicArena* arena;
+
+    explicit ArenaAllocator(MonotonicArena& arena) : arena(&arena) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t n) { return arena->allocate<T>(n); }
+    void deallocate(T*, size_t) {}
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// Free list of slot indices. acquire() returns a recycled slot, or the next
+// new one (== size() before the call) when none is free; the caller then
+// appends to its columns.
+class SlotPool {
+public:
+    explicit SlotPool(size_t slots = 0) : num_slots(slots) {
+        free_slots.reserve(slots);
+    }
+
+    int32_t acquire() {
+        if (!free_slots.empty()) {
+            int32_t slot = free_slots.back();
+            free_slots.pop_back();
+            return slot;
+        }
+        // The free list can hold every slot, so release() never reallocates
+        if (free_slots.capacity() <= num_slots) {
+            free_slots.reserve(2 * num_slots + 16);
+        }
+        return num_slots++;
+    }
+
+    void release(int32_t slot) {
+        free_slots.push_back(slot);
+    }
+
+    // Room for `slots` slots in total without reallocating
+    void reserve(size_t slots) {
+        free_slots.reserve(slots);
+    }
+
+    size_t size() const { return num_slots; }
+    size_t numFree() const { return free_slots.size(); }
+
+private:
+    size_t num_slots;
+    std::vector<int32_t> free_slots;
+};
+
+#ifdef COUNT_HEAP_ALLOCATIONS
+// Every variant is out of line: once inlined, GCC pairs the malloc and free
+// inside them with the caller's new and delete and flags a mismatch
+#define ARENA_NOINLINE __attribute__((noinline))
+
+inline void* countedAllocation(std::size_t size, std::size_t align) {
+    heap_allocation_count.fetch_add(1, std::memory_order_relaxed);
+    size = std::max<std::size_t>(size, 1);
+    void* p = align <= alignof(std::max_align_t) ? std::malloc(size)
+                                                  : std::aligned_alloc(align, (size + align - 1) & ~(align - 1));
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+ARENA_NOINLINE void* operator new(std::size_t size) { return countedAllocation(size, 1); }
+ARENA_NOINLINE void* operator new[](std::size_t size) { return countedAllocation(size, 1); }
+ARENA_NOINLINE void* operator new(std::size_t size, std::align_val_t align) { return countedAllocation(size, (std::size_t)align); }
+ARENA_NOINLINE void* operator new[](std::size_t size, std::align_val_t align) { return countedAllocation(size, (std::size_t)align); }
+ARENA_NOINLINE void operator delete(void* p) noexcept { std::free(p); }
+ARENA_NOINLINE void operator delete[](void* p) noexcept { std::free(p); }
+ARENA_NOINLINE void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+ARENA_NOINLINE void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+ARENA_NOINLINE void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+ARENA_NOINLINE void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+ARENA_NOINLINE void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+ARENA_NOINLINE void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+#endif
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "Arena.h"
+
+// Per-kernel benchmarking shared by the OpenMP and MPI binaries.
+//
+// A kernel is run `warmup` times untimed and then `repetitions` times timed.
+// Results carry the order statistics of the timed runs, the kernel's
+// element count and its C++ heap allocations per timed run (see Arena.h).
+// They are appended to a CSV, JSON or JSON Lines report together with the
+// thread and rank count, so the runs of a scaling sweep (scaling.sh)
+// collect into one file.
+
+struct BenchmarkResult {
+    std::string binary; // "openmp" or "mpi"
+    std::string kernel;
+    std::string preset;
+    int threads = 1;
+    int ranks = 1;
+    double elements = 0.0; // work items per run: readings, vehicle-ticks, multiply-adds
+    int repetitions = 0;
+    double min_seconds = 0.0;
+    double median_seconds = 0.0;
+    double p99_seconds = 0.0;
+    double mean_seconds = 0.0;
+    double allocations = 0.0; // heap allocations per timed run, this process
+
+    double elementsPerSecond() const { return median_seconds > 0.0 ? elements / median_seconds : 0.0; }
+};
+
+// Order statistic by the nearest-rank method: the smallest sample with at
+// least q of the samples at or below it.
+inline double percentile(std::vector<double> samples, double q) {
+    if (samples.empty()) {
+        return 0.0;
+    }
+    std::sort(samples.begin(), samples.end());
+    size_t rank = (size_t)std::ceil(q * samples.size());
+    return samples[std::min(samples.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+// Fills the timing fields of result from per-repetition wall times.
+inline void summarizeSamples(const std::vector<double>& samples, BenchmarkResult& result) {
+    result.repetitions = samples.size();
+    if (samples.empty()) {
+        return;
+    }
+    double sum = 0.0;
+    for (double s : samples) {
+        sum += s;
+    }
+    result.min_seconds = *std::min_element(samples.begin(), samples.end());
+    result.median_seconds = percentile(samples, 0.5);
+    result.p99_seconds = percentile(samples, 0.99);
+    result.mean_seconds = sum / samples.size();
+}
+
+// Runs `warmup` untimed and `repetitions` timed calls of run, which returns
+// the wall time of one call in seconds. allocations, if given, receives the
+// heap allocations made by the timed calls.
+template <typename F>
+std::vector<double> measureKernel(size_t warmup, size_t repetitions, F run, long* allocations = nullptr) {
+    for (size_t i = 0; i < warmup; ++i) {
+        run();
+    }
+    std::vector<double> samples;
+    samples.reserve(repetitions);
+    long before = heapAllocations();
+    for (size_t i = 0; i < repetitions; ++i) {
+        samples.push_back(run());
+    }
+    if (allocations != nullptr) {
+        *allocations = heapAllocations() - before;
+    }
+    return samples;
+}
+
+inline void printBenchmarkTable(const std::vector<BenchmarkResult>& results) {
+    printf("%-28s %8s %6s %12s %12s %12s %14s %11s\n", "kernel", "threads", "ranks", "median ms", "p99 ms", "min ms",
+           "elements/s", "allocs/run");
+    for (const BenchmarkResult& r : results) {
+        printf("%-28s %8d %6d %12.3f %12.3f %12.3f %14.4g %11.1f\n", r.kernel.c_str(), r.threads, r.ranks,
+               1e3 * r.median_seconds, 1e3 * r.p99_seconds, 1e3 * r.min_seconds, r.elementsPerSecond(), r.allocations);
+    }
+}
+
+inline bool endsWith(const std::string& s, const char* suffix) {
+    size_t n = strlen(suffix);
+    return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+inline void printBenchmarkJson(FILE* out, const BenchmarkResult& r) {
+    fprintf(out, "{\"binary\":\"%s\",\"kernel\":\"%s\",\"preset\":\"%s\",\"threads\":%d,\"ranks\":%d,"
+                 "\"elements\":%.0f,\"repetitions\":%d,\"min_s\":%.9g,\"median_s\":%.9g,\"p99_s\":%.9g,"
+                 "\"mean_s\":%.9g,\"elements_per_s\":%.9g,\"allocations\":%.9g}",
+            r.binary.c_str(), r.kernel.c_str(), r.preset.c_str(), r.threads, r.ranks, r.elements, r.repetitions,
+            r.min_seconds, r.median_seconds, r.p99_seconds, r.mean_seconds, r.elementsPerSecond(), r.allocations);
+}
+
+// Appends results to a .json report, which holds one JSON array: a new
+// file gets the opening bracket, and an existing one is continued from its
+// closing bracket.
+inline bool appendBenchmarkArray(const std::string& path, const std::vector<BenchmarkResult>& results) {
+    FILE* out = fopen(path.c_str(), "r+b");
+    if (out == nullptr) {
+        out = fopen(path.c_str(), "w+b");
+    }
+    if (out == nullptr) {
+        fprintf(stderr, "Cannot open benchmark report '%s'\n", path.c_str());
+        return false;
+    }
+    fseek(out, 0, SEEK_END);
+    long size = ftell(out);
+    bool first = size == 0;
+    if (first) {
+        fputs("[\n", out);
+    } else {
+        // Only whitespace may follow the closing bracket
+        char tail[16];
+        long tail_size = std::min<long>(size, sizeof(tail));
+        fseek(out, size - tail_size, SEEK_SET);
+        long bracket = -1;
+        if (fread(tail, 1, tail_size, out) == (size_t)tail_size) {
+            for (long i = tail_size - 1; i >= 0 && bracket < 0; --i) {
+                if (tail[i] == ']') {
+                    bracket = size - tail_size + i;
+                } else if (!isspace((unsigned char)tail[i])) {
+                    break;
+                }
+            }
+        }
+        if (bracket < 0) {
+            fprintf(stderr, "Benchmark report '%s' does not end in a JSON array\n", path.c_str());
+            fclose(out);
+            return false;
+        }
+        fseek(out, bracket, SEEK_SET);
+    }
+    for (const BenchmarkResult& r : results) {
+        fputs(first ? "  " : ",\n  ", out);
+        printBenchmarkJson(out, r);
+        first = false;
+    }
+    fputs("\n]\n", out);
+    fclose(out);
+    return true;
+}
+
+// Appends results to path: a JSON array for .json, one JSON object per line
+// for .jsonl, CSV otherwise (with a header when the file is new or empty).
+inline bool appendBenchmarkReport(const std::string& path, const std::vector<BenchmarkResult>& results) {
+    if (endsWith(path, ".json")) {
+        return appendBenchmarkArray(path, results);
+    }
+    bool json = endsWith(path, ".jsonl");
+    FILE* out = fopen(path.c_str(), "a");
+    if (out == nullptr) {
+        fprintf(stderr, "Cannot open benchmark report '%s'\n", path.c_str());
+        return false;
+    }
+    if (!json && ftell(out) == 0) {
+        fprintf(out, "binary,kernel,preset,threads,ranks,elements,repetitions,min_s,median_s,p99_s,mean_s,elements_per_s,allocations\n");
+    }
+    for (const BenchmarkResult& r : results) {
+        if (json) {
+            printBenchmarkJson(out, r);
+            fputc('\n', out);
+        } else {
+            fprintf(out, "%s,%s,%s,%d,%d,%.0f,%d,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g\n", r.binary.c_str(), r.kernel.c_str(),
+                    r.preset.c_str(), r.threads, r.ranks, r.elements, r.repetitions, r.min_seconds, r.median_seconds,
+                    r.p99_seconds, r.mean_seconds, r.elementsPerSecond(), r.allocations);
+        }
+    }
+    fclose(out);
+    return true;
+}
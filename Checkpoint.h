@@ -0,0 +1,459 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CityState.h"
+#include "Config.h"
+#include "Telemetry.h"
+#include "Trace.h"
+
+// Snapshots of the whole simulation state, for checkpoint and restart.
+//
+// A snapshot is a 128-byte header, the sections and a table naming them:
+//
+//   header | section 0 | section 1 | ... | table (one CheckpointSection each)
+//
+// A section is a global array: `rows` rows of `records` fixed-size records,
+// row-major, in global index order, starting on a cache line. Nothing in
+// the file depends on how the work was split, so a snapshot written by any
+// number of threads or MPI ranks restores on any other, and the OpenMP and
+// MPI executables read each other's snapshots.
+//
+// State is listed by the objects that own it, with one method used both to
+// save and to restore:
+//
+//   template <typename Archive>
+//   void checkpoint(Archive& archive) {
+//       archive.section("ev.soc", ev_soc.data(), fleet, first, first + count);
+//       archive.whole("ev.batch", &batch, 1);
+//   }
+//
+// section() covers the records [begin, end) of every row that this process
+// holds, at data (row r at data + r * stride); whole() an array every
+// process holds in full. On restore, records() gives the length of a
+// section in the snapshot, for state whose size varies.
+//
+// CheckpointWriter stages the sections in memory and writes the file from a
+// background thread, so the simulation only stalls for the copy. The file is
+// written next to its final path and renamed when complete, so a crash
+// while writing leaves the previous snapshot intact. DistributedCheckpoint.h
+// writes and reads the same format with MPI-IO.
+
+#define CHECKPOINT_MAGIC "TCSCKPT1"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_NAME_BYTES 40
+#define CHECKPOINT_COPY_CHUNK (1u << 20) // bytes per task when staging
+
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_bytes;
+    uint64_t num_sections;
+    uint64_t table_offset;
+    uint64_t passes; // pipeline passes (replay frames) completed
+    uint64_t seed;
+    uint64_t num_vehicles;
+    uint64_t num_sensors;
+    uint64_t num_cameras;
+    uint64_t num_intersections;
+    uint64_t num_ev_stations;
+    uint64_t num_transit_stops;
+    uint64_t reserved[4];
+};
+static_assert(sizeof(CheckpointHeader) == 128, "checkpoint header is 128 bytes");
+
+struct CheckpointSection {
+    char name[CHECKPOINT_NAME_BYTES];
+    uint32_t record_bytes;
+    uint32_t rows;
+    uint64_t records; // per row
+    uint64_t offset;  // bytes from the start of the file
+
+    uint64_t rowBytes() const { return records * record_bytes; }
+    uint64_t bytes() const { return rows * rowBytes(); }
+};
+static_assert(sizeof(CheckpointSection) == 64, "checkpoint sections are 64 bytes");
+
+// Header for the configured city after `passes` passes.
+inline CheckpointHeader makeCheckpointHeader(const CityConfig& config, uint64_t passes) {
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.header_bytes = sizeof(CheckpointHeader);
+    header.passes = passes;
+    header.seed = config.seed;
+    header.num_vehicles = config.num_vehicles;
+    header.num_sensors = config.num_sensors;
+    header.num_cameras = config.num_cameras;
+    header.num_intersections = config.num_intersections;
+    header.num_ev_stations = config.num_ev_stations;
+    header.num_transit_stops = config.num_transit_stops;
+    return header;
+}
+
+// Section offsets and lookup, shared by all writers and readers.
+class CheckpointLayout {
+public:
+    CheckpointHeader header;
+    std::vector<CheckpointSection> sections;
+
+    void reset(const CheckpointHeader& h) {
+        header = h;
+        sections.clear();
+        end = alignUp(sizeof(CheckpointHeader));
+    }
+
+    // Places the next section after the previous one; false if the name is
+    // too long for the table.
+    bool append(const std::string& name, uint32_t record_bytes, uint64_t rows, uint64_t records) {
+        if (name.size() >= CHECKPOINT_NAME_BYTES) {
+            fprintf(stderr, "Checkpoint section name '%s' is too long\n", name.c_str());
+            return false;
+        }
+        CheckpointSection s;
+        memset(&s, 0, sizeof(s));
+        memcpy(s.name, name.data(), name.size());
+        s.record_bytes = record_bytes;
+        s.rows = rows;
+        s.records = records;
+        s.offset = end;
+        sections.push_back(s);
+        end = alignUp(end + s.bytes());
+        return true;
+    }
+
+    // Header fields filled in once all sections are placed
+    void finish() {
+        header.num_sections = sections.size();
+        header.table_offset = end;
+    }
+
+    uint64_t fileBytes() const { return end + sections.size() * sizeof(CheckpointSection); }
+
+    const CheckpointSection* find(const std::string& name) const {
+        for (const CheckpointSection& s : sections) {
+            if (strncmp(s.name, name.c_str(), CHECKPOINT_NAME_BYTES) == 0) {
+                return &s;
+            }
+        }
+        return nullptr;
+    }
+
+    // The section as the restoring code expects it, or null (with a message
+    // if `report`)
+    const CheckpointSection* expect(const std::string& name, uint32_t record_bytes, uint64_t rows, uint64_t records,
+                                    bool report = true) const {
+        const CheckpointSection* s = find(name);
+        if (s == nullptr) {
+            if (report) {
+                fprintf(stderr, "Checkpoint has no section '%s'\n", name.c_str());
+            }
+        } else if (s->record_bytes != record_bytes || s->rows != rows || s->records != records) {
+            if (report) {
+                fprintf(stderr, "Checkpoint section '%s' is %llu x %llu records of %u bytes, expected %llu x %llu of %u\n",
+                        name.c_str(), (unsigned long long)s->rows, (unsigned long long)s->records, s->record_bytes,
+                        (unsigned long long)rows, (unsigned long long)records, record_bytes);
+            }
+            s = nullptr;
+        }
+        return s;
+    }
+
+    // Checks a snapshot's header against the header the run would write;
+    // says why not unless path is null
+    static bool matches(const CheckpointHeader& file, const CheckpointHeader& run, const char* path) {
+        if (memcmp(file.magic, CHECKPOINT_MAGIC, sizeof(file.magic)) != 0 || file.version != CHECKPOINT_VERSION) {
+            if (path != nullptr) {
+                fprintf(stderr, "'%s' is not a version %d checkpoint\n", path, CHECKPOINT_VERSION);
+            }
+            return false;
+        }
+        if (file.seed != run.seed || file.num_vehicles != run.num_vehicles || file.num_sensors != run.num_sensors ||
+            file.num_cameras != run.num_cameras || file.num_intersections != run.num_intersections ||
+            file.num_ev_stations != run.num_ev_stations || file.num_transit_stops != run.num_transit_stops) {
+            if (path != nullptr) {
+                fprintf(stderr, "Checkpoint '%s' is of a different city or seed\n", path);
+            }
+            return false;
+        }
+        return true;
+    }
+
+    static uint64_t alignUp(uint64_t bytes) {
+        return (bytes + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+    }
+
+private:
+    uint64_t end = alignUp(sizeof(CheckpointHeader));
+};
+
+struct CheckpointStats {
+    uint64_t bytes = 0;
+    double stall_seconds = 0.0; // compute blocked: waiting for the last write, staging
+    double write_seconds = 0.0; // staged to renamed, on the writer thread
+};
+
+// Stages snapshots in memory and writes them from a background thread. Two
+// staging buffers alternate, so the next snapshot can be staged while the
+// last one is still being written; commit() waits for that write first.
+class CheckpointWriter {
+public:
+    ~CheckpointWriter() {
+        wait();
+    }
+
+    bool restoring() const { return false; }
+    uint64_t records(const std::string&) const { return 0; } // restore only
+
+    // Starts staging a snapshot
+    void begin(const CheckpointHeader& header) {
+        stage_start = std::chrono::steady_clock::now();
+        layout[current].reset(header);
+        staged_ok = true;
+    }
+
+    template <typename T>
+    void section(const std::string& name, T* data, uint64_t records, uint64_t begin, uint64_t end, uint64_t rows = 1,
+                 uint64_t stride = 0) {
+        stage(name, data, sizeof(T), records, begin, end, rows, stride == 0 ? end - begin : stride);
+    }
+
+    template <typename T>
+    void whole(const std::string& name, T* data, uint64_t records, uint64_t rows = 1) {
+        stage(name, data, sizeof(T), records, 0, records, rows, records);
+    }
+
+    // Hands the staged snapshot to the writer thread; it is written to
+    // path + ".tmp" and renamed to path. Returns false if staging failed.
+    bool commit(const std::string& path) {
+        CheckpointLayout& staged = layout[current];
+        staged.finish();
+        if (!staged_ok) {
+            return false;
+        }
+        if (staging[current].size() < staged.header.table_offset) {
+            staging[current].resize(staged.header.table_offset);
+        }
+        wait();
+        writing = current;
+        current = 1 - current;
+        std::string target = path;
+        double stall = seconds(stage_start);
+        last.bytes = staged.fileBytes();
+        last.stall_seconds = stall;
+        last.write_seconds = 0.0;
+        int slot = writing;
+        writer = std::thread([this, slot, target] { writeFile(slot, target); });
+        return true;
+    }
+
+    // Blocks until the last committed snapshot is on disk
+    void wait() {
+        if (writer.joinable()) {
+            writer.join();
+        }
+    }
+
+    // The last committed snapshot; write_seconds is valid after wait()
+    const CheckpointStats& lastStats() const { return last; }
+    bool lastWriteOk() const { return write_ok; }
+
+private:
+    CheckpointLayout layout[2];
+    AlignedVector<char> staging[2];
+    int current = 0;
+    int writing = 0;
+    bool staged_ok = true;
+    bool write_ok = true;
+    std::chrono::steady_clock::time_point stage_start;
+    CheckpointStats last;
+    std::thread writer;
+
+    static double seconds(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void stage(const std::string& name, const void* data, uint32_t record_bytes, uint64_t records, uint64_t begin,
+               uint64_t end, uint64_t rows, uint64_t stride) {
+        CheckpointLayout& l = layout[current];
+        if (!l.append(name, record_bytes, rows, records)) {
+            staged_ok = false;
+            return;
+        }
+        const CheckpointSection& s = l.sections.back();
+        AlignedVector<char>& buffer = staging[current];
+        // Staging mirrors the file, so the writer thread writes it as is
+        if (buffer.size() < s.offset + s.bytes()) {
+            buffer.resize(std::max<size_t>(s.offset + s.bytes(), 2 * buffer.size()));
+        }
+        for (uint64_t r = 0; r < rows; ++r) {
+            copyParallel(buffer.data() + s.offset + r * s.rowBytes() + begin * record_bytes,
+                         (const char*)data + r * stride * record_bytes, (end - begin) * record_bytes);
+        }
+    }
+
+    // One task per chunk; outside a parallel region it opens its own
+    static void copyParallel(char* dst, const char* src, size_t bytes) {
+        long chunks = (bytes + CHECKPOINT_COPY_CHUNK - 1) / CHECKPOINT_COPY_CHUNK;
+        auto copy = [&]() {
+            #pragma omp taskloop default(shared) grainsize(1) if (chunks > 1)
+            for (long c = 0; c < chunks; ++c) {
+                size_t lo = c * (size_t)CHECKPOINT_COPY_CHUNK;
+                memcpy(dst + lo, src + lo, std::min<size_t>(CHECKPOINT_COPY_CHUNK, bytes - lo));
+            }
+        };
+#ifdef _OPENMP
+        if (chunks > 1 && !omp_in_parallel()) {
+            #pragma omp parallel
+            #pragma omp single
+            copy();
+            return;
+        }
+#endif
+        copy();
+    }
+
+    void writeFile(int slot, const std::string& path) {
+        TRACE_THREAD("Checkpoint writer", -1);
+        TRACE_SCOPE("Checkpoint Write", "io");
+        auto start = std::chrono::steady_clock::now();
+        const CheckpointLayout& l = layout[slot];
+        std::string tmp = path + ".tmp";
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        bool ok = fd >= 0;
+        if (ok) {
+            const char* buffer = staging[slot].data();
+            memcpy(staging[slot].data(), &l.header, sizeof(l.header));
+            ok = writeAll(fd, buffer, l.header.table_offset, 0) &&
+                 writeAll(fd, (const char*)l.sections.data(), l.sections.size() * sizeof(CheckpointSection),
+                          l.header.table_offset) &&
+                 fsync(fd) == 0;
+            ok = ::close(fd) == 0 && ok;
+        }
+        ok = ok && rename(tmp.c_str(), path.c_str()) == 0;
+        if (!ok) {
+            fprintf(stderr, "Cannot write checkpoint '%s'\n", path.c_str());
+        }
+        write_ok = ok;
+        last.write_seconds = seconds(start);
+        logMessage(LOG_SUMMARY, "Checkpoint: wrote %s, %.1f MB in %.3f s (%.2f GB/s).", path.c_str(), l.fileBytes() / 1e6,
+                   last.write_seconds, l.fileBytes() / 1e9 / std::max(last.write_seconds, 1e-9));
+    }
+
+    static bool writeAll(int fd, const char* data, size_t bytes, off_t offset) {
+        while (bytes > 0) {
+            ssize_t n = pwrite(fd, data, bytes, offset);
+            if (n <= 0) {
+                return false;
+            }
+            data += n;
+            bytes -= n;
+            offset += n;
+        }
+        return true;
+    }
+};
+
+// Restores a snapshot section by section, straight into the owners' arrays.
+class CheckpointReader {
+public:
+    CheckpointLayout layout;
+
+    ~CheckpointReader() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    bool restoring() const { return true; }
+    bool ok() const { return read_ok; }
+    uint64_t bytesRead() const { return bytes_read; }
+
+    // Reads the header and table; false with a message if the snapshot is
+    // unreadable or of another city
+    bool open(const std::string& path, const CheckpointHeader& run) {
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "Cannot open checkpoint '%s'\n", path.c_str());
+            return false;
+        }
+        CheckpointHeader header;
+        if (!readAll((char*)&header, sizeof(header), 0) || !CheckpointLayout::matches(header, run, path.c_str())) {
+            fprintf(stderr, "Cannot restore from '%s'\n", path.c_str());
+            return false;
+        }
+        layout.header = header;
+        layout.sections.resize(header.num_sections);
+        if (!readAll((char*)layout.sections.data(), header.num_sections * sizeof(CheckpointSection), header.table_offset)) {
+            fprintf(stderr, "Checkpoint '%s' is truncated\n", path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t records(const std::string& name) const {
+        const CheckpointSection* s = layout.find(name);
+        return s == nullptr ? 0 : s->records;
+    }
+
+    template <typename T>
+    void section(const std::string& name, T* data, uint64_t records, uint64_t begin, uint64_t end, uint64_t rows = 1,
+                 uint64_t stride = 0) {
+        load(name, data, sizeof(T), records, begin, end, rows, stride == 0 ? end - begin : stride);
+    }
+
+    template <typename T>
+    void whole(const std::string& name, T* data, uint64_t records, uint64_t rows = 1) {
+        load(name, data, sizeof(T), records, 0, records, rows, records);
+    }
+
+private:
+    int fd = -1;
+    bool read_ok = true;
+    uint64_t bytes_read = 0;
+
+    void load(const std::string& name, void* data, uint32_t record_bytes, uint64_t records, uint64_t begin,
+              uint64_t end, uint64_t rows, uint64_t stride) {
+        const CheckpointSection* s = layout.expect(name, record_bytes, rows, records);
+        if (s == nullptr) {
+            read_ok = false;
+            return;
+        }
+        for (uint64_t r = 0; r < rows && read_ok; ++r) {
+            read_ok = readAll((char*)data + r * stride * record_bytes, (end - begin) * record_bytes,
+                              s->offset + r * s->rowBytes() + begin * record_bytes);
+        }
+        if (!read_ok) {
+            fprintf(stderr, "Checkpoint section '%s' is truncated\n", name.c_str());
+        }
+    }
+
+    bool readAll(char* data, size_t bytes, off_t offset) {
+        bytes_read += bytes;
+        while (bytes > 0) {
+            ssize_t n = pread(fd, data, bytes, offset);
+            if (n <= 0) {
+                return false;
+            }
+            data += n;
+            bytes -= n;
+            offset += n;
+        }
+        return true;
+    }
+};
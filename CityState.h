@@ -0,0 +1,247 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Flat structure-of-arrays storage for all city state.
+//
+// Every array is a single contiguous allocation aligned to a cache line, so
+// static OpenMP partitions never share a line at their start, per-intersection
+// rows no longer each live in their own heap block, and the arrays can be
+// streamed with aligned vector loads. The arrays are first written by all
+// threads in parallel, so on a multi-socket node their pages are spread over
+// the sockets instead of all sitting on the node of the main thread.
+
+#define CACHE_LINE_SIZE 64
+#define NUM_APPROACHES 4 // signal heads per intersection (N, E, S, W)
+#define HISTORY_DAYS 91  // daily volumes kept per road segment
+#define FORECAST_DAYS 7  // forecast horizon per road segment
+
+template <typename T>
+struct AlignedAllocator {
+    typedef T value_type;
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(CACHE_LINE_SIZE)));
+    }
+
+    void deallocate(T* p, size_t) {
+        ::operator delete(p, std::align_val_t(CACHE_LINE_SIZE));
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U>&) const { return false; }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+// Like AlignedAllocator, but sizing a vector leaves its elements
+// default-initialized, i.e. unwritten for the plain reading types. The pages
+// are then placed on first touch by whichever thread writes them first (see
+// firstTouch()), not all on the node of the thread that allocated them.
+template <typename T>
+struct FirstTouchAllocator : AlignedAllocator<T> {
+    typedef T value_type;
+
+    FirstTouchAllocator() = default;
+    template <typename U>
+    FirstTouchAllocator(const FirstTouchAllocator<U>&) {}
+
+    template <typename U>
+    void construct(U* p) {
+        ::new (static_cast<void*>(p)) U;
+    }
+
+    template <typename U, typename... Args>
+    void construct(U* p, Args&&... args) {
+        ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+    }
+};
+
+template <typename T>
+using CityArray = std::vector<T, FirstTouchAllocator<T>>;
+
+// Allocates n elements and writes `value` to them with a static OpenMP
+// schedule, so each thread's share of the pages lands on its own NUMA node.
+// Kernels that split the array the same way then read local memory.
+template <typename T>
+void firstTouch(CityArray<T>& array, size_t n, T value) {
+    array.resize(n);
+    T* data = array.data();
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < n; ++i) {
+        data[i] = value;
+    }
+}
+
+// Value types for the individual readings. Widths are the narrowest that hold
+// the sensor's range, which keeps the per-element memory traffic down.
+typedef int32_t VehicleCount;
+typedef uint8_t IncidentFlag;    // 0 or 1
+typedef uint8_t DensityPercent;  // camera occupancy, 0-100
+typedef uint16_t AirQualityIndex; // US AQI, 0-500
+typedef uint8_t NoiseLevel;      // dB(A)
+typedef uint16_t PassengerCount;
+typedef uint8_t EvPriority;
+
+enum class LightPhase : uint8_t { Red = 0, Yellow = 1, Green = 2 };
+enum class ChargerStatus : uint8_t { Available = 0, Occupied = 1 };
+
+// Triple-buffered signal plans.
+//
+// A plan is the flat array of NUM_APPROACHES light phases per intersection.
+// Controllers compose the next plan in the draft slot; publish() makes it
+// current with a single atomic store of the epoch, and readers take a
+// snapshot of the current plan without locks.
+//
+// Plan e lives in slot e % 3. While the writer drafts plan e + 1, readers may
+// hold plan e or e - 1, which are in the other two slots. Slot e % 3 is next
+// written when plan e + 2 is published and the draft of e + 3 starts there,
+// so a snapshot stays intact for one full publish period after it was
+// superseded. Readers that start a snapshot within one pipeline
+// tick therefore never see a torn plan.
+//
+// There is one writer side (the controllers of a tick, ordered among
+// themselves) and any number of readers.
+
+struct SignalSnapshot {
+    const LightPhase* lights = nullptr;
+    uint64_t epoch = 0;
+
+    const LightPhase* intersection(size_t i) const { return lights + i * NUM_APPROACHES; }
+};
+
+class SignalPlanBuffer {
+public:
+    explicit SignalPlanBuffer(size_t num_intersections)
+        : plan_size(num_intersections * NUM_APPROACHES) {
+        for (auto& slot : slots) {
+            firstTouch(slot, plan_size, LightPhase::Red);
+        }
+    }
+
+    size_t size() const { return plan_size; }
+
+    // Writer side: the plan being composed for the next epoch. It starts as a
+    // copy of the current plan, so a controller may update only some heads.
+    LightPhase* draft() {
+        return slots[(epoch.load(std::memory_order_relaxed) + 1) % 3].data();
+    }
+
+    // Makes the draft current and starts the next draft from it.
+    void publish() {
+        uint64_t next = epoch.load(std::memory_order_relaxed) + 1;
+        epoch.store(next, std::memory_order_release);
+        memcpy(slots[(next + 1) % 3].data(), slots[next % 3].data(), plan_size * sizeof(LightPhase));
+    }
+
+    // Reader side: the current plan and its epoch.
+    SignalSnapshot snapshot() const {
+        uint64_t e = epoch.load(std::memory_order_acquire);
+        return SignalSnapshot{slots[e % 3].data(), e};
+    }
+
+    // True while the slot behind a snapshot has not been reused.
+    bool valid(const SignalSnapshot& snapshot) const {
+        return epoch.load(std::memory_order_acquire) - snapshot.epoch <= 1;
+    }
+
+    uint64_t currentEpoch() const { return epoch.load(std::memory_order_acquire); }
+
+    // Checkpoint restore: makes the draft the current plan of epoch e, with
+    // the other slots copies of it.
+    void restoreEpoch(uint64_t e) {
+        const CityArray<LightPhase>& restored = slots[(epoch.load(std::memory_order_relaxed) + 1) % 3];
+        for (auto& slot : slots) {
+            if (&slot != &restored) {
+                memcpy(slot.data(), restored.data(), plan_size * sizeof(LightPhase));
+            }
+        }
+        epoch.store(e, std::memory_order_release);
+    }
+
+    // Resources naming the two sides for TaskGraph dependency tracking.
+    const void* draftResource() const { return &slots; }
+    const void* publishedResource() const { return &epoch; }
+
+private:
+    size_t plan_size;
+    CityArray<LightPhase> slots[3];
+    std::atomic<uint64_t> epoch{0};
+};
+
+struct CityState {
+    // Per-vehicle data
+    CityArray<VehicleCount> vehicle_data;
+    CityArray<EvPriority> ev_prioritization;
+
+    // Per-sensor and per-camera readings
+    CityArray<IncidentFlag> incidents;
+    CityArray<DensityPercent> sensor_occupancy; // loop-detector occupancy, 0-100
+    CityArray<DensityPercent> traffic_density;
+    CityArray<AirQualityIndex> air_quality_data;
+    CityArray<NoiseLevel> noise_data;
+
+    // Daily traffic volume per road segment (one per sensor), day-major:
+    // day d of segment s is historical_data[(d % HISTORY_DAYS) * num_sensors + s]
+    CityArray<VehicleCount> historical_data;
+    CityArray<VehicleCount> future_traffic; // FORECAST_DAYS rows
+
+    CityArray<PassengerCount> public_transport_data; // passengers waiting per stop
+    CityArray<uint8_t> transit_priority; // per intersection, a bit per approach a bus asks green for
+    CityArray<ChargerStatus> charging_stations;
+
+    // Signal phases, NUM_APPROACHES consecutive entries per intersection
+    SignalPlanBuffer signal_plans;
+
+    // Origin-destination flow matrices, row-major matrix_size x matrix_size
+    CityArray<int32_t> matrix_a;
+    CityArray<int32_t> matrix_b;
+    CityArray<int32_t> result;
+
+    size_t num_intersections;
+    size_t matrix_size;
+
+    CityState(size_t num_vehicles, size_t num_sensors, size_t num_cameras, size_t num_intersections,
+              size_t num_ev_stations, size_t num_transit_stops, size_t matrix_size)
+        : signal_plans(num_intersections),
+          num_intersections(num_intersections),
+          matrix_size(matrix_size) {
+        firstTouch(vehicle_data, num_vehicles, 0);
+        firstTouch(ev_prioritization, num_vehicles, EvPriority(0));
+        firstTouch(incidents, num_sensors, IncidentFlag(0));
+        firstTouch(sensor_occupancy, num_sensors, DensityPercent(0));
+        firstTouch(traffic_density, num_cameras, DensityPercent(0));
+        firstTouch(air_quality_data, num_sensors, AirQualityIndex(50));
+        firstTouch(noise_data, num_sensors, NoiseLevel(30));
+        firstTouch(historical_data, HISTORY_DAYS * num_sensors, 0);
+        firstTouch(future_traffic, FORECAST_DAYS * num_sensors, 0);
+        firstTouch(public_transport_data, num_transit_stops, PassengerCount(0));
+        firstTouch(transit_priority, num_intersections, uint8_t(0));
+        firstTouch(charging_stations, num_ev_stations, ChargerStatus::Occupied);
+        firstTouch(matrix_a, matrix_size * matrix_size, 1);
+        firstTouch(matrix_b, matrix_size * matrix_size, 1);
+        firstTouch(result, matrix_size * matrix_size, 0);
+    }
+
+    // Controllers write the draft plan; readers use signal_plans.snapshot()
+    LightPhase& light(size_t intersection, int approach) {
+        return signal_plans.draft()[intersection * NUM_APPROACHES + approach];
+    }
+
+    LightPhase* intersectionLights(size_t intersection) {
+        return signal_plans.draft() + intersection * NUM_APPROACHES;
+    }
+};
@@ -0,0 +1,248 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include "SensorRNG.h"
+#include "Telemetry.h"
+
+// Runtime city scale.
+//
+// Every buffer is sized from a CityConfig at startup. Values come from a
+// preset, a key = value config file and command-line flags, applied left to
+// right so later settings override earlier ones:
+//
+//   ./openmp_traffic_management --preset city --vehicles 20000000
+//   ./openmp_traffic_management --config sweep.cfg --log off
+
+struct CityConfig {
+    size_t num_sensors = 100;
+    size_t num_cameras = 50;
+    size_t num_vehicles = 10000;
+    size_t num_intersections = 50;
+    size_t matrix_size = 200;
+    size_t num_ev_stations = 50;
+    size_t num_transit_stops = 100;
+    size_t sim_ticks = 60; // one-second ticks run by trafficSimulation
+    size_t env_grid = 256; // air quality and noise map cells per side (see EnvironmentMonitor.h)
+    uint64_t seed = DEFAULT_SENSOR_SEED;
+    LogLevel log_level = LOG_SUMMARY;
+    std::string preset = "small";
+
+    // Benchmark mode (see Benchmark.h): repetitions > 0 times each kernel
+    // separately instead of running the pipeline once
+    size_t repetitions = 0;
+    size_t warmup = 1;
+    std::string report; // CSV; a JSON array for .json, JSON Lines for .jsonl
+
+    // Sensor replay file (see SensorReplay.h); sizes come from its header
+    std::string replay;
+
+    // MPI only: post gathers and reductions without blocking and let the
+    // next kernel run while they complete (see Distribution.h)
+    bool pipeline = false;
+
+    // Adaptive signal control policy (see SignalController.h): max-pressure
+    // or webster
+    std::string signal_policy = "max-pressure";
+
+    // Snapshots of the whole state (see Checkpoint.h): written to
+    // `checkpoint` at the end of the run and every `checkpoint_every`
+    // replay frames, and resumed from `restart`
+    std::string checkpoint;
+    size_t checkpoint_every = 0;
+    std::string restart;
+
+    // Chrome trace JSON of the kernel, thread and MPI spans (see Trace.h),
+    // with per-kernel hardware counters if trace_counters is set
+    std::string trace;
+    bool trace_counters = false;
+
+    // GTFS-style transit feed directory (see TransitFeed.h); the stop count
+    // comes from the feed
+    std::string transit;
+};
+
+// Common city sizes. The matrix sizes match the fixed-size GEMM
+// instantiations in matrixMultiplication, so a preset runs one of them.
+struct CityPreset {
+    const char* name;
+    size_t num_sensors;
+    size_t num_cameras;
+    size_t num_vehicles;
+    size_t num_intersections;
+    size_t matrix_size;
+    size_t num_ev_stations;
+    size_t num_transit_stops;
+    size_t env_grid;
+};
+
+static const CityPreset CITY_PRESETS[] = {
+    {"small",    100,     50,      10000,     50,      200,  50,     100,     256},
+    {"district", 10000,   2000,    1000000,   5000,    512,  500,    2000,    4096},
+    {"city",     100000,  20000,   10000000,  50000,   1024, 5000,   20000,   4096},
+    {"metro",    1000000, 100000,  100000000, 100000,  2048, 20000,  100000,  8192},
+};
+
+inline bool applyPreset(const char* name, CityConfig& config) {
+    for (const CityPreset& preset : CITY_PRESETS) {
+        if (strcmp(preset.name, name) == 0) {
+            config.num_sensors = preset.num_sensors;
+            config.num_cameras = preset.num_cameras;
+            config.num_vehicles = preset.num_vehicles;
+            config.num_intersections = preset.num_intersections;
+            config.matrix_size = preset.matrix_size;
+            config.num_ev_stations = preset.num_ev_stations;
+            config.num_transit_stops = preset.num_transit_stops;
+            config.env_grid = preset.env_grid;
+            config.preset = name;
+            return true;
+        }
+    }
+    fprintf(stderr, "Unknown preset '%s' (expected small, district, city or metro)\n", name);
+    return false;
+}
+
+inline bool parseSize(const char* key, const char* value, size_t& out) {
+    char* end = nullptr;
+    unsigned long long parsed = strtoull(value, &end, 10);
+    if (end == value || *end != '\0' || parsed == 0) {
+        fprintf(stderr, "Invalid value '%s' for %s (expected a positive integer)\n", value, key);
+        return false;
+    }
+    out = parsed;
+    return true;
+}
+
+// Like parseSize, but zero is allowed.
+template <typename T>
+inline bool parseCount(const char* key, const char* value, T& out) {
+    char* end = nullptr;
+    unsigned long long parsed = strtoull(value, &end, 10);
+    if (end == value || *end != '\0') {
+        fprintf(stderr, "Invalid value '%s' for %s (expected a non-negative integer)\n", value, key);
+        return false;
+    }
+    out = parsed;
+    return true;
+}
+
+inline bool loadConfigFile(const char* path, CityConfig& config);
+
+// Applies one setting. Keys are the flag names without the leading dashes.
+inline bool applySetting(const std::string& key, const char* value, CityConfig& config) {
+    if (key == "sensors") return parseSize("sensors", value, config.num_sensors);
+    if (key == "cameras") return parseSize("cameras", value, config.num_cameras);
+    if (key == "vehicles") return parseSize("vehicles", value, config.num_vehicles);
+    if (key == "intersections") return parseSize("intersections", value, config.num_intersections);
+    if (key == "matrix") return parseSize("matrix", value, config.matrix_size);
+    if (key == "ev-stations") return parseSize("ev-stations", value, config.num_ev_stations);
+    if (key == "transit-stops") return parseSize("transit-stops", value, config.num_transit_stops);
+    if (key == "ticks") return parseSize("ticks", value, config.sim_ticks);
+    if (key == "env-grid") return parseSize("env-grid", value, config.env_grid);
+    if (key == "preset") return applyPreset(value, config);
+    if (key == "config") return loadConfigFile(value, config);
+    if (key == "seed") return parseCount("seed", value, config.seed);
+    if (key == "repetitions") return parseSize("repetitions", value, config.repetitions);
+    if (key == "warmup") return parseCount("warmup", value, config.warmup);
+    if (key == "replay") {
+        config.replay = value;
+        return true;
+    }
+    if (key == "transit") {
+        config.transit = value;
+        return true;
+    }
+    if (key == "signal-policy") {
+        if (strcmp(value, "max-pressure") != 0 && strcmp(value, "webster") != 0) {
+            fprintf(stderr, "Unknown signal policy '%s' (expected max-pressure or webster)\n", value);
+            return false;
+        }
+        config.signal_policy = value;
+        return true;
+    }
+    if (key == "checkpoint") {
+        config.checkpoint = value;
+        return true;
+    }
+    if (key == "checkpoint-every") return parseSize("checkpoint-every", value, config.checkpoint_every);
+    if (key == "restart") {
+        config.restart = value;
+        return true;
+    }
+    if (key == "trace") {
+        config.trace = value;
+        return true;
+    }
+    if (key == "trace-counters") {
+        config.trace_counters = atoi(value) != 0;
+        return true;
+    }
+    if (key == "pipeline") {
+        config.pipeline = atoi(value) != 0;
+        return true;
+    }
+    if (key == "report") {
+        config.report = value;
+        return true;
+    }
+    if (key == "log") {
+        if (strcmp(value, "off") != 0 && strcmp(value, "summary") != 0 && strcmp(value, "verbose") != 0) {
+            fprintf(stderr, "Unknown log level '%s' (expected off, summary or verbose)\n", value);
+            return false;
+        }
+        config.log_level = parseLogLevel(value, config.log_level);
+        return true;
+    }
+    fprintf(stderr, "Unknown setting '%s'\n", key.c_str());
+    return false;
+}
+
+// Reads "key = value" lines; blank lines and lines starting with '#' are skipped.
+inline bool loadConfigFile(const char* path, CityConfig& config) {
+    std::ifstream in(path);
+    if (!in) {
+        fprintf(stderr, "Cannot open config file '%s'\n", path);
+        return false;
+    }
+    std::string line;
+    while (getline(in, line)) {
+        size_t first = line.find_first_not_of(" \t");
+        if (first == std::string::npos || line[first] == '#') {
+            continue;
+        }
+        size_t eq = line.find('=');
+        if (eq == std::string::npos) {
+            fprintf(stderr, "%s: expected 'key = value', got '%s'\n", path, line.c_str());
+            return false;
+        }
+        std::string key = line.substr(first, eq - first);
+        std::string value = line.substr(eq + 1);
+        key.erase(key.find_last_not_of(" \t") + 1);
+        value.erase(0, value.find_first_not_of(" \t"));
+        value.erase(value.find_last_not_of(" \t\r") + 1);
+        if (!applySetting(key, value.c_str(), config)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Parses "--key value" pairs from the command line.
+inline bool parseArguments(int argc, char* argv[], CityConfig& config) {
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--", 2) != 0 || i + 1 == argc) {
+            fprintf(stderr, "Expected '--<setting> <value>', got '%s'\n", argv[i]);
+            return false;
+        }
+        if (!applySetting(argv[i] + 2, argv[i + 1], config)) {
+            return false;
+        }
+        ++i;
+    }
+    return true;
+}
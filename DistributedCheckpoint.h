@@ -0,0 +1,186 @@
+#pragma once
+
+#include <mpi.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "Checkpoint.h"
+
+// Checkpoint snapshots (Checkpoint.h) written and read with MPI-IO.
+//
+// All ranks open one shared file. Every section is one collective call: a
+// rank's file view selects its records of every row (a vector type of
+// `rows` blocks, `records` apart) and its memory type the same records in
+// its arrays, so the MPI-IO layer can aggregate the blocks of all ranks into
+// large contiguous writes. whole() sections are written by rank 0 and read
+// by every rank. Rank 0 writes the header and table last and renames the
+// file into place once every rank has closed it.
+//
+// Sections are placed in the order they are listed, so all ranks must list
+// the same sections; the block bounds may differ from the writing run's.
+
+class DistributedCheckpoint {
+public:
+    explicit DistributedCheckpoint(MPI_Comm comm, bool restoring) : comm(comm), reading(restoring) {
+        MPI_Comm_rank(comm, &rank);
+    }
+
+    ~DistributedCheckpoint() {
+        if (open_file) {
+            MPI_File_close(&file);
+        }
+    }
+
+    DistributedCheckpoint(const DistributedCheckpoint&) = delete;
+    DistributedCheckpoint& operator=(const DistributedCheckpoint&) = delete;
+
+    CheckpointLayout layout;
+
+    bool restoring() const { return reading; }
+    uint64_t bytes() const {
+        return reading ? layout.header.table_offset + layout.sections.size() * sizeof(CheckpointSection)
+                       : layout.fileBytes();
+    }
+
+    // Writing: creates path + ".tmp" (collective)
+    bool create(const std::string& target, const CheckpointHeader& header) {
+        path = target;
+        layout.reset(header);
+        std::string tmp = path + ".tmp";
+        ok = MPI_File_open(comm, tmp.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file) == MPI_SUCCESS;
+        open_file = ok;
+        ok = ok && MPI_File_set_size(file, 0) == MPI_SUCCESS;
+        return allOk("Cannot create checkpoint '%s'\n");
+    }
+
+    // Reading: opens the snapshot and reads its header and table (collective)
+    bool open(const std::string& source, const CheckpointHeader& run) {
+        path = source;
+        ok = MPI_File_open(comm, path.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &file) == MPI_SUCCESS;
+        open_file = ok;
+        CheckpointHeader header;
+        ok = ok && MPI_File_read_at_all(file, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE) == MPI_SUCCESS;
+        if (!allOk("Cannot open checkpoint '%s'\n")) {
+            return false;
+        }
+        ok = CheckpointLayout::matches(header, run, rank == 0 ? path.c_str() : nullptr);
+        if (ok) {
+            layout.header = header;
+            layout.sections.resize(header.num_sections);
+            ok = MPI_File_read_at_all(file, header.table_offset, layout.sections.data(),
+                                      header.num_sections * sizeof(CheckpointSection), MPI_BYTE,
+                                      MPI_STATUS_IGNORE) == MPI_SUCCESS;
+        }
+        return allOk("Cannot restore from '%s'\n");
+    }
+
+    uint64_t records(const std::string& name) const {
+        const CheckpointSection* s = layout.find(name);
+        return s == nullptr ? 0 : s->records;
+    }
+
+    template <typename T>
+    void section(const std::string& name, T* data, uint64_t records, uint64_t begin, uint64_t end, uint64_t rows = 1,
+                 uint64_t stride = 0) {
+        transfer(name, data, sizeof(T), records, begin, end, rows, stride == 0 ? end - begin : stride);
+    }
+
+    template <typename T>
+    void whole(const std::string& name, T* data, uint64_t records, uint64_t rows = 1) {
+        bool all = reading || rank == 0;
+        transfer(name, data, sizeof(T), records, 0, all ? records : 0, rows, records);
+    }
+
+    // Writing: header and table, then the rename (collective). Reading:
+    // closes the file and reports whether every section was read.
+    bool close() {
+        const char* message = reading ? "Cannot restore from '%s'\n" : "Cannot write checkpoint '%s'\n";
+        if (!reading && allOk(message)) {
+            layout.finish();
+            // Back to a plain byte view for the header and table
+            MPI_File_set_view(file, 0, MPI_BYTE, MPI_BYTE, "native", MPI_INFO_NULL);
+            int count = rank == 0 ? 1 : 0;
+            ok = MPI_File_write_at_all(file, 0, &layout.header, count * sizeof(CheckpointHeader), MPI_BYTE,
+                                       MPI_STATUS_IGNORE) == MPI_SUCCESS;
+            ok = MPI_File_write_at_all(file, layout.header.table_offset, layout.sections.data(),
+                                       count * layout.sections.size() * sizeof(CheckpointSection), MPI_BYTE,
+                                       MPI_STATUS_IGNORE) == MPI_SUCCESS && ok;
+            ok = MPI_File_sync(file) == MPI_SUCCESS && ok;
+        }
+        if (open_file) {
+            ok = MPI_File_close(&file) == MPI_SUCCESS && ok;
+            open_file = false;
+        }
+        if (!allOk(message)) {
+            return false;
+        }
+        if (!reading) {
+            ok = rank != 0 || rename((path + ".tmp").c_str(), path.c_str()) == 0;
+            return allOk(message);
+        }
+        return true;
+    }
+
+private:
+    MPI_Comm comm;
+    int rank = 0;
+    bool reading;
+    bool ok = true;
+    bool reported = false;
+    bool open_file = false;
+    MPI_File file;
+    std::string path;
+
+    // One collective read or write of this rank's records [begin, end) of
+    // every row
+    void transfer(const std::string& name, void* data, uint32_t record_bytes, uint64_t records, uint64_t begin,
+                  uint64_t end, uint64_t rows, uint64_t stride) {
+        const CheckpointSection* s = nullptr;
+        if (reading) {
+            s = layout.expect(name, record_bytes, rows, records, rank == 0);
+        } else if (layout.append(name, record_bytes, rows, records)) {
+            s = &layout.sections.back();
+        }
+        // Every rank takes part in the collective, even one that failed to
+        // place the section, so the others are not left waiting
+        bool usable = s != nullptr && ok;
+        uint64_t offset = s != nullptr ? s->offset : 0;
+        int count = usable ? int(end - begin) : 0;
+
+        MPI_Datatype record, file_type, memory_type;
+        MPI_Type_contiguous(record_bytes, MPI_BYTE, &record);
+        MPI_Type_vector(rows, count, records, record, &file_type);
+        MPI_Type_vector(rows, count, stride, record, &memory_type);
+        MPI_Type_commit(&record);
+        MPI_Type_commit(&file_type);
+        MPI_Type_commit(&memory_type);
+        int result = MPI_File_set_view(file, offset + begin * record_bytes, record, count > 0 ? file_type : record,
+                                       "native", MPI_INFO_NULL);
+        if (result == MPI_SUCCESS) {
+            result = reading ? MPI_File_read_all(file, data, count > 0 ? 1 : 0, memory_type, MPI_STATUS_IGNORE)
+                             : MPI_File_write_all(file, data, count > 0 ? 1 : 0, memory_type, MPI_STATUS_IGNORE);
+        }
+        MPI_Type_free(&memory_type);
+        MPI_Type_free(&file_type);
+        MPI_Type_free(&record);
+        if (usable && result != MPI_SUCCESS) {
+            fprintf(stderr, "Checkpoint section '%s' could not be %s\n", name.c_str(), reading ? "read" : "written");
+        }
+        ok = usable && result == MPI_SUCCESS;
+    }
+
+    // ok on every rank; prints `message` on rank 0 at the first failure
+    bool allOk(const char* message) {
+        bool all = ok;
+        MPI_Allreduce(&ok, &all, 1, MPI_C_BOOL, MPI_LAND, comm);
+        if (!all && rank == 0 && !reported) {
+            fprintf(stderr, message, path.c_str());
+        }
+        reported = reported || !all;
+        ok = all;
+        return all;
+    }
+};
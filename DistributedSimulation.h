@@ -0,0 +1,436 @@
+#pragma once
+
+#include <mpi.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "Arena.h"
+#include "CityState.h"
+#include "RoadNetwork.h"
+#include "RoutePlanner.h"
+#include "TrafficSimulator.h"
+#include "Trace.h"
+
+// Domain-decomposed traffic simulation over MPI.
+//
+// The grid city is split into bands of whole rows, one per rank, the same
+// split as Distribution::partition over rows. Each rank simulates its band
+// with a TrafficSimulator built on RoadNetwork::gridBand, which adds one
+// ghost row on each side. An edge belongs to the rank owning
+// its target intersection, so for a boundary edge only the source side ever
+// appends vehicles and only the owner moves or removes them.
+//
+// One tick exchanges two messages with each neighbouring rank, both
+// non-blocking and overlapped with compute:
+//
+//   halo        before the tick, each rank sends the count and tail position
+//               of its inbound boundary lanes; the neighbour uses that
+//               snapshot to decide which vehicles fit. The owner only moves
+//               vehicles forward or removes them during the tick, so the
+//               snapshot is conservative. Overlapped with signals, incidents
+//               and vehicle movement.
+//   migration   after the tick, the vehicles accepted into remote lanes are
+//               sent to their owner and appended there. Overlapped with the
+//               local statistics pass.
+//
+// With a RoutePlanner, every rank also allgathers the incident changes of its
+// band once its halo has arrived, so each rank's planner covering the whole
+// city applies the same sorted list and reroutes its vehicles that tick.
+//
+// Lanes are paired across ranks by their position in a list sorted by global
+// edge key, so messages carry list indices instead of edge ids. Nothing is
+// gathered: only reduced statistics reach rank 0.
+//
+// The simulation lives for the whole run. checkpoint() writes the layout of
+// TrafficSimulator::checkpoint: vehicles are sent to the rank holding their
+// block of ids to be saved, and to the rank owning their lane on restore.
+
+#define HALO_TAG 701
+#define MIGRATION_TAG 702
+
+struct MigratingVehicle {
+    int64_t vehicle_id;
+    int32_t pair_index; // index into the receiver's inbound lane list
+    float speed;
+    int32_t destination;
+};
+
+struct DistributedStats {
+    long tick = 0;
+    long active_vehicles = 0;
+    long parked_vehicles = 0; // no room on the network yet
+    long transfers = 0;
+    long migrations = 0; // vehicles that crossed a band boundary
+    long active_incidents = 0;
+    double mean_speed_mps = 0.0;
+    double halo_wait_seconds = 0.0; // slowest rank's time blocked in MPI_Waitall
+    long trips = 0;
+    long route_changes = 0; // edge speed changes, applied on every rank
+    long reroutes = 0;
+    long diversions = 0;
+    double route_seconds = 0.0; // slowest rank's routing time
+};
+
+class DistributedSimulation {
+public:
+    DistributedSimulation(MPI_Comm comm, int total_intersections, size_t total_vehicles, uint64_t seed,
+                          RoutePlanner* router = nullptr)
+        : comm(comm), total_intersections(total_intersections), total_vehicles(total_vehicles), router(router) {
+        MPI_Comm_rank(comm, &rank);
+        MPI_Comm_size(comm, &size);
+        total_rows = RoadNetwork::gridRows(total_intersections);
+        row_begin = bandBegin(rank);
+        row_end = bandBegin(rank + 1);
+        net = RoadNetwork::gridBand(total_intersections, row_begin, row_end);
+
+        // Vehicles are shared out in proportion to owned intersections, as
+        // differences of a global prefix so that no vehicle is lost to rounding
+        long owned_first = std::min(total_intersections, row_begin * net.grid_width);
+        long owned_last = std::min(total_intersections, row_end * net.grid_width);
+        long first_vehicle = (long)((double)total_vehicles * owned_first / total_intersections);
+        long local_vehicles = (long)((double)total_vehicles * owned_last / total_intersections) - first_vehicle;
+
+        sim.reset(new TrafficSimulator(net, local_vehicles, seed, first_vehicle, router));
+        lights.assign((size_t)net.num_intersections * NUM_APPROACHES, LightPhase::Red);
+        buildNeighbors();
+        // A neighbour receives at most one vehicle per lane it feeds us from
+        for (Neighbor& n : neighbors) {
+            n.send_vehicles.reserve(n.remote_lanes.size());
+        }
+        if (router) {
+            // At most every edge of the city changes in one tick
+            change_bytes.assign(size, 0);
+            change_offsets.assign(size + 1, 0);
+            all_changes.reserve((size_t)total_intersections * 4);
+        }
+    }
+
+    // The simulator refers to net, so the pair is neither copied nor moved
+    DistributedSimulation(const DistributedSimulation&) = delete;
+    DistributedSimulation& operator=(const DistributedSimulation&) = delete;
+
+    // Runs one tick on every rank. Collective. plan is the city-wide signal
+    // plan, or null for fixed-time signals; only the heads of owned rows are
+    // used, which are the rows whose signals this rank planned.
+    void step(const LightPhase* plan = nullptr) {
+        // Request and status arrays live in the tick arena
+        tick_arena.reset();
+        ArenaVector<MPI_Request> requests{ArenaAllocator<MPI_Request>(tick_arena)};
+        requests.reserve(2 * neighbors.size());
+
+        // Halo: post receives, then send the snapshot of our inbound lanes
+        for (Neighbor& n : neighbors) {
+            n.recv_state.resize(2 * n.remote_lanes.size());
+            requests.emplace_back();
+            MPI_Irecv(n.recv_state.data(), n.recv_state.size(), MPI_FLOAT, n.rank, HALO_TAG, comm, &requests.back());
+        }
+        for (Neighbor& n : neighbors) {
+            n.send_state.resize(2 * n.inbound_lanes.size());
+            for (size_t k = 0; k < n.inbound_lanes.size(); ++k) {
+                n.send_state[2 * k] = sim->laneCount(n.inbound_lanes[k]);
+                n.send_state[2 * k + 1] = sim->laneTailPosition(n.inbound_lanes[k]);
+            }
+            requests.emplace_back();
+            MPI_Isend(n.send_state.data(), n.send_state.size(), MPI_FLOAT, n.rank, HALO_TAG, comm, &requests.back());
+        }
+
+        sim->beginTick(lights.data(), plan);
+
+        waitAll(requests);
+        for (Neighbor& n : neighbors) {
+            for (size_t k = 0; k < n.remote_lanes.size(); ++k) {
+                sim->setRemoteLane(n.remote_lanes[k], (int)n.recv_state[2 * k], n.recv_state[2 * k + 1]);
+            }
+        }
+        if (router) {
+            exchangeIncidents();
+        }
+
+        transfers += sim->finishTick(lights.data());
+
+        // Migration: receive buffers are sized for the worst case of one
+        // vehicle per boundary lane per tick
+        requests.clear();
+        for (Neighbor& n : neighbors) {
+            n.recv_vehicles.resize(n.inbound_lanes.size());
+            n.send_vehicles.clear();
+            requests.emplace_back();
+            MPI_Irecv(n.recv_vehicles.data(), n.recv_vehicles.size() * sizeof(MigratingVehicle), MPI_BYTE, n.rank,
+                      MIGRATION_TAG, comm, &requests.back());
+        }
+        for (const TrafficSimulator::Departure& d : sim->departures) {
+            const RemotePair& pair = remote_pair[d.lane];
+            neighbors[pair.neighbor].send_vehicles.push_back({d.vehicle_id, pair.index, d.speed, d.destination});
+        }
+        for (Neighbor& n : neighbors) {
+            migrations += n.send_vehicles.size();
+            requests.emplace_back();
+            MPI_Isend(n.send_vehicles.data(), n.send_vehicles.size() * sizeof(MigratingVehicle), MPI_BYTE, n.rank,
+                      MIGRATION_TAG, comm, &requests.back());
+        }
+
+        local = sim->summarize();
+
+        // The receives were posted first, so their statuses lead the array
+        size_t first_recv = 0;
+        ArenaVector<MPI_Status> statuses(requests.size(), MPI_Status(), ArenaAllocator<MPI_Status>(tick_arena));
+        double start = MPI_Wtime();
+        {
+            TRACE_MPI("MPI_Waitall", "Traffic Simulation");
+            MPI_Waitall(requests.size(), requests.data(), statuses.data());
+        }
+        halo_wait += MPI_Wtime() - start;
+        for (Neighbor& n : neighbors) {
+            int bytes = 0;
+            MPI_Get_count(&statuses[first_recv++], MPI_BYTE, &bytes);
+            int arrivals = bytes / sizeof(MigratingVehicle);
+            for (int i = 0; i < arrivals; ++i) {
+                const MigratingVehicle& m = n.recv_vehicles[i];
+                sim->addArrival(n.inbound_lanes[m.pair_index], m.vehicle_id, m.speed, m.destination);
+                // Counted here: the statistics pass ran while they were in flight
+                ++local.active_vehicles;
+                local.speed_sum += m.speed;
+            }
+        }
+    }
+
+    // Reduces the statistics of the last tick to rank 0. Collective; only
+    // rank 0's result is meaningful.
+    DistributedStats reduce() {
+        // Arrivals counted after the statistics pass may have completed trips
+        SimulationStats routing = sim->summarize();
+        long local_counts[8] = {local.active_vehicles, local.parked_vehicles, transfers, migrations,
+                                local.active_incidents, routing.trips, routing.reroutes, routing.diversions};
+        long global_counts[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+        MPI_Reduce(local_counts, global_counts, 8, MPI_LONG, MPI_SUM, 0, comm);
+        double speed_sum = 0.0, wait = 0.0, route_seconds = 0.0;
+        MPI_Reduce(&local.speed_sum, &speed_sum, 1, MPI_DOUBLE, MPI_SUM, 0, comm);
+        MPI_Reduce(&halo_wait, &wait, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+        MPI_Reduce(&routing.route_seconds, &route_seconds, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+
+        DistributedStats stats;
+        stats.tick = sim->tick;
+        stats.active_vehicles = global_counts[0];
+        stats.parked_vehicles = global_counts[1];
+        stats.transfers = global_counts[2];
+        stats.migrations = global_counts[3];
+        stats.active_incidents = global_counts[4];
+        stats.mean_speed_mps = global_counts[0] > 0 ? speed_sum / global_counts[0] : 0.0;
+        stats.halo_wait_seconds = wait;
+        stats.trips = global_counts[5];
+        stats.route_changes = routing.route_changes;
+        stats.reroutes = global_counts[6];
+        stats.diversions = global_counts[7];
+        stats.route_seconds = route_seconds;
+        return stats;
+    }
+
+    // Checkpoint sections in the layout of TrafficSimulator::checkpoint, so
+    // a snapshot restores on any number of ranks and in the OpenMP build.
+    // Collective.
+    template <typename Archive>
+    void checkpoint(Archive& archive) {
+        typedef TrafficSimulator::VehicleState VehicleState;
+        size_t id_begin = blockBegin(total_vehicles, rank), id_end = blockBegin(total_vehicles, rank + 1);
+        int owned_first = std::min(total_intersections, row_begin * net.grid_width);
+        int owned_last = std::min(total_intersections, row_end * net.grid_width);
+        std::vector<VehicleState> held, block(id_end - id_begin);
+        std::vector<int32_t> incidents((size_t)(owned_last - owned_first) * NUM_APPROACHES, 0);
+        if (!archive.restoring()) {
+            sim->saveVehicles(held);
+            std::vector<VehicleState> received;
+            exchangeVehicles(held, received,
+                             [&](const VehicleState& state) { return blockOwner(total_vehicles, state.vehicle_id); });
+            for (const VehicleState& state : received) {
+                block[state.vehicle_id - id_begin] = state;
+            }
+            sim->saveIncidents(incidents.data(), owned_first);
+        }
+        archive.section("sim.vehicles", block.data(), total_vehicles, id_begin, id_end);
+        archive.section("sim.incident_ticks", incidents.data(), (size_t)total_intersections * NUM_APPROACHES,
+                        (size_t)owned_first * NUM_APPROACHES, (size_t)owned_last * NUM_APPROACHES);
+        archive.whole("sim.tick", &sim->tick, 1);
+        if (archive.restoring()) {
+            // Parked vehicles stay with the block they were read in
+            int width = net.grid_width;
+            exchangeVehicles(block, held, [&](const VehicleState& state) {
+                return state.edge < 0 ? rank : ownerOfRow(state.edge / NUM_APPROACHES / width);
+            });
+            std::sort(held.begin(), held.end(),
+                      [](const VehicleState& a, const VehicleState& b) { return a.vehicle_id < b.vehicle_id; });
+            sim->restoreVehicles(held.data(), held.size());
+            sim->restoreIncidents(incidents.data(), owned_first);
+        }
+    }
+
+    int numEdges() const { return net.numEdges(); }
+    int ownedRows() const { return row_end - row_begin; }
+
+private:
+    struct Neighbor {
+        int rank;
+        std::vector<int> remote_lanes;  // our lanes owned by this neighbour
+        std::vector<int> inbound_lanes; // our lanes fed from this neighbour's band
+        std::vector<float> send_state, recv_state;
+        std::vector<MigratingVehicle> send_vehicles, recv_vehicles;
+    };
+
+    struct RemotePair {
+        int neighbor = -1;
+        int index = -1;
+    };
+
+    // First of `total` items in rank r's block; as in BlockPartition, the
+    // first total % size ranks take one item more
+    size_t blockBegin(size_t total, int r) const {
+        size_t base = total / size, extra = total % size;
+        return r * base + std::min<size_t>(r, extra);
+    }
+
+    int bandBegin(int r) const { return (int)blockBegin(total_rows, r); }
+
+    // Rank whose block of `total` items holds `item`
+    int blockOwner(size_t total, size_t item) const {
+        size_t base = total / size, extra = total % size;
+        size_t split = extra * (base + 1); // items in the larger blocks
+        return item < split ? (int)(item / (base + 1)) : (int)(extra + (item - split) / base);
+    }
+
+    int ownerOfRow(int row) const {
+        return row >= 0 && row < total_rows ? blockOwner(total_rows, row) : -1;
+    }
+
+    Neighbor& neighborFor(int owner) {
+        for (Neighbor& n : neighbors) {
+            if (n.rank == owner) {
+                return n;
+            }
+        }
+        neighbors.push_back(Neighbor());
+        neighbors.back().rank = owner;
+        return neighbors.back();
+    }
+
+    // Pairs boundary lanes with the neighbour's view of the same lanes by
+    // sorting both sides on (edge key, lane within edge).
+    void buildNeighbors() {
+        std::vector<std::pair<int64_t, int>> remote, inbound; // (edge key * lanes + lane, local lane)
+        for (int e = 0; e < net.numEdges(); ++e) {
+            bool source_owned = net.intersection_owned[net.edge_source[e]];
+            bool target_owned = net.intersection_owned[net.edge_target[e]];
+            if (source_owned == target_owned) {
+                continue;
+            }
+            for (int l = sim->lane_first[e]; l < sim->lane_first[e + 1]; ++l) {
+                int64_t key = net.edge_key[e] * 256 + (l - sim->lane_first[e]);
+                (target_owned ? inbound : remote).push_back(std::make_pair(key, l));
+            }
+        }
+        std::sort(remote.begin(), remote.end());
+        std::sort(inbound.begin(), inbound.end());
+
+        remote_pair.assign(sim->numLanes(), RemotePair());
+        for (auto& r : remote) {
+            int ghost = net.edge_target[sim->lane_edge[r.second]];
+            Neighbor& n = neighborFor(ownerOfRow(net.intersection_global[ghost] / net.grid_width));
+            n.remote_lanes.push_back(r.second);
+        }
+        for (auto& r : inbound) {
+            int ghost = net.edge_source[sim->lane_edge[r.second]];
+            neighborFor(ownerOfRow(net.intersection_global[ghost] / net.grid_width)).inbound_lanes.push_back(r.second);
+        }
+        for (size_t i = 0; i < neighbors.size(); ++i) {
+            for (size_t k = 0; k < neighbors[i].remote_lanes.size(); ++k) {
+                remote_pair[neighbors[i].remote_lanes[k]] = {(int)i, (int)k};
+            }
+        }
+    }
+
+    // Every band's incident changes to every rank, sorted by edge key, then
+    // the reroute. The lists are short, so a blocking allgather suffices.
+    void exchangeIncidents() {
+        const std::vector<EdgeSpeedChange>& mine = sim->incident_changes;
+        int bytes = mine.size() * sizeof(EdgeSpeedChange);
+        {
+            TRACE_MPI("MPI_Allgather", "Traffic Simulation");
+            MPI_Allgather(&bytes, 1, MPI_INT, change_bytes.data(), 1, MPI_INT, comm);
+        }
+        for (int r = 0; r < size; ++r) {
+            change_offsets[r + 1] = change_offsets[r] + change_bytes[r];
+        }
+        all_changes.resize(change_offsets[size] / sizeof(EdgeSpeedChange));
+        if (!all_changes.empty()) {
+            TRACE_MPI("MPI_Allgatherv", "Traffic Simulation");
+            MPI_Allgatherv(mine.data(), bytes, MPI_BYTE, all_changes.data(), change_bytes.data(), change_offsets.data(),
+                           MPI_BYTE, comm);
+        }
+        std::sort(all_changes.begin(), all_changes.end(),
+                  [](const EdgeSpeedChange& a, const EdgeSpeedChange& b) { return a.key < b.key; });
+        sim->reroute(all_changes.data(), all_changes.size());
+    }
+
+    // Sends every state to rank owner(state) and fills `in` with the states
+    // sent to this rank. Runs at checkpoints only, so it may allocate.
+    template <typename Owner>
+    void exchangeVehicles(const std::vector<TrafficSimulator::VehicleState>& out,
+                          std::vector<TrafficSimulator::VehicleState>& in, Owner owner) {
+        typedef TrafficSimulator::VehicleState VehicleState;
+        // Counted in records, so a rank may hold more than INT_MAX bytes
+        std::vector<int> send_counts(size, 0), send_offsets(size + 1, 0), recv_counts(size), recv_offsets(size + 1, 0);
+        std::vector<int> destination(out.size());
+        for (size_t i = 0; i < out.size(); ++i) {
+            destination[i] = owner(out[i]);
+            ++send_counts[destination[i]];
+        }
+        for (int r = 0; r < size; ++r) {
+            send_offsets[r + 1] = send_offsets[r] + send_counts[r];
+        }
+        std::vector<VehicleState> sorted(out.size());
+        std::vector<int> cursor(send_offsets.begin(), send_offsets.end() - 1);
+        for (size_t i = 0; i < out.size(); ++i) {
+            sorted[cursor[destination[i]]++] = out[i];
+        }
+        TRACE_MPI("MPI_Alltoallv", "Checkpoint");
+        MPI_Alltoall(send_counts.data(), 1, MPI_INT, recv_counts.data(), 1, MPI_INT, comm);
+        for (int r = 0; r < size; ++r) {
+            recv_offsets[r + 1] = recv_offsets[r] + recv_counts[r];
+        }
+        in.resize(recv_offsets[size]);
+        MPI_Datatype record;
+        MPI_Type_contiguous(sizeof(VehicleState), MPI_BYTE, &record);
+        MPI_Type_commit(&record);
+        MPI_Alltoallv(sorted.data(), send_counts.data(), send_offsets.data(), record, in.data(), recv_counts.data(),
+                      recv_offsets.data(), record, comm);
+        MPI_Type_free(&record);
+    }
+
+    void waitAll(ArenaVector<MPI_Request>& requests) {
+        TRACE_MPI("MPI_Waitall", "Traffic Simulation");
+        double start = MPI_Wtime();
+        MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+        halo_wait += MPI_Wtime() - start;
+    }
+
+    MPI_Comm comm;
+    int rank = 0, size = 1;
+    int total_intersections = 0;
+    size_t total_vehicles = 0;
+    int total_rows = 0, row_begin = 0, row_end = 0;
+    RoadNetwork net;
+    std::unique_ptr<TrafficSimulator> sim;
+    RoutePlanner* router;
+    std::vector<int> change_bytes, change_offsets; // per rank, for the incident allgather
+    std::vector<EdgeSpeedChange> all_changes;
+    std::vector<LightPhase> lights;
+    std::vector<Neighbor> neighbors;
+    std::vector<RemotePair> remote_pair; // per local lane, for remote lanes only
+    MonotonicArena tick_arena{4096};
+    SimulationStats local;
+    long transfers = 0;
+    long migrations = 0;
+    double halo_wait = 0.0;
+};
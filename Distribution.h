@@ -0,0 +1,482 @@
+#pragma once
+
+#include <mpi.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <initializer_list>
+#include <string>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "Arena.h"
+#include "CityState.h"
+#include "Telemetry.h"
+#include "Trace.h"
+
+// Block distribution of CityState arrays over the ranks of a communicator.
+//
+// Every rank holds full-size CityState arrays and computes one contiguous
+// block of each. Blocks differ by at most one record, so any rank count
+// covers every element. Collectives run in place on the CityState storage:
+// rank 0 gathers straight into its own arrays and scatters straight out of
+// them, and the other ranks send from or receive into their block, so no
+// staging buffers are allocated.
+//
+// Partitions are cached per size, so kernels that run every tick reuse the
+// counts and displacements instead of allocating them.
+//
+// Each collective is charged to the kernel that issued it. report() reduces
+// the byte and latency totals to rank 0 at the end of a run.
+//
+// In pipelined mode gather() and reduceSums() only post the collective
+// (MPI_Igatherv, MPI_Ireduce) and the next kernel starts at once. Kernels
+// name the CityState buffers they use, as in TaskGraph; beginKernel() waits
+// only for pending collectives of earlier kernels that share a buffer, and
+// a progress engine (progress(), called between kernels) retires the rest
+// with MPI_Testsome. Whatever rank 0 does with the results goes into an
+// atRoot() continuation, which runs once the kernel's collectives are done.
+// Each collective's time in flight and time spent blocked on it are
+// recorded, so report() shows how much communication the kernels hid.
+// With --trace, every MPI call is also a span named after the call and its
+// kernel (Trace.h).
+
+// MPI datatype matching each CityState element type
+template <typename T> MPI_Datatype mpiType();
+template <> inline MPI_Datatype mpiType<int32_t>() { return MPI_INT32_T; }
+template <> inline MPI_Datatype mpiType<uint8_t>() { return MPI_UINT8_T; }
+template <> inline MPI_Datatype mpiType<uint16_t>() { return MPI_UINT16_T; }
+template <> inline MPI_Datatype mpiType<float>() { return MPI_FLOAT; }
+template <> inline MPI_Datatype mpiType<LightPhase>() { return MPI_UINT8_T; }
+template <> inline MPI_Datatype mpiType<ChargerStatus>() { return MPI_UINT8_T; }
+
+// Records [begin, end) of `total` owned by one rank, plus the counts and
+// displacements of every rank as the v-collectives expect them.
+struct BlockPartition {
+    std::vector<int> counts;
+    std::vector<int> displs;
+    int begin = 0;
+    int end = 0;
+
+    BlockPartition(size_t total, int rank, int size) : counts(size), displs(size) {
+        int base = total / size;
+        int extra = total % size;
+        int offset = 0;
+        for (int r = 0; r < size; ++r) {
+            counts[r] = base + (r < extra);
+            displs[r] = offset;
+            offset += counts[r];
+        }
+        begin = displs[rank];
+        end = begin + counts[rank];
+    }
+
+    // The same split counted in units of `unit` records and clipped to
+    // `total` records, e.g. a split of grid rows as a split of intersections.
+    BlockPartition scaled(int unit, size_t total) const {
+        BlockPartition out = *this;
+        auto clip = [&](int first) { return (int)std::min<size_t>((size_t)first * unit, total); };
+        for (size_t r = 0; r < counts.size(); ++r) {
+            out.displs[r] = clip(displs[r]);
+            out.counts[r] = clip(displs[r] + counts[r]) - out.displs[r];
+        }
+        out.begin = clip(begin);
+        out.end = clip(end);
+        return out;
+    }
+};
+
+struct CommRecord {
+    std::string kernel;
+    long calls = 0;
+    long bytes = 0;      // payload this rank put on the wire
+    double seconds = 0.0; // time this rank spent blocked in the collectives
+    double in_flight = 0.0; // time from posting to completion
+};
+
+class Distribution {
+public:
+    MPI_Comm comm;
+    int rank = 0;
+    int size = 1;
+
+    // One intersection's NUM_APPROACHES light phases, so light blocks are
+    // counted in intersections rather than bytes
+    MPI_Datatype intersection_lights;
+
+    // Post gathers and reductions without waiting (--pipeline 1)
+    bool pipelined = false;
+
+    explicit Distribution(MPI_Comm comm) : comm(comm) {
+        MPI_Comm_rank(comm, &rank);
+        MPI_Comm_size(comm, &size);
+        MPI_Type_contiguous(NUM_APPROACHES, mpiType<LightPhase>(), &intersection_lights);
+        MPI_Type_commit(&intersection_lights);
+    }
+
+    ~Distribution() {
+        MPI_Type_free(&intersection_lights);
+    }
+
+    Distribution(const Distribution&) = delete;
+    Distribution& operator=(const Distribution&) = delete;
+
+    const BlockPartition& partition(size_t total) const {
+        return partition(total, 1, total);
+    }
+
+    // The split of `units` records counted in `unit` records each and clipped
+    // to `total`, e.g. a split of grid rows as a split of intersections
+    const BlockPartition& partition(size_t units, int unit, size_t total) const {
+        for (const CachedPartition& c : partitions) {
+            if (c.units == units && c.unit == unit && c.total == total) {
+                return c.part;
+            }
+        }
+        // A deque keeps earlier references valid as the cache grows
+        partitions.push_back({units, unit, total, BlockPartition(units, rank, size).scaled(unit, total)});
+        return partitions.back().part;
+    }
+
+    // Collects every rank's block of data[0, total) into rank 0's data. In
+    // pipelined mode the gather is only posted.
+    template <typename T>
+    void gather(const char* kernel, T* data, const BlockPartition& part, MPI_Datatype type = mpiType<T>()) {
+        TRACE_MPI(pipelined ? "MPI_Igatherv" : "MPI_Gatherv", kernel);
+        double start = MPI_Wtime();
+        MPI_Request request;
+        if (rank == 0) {
+            MPI_Igatherv(MPI_IN_PLACE, 0, type, data, part.counts.data(), part.displs.data(), type, 0, comm, &request);
+        } else {
+            MPI_Igatherv(data + recordOffset(part.begin, type, sizeof(T)), part.counts[rank], type,
+                         nullptr, nullptr, nullptr, type, 0, comm, &request);
+        }
+        complete(kernel, request, rank == 0 ? 0 : part.counts[rank], type, start);
+    }
+
+    // Hands every rank its block of rank 0's data[0, total).
+    template <typename T>
+    void scatter(const char* kernel, T* data, const BlockPartition& part, MPI_Datatype type = mpiType<T>()) {
+        TRACE_MPI("MPI_Scatterv", kernel);
+        double start = MPI_Wtime();
+        long sent = 0;
+        if (rank == 0) {
+            MPI_Scatterv(data, part.counts.data(), part.displs.data(), type, MPI_IN_PLACE, 0, type, 0, comm);
+            for (int r = 1; r < size; ++r) {
+                sent += part.counts[r];
+            }
+        } else {
+            MPI_Scatterv(nullptr, nullptr, nullptr, type, data + recordOffset(part.begin, type, sizeof(T)),
+                         part.counts[rank], type, 0, comm);
+        }
+        charge(kernel, sent, type, MPI_Wtime() - start);
+    }
+
+    // Every rank's `count` records concatenated in rank order into `all` on
+    // every rank. The records are copied as bytes, so T must be trivially
+    // copyable; `all` keeps its capacity from one call to the next.
+    template <typename T>
+    void allgather(const char* kernel, const T* local, int count, std::vector<T>& all) {
+        TRACE_MPI("MPI_Allgatherv", kernel);
+        double start = MPI_Wtime();
+        int bytes = count * sizeof(T);
+        gather_bytes.resize(size);
+        gather_displs.resize(size);
+        MPI_Allgather(&bytes, 1, MPI_INT, gather_bytes.data(), 1, MPI_INT, comm);
+        int total = 0;
+        for (int r = 0; r < size; ++r) {
+            gather_displs[r] = total;
+            total += gather_bytes[r];
+        }
+        all.resize(total / sizeof(T));
+        MPI_Allgatherv(local, bytes, MPI_BYTE, all.data(), gather_bytes.data(), gather_displs.data(), MPI_BYTE, comm);
+        charge(kernel, bytes + sizeof(int), MPI_BYTE, MPI_Wtime() - start);
+    }
+
+    // Bitwise OR of data[0, count) over all ranks, in place on every rank.
+    void allreduceOr(const char* kernel, uint8_t* data, int count) {
+        TRACE_MPI("MPI_Allreduce", kernel);
+        double start = MPI_Wtime();
+        MPI_Allreduce(MPI_IN_PLACE, data, count, MPI_UINT8_T, MPI_BOR, comm);
+        charge(kernel, count, MPI_UINT8_T, MPI_Wtime() - start);
+    }
+
+    // Sum of one value per rank at rank 0.
+    long reduceSum(const char* kernel, long value) {
+        TRACE_MPI("MPI_Reduce", kernel);
+        double start = MPI_Wtime();
+        long total = 0;
+        MPI_Reduce(&value, &total, 1, MPI_LONG, MPI_SUM, 0, comm);
+        charge(kernel, rank == 0 ? 0 : 1, MPI_LONG, MPI_Wtime() - start);
+        return total;
+    }
+
+    // Sums of several values per rank at rank 0, in one reduction. The
+    // sums are valid in the kernel's atRoot() continuation; in pipelined
+    // mode the reduction is only posted.
+    const long* reduceSums(const char* kernel, std::initializer_list<long> values) {
+        TRACE_MPI(pipelined ? "MPI_Ireduce" : "MPI_Reduce", kernel);
+        double start = MPI_Wtime();
+        int count = values.size();
+        long* buffer = continuation_arena.allocate<long>(2 * count);
+        std::copy(values.begin(), values.end(), buffer);
+        MPI_Request request;
+        MPI_Ireduce(buffer, buffer + count, count, MPI_LONG, MPI_SUM, 0, comm, &request);
+        complete(kernel, request, rank == 0 ? 0 : count, MPI_LONG, start);
+        return buffer + count;
+    }
+
+    // Kernel boundaries. A kernel first waits for the pending collectives
+    // of earlier kernels that share one of its resources; the collectives it
+    // posts are tagged with its resources in turn. `resources` must outlive
+    // the pass.
+    void beginKernel(const std::vector<const void*>& resources) {
+        waitFor(resources);
+        current_resources = &resources;
+        kernel_first = posted;
+    }
+
+    // Runs f on rank 0 once the collectives the current kernel has posted
+    // so far are complete: at once in blocking mode, otherwise from a later
+    // progress() or wait. f is stored in an arena, so it may capture values
+    // but must not capture references to the kernel's locals.
+    template <typename F>
+    void atRoot(F f) {
+        if (rank != 0) {
+            return;
+        }
+        if (!pendingSince(kernel_first)) {
+            f();
+            return;
+        }
+        F* object = new (continuation_arena.allocate(sizeof(F), alignof(F))) F(std::move(f));
+        continuations.push_back({current_resources, kernel_first, posted, object, [](void* p) {
+            F* f = static_cast<F*>(p);
+            (*f)();
+            f->~F();
+        }});
+    }
+
+    // The progress engine: retires the collectives that have completed and
+    // runs the continuations that were waiting for them. Never blocks.
+    void progress() {
+        if (!pending.empty()) {
+            int done = 0;
+            completed_indices.resize(requests.size());
+            MPI_Testsome(requests.size(), requests.data(), &done, completed_indices.data(), MPI_STATUSES_IGNORE);
+            double now = MPI_Wtime();
+            for (int k = 0; k < done; ++k) {
+                retire(completed_indices[k], now);
+            }
+            compact();
+        }
+        TRACE_COUNTER("Pending collectives", pending.size());
+        runReady();
+    }
+
+    // Completes every pending collective; the end of a pass.
+    void drain() {
+        for (size_t k = 0; k < pending.size(); ++k) {
+            wait(k);
+        }
+        compact();
+        runReady();
+    }
+
+    size_t numPending() const { return pending.size(); }
+
+    // Per-kernel totals over all ranks: bytes summed, blocked time and time
+    // in flight of the slowest rank. The hidden share is the time in flight
+    // that no rank spent blocked. Collective; only rank 0 logs.
+    void report() {
+        logMessage(LOG_SUMMARY, "Communication (%d ranks, %s):", size, pipelined ? "pipelined" : "blocking");
+        double total_seconds = 0.0, total_in_flight = 0.0;
+        for (const CommRecord& record : records) {
+            long bytes = 0;
+            double seconds = 0.0, in_flight = 0.0;
+            MPI_Reduce(&record.bytes, &bytes, 1, MPI_LONG, MPI_SUM, 0, comm);
+            MPI_Reduce(&record.seconds, &seconds, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+            MPI_Reduce(&record.in_flight, &in_flight, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+            total_seconds += seconds;
+            total_in_flight += in_flight;
+            if (rank == 0) {
+                long calls = std::max(record.calls, 1L);
+                logMessage(LOG_SUMMARY, "  %-28s %3ld calls %12ld bytes %10.1f us/call %10.1f us in flight %3.0f%% hidden",
+                           record.kernel.c_str(), record.calls, bytes, 1e6 * seconds / calls, 1e6 * in_flight / calls,
+                           100.0 * hiddenShare(seconds, in_flight));
+            }
+        }
+        logMessage(LOG_SUMMARY, "  %.3f ms in flight, %.3f ms blocked: %.0f%% of communication hidden.",
+                   1e3 * total_in_flight, 1e3 * total_seconds, 100.0 * hiddenShare(total_seconds, total_in_flight));
+    }
+
+private:
+    struct PendingCollective {
+        uint64_t sequence;
+        CommRecord* record;
+        const std::vector<const void*>* resources;
+        double posted;
+    };
+
+    struct Continuation {
+        const std::vector<const void*>* resources;
+        uint64_t first, last; // the collectives [first, last) it waits for
+        void* object;
+        void (*run)(void*);
+    };
+
+    struct CachedPartition {
+        size_t units;
+        int unit;
+        size_t total;
+        BlockPartition part;
+    };
+
+    std::deque<CommRecord> records; // stable addresses for pending collectives
+
+    // Pipelined mode state. requests[k] belongs to pending[k]; a retired
+    // request is MPI_REQUEST_NULL until compact() drops it.
+    std::vector<MPI_Request> requests;
+    std::vector<PendingCollective> pending;
+    std::vector<int> completed_indices;
+    std::vector<Continuation> continuations;
+    MonotonicArena continuation_arena; // reduction buffers and continuations
+    const std::vector<const void*>* current_resources = nullptr;
+    uint64_t posted = 0;       // collectives posted so far
+    uint64_t kernel_first = 0; // first collective of the current kernel
+    std::vector<int> gather_bytes;  // allgather counts and displacements
+    std::vector<int> gather_displs;
+    mutable std::deque<CachedPartition> partitions;
+
+    // Element offset of a record index; records of a derived type span
+    // several elements of the underlying array
+    static size_t recordOffset(int record, MPI_Datatype type, size_t element_size) {
+        int type_size = 0;
+        MPI_Type_size(type, &type_size);
+        return (size_t)record * type_size / element_size;
+    }
+
+    static double hiddenShare(double blocked, double in_flight) {
+        return in_flight > 0.0 ? std::max(0.0, 1.0 - blocked / in_flight) : 0.0;
+    }
+
+    CommRecord* charge(const char* kernel, long count, MPI_Datatype type, double seconds) {
+        int type_size = 0;
+        MPI_Type_size(type, &type_size);
+        CommRecord* record = nullptr;
+        for (CommRecord& r : records) {
+            if (r.kernel == kernel) {
+                record = &r;
+            }
+        }
+        if (record == nullptr) {
+            records.emplace_back();
+            record = &records.back();
+            record->kernel = kernel;
+        }
+        ++record->calls;
+        record->bytes += count * type_size;
+        record->seconds += seconds;
+        record->in_flight += seconds;
+        return record;
+    }
+
+    // Finishes a posted collective: waits for it in blocking mode, or queues
+    // it for the progress engine
+    void complete(const char* kernel, MPI_Request& request, long count, MPI_Datatype type, double start) {
+        if (!pipelined) {
+            MPI_Wait(&request, MPI_STATUS_IGNORE);
+            charge(kernel, count, type, MPI_Wtime() - start);
+            return;
+        }
+        double now = MPI_Wtime();
+        CommRecord* record = charge(kernel, count, type, now - start);
+        record->in_flight -= now - start; // counted on retirement
+        requests.push_back(request);
+        pending.push_back({posted++, record, current_resources, start});
+    }
+
+    void retire(size_t k, double now) {
+        pending[k].record->in_flight += now - pending[k].posted;
+        requests[k] = MPI_REQUEST_NULL;
+    }
+
+    // Blocks on pending[k], charging the wait to its kernel
+    void wait(size_t k) {
+        if (requests[k] == MPI_REQUEST_NULL) {
+            return;
+        }
+        TRACE_MPI("MPI_Wait", pending[k].record->kernel.c_str());
+        double start = MPI_Wtime();
+        MPI_Wait(&requests[k], MPI_STATUS_IGNORE);
+        double now = MPI_Wtime();
+        pending[k].record->seconds += now - start;
+        retire(k, now);
+    }
+
+    void compact() {
+        size_t kept = 0;
+        for (size_t k = 0; k < pending.size(); ++k) {
+            if (requests[k] != MPI_REQUEST_NULL) {
+                requests[kept] = requests[k];
+                pending[kept++] = pending[k];
+            }
+        }
+        requests.resize(kept);
+        pending.resize(kept);
+    }
+
+    static bool shareResource(const std::vector<const void*>* a, const std::vector<const void*>& b) {
+        if (a == nullptr) {
+            return true;
+        }
+        for (const void* r : *a) {
+            if (std::find(b.begin(), b.end(), r) != b.end()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void waitFor(const std::vector<const void*>& resources) {
+        for (size_t k = 0; k < pending.size(); ++k) {
+            if (shareResource(pending[k].resources, resources)) {
+                wait(k);
+            }
+        }
+        compact();
+        runReady();
+    }
+
+    bool pendingSince(uint64_t first) const {
+        for (const PendingCollective& p : pending) {
+            if (p.sequence >= first) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Runs, in posting order, the continuations whose collectives are all
+    // complete; the arena is recycled once none is left
+    void runReady() {
+        size_t kept = 0;
+        for (size_t c = 0; c < continuations.size(); ++c) {
+            bool ready = true;
+            for (const PendingCollective& p : pending) {
+                ready = ready && (p.sequence < continuations[c].first || p.sequence >= continuations[c].last);
+            }
+            if (ready) {
+                continuations[c].run(continuations[c].object);
+            } else {
+                continuations[kept++] = continuations[c];
+            }
+        }
+        continuations.resize(kept);
+        if (continuations.empty() && pending.empty()) {
+            continuation_arena.reset();
+        }
+    }
+};
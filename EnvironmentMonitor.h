@@ -0,0 +1,378 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "CityState.h"
+#include "SensorRNG.h"
+
+// Air quality and noise maps of the city from sparse sensor readings.
+//
+// Sensors sit at fixed sites spread over the city, drawn from the seed.
+// Every pass turns their readings into a square grid of cells by inverse
+// distance weighting: a cell is the mean of the sensors within the radius,
+// each weighted by 1 / d^2. The radius is sized so that ENV_NEIGHBOURS
+// sensors fall inside it on average; a cell with none takes the mean of all
+// sensors. Noise is interpolated as sound energy, 10^(L/10), so levels from
+// several sensors combine the way sound does.
+//
+// The grid is cut into ENV_TILE x ENV_TILE tiles, and each tile keeps the
+// sensors that can reach it, found once from a bucketing of the sites by
+// tile. A pass is a taskloop over tiles: for every candidate sensor and tile
+// row, a SIMD loop over the row's cells adds the sensor's weight to sums
+// that stay in cache until the tile is written out.
+//
+// Tiles are grouped into square exposure zones, at most ENV_ZONES per city
+// side. Every pass is a one-minute sample of each zone's mean, kept in a
+// window of the last ENV_WINDOW samples. The window gives the time-weighted
+// average AQI, the noise Leq (the mean energy as a level) and the level
+// exceeded 10% of the time, L10.
+//
+// A grid covers the zone rows [begin, end), so an MPI rank interpolates and
+// aggregates its own band of tiles only. The sites are the same everywhere.
+
+#define ENV_TILE 64           // cells per tile side
+#define ENV_NEIGHBOURS 16     // sensors within the interpolation radius on average
+#define ENV_ZONES 16          // exposure zones per city side, at most one per tile
+#define ENV_WINDOW 60         // one-minute samples per zone
+#define ENV_AQI_LIMIT 100.0f  // AQI, "unhealthy for sensitive groups" above
+#define ENV_NOISE_LIMIT 65.0f // dB(A) Leq, daytime guideline for roads
+
+struct EnvironmentPass {
+    size_t sensors = 0;
+    size_t cells = 0; // interpolated by this grid
+    double seconds = 0.0;
+};
+
+// Zone statistics: the window averages (TWA AQI or Leq) and L10 of every zone
+struct ExposureSummary {
+    double mean = 0.0;     // of the zone averages
+    float max = 0.0f;      // highest zone average
+    float max_l10 = 0.0f;  // highest zone L10
+    long exceeding = 0;    // zones with an average above the limit
+};
+
+inline ExposureSummary summarizeExposure(const float* averages, const float* l10, size_t zones, float limit) {
+    ExposureSummary summary;
+    for (size_t z = 0; z < zones; ++z) {
+        summary.mean += averages[z];
+        summary.max = std::max(summary.max, averages[z]);
+        summary.max_l10 = std::max(summary.max_l10, l10[z]);
+        summary.exceeding += averages[z] > limit;
+    }
+    summary.mean /= std::max<size_t>(zones, 1);
+    return summary;
+}
+
+// Sensor sites, tiles and zones, shared by the maps of every quantity
+class EnvironmentGrid {
+public:
+    EnvironmentGrid(size_t num_sensors, size_t grid_cells, float extent, size_t zone_begin, size_t zone_end,
+                    uint64_t seed)
+        : num_cells(roundUp(grid_cells)),
+          num_tiles(num_cells / ENV_TILE),
+          num_zones(zonesPerSide(grid_cells)),
+          first_zone(zone_begin),
+          last_zone(zone_end),
+          cell_size(extent / num_cells),
+          site_x(num_sensors),
+          site_y(num_sensors) {
+        for (size_t s = 0; s < num_sensors; ++s) {
+            SensorRNG rng(seed, STREAM_ENV_SITES, s);
+            site_x[s] = extent * unit(rng);
+            site_y[s] = extent * unit(rng);
+        }
+        // Radius holding ENV_NEIGHBOURS sites at the mean density, and at
+        // least a cell so every site reaches its own cell
+        float radius = extent * std::sqrt(ENV_NEIGHBOURS / (3.14159265f * std::max<size_t>(num_sensors, 1)));
+        radius = std::max(radius, cell_size);
+        radius_squared = radius * radius;
+        findCandidates(radius);
+    }
+
+    // Zones per side of a grid of `grid_cells` cells per side
+    static size_t zonesPerSide(size_t grid_cells) {
+        return std::min<size_t>(ENV_ZONES, roundUp(grid_cells) / ENV_TILE);
+    }
+
+    size_t cells() const { return num_cells; }
+    size_t tiles() const { return num_tiles; }
+    size_t zones() const { return num_zones; }
+    size_t numSensors() const { return site_x.size(); }
+    size_t zoneBegin() const { return first_zone; }
+    size_t zoneEnd() const { return last_zone; }
+
+    // Tile rows and grid rows of this grid's zone rows
+    size_t tileBegin() const { return firstTile(first_zone); }
+    size_t tileEnd() const { return firstTile(last_zone); }
+    size_t rowBegin() const { return tileBegin() * ENV_TILE; }
+    size_t rowEnd() const { return tileEnd() * ENV_TILE; }
+
+    // First tile of zone row or column z; zone z holds tiles [firstTile(z), firstTile(z + 1))
+    size_t firstTile(size_t z) const { return (z * num_tiles + num_zones - 1) / num_zones; }
+
+private:
+    friend class EnvironmentMonitor;
+
+    size_t num_cells;
+    size_t num_tiles;
+    size_t num_zones;
+    size_t first_zone;
+    size_t last_zone;
+    float cell_size; // m
+    float radius_squared;
+    std::vector<float> site_x; // m
+    std::vector<float> site_y;
+
+    // Candidate sites of this grid's tiles, tile-major from tileBegin()
+    std::vector<int> candidate_offsets;
+    std::vector<int> candidate_site;
+    std::vector<float> candidate_x;
+    std::vector<float> candidate_y;
+
+    static size_t roundUp(size_t cells) {
+        return std::max<size_t>(ENV_TILE, (cells + ENV_TILE - 1) / ENV_TILE * ENV_TILE);
+    }
+
+    static float unit(SensorRNG& rng) {
+        return rng.uniform(1 << 20) * (1.0f / (1 << 20));
+    }
+
+    int tileOf(float coordinate) const {
+        return std::min<int>(num_tiles - 1, int(coordinate / (cell_size * ENV_TILE)));
+    }
+
+    // Sites within the radius of each tile: a counting sort of the sites
+    // into tiles, then a scan of the tiles around each one
+    void findCandidates(float radius) {
+        size_t num_sites = site_x.size();
+        std::vector<int> bucket_offsets(num_tiles * num_tiles + 1, 0);
+        std::vector<int> bucket_site(num_sites);
+        for (size_t s = 0; s < num_sites; ++s) {
+            ++bucket_offsets[tileOf(site_y[s]) * num_tiles + tileOf(site_x[s]) + 1];
+        }
+        for (size_t b = 0; b < num_tiles * num_tiles; ++b) {
+            bucket_offsets[b + 1] += bucket_offsets[b];
+        }
+        std::vector<int> fill(bucket_offsets.begin(), bucket_offsets.end() - 1);
+        for (size_t s = 0; s < num_sites; ++s) {
+            bucket_site[fill[tileOf(site_y[s]) * num_tiles + tileOf(site_x[s])]++] = s;
+        }
+
+        float tile_size = cell_size * ENV_TILE;
+        int reach = int(std::ceil(radius / tile_size));
+        candidate_offsets.assign(1, 0);
+        for (size_t ty = tileBegin(); ty < tileEnd(); ++ty) {
+            for (size_t tx = 0; tx < num_tiles; ++tx) {
+                float x0 = tx * tile_size, y0 = ty * tile_size;
+                int by_end = std::min<int>(num_tiles, ty + reach + 1);
+                int bx_end = std::min<int>(num_tiles, tx + reach + 1);
+                for (int by = std::max(0, int(ty) - reach); by < by_end; ++by) {
+                    for (int bx = std::max(0, int(tx) - reach); bx < bx_end; ++bx) {
+                        int b = by * num_tiles + bx;
+                        for (int k = bucket_offsets[b]; k < bucket_offsets[b + 1]; ++k) {
+                            int s = bucket_site[k];
+                            // Distance from the site to the tile's rectangle
+                            float dx = std::max(std::max(x0 - site_x[s], site_x[s] - x0 - tile_size), 0.0f);
+                            float dy = std::max(std::max(y0 - site_y[s], site_y[s] - y0 - tile_size), 0.0f);
+                            if (dx * dx + dy * dy < radius_squared) {
+                                candidate_site.push_back(s);
+                                candidate_x.push_back(site_x[s]);
+                                candidate_y.push_back(site_y[s]);
+                            }
+                        }
+                    }
+                }
+                candidate_offsets.push_back(candidate_site.size());
+            }
+        }
+    }
+};
+
+// The map and exposure window of one quantity
+class EnvironmentMonitor {
+public:
+    // energy: readings are levels in dB, interpolated and averaged as energy
+    EnvironmentMonitor(const EnvironmentGrid& grid, bool energy)
+        : layout(grid),
+          energy(energy),
+          values(layout.numSensors()),
+          map((layout.rowEnd() - layout.rowBegin()) * layout.cells()),
+          tile_sums((layout.tileEnd() - layout.tileBegin()) * layout.tiles()),
+          window((layout.zoneEnd() - layout.zoneBegin()) * layout.zones() * ENV_WINDOW, 0.0f),
+          zone_average(layout.zones() * layout.zones(), 0.0f),
+          zone_l10(layout.zones() * layout.zones(), 0.0f) {}
+
+    const EnvironmentGrid& grid() const { return layout; }
+    uint64_t samples() const { return sample_count; }
+
+    // Window average (TWA AQI or Leq in dB) and L10 of every zone, row-major;
+    // only this grid's zone rows are filled in
+    float* averages() { return zone_average.data(); }
+    float* l10() { return zone_l10.data(); }
+
+    // Interpolated AQI or level in dB of a cell in this grid's rows
+    float cell(size_t row, size_t col) const {
+        float v = map[(row - layout.rowBegin()) * layout.cells() + col];
+        return energy ? 10.0f * std::log10(v) : v;
+    }
+
+    // Interpolates one reading per sensor onto the grid and adds a sample
+    // to every zone's window
+    template <typename T>
+    EnvironmentPass update(const T* readings) {
+        auto start = std::chrono::steady_clock::now();
+        size_t num_sites = values.size();
+        double total = 0.0;
+        for (size_t s = 0; s < num_sites; ++s) {
+            values[s] = energy ? std::pow(10.0f, readings[s] / 10.0f) : float(readings[s]);
+            total += values[s];
+        }
+        float fallback = num_sites > 0 ? float(total / num_sites) : 0.0f;
+
+        long tiles = layout.tiles();
+        long num_local = (layout.tileEnd() - layout.tileBegin()) * tiles;
+        #pragma omp taskloop default(shared) grainsize(1)
+        for (long t = 0; t < num_local; ++t) {
+            tile_sums[t] = interpolateTile(t, layout.tileBegin() + t / tiles, t % tiles, fallback);
+        }
+
+        addSample();
+        EnvironmentPass pass;
+        pass.sensors = num_sites;
+        pass.cells = map.size();
+        pass.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return pass;
+    }
+
+    // Checkpoint sections (Checkpoint.h) of the zone windows
+    template <typename Archive>
+    void checkpoint(Archive& archive, const std::string& name) {
+        size_t per_row = layout.zones() * ENV_WINDOW;
+        archive.section(name + ".window", window.data(), layout.zones() * per_row, layout.zoneBegin() * per_row,
+                        layout.zoneEnd() * per_row);
+        archive.whole(name + ".samples", &sample_count, 1);
+        if (archive.restoring()) {
+            summarize();
+        }
+    }
+
+private:
+    const EnvironmentGrid& layout;
+    bool energy;
+    std::vector<float> values; // per site, linear or energy
+    AlignedVector<float> map;  // this grid's rows, linear or energy
+    std::vector<double> tile_sums;
+    std::vector<float> window; // this grid's zones x ENV_WINDOW
+    std::vector<float> zone_average;
+    std::vector<float> zone_l10;
+    uint64_t sample_count = 0;
+
+    // Fills one tile of the map and returns the sum of its cells
+    double interpolateTile(long local, size_t ty, size_t tx, float fallback) {
+        alignas(CACHE_LINE_SIZE) float num[ENV_TILE * ENV_TILE] = {};
+        alignas(CACHE_LINE_SIZE) float den[ENV_TILE * ENV_TILE] = {};
+        alignas(CACHE_LINE_SIZE) float col_x[ENV_TILE];
+        float h = layout.cell_size;
+        float r2 = layout.radius_squared;
+        // Keeps the weight finite for a site at a cell centre
+        float eps = 0.01f * h * h;
+        for (int c = 0; c < ENV_TILE; ++c) {
+            col_x[c] = (tx * ENV_TILE + c + 0.5f) * h;
+        }
+        float row_y = (ty * ENV_TILE + 0.5f) * h;
+
+        for (int k = layout.candidate_offsets[local]; k < layout.candidate_offsets[local + 1]; ++k) {
+            float sx = layout.candidate_x[k];
+            float sy = layout.candidate_y[k];
+            float v = values[layout.candidate_site[k]];
+            for (int r = 0; r < ENV_TILE; ++r) {
+                float dy = row_y + r * h - sy;
+                float dy2 = dy * dy;
+                if (dy2 >= r2) {
+                    continue;
+                }
+                float* n = num + r * ENV_TILE;
+                float* d = den + r * ENV_TILE;
+                #pragma omp simd aligned(n, d : CACHE_LINE_SIZE)
+                for (int c = 0; c < ENV_TILE; ++c) {
+                    float dx = col_x[c] - sx;
+                    float d2 = dx * dx + dy2;
+                    float w = d2 < r2 ? 1.0f / (d2 + eps) : 0.0f;
+                    n[c] += w * v;
+                    d[c] += w;
+                }
+            }
+        }
+
+        size_t stride = layout.cells();
+        float* out = map.data() + (ty * ENV_TILE - layout.rowBegin()) * stride + tx * ENV_TILE;
+        double sum = 0.0;
+        for (int r = 0; r < ENV_TILE; ++r) {
+            const float* n = num + r * ENV_TILE;
+            const float* d = den + r * ENV_TILE;
+            float* o = out + r * stride;
+            float row_sum = 0.0f;
+            #pragma omp simd reduction(+:row_sum)
+            for (int c = 0; c < ENV_TILE; ++c) {
+                o[c] = d[c] > 0.0f ? n[c] / d[c] : fallback;
+                row_sum += o[c];
+            }
+            sum += row_sum;
+        }
+        return sum;
+    }
+
+    // Zone means from the tile sums, in tile order, into the windows
+    void addSample() {
+        size_t zones = layout.zones();
+        size_t tiles = layout.tiles();
+        size_t slot = sample_count % ENV_WINDOW;
+        for (size_t zy = layout.zoneBegin(); zy < layout.zoneEnd(); ++zy) {
+            for (size_t zx = 0; zx < zones; ++zx) {
+                double sum = 0.0;
+                size_t count = 0;
+                for (size_t ty = layout.firstTile(zy); ty < layout.firstTile(zy + 1); ++ty) {
+                    for (size_t tx = layout.firstTile(zx); tx < layout.firstTile(zx + 1); ++tx) {
+                        sum += tile_sums[(ty - layout.tileBegin()) * tiles + tx];
+                        ++count;
+                    }
+                }
+                size_t z = (zy - layout.zoneBegin()) * zones + zx;
+                window[z * ENV_WINDOW + slot] = float(sum / (count * ENV_TILE * ENV_TILE));
+            }
+        }
+        ++sample_count;
+        summarize();
+    }
+
+    // Window averages and L10 of this grid's zones
+    void summarize() {
+        size_t zones = layout.zones();
+        size_t filled = std::min<uint64_t>(sample_count, ENV_WINDOW);
+        if (filled == 0) {
+            return;
+        }
+        // L10 is exceeded by 10% of the samples: the 90th percentile
+        size_t rank = (filled * 9 + 9) / 10 - 1;
+        float sorted[ENV_WINDOW];
+        for (size_t zy = layout.zoneBegin(); zy < layout.zoneEnd(); ++zy) {
+            for (size_t zx = 0; zx < zones; ++zx) {
+                const float* samples = window.data() + ((zy - layout.zoneBegin()) * zones + zx) * ENV_WINDOW;
+                double sum = 0.0;
+                for (size_t i = 0; i < filled; ++i) {
+                    sum += samples[i];
+                }
+                std::copy(samples, samples + filled, sorted);
+                std::nth_element(sorted, sorted + rank, sorted + filled);
+                float average = float(sum / filled);
+                zone_average[zy * zones + zx] = energy ? 10.0f * std::log10(average) : average;
+                zone_l10[zy * zones + zx] = energy ? 10.0f * std::log10(sorted[rank]) : sorted[rank];
+            }
+        }
+    }
+};
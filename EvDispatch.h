@@ -0,0 +1,464 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "CityState.h"
+#include "RoadNetwork.h"
+#include "SensorRNG.h"
+
+// Charging dispatch for the city's EV fleet.
+//
+// Every entry of CityState::ev_prioritization is an EV. A dispatch batch
+// covers EV_BATCH_SECONDS: driving EVs move and drain their battery, and those
+// below their charging threshold request a station. A request goes to the
+// station where the EV can start charging soonest: the drive there plus the
+// expected wait for a port. Stations are indexed in a uniform grid of cells,
+// and the search visits rings of cells around the EV until no unvisited cell
+// can beat the best station found.
+//
+// Each station has a fixed number of ports and a priority queue of waiting
+// EVs, lowest state of charge first, then earliest arrival. A port holds its
+// EV for the drive there and the charge to EV_TARGET_SOC. When it frees up,
+// the next queued EV takes it at once, within the batch.
+//
+// Requests are chosen in parallel over blocks of EVs, against the station
+// loads left by the previous batch. The stations are then run in parallel by
+// zone (a square tile of index cells); a zone owns its stations' queues and
+// ports, and an EV is in at most one queue or port.
+//
+// A dispatcher advances the driving EVs [begin, end) only, so an MPI rank
+// moves its own block. Station state is replicated: every rank runs
+// dispatch() on the requests of the whole fleet and gets the same result.
+
+#define EV_BATCH_SECONDS 60.0f
+#define EV_CHARGE_PER_SECOND (0.02f / 60.0f) // fraction of the battery, 2% per minute
+#define EV_TARGET_SOC 0.9f                    // sessions end at this state of charge
+#define EV_SESSION_SECONDS 2100.0f            // typical session, for wait estimates
+#define EV_FLEET_PER_PORT 20                  // EVs per charging port on average
+#define EV_CELL_STATIONS 2                    // stations per index cell on average
+#define EV_ZONE_CELLS 4                       // index cells per zone side
+#define EV_BLOCK 4096                         // EVs per task when requesting
+
+// A charging request bound for one station
+struct EvRequest {
+    uint64_t key; // queue order: state of charge in %, then ETA in s, then EV id
+    int32_t station;
+    float eta;    // drive to the station, s
+    float soc;    // state of charge when requested, 0-1
+};
+
+struct DispatchStats {
+    long requests = 0;     // new requests this batch, whole fleet
+    long started = 0;      // sessions that took a port
+    long finished = 0;     // sessions that reached EV_TARGET_SOC
+    long waiting = 0;      // EVs queued at the end of the batch
+    long charging = 0;     // ports held at the end of the batch
+    long wait_seconds = 0; // queueing time of the started sessions
+    long distance_m = 0;   // Manhattan distance of the new requests
+};
+
+class EvDispatcher {
+public:
+    // city_meters is the side of the square city the stations and EVs are
+    // spread over
+    EvDispatcher(size_t num_stations, size_t fleet, size_t begin, size_t end, float city_meters, uint64_t seed)
+        : num_stations(num_stations), fleet(fleet), first(begin), count(end - begin), extent(city_meters), seed(seed),
+          ev_x(end - begin), ev_y(end - begin), ev_soc(end - begin), ev_drain(end - begin),
+          ev_threshold(end - begin), ev_waiting(end - begin, 0), queues(num_stations) {
+        placeStations();
+        buildIndex();
+        for (size_t j = 0; j < count; ++j) {
+            SensorRNG rng(seed, STREAM_EV_FLEET, first + j);
+            ev_x[j] = extent * unit(rng);
+            ev_y[j] = extent * unit(rng);
+            ev_soc[j] = 0.2f + 0.8f * unit(rng);
+            ev_drain[j] = (0.0004f + 0.0008f * unit(rng)) / 60.0f;
+            ev_threshold[j] = 0.15f + 0.1f * unit(rng);
+        }
+        size_t num_blocks = (count + EV_BLOCK - 1) / EV_BLOCK;
+        block_requests.resize(count);
+        block_counts.resize(num_blocks);
+        requests.reserve(count);
+    }
+
+    size_t begin() const { return first; }
+    size_t end() const { return first + count; }
+    size_t numStations() const { return num_stations; }
+    int ports(int s) const { return port_offsets[s + 1] - port_offsets[s]; }
+    int busy(int s) const { return station_busy[s]; }
+    size_t waiting(int s) const { return queues[s].size(); }
+
+    // Checkpoint sections (Checkpoint.h): the driving state of this block's
+    // EVs and the replicated station state. The queues are saved as heaps,
+    // so sessions start in the same order after a restore. Positions of the
+    // stations and the EVs' drain and threshold follow from the seed.
+    template <typename Archive>
+    void checkpoint(Archive& archive) {
+        size_t last = first + count;
+        archive.section("ev.x", ev_x.data(), fleet, first, last);
+        archive.section("ev.y", ev_y.data(), fleet, first, last);
+        archive.section("ev.soc", ev_soc.data(), fleet, first, last);
+        archive.section("ev.waiting", ev_waiting.data(), fleet, first, last);
+        archive.whole("ev.port_ev", port_ev.data(), port_ev.size());
+        archive.whole("ev.port_travel", port_travel.data(), port_travel.size());
+        archive.whole("ev.port_soc", port_soc.data(), port_soc.size());
+        archive.whole("ev.station_busy", station_busy.data(), num_stations);
+        archive.whole("ev.batch", &batch, 1);
+
+        // Queues flattened in station order
+        std::vector<int64_t> queue_offsets(num_stations + 1, 0);
+        for (size_t s = 0; s < num_stations; ++s) {
+            queue_offsets[s + 1] = queue_offsets[s] + queues[s].size();
+        }
+        std::vector<QueueEntry> entries;
+        if (archive.restoring()) {
+            entries.resize(archive.records("ev.queue_entries"));
+        } else {
+            entries.reserve(queue_offsets[num_stations]);
+            for (const std::vector<QueueEntry>& queue : queues) {
+                entries.insert(entries.end(), queue.begin(), queue.end());
+            }
+        }
+        archive.whole("ev.queue_offsets", queue_offsets.data(), num_stations + 1);
+        archive.whole("ev.queue_entries", entries.data(), entries.size());
+        if (archive.restoring() && (size_t)queue_offsets[num_stations] == entries.size()) {
+            for (size_t s = 0; s < num_stations; ++s) {
+                queues[s].assign(entries.begin() + queue_offsets[s], entries.begin() + queue_offsets[s + 1]);
+            }
+        }
+    }
+
+    // Moves this block's driving EVs through the next batch and returns the
+    // requests of those that need a charge. priority is indexed by global EV
+    // id; a requesting EV gets 100 minus its state of charge in %.
+    const std::vector<EvRequest>& requestCharging(EvPriority* priority) {
+        long num_blocks = block_counts.size();
+        if (num_stations > 0) {
+            #pragma omp taskloop default(shared)
+            for (long b = 0; b < num_blocks; ++b) {
+                size_t lo = b * EV_BLOCK;
+                size_t hi = std::min(count, lo + EV_BLOCK);
+                int n = 0;
+                for (size_t j = lo; j < hi; ++j) {
+                    if (ev_waiting[j]) {
+                        continue;
+                    }
+                    SensorRNG rng(seed, STREAM_EV_FLEET, (batch + 1) * fleet + first + j);
+                    ev_x[j] = std::min(std::max(ev_x[j] + 1000.0f * (unit(rng) - 0.5f), 0.0f), extent);
+                    ev_y[j] = std::min(std::max(ev_y[j] + 1000.0f * (unit(rng) - 0.5f), 0.0f), extent);
+                    ev_soc[j] = std::max(ev_soc[j] - ev_drain[j] * EV_BATCH_SECONDS, 0.0f);
+                    if (ev_soc[j] >= ev_threshold[j]) {
+                        continue;
+                    }
+                    EvRequest& r = block_requests[lo + n++];
+                    r.station = chooseStation(ev_x[j], ev_y[j], r.eta);
+                    r.soc = ev_soc[j];
+                    uint64_t percent = uint64_t(100.0f * r.soc);
+                    uint64_t eta = std::min<uint64_t>(uint64_t(r.eta), 0xFFFF);
+                    r.key = percent << 48 | eta << 32 | uint64_t(first + j);
+                    ev_waiting[j] = 1;
+                    priority[first + j] = EvPriority(100 - percent);
+                }
+                block_counts[b] = n;
+            }
+        }
+        // Concatenated in EV order, independent of the schedule
+        requests.clear();
+        for (long b = 0; b < num_blocks && num_stations > 0; ++b) {
+            requests.insert(requests.end(), block_requests.begin() + b * EV_BLOCK,
+                            block_requests.begin() + b * EV_BLOCK + block_counts[b]);
+        }
+        return requests;
+    }
+
+    // Queues the new requests of the whole fleet, runs every station for one
+    // batch and writes each station's status. Sessions of this block's EVs
+    // that finish send them back to driving with priority 0.
+    DispatchStats dispatch(const EvRequest* batch_requests, size_t num_requests, ChargerStatus* status,
+                           EvPriority* priority) {
+        DispatchStats stats;
+        stats.requests = num_requests;
+
+        // Bucket the requests by the zone of their station (counting sort)
+        std::fill(zone_request_offsets.begin(), zone_request_offsets.end(), 0);
+        for (size_t k = 0; k < num_requests; ++k) {
+            ++zone_request_offsets[station_zone[batch_requests[k].station] + 1];
+            stats.distance_m += long(batch_requests[k].eta * ROAD_SPEED_MPS);
+        }
+        for (int z = 0; z < num_zones; ++z) {
+            zone_request_offsets[z + 1] += zone_request_offsets[z];
+        }
+        zone_requests.resize(num_requests);
+        zone_fill.assign(zone_request_offsets.begin(), zone_request_offsets.end() - 1);
+        for (size_t k = 0; k < num_requests; ++k) {
+            zone_requests[zone_fill[station_zone[batch_requests[k].station]]++] = batch_requests[k];
+        }
+
+        float now = batch * EV_BATCH_SECONDS;
+        long started = 0, finished = 0, waiting = 0, charging = 0, wait_seconds = 0;
+        #pragma omp taskloop default(shared) reduction(+:started, finished, waiting, charging, wait_seconds)
+        for (int z = 0; z < num_zones; ++z) {
+            for (int k = zone_request_offsets[z]; k < zone_request_offsets[z + 1]; ++k) {
+                const EvRequest& r = zone_requests[k];
+                std::vector<QueueEntry>& queue = queues[r.station];
+                queue.push_back({r.key, now, r.eta, r.soc});
+                std::push_heap(queue.begin(), queue.end(), laterInQueue);
+            }
+            for (int k = zone_offsets[z]; k < zone_offsets[z + 1]; ++k) {
+                int s = zone_stations[k];
+                int held = 0;
+                for (int p = port_offsets[s]; p < port_offsets[s + 1]; ++p) {
+                    SessionCounts counts = runPort(s, p, now, priority);
+                    started += counts.started;
+                    finished += counts.finished;
+                    wait_seconds += counts.wait_seconds;
+                    held += port_ev[p] >= 0;
+                }
+                station_busy[s] = held;
+                status[s] = held < ports(s) ? ChargerStatus::Available : ChargerStatus::Occupied;
+                charging += held;
+                waiting += queues[s].size();
+            }
+        }
+        ++batch;
+
+        stats.started = started;
+        stats.finished = finished;
+        stats.waiting = waiting;
+        stats.charging = charging;
+        stats.wait_seconds = wait_seconds;
+        return stats;
+    }
+
+private:
+    struct QueueEntry {
+        uint64_t key;
+        float queued_at; // s since the first batch
+        float eta;
+        float soc;
+    };
+
+    struct SessionCounts {
+        long started = 0;
+        long finished = 0;
+        long wait_seconds = 0;
+    };
+
+    size_t num_stations;
+    size_t fleet;
+    size_t first;
+    size_t count;
+    float extent;
+    uint64_t seed;
+    uint64_t batch = 0;
+
+    // Stations; the ports of station s are [port_offsets[s], port_offsets[s + 1])
+    AlignedVector<float> station_x;
+    AlignedVector<float> station_y;
+    AlignedVector<int32_t> port_offsets;
+    AlignedVector<int32_t> station_busy;
+
+    // Spatial index: the stations of cell c are
+    // cell_stations[cell_offsets[c] .. cell_offsets[c + 1])
+    int cells_per_side = 1;
+    float cell_size = 1.0f;
+    AlignedVector<int32_t> cell_offsets;
+    AlignedVector<int32_t> cell_stations;
+
+    // Zones, listed the same way, and each station's zone
+    int num_zones = 0;
+    AlignedVector<int32_t> zone_offsets;
+    AlignedVector<int32_t> zone_stations;
+    AlignedVector<int32_t> station_zone;
+
+    // Ports: the EV holding each (-1 when free), its remaining drive and its
+    // state of charge
+    AlignedVector<int32_t> port_ev;
+    AlignedVector<float> port_travel;
+    AlignedVector<float> port_soc;
+
+    // Driving state of EVs [first, first + count)
+    AlignedVector<float> ev_x;
+    AlignedVector<float> ev_y;
+    AlignedVector<float> ev_soc;
+    AlignedVector<float> ev_drain;     // per second of driving
+    AlignedVector<float> ev_threshold; // requests a charge below this
+    AlignedVector<uint8_t> ev_waiting; // queued or at a port
+
+    // Per-station binary min-heaps on the key. They grow to the longest
+    // queue seen and keep their capacity.
+    std::vector<std::vector<QueueEntry>> queues;
+
+    // Per-batch buffers, reused
+    std::vector<EvRequest> block_requests; // each block's requests at its first EV
+    std::vector<int> block_counts;
+    std::vector<EvRequest> requests;
+    std::vector<EvRequest> zone_requests;
+    std::vector<int> zone_request_offsets;
+    std::vector<int> zone_fill;
+
+    static float unit(SensorRNG& rng) {
+        return rng.uniform(1 << 20) * (1.0f / (1 << 20));
+    }
+
+    static bool laterInQueue(const QueueEntry& a, const QueueEntry& b) {
+        return a.key > b.key;
+    }
+
+    int cellOf(float coordinate) const {
+        return std::min(int(coordinate / cell_size), cells_per_side - 1);
+    }
+
+    void placeStations() {
+        station_x.resize(num_stations);
+        station_y.resize(num_stations);
+        station_busy.assign(num_stations, 0);
+        port_offsets.assign(num_stations + 1, 0);
+        double ports_per_station = (double)fleet / std::max<size_t>(num_stations, 1) / EV_FLEET_PER_PORT;
+        for (size_t s = 0; s < num_stations; ++s) {
+            SensorRNG rng(seed, STREAM_EV_STATIONS, s);
+            station_x[s] = extent * unit(rng);
+            station_y[s] = extent * unit(rng);
+            int ports = std::max(1, (int)std::lround(ports_per_station * (0.5f + unit(rng))));
+            port_offsets[s + 1] = port_offsets[s] + ports;
+        }
+        port_ev.assign(port_offsets[num_stations], -1);
+        port_travel.assign(port_offsets[num_stations], 0.0f);
+        port_soc.assign(port_offsets[num_stations], 0.0f);
+    }
+
+    // Counting sorts of the stations into cells and zones
+    void buildIndex() {
+        cells_per_side = std::max(1, (int)std::sqrt((double)num_stations / EV_CELL_STATIONS));
+        cell_size = std::max(extent, 1.0f) / cells_per_side;
+        int zones_per_side = (cells_per_side + EV_ZONE_CELLS - 1) / EV_ZONE_CELLS;
+        num_zones = zones_per_side * zones_per_side;
+
+        std::vector<int32_t> cell(num_stations);
+        station_zone.resize(num_stations);
+        cell_offsets.assign(cells_per_side * cells_per_side + 1, 0);
+        zone_offsets.assign(num_zones + 1, 0);
+        for (size_t s = 0; s < num_stations; ++s) {
+            int cx = cellOf(station_x[s]), cy = cellOf(station_y[s]);
+            cell[s] = cy * cells_per_side + cx;
+            station_zone[s] = (cy / EV_ZONE_CELLS) * zones_per_side + cx / EV_ZONE_CELLS;
+            ++cell_offsets[cell[s] + 1];
+            ++zone_offsets[station_zone[s] + 1];
+        }
+        for (size_t c = 1; c < cell_offsets.size(); ++c) {
+            cell_offsets[c] += cell_offsets[c - 1];
+        }
+        for (int z = 0; z < num_zones; ++z) {
+            zone_offsets[z + 1] += zone_offsets[z];
+        }
+        cell_stations.resize(num_stations);
+        zone_stations.resize(num_stations);
+        std::vector<int32_t> cell_fill(cell_offsets.begin(), cell_offsets.end() - 1);
+        std::vector<int32_t> zone_fill_init(zone_offsets.begin(), zone_offsets.end() - 1);
+        for (size_t s = 0; s < num_stations; ++s) {
+            cell_stations[cell_fill[cell[s]]++] = s;
+            zone_stations[zone_fill_init[station_zone[s]]++] = s;
+        }
+        zone_request_offsets.assign(num_zones + 1, 0);
+        zone_fill.reserve(num_zones);
+    }
+
+    // Expected time until a new arrival at station s gets a port
+    float expectedWait(int s) const {
+        int ahead = station_busy[s] + (int)queues[s].size() + 1 - ports(s);
+        return ahead > 0 ? ahead * EV_SESSION_SECONDS / ports(s) : 0.0f;
+    }
+
+    // Station with the earliest start of charging from (x, y), and the drive
+    // there. A station in ring r of cells around the EV is at least r - 1
+    // cells away, which bounds the rings worth visiting.
+    int chooseStation(float x, float y, float& eta) const {
+        int cx = cellOf(x), cy = cellOf(y);
+        int best = -1;
+        float best_cost = 0.0f, best_eta = 0.0f;
+        for (int r = 0; r <= cells_per_side; ++r) {
+            if (best >= 0 && (r - 1) * cell_size / ROAD_SPEED_MPS >= best_cost) {
+                break;
+            }
+            for (int dy = -r; dy <= r; ++dy) {
+                int y_cell = cy + dy;
+                if (y_cell < 0 || y_cell >= cells_per_side) {
+                    continue;
+                }
+                // Whole rows at the top and bottom of the ring, the two ends elsewhere
+                int step = (dy == -r || dy == r) ? 1 : 2 * r;
+                for (int dx = -r; dx <= r; dx += step) {
+                    int x_cell = cx + dx;
+                    if (x_cell < 0 || x_cell >= cells_per_side) {
+                        continue;
+                    }
+                    int c = y_cell * cells_per_side + x_cell;
+                    for (int k = cell_offsets[c]; k < cell_offsets[c + 1]; ++k) {
+                        int s = cell_stations[k];
+                        float drive = (std::fabs(station_x[s] - x) + std::fabs(station_y[s] - y)) / ROAD_SPEED_MPS;
+                        float cost = drive + expectedWait(s);
+                        if (best < 0 || cost < best_cost) {
+                            best = s;
+                            best_cost = cost;
+                            best_eta = drive;
+                        }
+                    }
+                }
+            }
+        }
+        eta = best_eta;
+        return best;
+    }
+
+    // Runs port p of station s through the batch starting at `now`. A free
+    // port takes the head of the queue, so a session that ends mid-batch is
+    // followed by the next one straight away.
+    SessionCounts runPort(int s, int p, float now, EvPriority* priority) {
+        SessionCounts counts;
+        std::vector<QueueEntry>& queue = queues[s];
+        float t = 0.0f; // s into the batch
+        while (true) {
+            if (port_ev[p] < 0) {
+                if (queue.empty()) {
+                    break;
+                }
+                std::pop_heap(queue.begin(), queue.end(), laterInQueue);
+                const QueueEntry& next = queue.back();
+                port_ev[p] = int32_t(next.key & 0xFFFFFFFFu);
+                port_travel[p] = next.eta;
+                port_soc[p] = next.soc;
+                counts.wait_seconds += long(now + t - next.queued_at);
+                ++counts.started;
+                queue.pop_back();
+            }
+            float left = EV_BATCH_SECONDS - t;
+            float drive = std::min(port_travel[p], left);
+            port_travel[p] -= drive;
+            t += drive;
+            left -= drive;
+            float charge = (EV_TARGET_SOC - port_soc[p]) / EV_CHARGE_PER_SECOND;
+            if (charge > left) {
+                port_soc[p] += left * EV_CHARGE_PER_SECOND;
+                break;
+            }
+            t += charge;
+            finishSession(port_ev[p], priority);
+            port_ev[p] = -1;
+            ++counts.finished;
+        }
+        return counts;
+    }
+
+    void finishSession(int32_t ev, EvPriority* priority) {
+        if ((size_t)ev < first || (size_t)ev >= first + count) {
+            return;
+        }
+        ev_soc[ev - first] = EV_TARGET_SOC;
+        ev_waiting[ev - first] = 0;
+        priority[ev] = 0;
+    }
+};
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Cache-blocked, register-blocked matrix multiplication on contiguous
+// row-major storage: C (m x n) += A (m x k) * B (k x n).
+//
+// The iteration space is tiled so that a GEMM_KC x GEMM_NC panel of B stays
+// in L2 while GEMM_MC rows of A stream through it. Inside a tile a
+// GEMM_MR x (2 * vector width) block of C is held in registers across the
+// whole k loop and updated with broadcast(A) * row(B), so every load of B is
+// contiguous. AVX-512 and AVX2 paths are chosen at compile time (build with
+// -march=native); otherwise a scalar micro-kernel with the same blocking is
+// used.
+
+#define GEMM_MC 64
+#define GEMM_NC 256
+#define GEMM_KC 256
+#define GEMM_MR 4
+
+// Vector operations used by the micro-kernel, one struct per element type
+// and instruction set. WIDTH is the number of elements per vector.
+template <typename T>
+struct ScalarOps {
+    typedef T Vec;
+    static const int WIDTH = 1;
+    static Vec load(const T* p) { return *p; }
+    static void store(T* p, Vec v) { *p = v; }
+    static Vec broadcast(T x) { return x; }
+    static Vec madd(Vec a, Vec b, Vec c) { return a * b + c; }
+};
+
+#if defined(__AVX512F__)
+struct FloatOps {
+    typedef __m512 Vec;
+    static const int WIDTH = 16;
+    static Vec load(const float* p) { return _mm512_loadu_ps(p); }
+    static void store(float* p, Vec v) { _mm512_storeu_ps(p, v); }
+    static Vec broadcast(float x) { return _mm512_set1_ps(x); }
+    static Vec madd(Vec a, Vec b, Vec c) { return _mm512_fmadd_ps(a, b, c); }
+};
+
+struct Int32Ops {
+    typedef __m512i Vec;
+    static const int WIDTH = 16;
+    static Vec load(const int32_t* p) { return _mm512_loadu_si512(p); }
+    static void store(int32_t* p, Vec v) { _mm512_storeu_si512(p, v); }
+    static Vec broadcast(int32_t x) { return _mm512_set1_epi32(x); }
+    static Vec madd(Vec a, Vec b, Vec c) { return _mm512_add_epi32(_mm512_mullo_epi32(a, b), c); }
+};
+#elif defined(__AVX2__)
+struct FloatOps {
+    typedef __m256 Vec;
+    static const int WIDTH = 8;
+    static Vec load(const float* p) { return _mm256_loadu_ps(p); }
+    static void store(float* p, Vec v) { _mm256_storeu_ps(p, v); }
+    static Vec broadcast(float x) { return _mm256_set1_ps(x); }
+#if defined(__FMA__)
+    static Vec madd(Vec a, Vec b, Vec c) { return _mm256_fmadd_ps(a, b, c); }
+#else
+    static Vec madd(Vec a, Vec b, Vec c) { return _mm256_add_ps(_mm256_mul_ps(a, b), c); }
+#endif
+};
+
+struct Int32Ops {
+    typedef __m256i Vec;
+    static const int WIDTH = 8;
+    static Vec load(const int32_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+    static void store(int32_t* p, Vec v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+    static Vec broadcast(int32_t x) { return _mm256_set1_epi32(x); }
+    static Vec madd(Vec a, Vec b, Vec c) { return _mm256_add_epi32(_mm256_mullo_epi32(a, b), c); }
+};
+#else
+typedef ScalarOps<float> FloatOps;
+typedef ScalarOps<int32_t> Int32Ops;
+#endif
+
+template <typename T> struct SimdOps;
+template <> struct SimdOps<float> { typedef FloatOps Type; };
+template <> struct SimdOps<int32_t> { typedef Int32Ops Type; };
+
+// GEMM_MR x (2 * WIDTH) block of C kept in registers over kc steps of k.
+template <typename T, typename Ops>
+inline void gemmMicroKernel(const T* a, int lda, const T* b, int ldb, T* c, int ldc, int kc) {
+    typedef typename Ops::Vec Vec;
+    const int W = Ops::WIDTH;
+    Vec c0[GEMM_MR], c1[GEMM_MR];
+    for (int r = 0; r < GEMM_MR; ++r) {
+        c0[r] = Ops::load(c + r * ldc);
+        c1[r] = Ops::load(c + r * ldc + W);
+    }
+    for (int k = 0; k < kc; ++k) {
+        Vec b0 = Ops::load(b + k * ldb);
+        Vec b1 = Ops::load(b + k * ldb + W);
+        for (int r = 0; r < GEMM_MR; ++r) {
+            Vec ar = Ops::broadcast(a[r * lda + k]);
+            c0[r] = Ops::madd(ar, b0, c0[r]);
+            c1[r] = Ops::madd(ar, b1, c1[r]);
+        }
+    }
+    for (int r = 0; r < GEMM_MR; ++r) {
+        Ops::store(c + r * ldc, c0[r]);
+        Ops::store(c + r * ldc + W, c1[r]);
+    }
+}
+
+// Edge of a tile that does not fill a micro-kernel block; i-k-j order keeps
+// the inner loop contiguous so the compiler can still vectorize it.
+template <typename T>
+inline void gemmEdge(const T* a, int lda, const T* b, int ldb, T* c, int ldc, int rows, int cols, int kc) {
+    for (int i = 0; i < rows; ++i) {
+        for (int k = 0; k < kc; ++k) {
+            T aik = a[i * lda + k];
+            for (int j = 0; j < cols; ++j) {
+                c[i * ldc + j] += aik * b[k * ldb + j];
+            }
+        }
+    }
+}
+
+template <typename T, typename Ops>
+inline void gemmTile(const T* a, int lda, const T* b, int ldb, T* c, int ldc, int mc, int nc, int kc) {
+    const int NR = 2 * Ops::WIDTH;
+    int full_rows = mc - mc % GEMM_MR;
+    int full_cols = nc - nc % NR;
+    for (int i = 0; i < full_rows; i += GEMM_MR) {
+        for (int j = 0; j < full_cols; j += NR) {
+            gemmMicroKernel<T, Ops>(a + i * lda, lda, b + j, ldb, c + i * ldc + j, ldc, kc);
+        }
+        gemmEdge(a + i * lda, lda, b + full_cols, ldb, c + i * ldc + full_cols, ldc, GEMM_MR, nc - full_cols, kc);
+    }
+    gemmEdge(a + full_rows * lda, lda, b, ldb, c + full_rows * ldc, ldc, mc - full_rows, nc, kc);
+}
+
+// Matrix extent: N when the size is fixed at compile time, else the
+// runtime size.
+template <int N>
+inline int gemmExtent(int runtime) {
+    return N > 0 ? N : runtime;
+}
+
+// Block of at most B starting `remaining` before the end; a constant B when
+// the fixed size N is a multiple of it, so the tails drop out.
+template <int N, int B>
+inline int gemmBlockSize(int remaining) {
+    return N > 0 && N % B == 0 ? B : std::min(B, remaining);
+}
+
+// C += A * B with the micro-kernel selected by Ops, or C = A * B when
+// accumulate is false (each task zeroes its own block of C first, so the
+// product costs no separate pass). Each (row block, column block) of C is
+// owned by one task, so no synchronization is needed. Inside a
+// parallel region (a TaskGraph kernel) the tiles are tasks of the current
+// team; otherwise the call opens its own team. N > 0 fixes m = n = k = N
+// at compile time, so strides, loop bounds and tile sizes are constants.
+template <typename T, typename Ops, int N = 0>
+void gemmBlockedWith(const T* a, const T* b, T* c, int m, int n, int k, bool accumulate) {
+    auto tiles = [&]() {
+        #pragma omp taskloop collapse(2) default(shared)
+        for (int ii = 0; ii < gemmExtent<N>(m); ii += GEMM_MC) {
+            for (int jj = 0; jj < gemmExtent<N>(n); jj += GEMM_NC) {
+                const int rows = gemmExtent<N>(m), cols = gemmExtent<N>(n), depth = gemmExtent<N>(k);
+                int mc = gemmBlockSize<N, GEMM_MC>(rows - ii);
+                int nc = gemmBlockSize<N, GEMM_NC>(cols - jj);
+                if (!accumulate) {
+                    for (int i = ii; i < ii + mc; ++i) {
+                        std::fill(c + i * cols + jj, c + i * cols + jj + nc, T(0));
+                    }
+                }
+                for (int kk = 0; kk < depth; kk += GEMM_KC) {
+                    int kc = gemmBlockSize<N, GEMM_KC>(depth - kk);
+                    gemmTile<T, Ops>(a + ii * depth + kk, depth, b + kk * cols + jj, cols, c + ii * cols + jj, cols,
+                                     mc, nc, kc);
+                }
+            }
+        }
+    };
+#ifdef _OPENMP
+    if (!omp_in_parallel()) {
+        #pragma omp parallel
+        #pragma omp single
+        tiles();
+        return;
+    }
+#endif
+    tiles();
+}
+
+// Vectorized path for the widest instruction set the build targets.
+template <typename T>
+void gemmBlocked(const T* a, const T* b, T* c, int m, int n, int k, bool accumulate = true) {
+    gemmBlockedWith<T, typename SimdOps<T>::Type>(a, b, c, m, n, k, accumulate);
+}
+
+// Vectorized C = A * B (or C += A * B) for N x N matrices, with the size
+// fixed at compile time.
+template <int N, typename T>
+void gemmSquare(const T* a, const T* b, T* c, bool accumulate = true) {
+    gemmBlockedWith<T, typename SimdOps<T>::Type, N>(a, b, c, N, N, N, accumulate);
+}
+
+// Same blocking with the scalar micro-kernel, for targets without SIMD and
+// for checking the vector paths.
+template <typename T>
+void gemmBlockedScalar(const T* a, const T* b, T* c, int m, int n, int k, bool accumulate = true) {
+    gemmBlockedWith<T, ScalarOps<T>>(a, b, c, m, n, k, accumulate);
+}
+
+// Name of the instruction set gemmBlocked was compiled for.
+inline const char* gemmInstructionSet() {
+#if defined(__AVX512F__)
+    return "AVX-512";
+#elif defined(__AVX2__)
+    return "AVX2";
+#else
+    return "scalar";
+#endif
+}
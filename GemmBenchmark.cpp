@@ -0,0 +1,118 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <omp.h>
+#include "CityState.h"
+#include "Gemm.h"
+
+using namespace std;
+
+// Compares the blocked SIMD GEMM against the original matrixMultiplication
+// (naive i-j-k over vector<vector<int>>) and reports GFLOP/s per size.
+//
+//   g++ -O3 -march=native -fopenmp GemmBenchmark.cpp -o gemm_benchmark
+//   ./gemm_benchmark [--max-reference 1024] [--repetitions 3]
+
+static const int SIZES[] = {200, 256, 512, 1024, 2048, 4096};
+
+// The pre-blocking matrixMultiplication kernel, kept as the baseline.
+void naiveMultiply(vector<vector<int>>& matrix_a, vector<vector<int>>& matrix_b, vector<vector<int>>& result) {
+    #pragma omp parallel for collapse(2)
+    for (int i = 0; i < matrix_a.size(); ++i) {
+        for (int j = 0; j < matrix_b[0].size(); ++j) {
+            for (int k = 0; k < matrix_a[0].size(); ++k) {
+                result[i][j] += matrix_a[i][k] * matrix_b[k][j];
+            }
+        }
+    }
+}
+
+template <typename T>
+void fillMatrix(AlignedVector<T>& m, int n, int salt) {
+    for (int i = 0; i < n * n; ++i) {
+        m[i] = T((i * 7 + salt) % 13 - 6);
+    }
+}
+
+// Best-of-repetitions wall time of fn, in seconds.
+template <typename F>
+double bestTime(int repetitions, F fn) {
+    double best = 1e300;
+    for (int r = 0; r < repetitions; ++r) {
+        auto start = chrono::high_resolution_clock::now();
+        fn();
+        chrono::duration<double> elapsed = chrono::high_resolution_clock::now() - start;
+        best = min(best, elapsed.count());
+    }
+    return best;
+}
+
+double gflops(int n, double seconds) {
+    return 2.0 * n * n * (double)n / seconds * 1e-9;
+}
+
+int main(int argc, char* argv[]) {
+    int max_reference = 1024;
+    int repetitions = 3;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--max-reference") == 0) {
+            max_reference = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--repetitions") == 0) {
+            repetitions = atoi(argv[i + 1]);
+        }
+    }
+
+    printf("GEMM benchmark: %s micro-kernel, %d threads, best of %d\n", gemmInstructionSet(), omp_get_max_threads(), repetitions);
+    printf("%6s %14s %14s %14s %10s %8s\n", "n", "naive int", "blocked int", "blocked float", "speedup", "check");
+
+    for (int n : SIZES) {
+        AlignedVector<int32_t> a(n * n), b(n * n), c(n * n);
+        AlignedVector<float> af(n * n), bf(n * n), cf(n * n);
+        fillMatrix(a, n, 1);
+        fillMatrix(b, n, 5);
+        fillMatrix(af, n, 1);
+        fillMatrix(bf, n, 5);
+
+        double blocked = bestTime(repetitions, [&] {
+            fill(c.begin(), c.end(), 0);
+            gemmBlocked(a.data(), b.data(), c.data(), n, n, n);
+        });
+        double blocked_float = bestTime(repetitions, [&] {
+            fill(cf.begin(), cf.end(), 0.0f);
+            gemmBlocked(af.data(), bf.data(), cf.data(), n, n, n);
+        });
+
+        if (n > max_reference) {
+            printf("%6d %14s %14.2f %14.2f %10s %8s\n", n, "-", gflops(n, blocked), gflops(n, blocked_float), "-", "-");
+            continue;
+        }
+
+        vector<vector<int>> va(n, vector<int>(n)), vb(n, vector<int>(n)), vc(n, vector<int>(n));
+        for (int i = 0; i < n; ++i) {
+            for (int j = 0; j < n; ++j) {
+                va[i][j] = a[i * n + j];
+                vb[i][j] = b[i * n + j];
+            }
+        }
+        double naive = bestTime(repetitions, [&] {
+            for (auto& row : vc) fill(row.begin(), row.end(), 0);
+            naiveMultiply(va, vb, vc);
+        });
+
+        bool match = true;
+        for (int i = 0; i < n && match; ++i) {
+            for (int j = 0; j < n; ++j) {
+                if (vc[i][j] != c[i * n + j] || float(vc[i][j]) != cf[i * n + j]) {
+                    match = false;
+                    break;
+                }
+            }
+        }
+        printf("%6d %14.2f %14.2f %14.2f %9.1fx %8s\n", n, gflops(n, naive), gflops(n, blocked), gflops(n, blocked_float),
+               naive / blocked, match ? "ok" : "MISMATCH");
+    }
+    return 0;
+}
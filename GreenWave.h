@@ -0,0 +1,540 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "CityState.h"
+#include "RoadNetwork.h"
+
+// Green-wave timing for arterial corridors.
+//
+// A corridor is an ordered chain of intersections joined by links with a
+// length and a design speed. Every signal on it runs a two-phase plan with
+// the corridor's common cycle: the arterial gets a split of the cycle, then
+// the cross street. The optimizer picks the cycle and the offset of every
+// signal that maximize the through bandwidth (the widest window of
+// departures that clears every signal without stopping) summed over both
+// directions, as a fraction of the cycle, which is MAXBAND's objective.
+//
+// Bandwidth is computed exactly on the circle of one cycle. A signal's green,
+// shifted by the travel time from the corridor's first intersection, is an
+// arc; a direction's band is the longest piece of the intersection of its
+// arcs. Offsets improve by coordinate ascent: with the other signals fixed,
+// the band is piecewise linear in one signal's offset, so its best offset is
+// one where an end of its arc meets an end of the others' intersection. The
+// others' intersection is a prefix and a suffix intersection combined, which
+// makes a sweep linear in the corridor length.
+//
+// A change of link speed only moves the arcs downstream of that link, so
+// corridors with few changed links are re-timed from their previous plan at
+// the same cycle with a few sweeps instead of searching every cycle again.
+// Corridors are independent and are timed in parallel with taskloop.
+
+#define GREEN_WAVE_CYCLE_MIN 60.0  // s
+#define GREEN_WAVE_CYCLE_MAX 120.0 // s
+#define GREEN_WAVE_CYCLE_STEP 5.0  // s, coarse scan
+#define GREEN_WAVE_CYCLE_REFINE 1.0 // s, scan around the best coarse cycle
+#define GREEN_WAVE_YELLOW 3.0      // s at the end of each green
+#define GREEN_WAVE_ALL_RED 1.0     // s after each yellow
+#define GREEN_WAVE_MIN_GREEN 10.0  // s for either phase
+#define GREEN_WAVE_ARTERIAL_SHARE 0.6f // share of the usable cycle the arterial gets
+#define GREEN_WAVE_SWEEPS 4        // coordinate-ascent sweeps per start
+#define GREEN_WAVE_SPEED_STEP 0.5f // m/s, link speed changes below this are ignored
+#define GREEN_WAVE_ARTERIAL_SPACING 4 // grid rows per arterial
+
+struct Corridor {
+    std::vector<int32_t> intersections; // global ids in outbound travel order
+    std::vector<float> link_length;     // m, between consecutive intersections
+    std::vector<float> link_speed;      // m/s
+    std::vector<float> arterial_share;  // per intersection
+    uint8_t outbound_approach = APPROACH_WEST; // approach outbound traffic arrives on
+    uint8_t inbound_approach = APPROACH_EAST;
+
+    size_t size() const { return intersections.size(); }
+};
+
+struct CorridorPlan {
+    double cycle = 0.0;          // s, 0 until the corridor is first timed
+    std::vector<double> offset;  // s, start of the arterial green in the cycle
+    std::vector<double> green;   // s of arterial green, yellow included
+    std::vector<double> travel;  // s from the first intersection, at the speeds timed for
+    double outbound_band = 0.0;  // s
+    double inbound_band = 0.0;   // s
+
+    double efficiency() const { return cycle > 0.0 ? (outbound_band + inbound_band) / (2.0 * cycle) : 0.0; }
+};
+
+struct RetimeStats {
+    int full = 0;        // corridors searched over every cycle
+    int incremental = 0; // corridors re-timed from their previous plan
+};
+
+// Sorted disjoint intervals [first, second] within [0, cycle]
+typedef std::vector<std::pair<double, double>> ArcSet;
+
+inline double wrapTime(double t, double cycle) {
+    double r = std::fmod(t, cycle);
+    return r < 0.0 ? r + cycle : r;
+}
+
+// Pieces of the arc of the given length starting at start, in order; an
+// arc that wraps past the end of the cycle is split in two. Returns the
+// number of pieces.
+inline int arcPieces(double start, double length, double cycle, double pieces[2][2]) {
+    double s = wrapTime(start, cycle);
+    if (s + length <= cycle) {
+        pieces[0][0] = s;
+        pieces[0][1] = s + length;
+        return 1;
+    }
+    pieces[0][0] = 0.0;
+    pieces[0][1] = s + length - cycle;
+    pieces[1][0] = s;
+    pieces[1][1] = cycle;
+    return 2;
+}
+
+// out = a intersected with b; out must be neither.
+inline void intersectArcs(const ArcSet& a, const ArcSet& b, ArcSet& out) {
+    out.clear();
+    size_t i = 0, j = 0;
+    while (i < a.size() && j < b.size()) {
+        double lo = std::max(a[i].first, b[j].first);
+        double hi = std::min(a[i].second, b[j].second);
+        if (lo < hi) {
+            out.emplace_back(lo, hi);
+        }
+        if (a[i].second < b[j].second) {
+            ++i;
+        } else {
+            ++j;
+        }
+    }
+}
+
+// out = arcs intersected with one arc; out must not be arcs.
+inline void intersectArc(const ArcSet& arcs, double start, double length, double cycle, ArcSet& out) {
+    if (length >= cycle) {
+        out = arcs;
+        return;
+    }
+    out.clear();
+    double arc[2][2];
+    int pieces = arcPieces(start, length, cycle, arc);
+    for (int p = 0; p < pieces; ++p) {
+        for (const auto& piece : arcs) {
+            double lo = std::max(piece.first, arc[p][0]);
+            double hi = std::min(piece.second, arc[p][1]);
+            if (lo < hi) {
+                out.emplace_back(lo, hi);
+            }
+        }
+    }
+}
+
+// Longest contiguous piece, joining the pieces at either end of the cycle.
+inline double longestPiece(const ArcSet& arcs, double cycle) {
+    double best = 0.0;
+    for (const auto& piece : arcs) {
+        best = std::max(best, piece.second - piece.first);
+    }
+    if (arcs.size() > 1 && arcs.front().first <= 0.0 && arcs.back().second >= cycle) {
+        best = std::max(best, arcs.front().second + cycle - arcs.back().first);
+    }
+    return best;
+}
+
+// longestPiece of arcs intersected with one arc, without building the
+// intersection; scores candidate offsets in the inner loop.
+inline double longestOverlap(const ArcSet& arcs, double start, double length, double cycle) {
+    if (length >= cycle) {
+        return longestPiece(arcs, cycle);
+    }
+    double arc[2][2];
+    int pieces = arcPieces(start, length, cycle, arc);
+    double best = 0.0, head = 0.0, tail = 0.0; // pieces touching 0 and cycle
+    for (const auto& piece : arcs) {
+        for (int p = 0; p < pieces; ++p) {
+            double lo = std::max(piece.first, arc[p][0]);
+            double hi = std::min(piece.second, arc[p][1]);
+            if (lo < hi) {
+                best = std::max(best, hi - lo);
+                head = lo <= 0.0 ? hi : head;
+                tail = hi >= cycle ? cycle - lo : tail;
+            }
+        }
+    }
+    return head > 0.0 && tail > 0.0 && head < cycle ? std::max(best, head + tail) : best;
+}
+
+// Link speed under congestion: the design speed slowed by the density
+// reading of the link's downstream intersection, in GREEN_WAVE_SPEED_STEP
+// steps so sensor noise does not trigger re-timing.
+inline float congestedSpeed(float design_speed, DensityPercent density) {
+    float speed = design_speed * (1.0f - density / 200.0f);
+    return std::max(GREEN_WAVE_SPEED_STEP, std::round(speed / GREEN_WAVE_SPEED_STEP) * GREEN_WAVE_SPEED_STEP);
+}
+
+// Working storage for timing one corridor. Each corridor keeps its own, so
+// the buffers are sized by the first search and reused by every later one,
+// and corridors timed in parallel never share any.
+struct CorridorScratch {
+    std::vector<ArcSet> suffix_out, suffix_in;
+    ArcSet prefix_out, prefix_in, others_out, others_in, arcs;
+    std::vector<double> travel;
+    CorridorPlan candidate;
+};
+
+class GreenWaveOptimizer {
+public:
+    std::vector<Corridor> corridors;
+    std::vector<CorridorPlan> plans;
+
+    explicit GreenWaveOptimizer(std::vector<Corridor> corridors)
+        : corridors(std::move(corridors)),
+          plans(this->corridors.size()),
+          changed_links(this->corridors.size(), 0),
+          scratch(this->corridors.size()) {}
+
+    // The east-west arterials of the grid city (RoadNetwork::grid) in rows
+    // [row_begin, row_end), eastbound outbound. Arterial k is the middle row
+    // of the k-th group of GREEN_WAVE_ARTERIAL_SPACING rows; the signal
+    // controllers own the intersections of all other rows.
+    static std::vector<Corridor> gridArterials(int num_intersections, int row_begin, int row_end) {
+        int width = RoadNetwork::gridWidth(num_intersections);
+        std::vector<Corridor> out;
+        for (int row = row_begin; row < row_end; ++row) {
+            if (!isArterialRow(row)) {
+                continue;
+            }
+            Corridor corridor;
+            for (int g = row * width; g < std::min(num_intersections, (row + 1) * width); ++g) {
+                if (!corridor.intersections.empty()) {
+                    corridor.link_length.push_back(ROAD_LENGTH_M);
+                    corridor.link_speed.push_back(ROAD_SPEED_MPS);
+                }
+                corridor.intersections.push_back(g);
+                corridor.arterial_share.push_back(GREEN_WAVE_ARTERIAL_SHARE);
+            }
+            out.push_back(std::move(corridor));
+        }
+        return out;
+    }
+
+    static bool isArterialRow(int row) {
+        return row % GREEN_WAVE_ARTERIAL_SPACING == GREEN_WAVE_ARTERIAL_SPACING / 2;
+    }
+
+    // Arterials of a whole grid city; arterial k is row k * spacing + spacing / 2.
+    static int numGridArterials(int num_intersections) {
+        int rows = RoadNetwork::gridRows(num_intersections);
+        return (rows + GREEN_WAVE_ARTERIAL_SPACING - 1 - GREEN_WAVE_ARTERIAL_SPACING / 2) / GREEN_WAVE_ARTERIAL_SPACING;
+    }
+
+    size_t numIntersections() const {
+        size_t n = 0;
+        for (const Corridor& corridor : corridors) {
+            n += corridor.size();
+        }
+        return n;
+    }
+
+    // Records a new speed for one link; the corridor is re-timed by the next
+    // retime() if the speed moved by at least GREEN_WAVE_SPEED_STEP.
+    void setLinkSpeed(size_t c, size_t link, float speed) {
+        float& current = corridors[c].link_speed[link];
+        if (std::fabs(speed - current) >= GREEN_WAVE_SPEED_STEP) {
+            current = speed;
+            ++changed_links[c];
+        }
+    }
+
+    // Times every corridor that has no plan yet or has changed links. A
+    // corridor with at most a quarter of its links changed keeps its cycle
+    // and is re-timed from its previous offsets.
+    RetimeStats retime() {
+        int full = 0, incremental = 0;
+        int n = corridors.size();
+        #pragma omp taskloop default(shared) grainsize(1) reduction(+:full, incremental)
+        for (int c = 0; c < n; ++c) {
+            CorridorPlan& plan = plans[c];
+            if (plan.cycle <= 0.0 || 4 * changed_links[c] > std::max<int>(1, corridors[c].link_speed.size())) {
+                optimize(corridors[c], plan, scratch[c]);
+                ++full;
+            } else if (changed_links[c] > 0) {
+                reoptimize(corridors[c], plan, scratch[c]);
+                ++incremental;
+            }
+            changed_links[c] = 0;
+        }
+        RetimeStats stats;
+        stats.full = full;
+        stats.incremental = incremental;
+        return stats;
+    }
+
+    // Checkpoint sections (Checkpoint.h) of the grid arterials of a city of
+    // num_intersections: the plans and link speeds, one record per corridor
+    // and gridWidth records per corridor for its intersections (the link
+    // speed of the link leaving each eastbound), in arterial order.
+    template <typename Archive>
+    void checkpoint(Archive& archive, int num_intersections) {
+        size_t width = RoadNetwork::gridWidth(num_intersections);
+        size_t arterials = numGridArterials(num_intersections);
+        size_t arterial_first = corridors.empty() ? 0 : corridors.front().intersections.front() / width / GREEN_WAVE_ARTERIAL_SPACING;
+        size_t arterial_last = arterial_first + corridors.size();
+        size_t first = arterial_first * width;
+        size_t last = arterial_last * width;
+
+        std::vector<double> cycle(corridors.size()), outbound(corridors.size()), inbound(corridors.size());
+        std::vector<double> offset(last - first), green(last - first), travel(last - first);
+        std::vector<float> speed(last - first, 0.0f);
+        if (!archive.restoring()) {
+            for (size_t c = 0; c < corridors.size(); ++c) {
+                const CorridorPlan& plan = plans[c];
+                cycle[c] = plan.cycle;
+                outbound[c] = plan.outbound_band;
+                inbound[c] = plan.inbound_band;
+                size_t base = c * width;
+                for (size_t k = 0; k < corridors[c].size() && plan.cycle > 0.0; ++k) {
+                    offset[base + k] = plan.offset[k];
+                    green[base + k] = plan.green[k];
+                    travel[base + k] = plan.travel[k];
+                }
+                std::copy(corridors[c].link_speed.begin(), corridors[c].link_speed.end(), speed.begin() + base);
+            }
+        }
+        archive.section("green_wave.cycle", cycle.data(), arterials, arterial_first, arterial_last);
+        archive.section("green_wave.outbound_band", outbound.data(), arterials, arterial_first, arterial_last);
+        archive.section("green_wave.inbound_band", inbound.data(), arterials, arterial_first, arterial_last);
+        archive.section("green_wave.offset", offset.data(), arterials * width, first, last);
+        archive.section("green_wave.green", green.data(), arterials * width, first, last);
+        archive.section("green_wave.travel", travel.data(), arterials * width, first, last);
+        archive.section("green_wave.link_speed", speed.data(), arterials * width, first, last);
+        if (archive.restoring()) {
+            for (size_t c = 0; c < corridors.size(); ++c) {
+                CorridorPlan& plan = plans[c];
+                size_t base = c * width;
+                size_t size = corridors[c].size();
+                plan.cycle = cycle[c];
+                plan.outbound_band = outbound[c];
+                plan.inbound_band = inbound[c];
+                plan.offset.assign(offset.begin() + base, offset.begin() + base + size);
+                plan.green.assign(green.begin() + base, green.begin() + base + size);
+                plan.travel.assign(travel.begin() + base, travel.begin() + base + size);
+                std::copy(speed.begin() + base, speed.begin() + base + corridors[c].link_speed.size(),
+                          corridors[c].link_speed.begin());
+                changed_links[c] = 0;
+            }
+        }
+    }
+
+    // Writes the phases of corridor c at time t (s) into a flat plan indexed
+    // by global intersection id.
+    void applyLights(size_t c, double t, LightPhase* lights) const {
+        const Corridor& corridor = corridors[c];
+        const CorridorPlan& plan = plans[c];
+        for (size_t k = 0; k < corridor.size(); ++k) {
+            LightPhase arterial, cross;
+            phasesAt(plan, k, t, arterial, cross);
+            LightPhase* l = lights + (size_t)corridor.intersections[k] * NUM_APPROACHES;
+            for (int a = 0; a < NUM_APPROACHES; ++a) {
+                bool on_arterial = a == corridor.outbound_approach || a == corridor.inbound_approach;
+                l[a] = on_arterial ? arterial : cross;
+            }
+        }
+    }
+
+    // Arterial and cross-street phases of signal k at time t: arterial green
+    // then yellow, all-red, cross green then yellow, all-red.
+    static void phasesAt(const CorridorPlan& plan, size_t k, double t, LightPhase& arterial, LightPhase& cross) {
+        double in_cycle = wrapTime(t - plan.offset[k], plan.cycle);
+        double green = plan.green[k];
+        arterial = cross = LightPhase::Red;
+        if (in_cycle < green) {
+            arterial = in_cycle < green - GREEN_WAVE_YELLOW ? LightPhase::Green : LightPhase::Yellow;
+        } else if (in_cycle >= green + GREEN_WAVE_ALL_RED && in_cycle < plan.cycle - GREEN_WAVE_ALL_RED) {
+            cross = in_cycle < plan.cycle - GREEN_WAVE_ALL_RED - GREEN_WAVE_YELLOW ? LightPhase::Green : LightPhase::Yellow;
+        }
+    }
+
+    // Best plan over the candidate cycles: a coarse scan of the cycle range,
+    // then a fine scan around the best coarse cycle. Each cycle is tried
+    // from an outbound-progressive, an inbound-progressive and a greedy start.
+    static void optimize(const Corridor& corridor, CorridorPlan& best, CorridorScratch& s) {
+        travelTimes(corridor, s.travel);
+        best.cycle = 0.0;
+        for (double cycle = GREEN_WAVE_CYCLE_MIN; cycle <= GREEN_WAVE_CYCLE_MAX; cycle += GREEN_WAVE_CYCLE_STEP) {
+            tryCycle(corridor, cycle, best, s);
+        }
+        double coarse = best.cycle;
+        for (double cycle = coarse - GREEN_WAVE_CYCLE_STEP + GREEN_WAVE_CYCLE_REFINE; cycle < coarse + GREEN_WAVE_CYCLE_STEP;
+             cycle += GREEN_WAVE_CYCLE_REFINE) {
+            if (cycle != coarse && cycle >= GREEN_WAVE_CYCLE_MIN && cycle <= GREEN_WAVE_CYCLE_MAX) {
+                tryCycle(corridor, cycle, best, s);
+            }
+        }
+    }
+
+    // Re-times a corridor from its previous plan after link speed changes.
+    // Signals downstream of a slower link are first delayed by the extra
+    // travel time, which keeps the outbound band where it was.
+    static void reoptimize(const Corridor& corridor, CorridorPlan& plan, CorridorScratch& s) {
+        travelTimes(corridor, s.travel);
+        for (size_t k = 0; k < corridor.size(); ++k) {
+            plan.offset[k] = wrapTime(plan.offset[k] + s.travel[k] - plan.travel[k], plan.cycle);
+        }
+        plan.travel.swap(s.travel);
+        ascend(plan, s);
+    }
+
+private:
+    std::vector<int> changed_links;
+    std::vector<CorridorScratch> scratch;
+
+    // Times the corridor at one cycle and keeps the plan if it beats best.
+    // Travel times are in s.travel. The candidate and best plans trade
+    // buffers instead of copying them.
+    static void tryCycle(const Corridor& corridor, double cycle, CorridorPlan& best, CorridorScratch& s) {
+        const std::vector<double>& travel = s.travel;
+        for (int start = 0; start < 3; ++start) {
+            CorridorPlan& plan = s.candidate;
+            plan.cycle = cycle;
+            splits(corridor, cycle, plan.green);
+            plan.travel = travel;
+            plan.offset.resize(corridor.size());
+            if (start < 2) {
+                for (size_t k = 0; k < corridor.size(); ++k) {
+                    plan.offset[k] = wrapTime(start == 0 ? travel[k] : -travel[k], cycle);
+                }
+            } else {
+                placeGreedily(plan, s);
+            }
+            ascend(plan, s);
+            if (best.cycle <= 0.0 || plan.efficiency() > best.efficiency()) {
+                std::swap(best, plan);
+            }
+        }
+    }
+
+    // Cumulative travel time from the first intersection to each one.
+    static void travelTimes(const Corridor& corridor, std::vector<double>& travel) {
+        travel.assign(corridor.size(), 0.0);
+        for (size_t k = 1; k < corridor.size(); ++k) {
+            travel[k] = travel[k - 1] + corridor.link_length[k - 1] / corridor.link_speed[k - 1];
+        }
+    }
+
+    // Arterial green per signal: its share of the cycle left after the two
+    // clearance intervals, keeping both phases above the minimum green.
+    static void splits(const Corridor& corridor, double cycle, std::vector<double>& green) {
+        double usable = cycle - 2.0 * GREEN_WAVE_ALL_RED;
+        green.resize(corridor.size());
+        for (size_t k = 0; k < corridor.size(); ++k) {
+            green[k] = std::min(std::max(usable * corridor.arterial_share[k], GREEN_WAVE_MIN_GREEN),
+                                usable - GREEN_WAVE_MIN_GREEN);
+        }
+    }
+
+    // Coordinate ascent on the offsets of plan at its cycle; fills the bands.
+    // Signal k's outbound arc starts at offset - travel, its inbound arc at
+    // offset + travel.
+    static void ascend(CorridorPlan& plan, CorridorScratch& s) {
+        const std::vector<double>& travel = plan.travel;
+        size_t n = plan.offset.size();
+        double cycle = plan.cycle;
+        std::vector<ArcSet>& suffix_out = s.suffix_out;
+        std::vector<ArcSet>& suffix_in = s.suffix_in;
+        ArcSet& prefix_out = s.prefix_out;
+        ArcSet& prefix_in = s.prefix_in;
+        ArcSet& others_out = s.others_out;
+        ArcSet& others_in = s.others_in;
+        ArcSet& scratch = s.arcs;
+        suffix_out.resize(n + 1);
+        suffix_in.resize(n + 1);
+        double total = -1.0;
+
+        for (int sweep = 0; sweep < GREEN_WAVE_SWEEPS; ++sweep) {
+            suffix_out[n].assign(1, {0.0, cycle});
+            suffix_in[n].assign(1, {0.0, cycle});
+            for (size_t k = n; k-- > 0;) {
+                intersectArc(suffix_out[k + 1], plan.offset[k] - travel[k], plan.green[k], cycle, suffix_out[k]);
+                intersectArc(suffix_in[k + 1], plan.offset[k] + travel[k], plan.green[k], cycle, suffix_in[k]);
+            }
+            prefix_out.assign(1, {0.0, cycle});
+            prefix_in.assign(1, {0.0, cycle});
+            for (size_t k = 0; k < n; ++k) {
+                intersectArcs(prefix_out, suffix_out[k + 1], others_out);
+                intersectArcs(prefix_in, suffix_in[k + 1], others_in);
+                plan.offset[k] = bestOffset(others_out, others_in, travel[k], plan.green[k], cycle, plan.offset[k]);
+                intersectArc(prefix_out, plan.offset[k] - travel[k], plan.green[k], cycle, scratch);
+                prefix_out.swap(scratch);
+                intersectArc(prefix_in, plan.offset[k] + travel[k], plan.green[k], cycle, scratch);
+                prefix_in.swap(scratch);
+            }
+            plan.outbound_band = longestPiece(prefix_out, cycle);
+            plan.inbound_band = longestPiece(prefix_in, cycle);
+            double now = plan.outbound_band + plan.inbound_band;
+            if (now <= total + 1e-9) {
+                break;
+            }
+            total = now;
+        }
+    }
+
+    // Places the signals in corridor order, each at the best offset against
+    // the bands of the signals before it. Unlike the progressive starts this
+    // keeps both bands open, which the ascent alone cannot recover once a
+    // band has closed.
+    static void placeGreedily(CorridorPlan& plan, CorridorScratch& s) {
+        ArcSet& prefix_out = s.prefix_out;
+        ArcSet& prefix_in = s.prefix_in;
+        ArcSet& scratch = s.arcs;
+        prefix_out.assign(1, {0.0, plan.cycle});
+        prefix_in.assign(1, {0.0, plan.cycle});
+        for (size_t k = 0; k < plan.offset.size(); ++k) {
+            double travel = plan.travel[k];
+            plan.offset[k] = bestOffset(prefix_out, prefix_in, travel, plan.green[k], plan.cycle, 0.0);
+            intersectArc(prefix_out, plan.offset[k] - travel, plan.green[k], plan.cycle, scratch);
+            prefix_out.swap(scratch);
+            intersectArc(prefix_in, plan.offset[k] + travel, plan.green[k], plan.cycle, scratch);
+            prefix_in.swap(scratch);
+        }
+    }
+
+    // Offset of one signal maximizing the sum of both bands against the
+    // intersections of the other signals' arcs; keeps current on ties.
+    static double bestOffset(const ArcSet& others_out, const ArcSet& others_in, double travel, double green,
+                             double cycle, double current) {
+        auto score = [&](double offset) {
+            return longestOverlap(others_out, offset - travel, green, cycle) +
+                   longestOverlap(others_in, offset + travel, green, cycle);
+        };
+        double best = current;
+        double best_score = score(current);
+        auto consider = [&](double offset) {
+            offset = wrapTime(offset, cycle);
+            double s = score(offset);
+            if (s > best_score + 1e-9) {
+                best = offset;
+                best_score = s;
+            }
+        };
+        for (const auto& piece : others_out) {
+            for (double p : {piece.first, piece.second}) {
+                consider(p + travel);
+                consider(p + travel - green);
+            }
+        }
+        for (const auto& piece : others_in) {
+            for (double p : {piece.first, piece.second}) {
+                consider(p - travel);
+                consider(p - travel - green);
+            }
+        }
+        return best;
+    }
+};
@@ -3,72 +3,374 @@
 #include <random>
 #include <chrono>
 #include <numeric>
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <functional>
 #include <mpi.h>
+#ifdef _OPENMP
+#include <omp.h>
+#else
+inline int omp_get_max_threads() { return 1; }
+inline void omp_set_num_threads(int) {}
+#endif
+// This program counts its heap allocations (Arena.h)
+#define COUNT_HEAP_ALLOCATIONS
+#include "Arena.h"
+#include "SensorRNG.h"
+#include "Telemetry.h"
+#include "CityState.h"
+#include "Config.h"
+#include "Distribution.h"
+#include "Benchmark.h"
+#include "SensorReplay.h"
+#include "DistributedSimulation.h"
+#include "GreenWave.h"
+#include "SensorDetectors.h"
+#include "TrafficForecast.h"
+#include "EvDispatch.h"
+#include "TransitFeed.h"
+#include "TransitTracker.h"
+#include "SignalController.h"
+#include "EnvironmentMonitor.h"
+#include "RoutePlanner.h"
+#include "DistributedCheckpoint.h"
+#include "Trace.h"
 
 using namespace std;
 
-#define NUM_SENSORS 100
-#define NUM_CAMERAS 50
-#define NUM_VEHICLES 10000
-#define NUM_INTERSECTIONS 50
-#define NUM_EV_STATIONS 50
-#define NUM_PEDESTRIANS 200
-#define NUM_DRONES 10
-#define NUM_USER_PREFERENCES 50
+// Seed for all synthesized sensor data (set from --seed). Values depend
+// only on the seed and the element index, never on the rank that computes them.
+uint64_t sensor_seed = DEFAULT_SENSOR_SEED;
+
+// Set when readings come from a replay file (--replay); each rank loads its
+// block of every frame and the sensor kernels skip synthesis
+bool sensor_replay = false;
+
+// Temporaries of the running kernel; a kernel that uses it resets it first.
+// The kernels run one at a time, so one arena serves them all.
+MonotonicArena kernel_arena;
+
+// Charging requests of the whole fleet in the current dispatch batch
+vector<EvRequest> ev_requests;
+
+// Readings of every sensor, which each rank's band of the maps may need
+vector<AirQualityIndex> air_readings;
+vector<NoiseLevel> noise_readings;
+
+// Boundary queue rows of every rank's signal controller (see
+// SignalController::boundaryRows())
+vector<int32_t> signal_halos;
 
 // Function prototypes
-void trafficFlowMonitoring(vector<int>& vehicle_data, int rank, int size);
-void incidentDetection(vector<int>& incidents, int rank, int size);
-void congestionMonitoring(vector<int>& traffic_density, int rank, int size);
-void vehicleCounting(vector<int>& vehicle_data, int num_sections, int rank, int size);
-void adaptiveSignalControl(vector<vector<int>>& traffic_lights, vector<int>& traffic_flow, int rank, int size);
-void predictiveAnalytics(vector<int>& historical_data, vector<int>& future_traffic, int rank, int size);
-void airQualityMonitoring(vector<int>& air_quality_data, int rank, int size);
-void noisePollutionMonitoring(vector<int>& noise_data, int rank, int size);
-void greenWaveSystem(vector<vector<int>>& traffic_lights, int rank, int size);
-void evChargingIntegration(vector<int>& charging_stations, vector<int>& ev_prioritization, int rank, int size);
-void publicTransportIntegration(vector<int>& public_transport_data, int rank, int size);
-void trafficSimulation(vector<int>& traffic_flow, vector<int>& incidents, int rank, int size);
+void trafficFlowMonitoring(CityState& city, Distribution& dist);
+void incidentDetection(CityState& city, SensorDetectors& detectors, Distribution& dist);
+void congestionMonitoring(CityState& city, SensorDetectors& detectors, Distribution& dist);
+void vehicleCounting(CityState& city, int num_sections, Distribution& dist);
+void adaptiveSignalControl(CityState& city, SignalController& controller, Distribution& dist);
+void predictiveAnalytics(CityState& city, TrafficForecaster& forecaster, Distribution& dist);
+void airQualityMonitoring(CityState& city, EnvironmentMonitor& monitor, Distribution& dist);
+void noisePollutionMonitoring(CityState& city, EnvironmentMonitor& monitor, Distribution& dist);
+void greenWaveSystem(CityState& city, GreenWaveOptimizer& green_wave, Distribution& dist);
+void evChargingIntegration(CityState& city, EvDispatcher& dispatcher, Distribution& dist);
+void publicTransportIntegration(CityState& city, TransitTracker& tracker, const TransitFeed& feed, Distribution& dist);
+void trafficSimulation(CityState& city, int ticks, DistributedSimulation& sim, Distribution& dist);
+
+struct MpiKernel {
+    const char* name;
+    double elements; // work items per run, for throughput
+    vector<const void*> resources; // CityState buffers it reads or writes, as in TaskGraph
+    function<void()> run;
+
+    // Runs the kernel on the rank's thread team. The main thread runs the
+    // kernel body and makes all of its MPI calls (MPI_THREAD_FUNNELED); the
+    // loops it reaches spread over the team as tasks. In pipelined mode the
+    // kernel first waits only for earlier collectives on its resources.
+    void operator()(Distribution& dist) {
+        double start = MPI_Wtime();
+        dist.beginKernel(resources);
+        double ready = MPI_Wtime();
+        #pragma omp parallel
+        #pragma omp master
+        {
+            TRACE_KERNEL(name);
+            run();
+        }
+        dist.progress();
+        logMessage(LOG_VERBOSE, "Timeline: %-28s %8.3f ms waiting, %8.3f ms running, %zu collectives in flight.", name,
+                   1e3 * (ready - start), 1e3 * (MPI_Wtime() - ready), dist.numPending());
+    }
+};
+void runBenchmark(vector<MpiKernel>& kernels, Distribution& dist, const CityConfig& config,
+                  const function<uint64_t()>& checkpoint);
+void runReplay(vector<MpiKernel>& kernels, CityState& city, Distribution& dist, const SensorReplayReader& replay,
+               uint64_t first_frame, const function<void()>& after_frame);
+void writeTrace(Distribution& dist, const string& path);
 
 int main(int argc, char* argv[]) {
-    int rank, size;
-    // Initialize MPI
-    MPI_Init(&argc, &argv);
+    int rank, size, provided;
+    // Initialize MPI. Only the main thread of each rank calls MPI, so a
+    // funneled library is enough for OpenMP threads inside the ranks.
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
+    if (provided < MPI_THREAD_FUNNELED) {
+        if (rank == 0) {
+            fprintf(stderr, "MPI library without thread support; running one thread per rank\n");
+        }
+        omp_set_num_threads(1);
+    }
 
-    vector<int> vehicle_data(NUM_VEHICLES, 0);
-    vector<int> incidents(NUM_SENSORS, 0);
-    vector<int> traffic_density(NUM_CAMERAS, 0);
-    vector<int> air_quality_data(NUM_SENSORS, 50);
-    vector<int> noise_data(NUM_SENSORS, 30);
-    vector<int> historical_data(365, 0);
-    vector<int> future_traffic(7, 0);
-    vector<int> ev_prioritization(NUM_VEHICLES, 0);
-    vector<int> public_transport_data(100, 0);
-    vector<int> charging_stations(NUM_EV_STATIONS, 1);
-    vector<vector<int>> traffic_lights(NUM_INTERSECTIONS, vector<int>(4, 0));
-
-    auto start = chrono::high_resolution_clock::now();
-
-    // Call functions sequentially instead of using OpenMP
-    trafficFlowMonitoring(vehicle_data, rank, size);
-    incidentDetection(incidents, rank, size);
-    congestionMonitoring(traffic_density, rank, size);
-    vehicleCounting(vehicle_data, NUM_SENSORS, rank, size);
-    adaptiveSignalControl(traffic_lights, traffic_density, rank, size);
-    predictiveAnalytics(historical_data, future_traffic, rank, size);
-    airQualityMonitoring(air_quality_data, rank, size);
-    noisePollutionMonitoring(noise_data, rank, size);
-    greenWaveSystem(traffic_lights, rank, size);
-    evChargingIntegration(charging_stations, ev_prioritization, rank, size);
-    publicTransportIntegration(public_transport_data, rank, size);
-    trafficSimulation(vehicle_data, incidents, rank, size);
-
-    auto end = chrono::high_resolution_clock::now();
-    chrono::duration<double> elapsed = end - start;
-
-    if (rank == 0) {
+    // Every rank parses the same arguments, so all agree on the sizes
+    CityConfig config;
+    if (!parseArguments(argc, argv, config)) {
+        MPI_Finalize();
+        return 1;
+    }
+    sensor_seed = config.seed;
+    // Every rank maps the replay file; the pages a rank never touches are
+    // never read
+    SensorReplayReader replay;
+    if (!config.replay.empty()) {
+        if (!replay.open(config.replay.c_str())) {
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        config.num_vehicles = replay.header.num_vehicles;
+        config.num_cameras = replay.header.num_cameras;
+        config.num_sensors = replay.header.num_sensors;
+        sensor_replay = true;
+    }
+    // Every rank loads or synthesizes the whole schedule and tracks a block
+    // of its trips
+    TransitFeed transit_feed;
+    double load_start = MPI_Wtime();
+    if (!openTransitFeed(config.transit, config.num_intersections, config.num_transit_stops, transit_feed)) {
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    double load_time = MPI_Wtime() - load_start;
+    config.num_transit_stops = transit_feed.numStops();
+    // Only rank 0 reports, so the other ranks never start a writer thread.
+    // Benchmark mode measures the kernels, not the logging.
+    bool benchmark = config.repetitions > 0;
+    TelemetrySink::instance().start(rank == 0 && !benchmark ? config.log_level : LOG_OFF);
+    // Ranks start their trace clocks together, so their spans line up
+    if (!config.trace.empty()) {
+        MPI_Barrier(MPI_COMM_WORLD);
+        Tracer::instance().start(config.trace_counters);
+    }
+    logMessage(LOG_SUMMARY, "Hybrid MPI+OpenMP: %d ranks x %d threads.", size, omp_get_max_threads());
+    logMessage(LOG_SUMMARY, "Public Transport Integration: %zu stops, %zu trips, %zu stop times %s in %.3f s.",
+               transit_feed.numStops(), transit_feed.numTrips(), transit_feed.numStopTimes(),
+               config.transit.empty() ? "synthesized" : "loaded", load_time);
+
+    SignalPolicy signal_policy = SIGNAL_MAX_PRESSURE;
+    parseSignalPolicy(config.signal_policy, signal_policy);
+
+    CityState city(config.num_vehicles, config.num_sensors, config.num_cameras, config.num_intersections,
+                   config.num_ev_stations, config.num_transit_stops, 0);
+
+    chrono::duration<double> elapsed(0.0);
+
+    // The kernels run one after another, each across the rank's threads (see
+    // MpiKernel). The distribution layer owns committed datatypes, so it
+    // goes out of scope before MPI_Finalize.
+    {
+        Distribution dist(MPI_COMM_WORLD);
+        // Each rank times the east-west arterials of its block of grid rows
+        const BlockPartition& arterial_rows = dist.partition(RoadNetwork::gridRows(config.num_intersections));
+        GreenWaveOptimizer green_wave(
+            GreenWaveOptimizer::gridArterials(config.num_intersections, arterial_rows.begin, arterial_rows.end));
+        // Rolling detector state for this rank's block of sensors and cameras
+        const BlockPartition& sensor_block = dist.partition(config.num_sensors);
+        const BlockPartition& camera_block = dist.partition(config.num_cameras);
+        SensorDetectors incident_detectors(sensor_block.begin, sensor_block.end);
+        SensorDetectors congestion_detectors(camera_block.begin, camera_block.end);
+        TrafficForecaster forecaster(sensor_block.begin, sensor_block.end);
+        // Every rank moves its block of the EV fleet and runs all stations
+        const BlockPartition& vehicle_block = dist.partition(config.num_vehicles);
+        EvDispatcher ev_dispatcher(config.num_ev_stations, config.num_vehicles, vehicle_block.begin, vehicle_block.end,
+                                   RoadNetwork::gridWidth(config.num_intersections) * ROAD_LENGTH_M, sensor_seed);
+        // Each rank re-times its block of grid rows, reading its neighbours'
+        // boundary queues
+        const BlockPartition& signal_block = dist.partition(
+            RoadNetwork::gridRows(config.num_intersections), RoadNetwork::gridWidth(config.num_intersections),
+            config.num_intersections);
+        SignalController signal_controller(config.num_intersections, signal_block.begin, signal_block.end, signal_policy);
+        // The green wave sets the lights of its corridors, the controller the
+        // rest; both cover the same rows
+        for (const Corridor& corridor : green_wave.corridors) {
+            for (int i : corridor.intersections) {
+                signal_controller.setCoordinated(i);
+            }
+        }
+        const BlockPartition& trip_block = dist.partition(transit_feed.numTrips());
+        TransitTracker transit_tracker(transit_feed, trip_block.begin, trip_block.end, sensor_seed);
+        // Each rank maps and aggregates its block of zone rows
+        const BlockPartition& zone_rows = dist.partition(EnvironmentGrid::zonesPerSide(config.env_grid));
+        EnvironmentGrid env_grid(config.num_sensors, config.env_grid,
+                                 RoadNetwork::gridWidth(config.num_intersections) * ROAD_LENGTH_M, zone_rows.begin,
+                                 zone_rows.end, sensor_seed);
+        EnvironmentMonitor air_monitor(env_grid, false);
+        EnvironmentMonitor noise_monitor(env_grid, true);
+        double env_cells = (double)env_grid.cells() * env_grid.cells();
+        // Every rank routes over the whole city, so its trees need no exchange
+        RoutePlanner router(config.num_intersections, sensor_seed);
+        if (dist.rank == 0) {
+            logMessage(LOG_VERBOSE, "Traffic Simulation: routes from %d intersections to %d hubs built in %.3f s.",
+                       router.numIntersections(), router.numDestinations(), router.buildSeconds());
+        }
+        // This rank's band of the simulated city, carried from one pass to the next
+        DistributedSimulation simulation(dist.comm, config.num_intersections, config.num_vehicles, sensor_seed, &router);
+        // Kernel resources for the pipelined mode, named as in OpenMP.cpp's task graph
+        const void* draft = city.signal_plans.draftResource();
+        const void* published = city.signal_plans.publishedResource();
+        dist.pipelined = config.pipeline;
+        vector<MpiKernel> kernels = {
+            {"Traffic Flow Monitoring", (double)config.num_vehicles, {&city.vehicle_data}, [&] { trafficFlowMonitoring(city, dist); }},
+            {"Incident Detection", (double)config.num_sensors, {&city.sensor_occupancy, &city.incidents}, [&] { incidentDetection(city, incident_detectors, dist); }},
+            {"Congestion Monitoring", (double)config.num_cameras, {&city.traffic_density}, [&] { congestionMonitoring(city, congestion_detectors, dist); }},
+            {"Vehicle Counting", (double)config.num_vehicles, {&city.vehicle_data}, [&] { vehicleCounting(city, config.num_sensors, dist); }},
+            {"Adaptive Signal Control", (double)config.num_intersections, {&city.traffic_density, draft}, [&] { adaptiveSignalControl(city, signal_controller, dist); }},
+            {"Predictive Analytics", (double)config.num_sensors, {&city.historical_data, &city.future_traffic}, [&] { predictiveAnalytics(city, forecaster, dist); }},
+            {"Air Quality Monitoring", env_cells, {&city.air_quality_data, &air_monitor}, [&] { airQualityMonitoring(city, air_monitor, dist); }},
+            {"Noise Pollution Monitoring", env_cells, {&city.noise_data, &noise_monitor}, [&] { noisePollutionMonitoring(city, noise_monitor, dist); }},
+            {"Green Wave System", (double)config.num_intersections, {&city.traffic_density, draft}, [&] { greenWaveSystem(city, green_wave, dist); }},
+            {"EV Charging Integration", (double)config.num_vehicles, {&city.charging_stations, &city.ev_prioritization}, [&] { evChargingIntegration(city, ev_dispatcher, dist); }},
+            // Transit priority overrides the controllers' draft before it is published
+            {"Public Transport Integration", (double)config.num_transit_stops,
+             {&city.public_transport_data, &city.transit_priority, draft},
+             [&] { publicTransportIntegration(city, transit_tracker, transit_feed, dist); }},
+            // As in the task graph, a pass simulates the plan published by the
+            // previous pass and then publishes its own draft
+            {"Traffic Simulation", (double)config.num_vehicles * config.sim_ticks, {published, &city.vehicle_data, &simulation, &router}, [&] { trafficSimulation(city, config.sim_ticks, simulation, dist); }},
+            {"Signal Plan Publish", (double)config.num_intersections, {draft, published}, [&] { city.signal_plans.publish(); }},
+        };
+
+        // Every rank saves and restores its own blocks, in the same global
+        // layout as OpenMP.cpp, so a snapshot restores on any number of ranks
+        auto checkpoint_state = [&](DistributedCheckpoint& archive) {
+            size_t sensors = config.num_sensors;
+            archive.section("city.vehicle_data", city.vehicle_data.data() + vehicle_block.begin, config.num_vehicles,
+                            vehicle_block.begin, vehicle_block.end);
+            archive.section("city.ev_prioritization", city.ev_prioritization.data() + vehicle_block.begin,
+                            config.num_vehicles, vehicle_block.begin, vehicle_block.end);
+            archive.section("city.incidents", city.incidents.data() + sensor_block.begin, sensors, sensor_block.begin,
+                            sensor_block.end);
+            archive.section("city.sensor_occupancy", city.sensor_occupancy.data() + sensor_block.begin, sensors,
+                            sensor_block.begin, sensor_block.end);
+            archive.section("city.traffic_density", city.traffic_density.data() + camera_block.begin,
+                            config.num_cameras, camera_block.begin, camera_block.end);
+            archive.section("city.air_quality_data", city.air_quality_data.data() + sensor_block.begin, sensors,
+                            sensor_block.begin, sensor_block.end);
+            archive.section("city.noise_data", city.noise_data.data() + sensor_block.begin, sensors, sensor_block.begin,
+                            sensor_block.end);
+            archive.section("city.historical_data", city.historical_data.data() + sensor_block.begin, sensors,
+                            sensor_block.begin, sensor_block.end, HISTORY_DAYS, sensors);
+            archive.section("city.future_traffic", city.future_traffic.data() + sensor_block.begin, sensors,
+                            sensor_block.begin, sensor_block.end, FORECAST_DAYS, sensors);
+            // Stops, priority requests and stations are the same on every rank
+            archive.whole("city.public_transport_data", city.public_transport_data.data(), city.public_transport_data.size());
+            archive.whole("city.transit_priority", city.transit_priority.data(), city.transit_priority.size());
+            archive.whole("city.charging_stations", city.charging_stations.data(), city.charging_stations.size());
+            // A rank's heads are the block of grid rows it re-times
+            size_t heads = city.signal_plans.size();
+            uint64_t epoch = city.signal_plans.currentEpoch();
+            archive.section("signal.plan", city.signal_plans.draft() + signal_block.begin * NUM_APPROACHES, heads,
+                            signal_block.begin * NUM_APPROACHES, signal_block.end * NUM_APPROACHES);
+            archive.whole("signal.epoch", &epoch, 1);
+            if (archive.restoring()) {
+                city.signal_plans.restoreEpoch(epoch);
+            }
+            incident_detectors.checkpoint(archive, "incident", config.num_sensors);
+            congestion_detectors.checkpoint(archive, "congestion", config.num_cameras);
+            forecaster.checkpoint(archive, config.num_sensors);
+            green_wave.checkpoint(archive, config.num_intersections);
+            ev_dispatcher.checkpoint(archive);
+            transit_tracker.checkpoint(archive);
+            signal_controller.checkpoint(archive);
+            simulation.checkpoint(archive);
+            router.checkpoint(archive);
+            air_monitor.checkpoint(archive, "air");
+            noise_monitor.checkpoint(archive, "noise");
+        };
+
+        // Passes (replay frames) run so far, including those before --restart
+        uint64_t passes = 0;
+        if (!config.restart.empty()) {
+            TRACE_SCOPE("Restart", "io");
+            double start = MPI_Wtime();
+            DistributedCheckpoint reader(dist.comm, true);
+            if (!reader.open(config.restart, makeCheckpointHeader(config, 0))) {
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+            checkpoint_state(reader);
+            if (!reader.close()) {
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+            passes = reader.layout.header.passes;
+            double restore_time = MPI_Wtime() - start, slowest = 0.0;
+            MPI_Reduce(&restore_time, &slowest, 1, MPI_DOUBLE, MPI_MAX, 0, dist.comm);
+            logMessage(LOG_SUMMARY, "Restart: %s after pass %llu, %.1f MB in %.3f s (%.2f GB/s).", config.restart.c_str(),
+                       (unsigned long long)passes, reader.bytes() / 1e6, slowest, reader.bytes() / 1e9 / max(slowest, 1e-9));
+        }
+
+        // Snapshots are written collectively while the kernels wait; returns
+        // the bytes written, or 0 if the snapshot failed
+        uint64_t checkpointed = passes;
+        auto save_checkpoint = [&]() -> uint64_t {
+            TRACE_SCOPE("Checkpoint Write", "io");
+            double start = MPI_Wtime();
+            DistributedCheckpoint writer(dist.comm, false);
+            if (!writer.create(config.checkpoint, makeCheckpointHeader(config, passes))) {
+                return 0;
+            }
+            checkpoint_state(writer);
+            if (!writer.close()) {
+                return 0;
+            }
+            checkpointed = passes;
+            double write_time = MPI_Wtime() - start, slowest = 0.0;
+            MPI_Reduce(&write_time, &slowest, 1, MPI_DOUBLE, MPI_MAX, 0, dist.comm);
+            logMessage(LOG_SUMMARY, "Checkpoint: pass %llu, wrote %s, %.1f MB in %.3f s (%.2f GB/s).",
+                       (unsigned long long)passes, config.checkpoint.c_str(), writer.bytes() / 1e6, slowest,
+                       writer.bytes() / 1e9 / max(slowest, 1e-9));
+            return writer.bytes();
+        };
+
+        if (benchmark) {
+            runBenchmark(kernels, dist, config, config.checkpoint.empty() ? nullptr : function<uint64_t()>(save_checkpoint));
+        } else if (sensor_replay) {
+            auto start = chrono::high_resolution_clock::now();
+            runReplay(kernels, city, dist, replay, passes, [&] {
+                ++passes;
+                if (!config.checkpoint.empty() && config.checkpoint_every > 0 && passes % config.checkpoint_every == 0) {
+                    save_checkpoint();
+                }
+            });
+            elapsed = chrono::high_resolution_clock::now() - start;
+            dist.report();
+        } else {
+            auto start = chrono::high_resolution_clock::now();
+            for (MpiKernel& kernel : kernels) {
+                kernel(dist);
+            }
+            dist.drain();
+            ++passes;
+            auto end = chrono::high_resolution_clock::now();
+            elapsed = end - start;
+            dist.report();
+        }
+        if (!benchmark && !config.checkpoint.empty() && (checkpointed != passes || passes == 0)) {
+            save_checkpoint();
+        }
+        if (!config.trace.empty()) {
+            writeTrace(dist, config.trace);
+        }
+    }
+
+    TelemetrySink::instance().stop();
+    if (rank == 0 && !benchmark) {
         cout << "Execution Time: " << elapsed.count() << " seconds" << endl;
     }
 
@@ -77,298 +379,531 @@ int main(int argc, char* argv[]) {
     return 0;
 }
 
-// Function implementations with MPI communication and print statements
-
-void trafficFlowMonitoring(vector<int>& vehicle_data, int rank, int size) {
-    int chunk_size = vehicle_data.size() / size;
-    int start = rank * chunk_size;
-    int end = (rank == size - 1) ? vehicle_data.size() : start + chunk_size;
-
-    srand(rank); // Seed random number generator for consistency
-    for (int i = start; i < end; ++i) {
-        vehicle_data[i] = rand() % 100;
+// Times every kernel across all ranks: each repetition starts at a barrier
+// and counts until the slowest rank finishes. Rank 0 prints or appends the
+// results. With --checkpoint, a collective snapshot of the state is timed
+// last; its elements are bytes, so elements/s is the bandwidth.
+void runBenchmark(vector<MpiKernel>& kernels, Distribution& dist, const CityConfig& config,
+                  const function<uint64_t()>& checkpoint) {
+    vector<BenchmarkResult> results;
+    auto measure = [&](const string& name, double elements, const function<void()>& run) {
+        long allocations = 0;
+        vector<double> samples = measureKernel(config.warmup, config.repetitions, [&] {
+            MPI_Barrier(dist.comm);
+            double start = MPI_Wtime();
+            run();
+            dist.drain();
+            double local = MPI_Wtime() - start, slowest = 0.0;
+            MPI_Reduce(&local, &slowest, 1, MPI_DOUBLE, MPI_MAX, 0, dist.comm);
+            return slowest;
+        }, &allocations);
+        BenchmarkResult result;
+        result.binary = "mpi";
+        result.kernel = name;
+        result.preset = config.preset;
+        result.ranks = dist.size;
+        result.threads = omp_get_max_threads();
+        result.elements = elements;
+        summarizeSamples(samples, result);
+        result.allocations = (double)allocations / max<size_t>(samples.size(), 1);
+        results.push_back(result);
+    };
+    for (MpiKernel& kernel : kernels) {
+        measure(kernel.name, kernel.elements, [&] { kernel(dist); });
+    }
+    if (checkpoint) {
+        uint64_t bytes = 0;
+        measure("Checkpoint Write", 0.0, [&] { bytes = checkpoint(); });
+        results.back().elements = bytes;
     }
 
-    // Gather data at rank 0 and print it
-    if (rank == 0) {
-        vector<int> global_data(vehicle_data.size());
-        MPI_Gather(vehicle_data.data() + start, chunk_size, MPI_INT, global_data.data(), chunk_size, MPI_INT, 0, MPI_COMM_WORLD);
-
-        cout << "Traffic Flow Monitoring Data: " << endl;
-        for (int i = 0; i < NUM_VEHICLES; ++i) {
-            cout << "Vehicle " << i << ": " << global_data[i] << " vehicles detected." << endl;
+    if (dist.rank == 0) {
+        printBenchmarkTable(results);
+        if (!config.report.empty()) {
+            appendBenchmarkReport(config.report, results);
         }
-    } else {
-        MPI_Gather(vehicle_data.data() + start, chunk_size, MPI_INT, nullptr, chunk_size, MPI_INT, 0, MPI_COMM_WORLD);
     }
 }
 
-void incidentDetection(vector<int>& incidents, int rank, int size) {
-    int chunk_size = incidents.size() / size;
-    int start = rank * chunk_size;
-    int end = (rank == size - 1) ? incidents.size() : start + chunk_size;
-
-    srand(rank); // Seed random number generator
-    for (int i = start; i < end; ++i) {
-        incidents[i] = rand() % 2; // Randomly detect incident (0 or 1)
+// Streams the replay file through the kernels one frame at a time, from
+// first_frame on, and calls after_frame after each. Each rank copies only
+// its block of every column, straight from the mapping.
+void runReplay(vector<MpiKernel>& kernels, CityState& city, Distribution& dist, const SensorReplayReader& replay,
+               uint64_t first_frame, const function<void()>& after_frame) {
+    const BlockPartition& vehicles = dist.partition(city.vehicle_data.size());
+    const BlockPartition& cameras = dist.partition(city.traffic_density.size());
+    const BlockPartition& sensors = dist.partition(city.air_quality_data.size());
+    size_t frames = replay.numFrames();
+    size_t batch = replay.batchFrames();
+    double ingest_seconds = 0.0;
+    double start = MPI_Wtime();
+
+    for (size_t first = first_frame; first < frames; first += batch) {
+        size_t last = min(frames, first + batch);
+        replay.prefetch(last, last + batch);
+        for (size_t f = first; f < last; ++f) {
+            double load_start = MPI_Wtime();
+            {
+                TRACE_SCOPE("Replay Ingest", "io");
+                replay.loadColumn(f, REPLAY_VEHICLE_COUNT, city.vehicle_data.data(), vehicles.begin, vehicles.end);
+                replay.loadColumn(f, REPLAY_DENSITY, city.traffic_density.data(), cameras.begin, cameras.end);
+                replay.loadColumn(f, REPLAY_AIR_QUALITY, city.air_quality_data.data(), sensors.begin, sensors.end);
+                replay.loadColumn(f, REPLAY_NOISE, city.noise_data.data(), sensors.begin, sensors.end);
+            }
+            ingest_seconds += MPI_Wtime() - load_start;
+            logMessage(LOG_VERBOSE, "Replay: frame %zu at %lld ms.", f, (long long)replay.timestamp(f));
+            for (MpiKernel& kernel : kernels) {
+                kernel(dist);
+            }
+            // The next frame overwrites the readings
+            dist.drain();
+            after_frame();
+        }
+        replay.release(first, last);
     }
 
-    // Reduce to get the sum of incidents across all processes
-    int local_sum = accumulate(incidents.begin() + start, incidents.begin() + end, 0);
-    int global_sum = 0;
-    MPI_Reduce(&local_sum, &global_sum, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+    double elapsed = MPI_Wtime() - start;
+    double slowest_ingest = 0.0;
+    MPI_Reduce(&ingest_seconds, &slowest_ingest, 1, MPI_DOUBLE, MPI_MAX, 0, dist.comm);
+    frames -= min<size_t>(first_frame, frames);
+    double bytes = (double)frames * replay.header.frame_bytes;
+    logMessage(LOG_SUMMARY, "Replay: %zu frames (%.1f MB) across %d ranks, %.1f frames/s.", frames, bytes / 1e6, dist.size,
+               frames / max(elapsed, 1e-9));
+    logMessage(LOG_SUMMARY, "Replay: ingest %.3f s on the slowest rank (%.2f GB/s aggregate).", slowest_ingest,
+               bytes / 1e9 / max(slowest_ingest, 1e-9));
+}
 
-    if (rank == 0) {
-        cout << "Total incidents detected: " << global_sum << endl;
+// Gathers every rank's spans at rank 0, which writes them as one trace with
+// a process per rank (--trace)
+void writeTrace(Distribution& dist, const string& path) {
+    Tracer& tracer = Tracer::instance();
+    tracer.stop();
+    char process[32];
+    snprintf(process, sizeof(process), "rank %d", dist.rank);
+    string local = tracer.events(dist.rank, process);
+    int length = local.size();
+    vector<int> lengths(dist.size), displs(dist.size);
+    MPI_Gather(&length, 1, MPI_INT, lengths.data(), 1, MPI_INT, 0, dist.comm);
+    int total = 0;
+    for (int r = 0; r < dist.size; ++r) {
+        displs[r] = total;
+        total += lengths[r];
+    }
+    string all(dist.rank == 0 ? total : 0, '\0');
+    MPI_Gatherv(local.data(), length, MPI_CHAR, &all[0], lengths.data(), displs.data(), MPI_CHAR, 0, dist.comm);
+    long counts[2] = {(long)tracer.numEvents(), (long)tracer.dropped()}, totals[2] = {0, 0};
+    MPI_Reduce(counts, totals, 2, MPI_LONG, MPI_SUM, 0, dist.comm);
+    if (dist.rank == 0 && Tracer::writeFile(path, all)) {
+        logMessage(LOG_SUMMARY, "Trace: %ld events from %d ranks written to %s (%ld dropped).", totals[0], dist.size,
+                   path.c_str(), totals[1]);
     }
 }
 
-void congestionMonitoring(vector<int>& traffic_density, int rank, int size) {
-    int chunk_size = traffic_density.size() / size;
-    int start = rank * chunk_size;
-    int end = (rank == size - 1) ? traffic_density.size() : start + chunk_size;
+// Function implementations with MPI communication and print statements.
+// Each kernel fills its block of the CityState arrays and gathers the
+// blocks in place at rank 0, which then reads its own arrays.
+
+void trafficFlowMonitoring(CityState& city, Distribution& dist) {
+    auto& vehicle_data = city.vehicle_data;
+    const BlockPartition& part = dist.partition(vehicle_data.size());
 
-    srand(rank); // Seed random number generator
-    for (int i = start; i < end; ++i) {
-        traffic_density[i] = rand() % 100;
+    #pragma omp taskloop default(shared)
+    for (int i = part.begin; i < part.end; ++i) {
+        if (!sensor_replay) {
+            vehicle_data[i] = sensorValue(sensor_seed, STREAM_TRAFFIC_FLOW, i, 100);
+        }
     }
 
     // Gather data at rank 0 and print it
-    if (rank == 0) {
-        vector<int> global_data(traffic_density.size());
-        MPI_Gather(traffic_density.data() + start, chunk_size, MPI_INT, global_data.data(), chunk_size, MPI_INT, 0, MPI_COMM_WORLD);
-
-        cout << "Traffic Congestion Data: " << endl;
-        for (int i = 0; i < NUM_CAMERAS; ++i) {
-            cout << "Camera " << i << ": " << global_data[i] << " traffic density." << endl;
+    dist.gather("Traffic Flow Monitoring", vehicle_data.data(), part);
+    dist.atRoot([&city] {
+        logMessage(LOG_SUMMARY, "Traffic Flow Monitoring Data:");
+        for (size_t i = 0; i < city.vehicle_data.size(); ++i) {
+            logMessage(LOG_VERBOSE, "Vehicle %zu: %d vehicles detected.", i, city.vehicle_data[i]);
         }
-    } else {
-        MPI_Gather(traffic_density.data() + start, chunk_size, MPI_INT, nullptr, chunk_size, MPI_INT, 0, MPI_COMM_WORLD);
-    }
+    });
 }
 
-void vehicleCounting(vector<int>& vehicle_data, int num_sections, int rank, int size) {
-    int chunk_size = vehicle_data.size() / size;
-    int start = rank * chunk_size;
-    int end = (rank == size - 1) ? vehicle_data.size() : start + chunk_size;
+// Occupancy loops are not part of the replay format, so their frames are
+// always synthesized, indexed by frame so each frame differs
+void incidentDetection(CityState& city, SensorDetectors& detectors, Distribution& dist) {
+    auto& occupancy = city.sensor_occupancy;
+    uint64_t frame_base = detectors.frames() * occupancy.size();
 
-    srand(rank); // Seed random number generator
-    for (int i = start; i < end; ++i) {
-        vehicle_data[i] = rand() % 100;
+    #pragma omp taskloop default(shared)
+    for (size_t i = detectors.begin(); i < detectors.end(); ++i) {
+        occupancy[i] = sensorValue(sensor_seed, STREAM_INCIDENTS, frame_base + i, 100);
     }
+    DetectorFrame frame = detectors.update(occupancy.data(), chrono::steady_clock::now());
+    memcpy(city.incidents.data() + detectors.begin(), detectors.incident.data(), detectors.incident.size());
 
-    // Gather data at rank 0 and print it
-    if (rank == 0) {
-        vector<int> global_data(vehicle_data.size());
-        MPI_Gather(vehicle_data.data() + start, chunk_size, MPI_INT, global_data.data(), chunk_size, MPI_INT, 0, MPI_COMM_WORLD);
+    // Reduce to get the totals across all processes
+    const long* totals = dist.reduceSums("Incident Detection", {frame.incidents, frame.incident_alerts});
+    double rate = detectors.incident.size() / max(frame.seconds, 1e-9) / 1e9;
 
-        cout << "Vehicle Counting Data: " << endl;
-        for (int i = 0; i < NUM_SENSORS; ++i) {
-            cout << "Section " << i << ": " << global_data[i] << " vehicles." << endl;
-        }
-    } else {
-        MPI_Gather(vehicle_data.data() + start, chunk_size, MPI_INT, nullptr, chunk_size, MPI_INT, 0, MPI_COMM_WORLD);
-    }
+    dist.atRoot([totals, rate] {
+        logMessage(LOG_SUMMARY, "Total incidents detected: %ld (%ld raised), %.2f M updates/ms on rank 0.", totals[0],
+                   totals[1], rate);
+    });
 }
 
-void adaptiveSignalControl(vector<vector<int>>& traffic_lights, vector<int>& traffic_flow, int rank, int size) {
-    int chunk_size = traffic_lights.size() / size;
-    int start = rank * chunk_size;
-    int end = (rank == size - 1) ? traffic_lights.size() : start + chunk_size;
+void congestionMonitoring(CityState& city, SensorDetectors& detectors, Distribution& dist) {
+    auto& traffic_density = city.traffic_density;
+    const BlockPartition& part = dist.partition(traffic_density.size());
+    uint64_t frame_base = detectors.frames() * traffic_density.size();
 
-    for (int i = start; i < end; ++i) {
-        for (int j = 0; j < 4; ++j) {
-            traffic_lights[i][j] = traffic_flow[i % traffic_flow.size()];
+    #pragma omp taskloop default(shared)
+    for (int i = part.begin; i < part.end; ++i) {
+        if (!sensor_replay) {
+            traffic_density[i] = sensorValue(sensor_seed, STREAM_CONGESTION, frame_base + i, 100);
         }
     }
+    DetectorFrame frame = detectors.update(traffic_density.data(), chrono::steady_clock::now());
+    const long* totals = dist.reduceSums("Congestion Monitoring", {frame.congested, frame.congestion_alerts});
 
     // Gather data at rank 0 and print it
-    if (rank == 0) {
-        vector<vector<int>> global_data(traffic_lights.size(), vector<int>(4, 0));
-        MPI_Gather(traffic_lights.data() + start, chunk_size * 4, MPI_INT, global_data.data(), chunk_size * 4, MPI_INT, 0, MPI_COMM_WORLD);
-
-        cout << "Adaptive Signal Control Data: " << endl;
-        for (int i = 0; i < NUM_INTERSECTIONS; ++i) {
-            cout << "Intersection " << i << ": ";
-            for (int j = 0; j < 4; ++j) {
-                cout << global_data[i][j] << " ";
-            }
-            cout << endl;
+    dist.gather("Congestion Monitoring", traffic_density.data(), part);
+    dist.atRoot([&city, totals] {
+        logMessage(LOG_SUMMARY, "Traffic Congestion Data: %ld cameras congested (%ld raised).", totals[0], totals[1]);
+        for (size_t i = 0; i < city.traffic_density.size(); ++i) {
+            logMessage(LOG_VERBOSE, "Camera %zu: %d traffic density.", i, city.traffic_density[i]);
         }
-    } else {
-        MPI_Gather(traffic_lights.data() + start, chunk_size * 4, MPI_INT, nullptr, chunk_size * 4, MPI_INT, 0, MPI_COMM_WORLD);
-    }
+    });
 }
 
-void predictiveAnalytics(vector<int>& historical_data, vector<int>& future_traffic, int rank, int size) {
-    int chunk_size = historical_data.size() / size;
-    int start = rank * chunk_size;
-    int end = (rank == size - 1) ? historical_data.size() : start + chunk_size;
+void vehicleCounting(CityState& city, int num_sections, Distribution& dist) {
+    auto& vehicle_data = city.vehicle_data;
+    num_sections = min<int>(num_sections, vehicle_data.size());
+    const BlockPartition& part = dist.partition(vehicle_data.size());
 
-    srand(rank);
-    for (int i = start; i < end; ++i) {
-        historical_data[i] = rand() % 100;
+    #pragma omp taskloop default(shared)
+    for (int i = part.begin; i < part.end; ++i) {
+        if (!sensor_replay) {
+            vehicle_data[i] = sensorValue(sensor_seed, STREAM_VEHICLE_COUNT, i, 500);
+        }
     }
 
     // Gather data at rank 0 and print it
-    if (rank == 0) {
-        vector<int> global_data(historical_data.size());
-        MPI_Gather(historical_data.data() + start, chunk_size, MPI_INT, global_data.data(), chunk_size, MPI_INT, 0, MPI_COMM_WORLD);
-
-        cout << "Historical Data: " << endl;
-        for (int i = 0; i < 365; ++i) {
-            cout << "Day " << i << ": " << global_data[i] << " vehicles." << endl;
+    dist.gather("Vehicle Counting", vehicle_data.data(), part);
+    dist.atRoot([&city, num_sections] {
+        logMessage(LOG_SUMMARY, "Vehicle Counting Data:");
+        for (int i = 0; i < num_sections; ++i) {
+            logMessage(LOG_VERBOSE, "Section %d: %d vehicles.", i, city.vehicle_data[i]);
         }
-    } else {
-        MPI_Gather(historical_data.data() + start, chunk_size, MPI_INT, nullptr, chunk_size, MPI_INT, 0, MPI_COMM_WORLD);
-    }
+    });
 }
 
-void airQualityMonitoring(vector<int>& air_quality_data, int rank, int size) {
-    int chunk_size = air_quality_data.size() / size;
-    int start = rank * chunk_size;
-    int end = (rank == size - 1) ? air_quality_data.size() : start + chunk_size;
-
-    srand(rank); 
-    for (int i = start; i < end; ++i) {
-        air_quality_data[i] = rand() % 200; // Random air quality index
+// Intersection i is driven by camera i % cameras, which congestion
+// monitoring left on rank 0. With at least one camera per intersection rank 0
+// scatters its density array as is; otherwise it first lays the readings out
+// per intersection in a buffer from the kernel arena.
+DensityPercent* intersectionDensity(CityState& city, Distribution& dist) {
+    size_t num_intersections = city.num_intersections;
+    if (city.traffic_density.size() >= num_intersections) {
+        return city.traffic_density.data();
     }
-
-    if (rank == 0) {
-        vector<int> global_data(air_quality_data.size());
-        MPI_Gather(air_quality_data.data() + start, chunk_size, MPI_INT, global_data.data(), chunk_size, MPI_INT, 0, MPI_COMM_WORLD);
-
-        cout << "Air Quality Monitoring Data: " << endl;
-        for (int i = 0; i < NUM_SENSORS; ++i) {
-            cout << "Sensor " << i << ": " << global_data[i] << " AQI." << endl;
+    DensityPercent* remapped = kernel_arena.allocate<DensityPercent>(num_intersections);
+    if (dist.rank == 0) {
+        for (size_t i = 0; i < num_intersections; ++i) {
+            remapped[i] = city.traffic_density[i % city.traffic_density.size()];
         }
-    } else {
-        MPI_Gather(air_quality_data.data() + start, chunk_size, MPI_INT, nullptr, chunk_size, MPI_INT, 0, MPI_COMM_WORLD);
     }
+    return remapped;
 }
 
-void noisePollutionMonitoring(vector<int>& noise_data, int rank, int size) {
-    int chunk_size = noise_data.size() / size;
-    int start = rank * chunk_size;
-    int end = (rank == size - 1) ? noise_data.size() : start + chunk_size;
-
-    srand(rank); 
-    for (int i = start; i < end; ++i) {
-        noise_data[i] = rand() % 100; // Random noise level
+// Each rank runs the controller on its block of grid rows. Rank 0 maps the
+// cameras to approaches and scatters the readings; the queues one row past
+// each end of a block come from the neighbouring ranks.
+void adaptiveSignalControl(CityState& city, SignalController& controller, Distribution& dist) {
+    const char* kernel = "Adaptive Signal Control";
+    int num_intersections = city.num_intersections;
+    int width = RoadNetwork::gridWidth(num_intersections);
+    const BlockPartition& part = dist.partition(RoadNetwork::gridRows(num_intersections), width, num_intersections);
+    double start = MPI_Wtime();
+
+    if (dist.rank == 0) {
+        controller.readCameras(city.traffic_density.data(), city.traffic_density.size(), 0, num_intersections);
     }
+    // NUM_APPROACHES one-byte readings per intersection, laid out like its lights
+    dist.scatter(kernel, controller.approachReadings(), part, dist.intersection_lights);
+
+    kernel_arena.reset();
+    int32_t* boundary = kernel_arena.allocate<int32_t>(2 * width);
+    controller.boundaryRows(boundary);
+    dist.allgather(kernel, boundary, 2 * width, signal_halos);
+    // Blocks are filled in rank order, so only trailing ranks can be empty
+    bool has_above = dist.rank > 0 && part.counts[dist.rank] > 0;
+    bool has_below = dist.rank + 1 < dist.size && part.counts[dist.rank + 1] > 0;
+    controller.setHaloRows(has_above ? &signal_halos[(dist.rank - 1) * 2 * width] : nullptr,
+                           has_below ? &signal_halos[(dist.rank + 1) * 2 * width] : nullptr);
+
+    ControlStats stats = controller.update(city.signal_plans.draft());
+
+    // Light phases are stored flat, so a rank's intersections are one
+    // contiguous block of the intersection record type
+    dist.gather(kernel, city.signal_plans.draft(), part, dist.intersection_lights);
+    const long* totals = dist.reduceSums(kernel, {stats.switches, stats.queued_mveh, stats.cycle_seconds, stats.coordinated});
+    double elapsed = MPI_Wtime() - start;
+    SignalPolicy policy = controller.signalPolicy();
+    dist.atRoot([&city, num_intersections, totals, elapsed, policy] {
+        const LightPhase* lights = city.signal_plans.draft();
+        for (int i = 0; i < num_intersections; i += 10) {
+            logMessage(LOG_VERBOSE, "Adaptive Signal Control: intersection %d, lights %d %d %d %d.", i,
+                       int(lights[i * NUM_APPROACHES]), int(lights[i * NUM_APPROACHES + 1]),
+                       int(lights[i * NUM_APPROACHES + 2]), int(lights[i * NUM_APPROACHES + 3]));
+        }
+        logMessage(LOG_SUMMARY, "Adaptive Signal Control: %d intersections re-timed (%s), %ld on green-wave corridors, in %.3f ms, %.1f M/s.",
+                   num_intersections, signalPolicyName(policy), totals[3], 1e3 * elapsed, num_intersections / max(elapsed, 1e-9) / 1e6);
+        logMessage(LOG_SUMMARY, "Adaptive Signal Control: %ld phase changes, %.1f veh queued per intersection, mean cycle %.0f s.",
+                   totals[0], totals[1] / 1e3 / max(num_intersections, 1), (double)totals[2] / max(num_intersections, 1));
+    });
+}
 
-    if (rank == 0) {
-        vector<int> global_data(noise_data.size());
-        MPI_Gather(noise_data.data() + start, chunk_size, MPI_INT, global_data.data(), chunk_size, MPI_INT, 0, MPI_COMM_WORLD);
-
-        cout << "Noise Pollution Monitoring Data: " << endl;
-        for (int i = 0; i < NUM_SENSORS; ++i) {
-            cout << "Sensor " << i << ": " << global_data[i] << " dB." << endl;
+// One night of forecasting for this rank's block of segments; see the
+// OpenMP version. Only the totals are reduced.
+void predictiveAnalytics(CityState& city, TrafficForecaster& forecaster, Distribution& dist) {
+    auto& history = city.historical_data;
+    size_t segments = history.size() / HISTORY_DAYS;
+    bool first_night = forecaster.days() == 0;
+    ForecastStats stats;
+    if (first_night) {
+        #pragma omp taskloop default(shared)
+        for (size_t s = forecaster.begin(); s < forecaster.end(); ++s) {
+            for (uint64_t d = 0; d < HISTORY_DAYS; ++d) {
+                history[d * segments + s] = dailyVolume(sensor_seed, s, d);
+            }
         }
+        stats = forecaster.fit(history.data(), segments, HISTORY_DAYS);
     } else {
-        MPI_Gather(noise_data.data() + start, chunk_size, MPI_INT, nullptr, chunk_size, MPI_INT, 0, MPI_COMM_WORLD);
+        uint64_t day = forecaster.days();
+        VehicleCount* row = history.data() + (day % HISTORY_DAYS) * segments;
+        #pragma omp taskloop default(shared)
+        for (size_t s = forecaster.begin(); s < forecaster.end(); ++s) {
+            row[s] = dailyVolume(sensor_seed, s, day);
+        }
+        stats = forecaster.addDay(row);
+        if (forecaster.days() % FORECAST_REFIT_DAYS == 0) {
+            stats.seconds += forecaster.fit(history.data(), segments, forecaster.days()).seconds;
+        }
     }
+    forecaster.predict(city.future_traffic.data(), segments, FORECAST_DAYS);
+
+    long tomorrow = accumulate(city.future_traffic.begin() + forecaster.begin(),
+                               city.future_traffic.begin() + forecaster.end(), 0L);
+    const long* totals = dist.reduceSums("Predictive Analytics", {tomorrow, lround(stats.squared_error), stats.samples});
+    double seconds = stats.seconds;
+
+    dist.atRoot([totals, segments, first_night, seconds] {
+        logMessage(LOG_SUMMARY, "Predictive Analytics: %zu segments %s in %.3f s, RMSE %.1f vehicles/day, %ld vehicles tomorrow.",
+                   segments, first_night ? "fitted" : "updated", seconds,
+                   sqrt((double)totals[1] / max(totals[2], 1L)), totals[0]);
+    });
+}
+
+// Each rank reads its block of sensors and maps its band of zone rows from
+// the readings of all of them; rank 0 receives the zone statistics only
+template <typename T>
+void environmentMonitoring(const char* kernel, T* readings, vector<T>& all, EnvironmentMonitor& monitor,
+                           Distribution& dist, const char* average, const char* unit, float limit) {
+    double start = MPI_Wtime();
+    const BlockPartition& part = dist.partition(monitor.grid().numSensors());
+    dist.allgather(kernel, readings + part.begin, part.end - part.begin, all);
+    EnvironmentPass pass = monitor.update(all.data());
+    size_t zones = monitor.grid().zones();
+    const BlockPartition& zone_part = dist.partition(zones, zones, zones * zones);
+    dist.gather(kernel, monitor.averages(), zone_part);
+    dist.gather(kernel, monitor.l10(), zone_part);
+    double elapsed = MPI_Wtime() - start;
+
+    size_t cells = monitor.grid().cells();
+    float* averages = monitor.averages();
+    float* l10 = monitor.l10();
+    dist.atRoot([kernel, averages, l10, zones, cells, pass, elapsed, average, unit, limit] {
+        ExposureSummary summary = summarizeExposure(averages, l10, zones * zones, limit);
+        logMessage(LOG_SUMMARY, "%s: %zu sensors onto %zux%zu cells in %.3f s (%.1f M cells/s).", kernel,
+                   pass.sensors, cells, cells, elapsed, (double)cells * cells / max(elapsed, 1e-9) / 1e6);
+        logMessage(LOG_SUMMARY, "%s: %zu zones, %s mean %.1f%s, max %.1f%s, L10 max %.1f%s, %ld above %.0f.", kernel,
+                   zones * zones, average, summary.mean, unit, summary.max, unit, summary.max_l10, unit,
+                   summary.exceeding, limit);
+    });
 }
 
-void greenWaveSystem(vector<vector<int>>& traffic_lights, int rank, int size) {
-    int chunk_size = traffic_lights.size() / size;
-    int start = rank * chunk_size;
-    int end = (rank == size - 1) ? traffic_lights.size() : start + chunk_size;
+// Sensor frames are indexed by the maps' sample count so each minute differs
+void airQualityMonitoring(CityState& city, EnvironmentMonitor& monitor, Distribution& dist) {
+    auto& air_quality_data = city.air_quality_data;
+    const BlockPartition& part = dist.partition(air_quality_data.size());
+    uint64_t frame_base = monitor.samples() * air_quality_data.size();
 
-    for (int i = start; i < end; ++i) {
-        for (int j = 0; j < 4; ++j) {
-            traffic_lights[i][j] = (rand() % 2); // Random green wave activation
+    #pragma omp taskloop default(shared)
+    for (int i = part.begin; i < part.end; ++i) {
+        if (!sensor_replay) {
+            air_quality_data[i] = sensorValue(sensor_seed, STREAM_AIR_QUALITY, frame_base + i, 200); // Random air quality index
         }
     }
 
-    if (rank == 0) {
-        vector<vector<int>> global_data(traffic_lights.size(), vector<int>(4, 0));
-        MPI_Gather(traffic_lights.data() + start, chunk_size * 4, MPI_INT, global_data.data(), chunk_size * 4, MPI_INT, 0, MPI_COMM_WORLD);
-
-        cout << "Green Wave System Data: " << endl;
-        for (int i = 0; i < NUM_INTERSECTIONS; ++i) {
-            cout << "Intersection " << i << ": ";
-            for (int j = 0; j < 4; ++j) {
-                cout << global_data[i][j] << " ";
-            }
-            cout << endl;
+    environmentMonitoring("Air Quality Monitoring", air_quality_data.data(), air_readings, monitor, dist, "TWA AQI", "",
+                          ENV_AQI_LIMIT);
+    if (dist.rank == 0) {
+        for (size_t i = 0; i < air_readings.size(); ++i) {
+            logMessage(LOG_VERBOSE, "Sensor %zu: %d AQI.", i, air_readings[i]);
         }
-    } else {
-        MPI_Gather(traffic_lights.data() + start, chunk_size * 4, MPI_INT, nullptr, chunk_size * 4, MPI_INT, 0, MPI_COMM_WORLD);
     }
 }
 
-void evChargingIntegration(vector<int>& charging_stations, vector<int>& ev_prioritization, int rank, int size) {
-    int chunk_size = charging_stations.size() / size;
-    int start = rank * chunk_size;
-    int end = (rank == size - 1) ? charging_stations.size() : start + chunk_size;
+void noisePollutionMonitoring(CityState& city, EnvironmentMonitor& monitor, Distribution& dist) {
+    auto& noise_data = city.noise_data;
+    const BlockPartition& part = dist.partition(noise_data.size());
+    uint64_t frame_base = monitor.samples() * noise_data.size();
 
-    srand(rank); 
-    for (int i = start; i < end; ++i) {
-        charging_stations[i] = rand() % 2; // Random charging station status
+    #pragma omp taskloop default(shared)
+    for (int i = part.begin; i < part.end; ++i) {
+        if (!sensor_replay) {
+            noise_data[i] = sensorValue(sensor_seed, STREAM_NOISE, frame_base + i, 100); // Random noise level
+        }
     }
 
-    if (rank == 0) {
-        vector<int> global_data(charging_stations.size());
-        MPI_Gather(charging_stations.data() + start, chunk_size, MPI_INT, global_data.data(), chunk_size, MPI_INT, 0, MPI_COMM_WORLD);
-
-        cout << "EV Charging Integration Data: " << endl;
-        for (int i = 0; i < NUM_EV_STATIONS; ++i) {
-            cout << "Charging Station " << i << ": " << (global_data[i] == 0 ? "Available" : "Occupied") << endl;
+    environmentMonitoring("Noise Pollution Monitoring", noise_data.data(), noise_readings, monitor, dist, "Leq",
+                          " dB", ENV_NOISE_LIMIT);
+    if (dist.rank == 0) {
+        for (size_t i = 0; i < noise_readings.size(); ++i) {
+            logMessage(LOG_VERBOSE, "Sensor %zu: %d dB.", i, noise_readings[i]);
         }
-    } else {
-        MPI_Gather(charging_stations.data() + start, chunk_size, MPI_INT, nullptr, chunk_size, MPI_INT, 0, MPI_COMM_WORLD);
     }
 }
 
-void publicTransportIntegration(vector<int>& public_transport_data, int rank, int size) {
-    int chunk_size = public_transport_data.size() / size;
-    int start = rank * chunk_size;
-    int end = (rank == size - 1) ? public_transport_data.size() : start + chunk_size;
+void greenWaveSystem(CityState& city, GreenWaveOptimizer& green_wave, Distribution& dist) {
+    int num_intersections = city.num_intersections;
+    const BlockPartition& part = dist.partition(RoadNetwork::gridRows(num_intersections),
+                                                RoadNetwork::gridWidth(num_intersections), num_intersections);
+
+    // Link speeds follow the congestion reading at the downstream intersection
+    kernel_arena.reset();
+    DensityPercent* density = intersectionDensity(city, dist);
+    dist.scatter("Green Wave System", density, part);
+    for (size_t c = 0; c < green_wave.corridors.size(); ++c) {
+        const Corridor& corridor = green_wave.corridors[c];
+        for (size_t l = 0; l + 1 < corridor.size(); ++l) {
+            green_wave.setLinkSpeed(c, l, congestedSpeed(ROAD_SPEED_MPS, density[corridor.intersections[l + 1]]));
+        }
+    }
+    RetimeStats retimed = green_wave.retime();
 
-    srand(rank); 
-    for (int i = start; i < end; ++i) {
-        public_transport_data[i] = rand() % 100; // Random number of passengers
+    // Lights at the current signal time; one pass is one second
+    double t = city.signal_plans.currentEpoch();
+    for (size_t c = 0; c < green_wave.corridors.size(); ++c) {
+        green_wave.applyLights(c, t, city.signal_plans.draft());
     }
 
-    if (rank == 0) {
-        vector<int> global_data(public_transport_data.size());
-        MPI_Gather(public_transport_data.data() + start, chunk_size, MPI_INT, global_data.data(), chunk_size, MPI_INT, 0, MPI_COMM_WORLD);
+    dist.gather("Green Wave System", city.signal_plans.draft(), part, dist.intersection_lights);
+    const long* totals = dist.reduceSums("Green Wave System", {retimed.full, retimed.incremental});
+    dist.atRoot([&city, totals, num_intersections] {
+        logMessage(LOG_SUMMARY, "Green Wave System Data: %d corridors, %ld fully and %ld incrementally re-timed.",
+                   GreenWaveOptimizer::numGridArterials(num_intersections), totals[0], totals[1]);
+        for (int i = 0; i < num_intersections; ++i) {
+            const LightPhase* lights = city.intersectionLights(i);
+            logMessage(LOG_VERBOSE, "Intersection %d: %d %d %d %d", i, int(lights[0]), int(lights[1]), int(lights[2]), int(lights[3]));
+        }
+    });
+}
 
-        cout << "Public Transport Integration Data: " << endl;
-        for (int i = 0; i < public_transport_data.size(); ++i) {
-            cout << "Stop " << i << ": " << global_data[i] << " passengers." << endl;
+// Each rank requests charges for its own EVs; the requests are shared so
+// every rank runs the same station state
+void evChargingIntegration(CityState& city, EvDispatcher& dispatcher, Distribution& dist) {
+    double start = MPI_Wtime();
+    const vector<EvRequest>& local = dispatcher.requestCharging(city.ev_prioritization.data());
+    dist.allgather("EV Charging Integration", local.data(), local.size(), ev_requests);
+    DispatchStats stats = dispatcher.dispatch(ev_requests.data(), ev_requests.size(), city.charging_stations.data(),
+                                              city.ev_prioritization.data());
+    double elapsed = MPI_Wtime() - start;
+
+    if (dist.rank == 0) {
+        logMessage(LOG_SUMMARY, "EV Charging Integration Data:");
+        int num_stations = dispatcher.numStations();
+        for (int s = 0; s < num_stations; ++s) {
+            logMessage(LOG_VERBOSE, "Charging Station %d: %s, %d of %d ports busy, %zu waiting", s,
+                       (city.charging_stations[s] == ChargerStatus::Available ? "Available" : "Occupied"),
+                       dispatcher.busy(s), dispatcher.ports(s), dispatcher.waiting(s));
         }
-    } else {
-        MPI_Gather(public_transport_data.data() + start, chunk_size, MPI_INT, nullptr, chunk_size, MPI_INT, 0, MPI_COMM_WORLD);
+        logMessage(LOG_SUMMARY, "EV Charging Integration: %ld requests, %ld started, %ld charging, %ld waiting in %.3f ms.",
+                   stats.requests, stats.started, stats.charging, stats.waiting, 1e3 * elapsed);
+        logMessage(LOG_SUMMARY, "EV Charging Integration: mean trip %.0f m, mean wait %.0f s.",
+                   (double)stats.distance_m / max(stats.requests, 1L), (double)stats.wait_seconds / max(stats.started, 1L));
     }
 }
 
-void trafficSimulation(vector<int>& traffic_flow, vector<int>& incidents, int rank, int size) {
-    int chunk_size = traffic_flow.size() / size;
-    int start = rank * chunk_size;
-    int end = (rank == size - 1) ? traffic_flow.size() : start + chunk_size;
-
-    srand(rank); 
-    for (int i = start; i < end; ++i) {
-        traffic_flow[i] = rand() % 100;
-        incidents[i] = rand() % 2;
-    }
+// Each rank moves the buses of its trips; served stops and priority requests
+// are ORed over the ranks, so boarding and priority run the same everywhere
+void publicTransportIntegration(CityState& city, TransitTracker& tracker, const TransitFeed& feed, Distribution& dist) {
+    const char* kernel = "Public Transport Integration";
+    double start = MPI_Wtime();
+    TransitTickStats stats = tracker.advance(city.transit_priority.data(), city.num_intersections);
+    dist.allreduceOr(kernel, tracker.servedStops(), feed.numStops());
+    dist.allreduceOr(kernel, city.transit_priority.data(), city.num_intersections);
+    long boarded = tracker.board(city.public_transport_data.data(), tracker.servedStops());
+    TransitTracker::applyPriority(city.transit_priority.data(), city.num_intersections, city.signal_plans.draft());
+    // active, late, requests, delay_seconds
+    const long* totals = dist.reduceSums(kernel, {stats.active, stats.late, stats.requests, stats.delay_seconds});
+    double elapsed = MPI_Wtime() - start;
+
+    int now = tracker.clock();
+    dist.atRoot([&city, &feed, totals, now, boarded, elapsed] {
+        int num_stops = feed.numStops();
+        for (int s = 0; s < num_stops; s += 20) {
+            int trip = -1;
+            int next = feed.nextArrival(s, now, trip);
+            logMessage(LOG_VERBOSE, "Public Transport Integration: stop %d, %d waiting, next bus %02d:%02d (%s).", s,
+                       city.public_transport_data[s], next / 3600, next / 60 % 60, next < 0 ? "none" : feed.trip_ids[trip].c_str());
+        }
+        logMessage(LOG_SUMMARY, "Public Transport Integration: %02d:%02d, %ld buses (%ld late), %ld priority requests, %ld boarded.",
+                   now / 3600, now / 60 % 60, totals[0], totals[1], totals[2], boarded);
+        logMessage(LOG_VERBOSE, "Public Transport Integration: mean delay %.0f s, tick in %.3f ms.",
+                   (double)totals[3] / max(totals[0], 1L), 1e3 * elapsed);
+    });
+}
 
-    // Gather data at rank 0 and print it
-    if (rank == 0) {
-        vector<int> global_traffic(traffic_flow.size());
-        vector<int> global_incidents(incidents.size());
-        MPI_Gather(traffic_flow.data() + start, chunk_size, MPI_INT, global_traffic.data(), chunk_size, MPI_INT, 0, MPI_COMM_WORLD);
-        MPI_Gather(incidents.data() + start, chunk_size, MPI_INT, global_incidents.data(), chunk_size, MPI_INT, 0, MPI_COMM_WORLD);
-
-        cout << "Traffic Simulation Data: " << endl;
-        for (int i = 0; i < traffic_flow.size(); ++i) {
-            cout << "Location " << i << ": Traffic Flow = " << global_traffic[i] << ", Incidents = " << global_incidents[i] << endl;
+// Each rank simulates one band of grid rows and exchanges only boundary lane
+// state and migrating vehicles with its neighbours; rank 0 receives reduced
+// statistics, never per-vehicle data.
+void trafficSimulation(CityState& city, int ticks, DistributedSimulation& sim, Distribution& dist) {
+    // Each rank's published plan holds the rows it planned, which are the
+    // rows of its band. Fixed time before the first plan is published or
+    // once the snapshot's slot may have been reused; the epochs agree on
+    // every rank, so all ranks decide alike.
+    SignalSnapshot plan = city.signal_plans.snapshot();
+    long fixed_ticks = 0;
+
+    MPI_Barrier(dist.comm);
+    double start = MPI_Wtime();
+    // Heap allocations after the first tick, which sizes the tick arena
+    long warm_allocations = heapAllocations();
+    for (int t = 0; t < ticks; ++t) {
+        bool planned = plan.epoch > 0 && city.signal_plans.valid(plan);
+        fixed_ticks += !planned;
+        sim.step(planned ? plan.lights : nullptr);
+        if (t == 0) {
+            warm_allocations = heapAllocations();
         }
-    } else {
-        MPI_Gather(traffic_flow.data() + start, chunk_size, MPI_INT, nullptr, chunk_size, MPI_INT, 0, MPI_COMM_WORLD);
-        MPI_Gather(incidents.data() + start, chunk_size, MPI_INT, nullptr, chunk_size, MPI_INT, 0, MPI_COMM_WORLD);
+    }
+    long tick_allocations = heapAllocations() - warm_allocations;
+    double elapsed = MPI_Wtime() - start;
+    double slowest = 0.0;
+    MPI_Reduce(&elapsed, &slowest, 1, MPI_DOUBLE, MPI_MAX, 0, dist.comm);
+    DistributedStats stats = sim.reduce();
+    tick_allocations = dist.reduceSum("Traffic Simulation", tick_allocations);
+
+    if (dist.rank == 0) {
+        double ticks_per_second = ticks / max(slowest, 1e-9);
+        logMessage(LOG_SUMMARY, "Traffic Simulation: %d ticks on %zu intersections across %d ranks, %ld of %zu vehicles on the network, %ld parked.",
+                   ticks, city.num_intersections, dist.size, stats.active_vehicles, city.vehicle_data.size(), stats.parked_vehicles);
+        logMessage(LOG_SUMMARY, "Traffic Simulation: mean speed %.1f m/s, %ld transfers, %ld boundary migrations, %ld incidents.",
+                   stats.mean_speed_mps, stats.transfers, stats.migrations, stats.active_incidents);
+        logMessage(LOG_SUMMARY, "Traffic Simulation: %.1f ticks/s (%.1fx real time), %.3f s waiting on neighbours.",
+                   ticks_per_second, ticks_per_second * TICK_SECONDS, stats.halo_wait_seconds);
+        logMessage(LOG_SUMMARY, "Traffic Simulation: %ld heap allocations over all ranks after the first tick.", tick_allocations);
+        logMessage(LOG_SUMMARY, "Traffic Simulation: signal plan %llu, %ld ticks on fixed-time signals.",
+                   (unsigned long long)plan.epoch, fixed_ticks);
+        logMessage(LOG_SUMMARY, "Traffic Simulation: %ld edge speed changes, %ld reroutes (%ld diverted) in %.1f ms, %.0f reroutes/s, %ld trips.",
+                   stats.route_changes, stats.reroutes, stats.diversions, 1e3 * stats.route_seconds,
+                   stats.reroutes / max(stats.route_seconds, 1e-9), stats.trips);
     }
 }
-
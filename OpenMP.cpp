@@ -7,255 +7,717 @@
 #include <cmath>
 #include <queue>
 #include <map>
-#include <mutex>
 #include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <functional>
+// This program counts its heap allocations (Arena.h)
+#define COUNT_HEAP_ALLOCATIONS
+#include "Arena.h"
+#include "SensorRNG.h"
+#include "Telemetry.h"
+#include "CityState.h"
+#include "Config.h"
+#include "Gemm.h"
+#include "RoadNetwork.h"
+#include "TrafficSimulator.h"
+#include "TaskGraph.h"
+#include "Benchmark.h"
+#include "SensorReplay.h"
+#include "GreenWave.h"
+#include "SensorDetectors.h"
+#include "TrafficForecast.h"
+#include "EvDispatch.h"
+#include "TransitFeed.h"
+#include "TransitTracker.h"
+#include "SignalController.h"
+#include "EnvironmentMonitor.h"
+#include "RoutePlanner.h"
+#include "Checkpoint.h"
+#include "Trace.h"
 
 using namespace std;
 
-#define NUM_SENSORS 100
-#define NUM_CAMERAS 50
-#define NUM_VEHICLES 10000
-#define NUM_INTERSECTIONS 50
-#define MATRIX_SIZE 200
-#define NUM_EV_STATIONS 50
-#define NUM_PEDESTRIANS 200
-#define NUM_DRONES 10
-#define NUM_USER_PREFERENCES 50
+// Seed for all synthesized sensor data (set from --seed)
+uint64_t sensor_seed = DEFAULT_SENSOR_SEED;
 
-// Mutex for shared resource access
-mutex resource_mutex;
+// Set when readings come from a replay file (--replay); the sensor kernels
+// then process the loaded frame instead of synthesizing one
+bool sensor_replay = false;
 
 // Function prototypes
-void trafficFlowMonitoring(vector<int>& vehicle_data);
-void incidentDetection(vector<int>& incidents);
-void congestionMonitoring(vector<int>& traffic_density);
-void vehicleCounting(vector<int>& vehicle_data, int num_sections);
-void adaptiveSignalControl(vector<vector<int>>& traffic_lights, vector<int>& traffic_flow);
-void predictiveAnalytics(vector<int>& historical_data, vector<int>& future_traffic);
-void airQualityMonitoring(vector<int>& air_quality_data);
-void noisePollutionMonitoring(vector<int>& noise_data);
-void greenWaveSystem(vector<vector<int>>& traffic_lights);
-void evChargingIntegration(vector<int>& charging_stations, vector<int>& ev_prioritization);
-void publicTransportIntegration(vector<int>& public_transport_data);
-void trafficSimulation(vector<int>& traffic_flow, vector<int>& incidents);
-void matrixMultiplication(vector<vector<int>>& matrix_a, vector<vector<int>>& matrix_b, vector<vector<int>>& result);
-
-int main() {
-    vector<int> vehicle_data(NUM_VEHICLES, 0);
-    vector<int> incidents(NUM_SENSORS, 0);
-    vector<int> traffic_density(NUM_CAMERAS, 0);
-    vector<int> air_quality_data(NUM_SENSORS, 50);
-    vector<int> noise_data(NUM_SENSORS, 30);
-    vector<int> historical_data(365, 0);
-    vector<int> future_traffic(7, 0);
-    vector<int> ev_prioritization(NUM_VEHICLES, 0);
-    vector<int> public_transport_data(100, 0);
-    vector<int> charging_stations(NUM_EV_STATIONS, 1);
-    vector<vector<int>> traffic_lights(NUM_INTERSECTIONS, vector<int>(4, 0));
-    vector<vector<int>> matrix_a(MATRIX_SIZE, vector<int>(MATRIX_SIZE, 1));
-    vector<vector<int>> matrix_b(MATRIX_SIZE, vector<int>(MATRIX_SIZE, 1));
-    vector<vector<int>> result(MATRIX_SIZE, vector<int>(MATRIX_SIZE, 0));
-
-    auto start = chrono::high_resolution_clock::now();
-
-    #pragma omp parallel sections
-    {
-        #pragma omp section
-        trafficFlowMonitoring(vehicle_data);
-
-        #pragma omp section
-        incidentDetection(incidents);
-
-        #pragma omp section
-        congestionMonitoring(traffic_density);
-
-        #pragma omp section
-        vehicleCounting(vehicle_data, NUM_SENSORS);
-
-        #pragma omp section
-        adaptiveSignalControl(traffic_lights, traffic_density);
-
-        #pragma omp section
-        predictiveAnalytics(historical_data, future_traffic);
-
-        #pragma omp section
-        airQualityMonitoring(air_quality_data);
+void trafficFlowMonitoring(CityState& city);
+void incidentDetection(CityState& city, SensorDetectors& detectors);
+void congestionMonitoring(CityState& city, SensorDetectors& detectors);
+void vehicleCounting(CityState& city, int num_sections);
+void adaptiveSignalControl(CityState& city, SignalController& controller);
+void predictiveAnalytics(CityState& city, TrafficForecaster& forecaster);
+void airQualityMonitoring(CityState& city, EnvironmentMonitor& monitor);
+void noisePollutionMonitoring(CityState& city, EnvironmentMonitor& monitor);
+void greenWaveSystem(CityState& city, GreenWaveOptimizer& green_wave);
+void evChargingIntegration(CityState& city, EvDispatcher& dispatcher);
+void publicTransportIntegration(CityState& city, TransitTracker& tracker, const TransitFeed& feed);
+void trafficSimulation(CityState& city, int ticks, TrafficSimulator& sim);
+void matrixMultiplication(CityState& city);
+void runBenchmark(TaskGraph& graph, const CityConfig& config, const function<CheckpointStats()>& checkpoint);
+void runReplay(TaskGraph& graph, CityState& city, const SensorReplayReader& replay, uint64_t first_frame,
+               const function<void()>& after_frame);
+void writeTrace(const string& path);
+
+int main(int argc, char* argv[]) {
+    CityConfig config;
+    if (!parseArguments(argc, argv, config)) {
+        return 1;
+    }
+    sensor_seed = config.seed;
+    SensorReplayReader replay;
+    if (!config.replay.empty()) {
+        if (!replay.open(config.replay.c_str())) {
+            return 1;
+        }
+        config.num_vehicles = replay.header.num_vehicles;
+        config.num_cameras = replay.header.num_cameras;
+        config.num_sensors = replay.header.num_sensors;
+        sensor_replay = true;
+    }
+    // Bus schedule from --transit, or routes synthesized over the grid
+    TransitFeed transit_feed;
+    auto load_start = chrono::high_resolution_clock::now();
+    if (!openTransitFeed(config.transit, config.num_intersections, config.num_transit_stops, transit_feed)) {
+        return 1;
+    }
+    chrono::duration<double> load_time = chrono::high_resolution_clock::now() - load_start;
+    config.num_transit_stops = transit_feed.numStops();
+    // Benchmark mode measures the kernels, not the logging
+    bool benchmark = config.repetitions > 0;
+    TelemetrySink::instance().start(benchmark ? LOG_OFF : config.log_level);
+    if (!config.trace.empty()) {
+        Tracer::instance().start(config.trace_counters);
+    }
+    logMessage(LOG_SUMMARY, "Public Transport Integration: %zu stops, %zu trips, %zu stop times %s in %.3f s.",
+               transit_feed.numStops(), transit_feed.numTrips(), transit_feed.numStopTimes(),
+               config.transit.empty() ? "synthesized" : "loaded", load_time.count());
+
+    SignalPolicy signal_policy = SIGNAL_MAX_PRESSURE;
+    parseSignalPolicy(config.signal_policy, signal_policy);
+
+    CityState city(config.num_vehicles, config.num_sensors, config.num_cameras, config.num_intersections,
+                   config.num_ev_stations, config.num_transit_stops, config.matrix_size);
+    double matrix_n = config.matrix_size;
+
+    // East-west arterials, timed once and re-timed as link speeds change
+    GreenWaveOptimizer green_wave(GreenWaveOptimizer::gridArterials(
+        config.num_intersections, 0, RoadNetwork::gridRows(config.num_intersections)));
+    // Rolling per-sensor statistics, carried from one frame to the next
+    SensorDetectors incident_detectors(0, config.num_sensors);
+    SensorDetectors congestion_detectors(0, config.num_cameras);
+    // Daily volume models, one per road segment (sensor)
+    TrafficForecaster forecaster(0, config.num_sensors);
+    // Charging stations and the EV fleet (one EV per vehicle entry)
+    EvDispatcher ev_dispatcher(config.num_ev_stations, config.num_vehicles, 0, config.num_vehicles,
+                               RoadNetwork::gridWidth(config.num_intersections) * ROAD_LENGTH_M, sensor_seed);
+    // Buses of every trip in the feed
+    TransitTracker transit_tracker(transit_feed, 0, transit_feed.numTrips(), sensor_seed);
+    // Queue and arrival estimates per approach, carried from tick to tick
+    SignalController signal_controller(config.num_intersections, 0, config.num_intersections, signal_policy);
+    // The green wave sets the lights of its corridors, the controller the rest
+    for (const Corridor& corridor : green_wave.corridors) {
+        for (int i : corridor.intersections) {
+            signal_controller.setCoordinated(i);
+        }
+    }
+    // Air quality and noise maps over the whole city, with their zone windows
+    EnvironmentGrid env_grid(config.num_sensors, config.env_grid,
+                             RoadNetwork::gridWidth(config.num_intersections) * ROAD_LENGTH_M, 0,
+                             EnvironmentGrid::zonesPerSide(config.env_grid), sensor_seed);
+    EnvironmentMonitor air_monitor(env_grid, false);
+    EnvironmentMonitor noise_monitor(env_grid, true);
+    // Shortest-path trees to the destination hubs, repaired as incidents
+    // start and clear in the simulation
+    RoutePlanner router(config.num_intersections, sensor_seed);
+    logMessage(LOG_VERBOSE, "Traffic Simulation: routes from %d intersections to %d hubs built in %.3f s.",
+               router.numIntersections(), router.numDestinations(), router.buildSeconds());
+    // The simulated road network and its vehicles, carried from one pass to
+    // the next
+    RoadNetwork road_network = RoadNetwork::grid(config.num_intersections);
+    TrafficSimulator simulator(road_network, config.num_vehicles, sensor_seed, 0, &router);
+
+    // Each kernel declares the CityState buffers it reads and writes; the
+    // graph orders conflicting kernels and runs the rest concurrently
+    TaskGraph graph;
+    graph.add("Traffic Flow Monitoring", {}, {&city.vehicle_data}, [&] { trafficFlowMonitoring(city); },
+              config.num_vehicles);
+    graph.add("Incident Detection", {}, {&city.sensor_occupancy, &city.incidents, &incident_detectors},
+              [&] { incidentDetection(city, incident_detectors); },
+              config.num_sensors);
+    graph.add("Congestion Monitoring", {}, {&city.traffic_density, &congestion_detectors},
+              [&] { congestionMonitoring(city, congestion_detectors); },
+              config.num_cameras);
+    graph.add("Vehicle Counting", {}, {&city.vehicle_data}, [&] { vehicleCounting(city, config.num_sensors); },
+              min(config.num_sensors, config.num_vehicles));
+    graph.add("Adaptive Signal Control", {&city.traffic_density}, {city.signal_plans.draftResource(), &signal_controller},
+              [&] { adaptiveSignalControl(city, signal_controller); }, config.num_intersections);
+    graph.add("Predictive Analytics", {}, {&city.historical_data, &city.future_traffic, &forecaster},
+              [&] { predictiveAnalytics(city, forecaster); }, config.num_sensors);
+    // Elements are grid cells
+    double env_cells = (double)env_grid.cells() * env_grid.cells();
+    graph.add("Air Quality Monitoring", {}, {&city.air_quality_data, &air_monitor},
+              [&] { airQualityMonitoring(city, air_monitor); }, env_cells);
+    graph.add("Noise Pollution Monitoring", {}, {&city.noise_data, &noise_monitor},
+              [&] { noisePollutionMonitoring(city, noise_monitor); }, env_cells);
+    graph.add("Green Wave System", {&city.traffic_density}, {city.signal_plans.draftResource(), &green_wave}, [&] { greenWaveSystem(city, green_wave); },
+              config.num_intersections);
+    graph.add("EV Charging Integration", {}, {&city.charging_stations, &city.ev_prioritization, &ev_dispatcher},
+              [&] { evChargingIntegration(city, ev_dispatcher); }, config.num_vehicles);
+    // Transit priority overrides the controllers' draft, so it is added after them
+    graph.add("Public Transport Integration", {},
+              {&city.public_transport_data, &city.transit_priority, city.signal_plans.draftResource(), &transit_tracker},
+              [&] { publicTransportIntegration(city, transit_tracker, transit_feed); }, config.num_transit_stops);
+    graph.add("Traffic Simulation", {city.signal_plans.publishedResource()}, {&city.vehicle_data, &simulator, &router},
+              [&] { trafficSimulation(city, config.sim_ticks, simulator); },
+              (double)config.num_vehicles * config.sim_ticks);
+    // Added after the simulation so it reads the previous plan while the
+    // controllers draft the next one; the single publish ends the pass
+    graph.add("Signal Plan Publish", {}, {city.signal_plans.draftResource(), city.signal_plans.publishedResource()},
+              [&] { city.signal_plans.publish(); }, config.num_intersections);
+    graph.add("Matrix Multiplication", {&city.matrix_a, &city.matrix_b}, {&city.result}, [&] { matrixMultiplication(city); },
+              matrix_n * matrix_n * matrix_n);
+
+    // Everything a restarted run needs; the same listing saves and restores
+    // it (see Checkpoint.h)
+    auto checkpoint_state = [&](auto& archive) {
+        size_t sensors = config.num_sensors;
+        archive.whole("city.vehicle_data", city.vehicle_data.data(), city.vehicle_data.size());
+        archive.whole("city.ev_prioritization", city.ev_prioritization.data(), city.ev_prioritization.size());
+        archive.whole("city.incidents", city.incidents.data(), sensors);
+        archive.whole("city.sensor_occupancy", city.sensor_occupancy.data(), sensors);
+        archive.whole("city.traffic_density", city.traffic_density.data(), city.traffic_density.size());
+        archive.whole("city.air_quality_data", city.air_quality_data.data(), sensors);
+        archive.whole("city.noise_data", city.noise_data.data(), sensors);
+        archive.whole("city.historical_data", city.historical_data.data(), sensors, HISTORY_DAYS);
+        archive.whole("city.future_traffic", city.future_traffic.data(), sensors, FORECAST_DAYS);
+        archive.whole("city.public_transport_data", city.public_transport_data.data(), city.public_transport_data.size());
+        archive.whole("city.transit_priority", city.transit_priority.data(), city.transit_priority.size());
+        archive.whole("city.charging_stations", city.charging_stations.data(), city.charging_stations.size());
+        // Between passes the draft is a copy of the current plan
+        uint64_t epoch = city.signal_plans.currentEpoch();
+        archive.whole("signal.plan", city.signal_plans.draft(), city.signal_plans.size());
+        archive.whole("signal.epoch", &epoch, 1);
+        if (archive.restoring()) {
+            city.signal_plans.restoreEpoch(epoch);
+        }
+        incident_detectors.checkpoint(archive, "incident", config.num_sensors);
+        congestion_detectors.checkpoint(archive, "congestion", config.num_cameras);
+        forecaster.checkpoint(archive, config.num_sensors);
+        green_wave.checkpoint(archive, config.num_intersections);
+        ev_dispatcher.checkpoint(archive);
+        transit_tracker.checkpoint(archive);
+        signal_controller.checkpoint(archive);
+        simulator.checkpoint(archive);
+        router.checkpoint(archive);
+        air_monitor.checkpoint(archive, "air");
+        noise_monitor.checkpoint(archive, "noise");
+    };
+
+    // Passes (replay frames) run so far, including those before --restart
+    uint64_t passes = 0;
+    if (!config.restart.empty()) {
+        TRACE_SCOPE("Restart", "io");
+        auto start = chrono::high_resolution_clock::now();
+        CheckpointReader reader;
+        if (!reader.open(config.restart, makeCheckpointHeader(config, 0))) {
+            return 1;
+        }
+        checkpoint_state(reader);
+        if (!reader.ok()) {
+            fprintf(stderr, "Cannot restore from '%s'\n", config.restart.c_str());
+            return 1;
+        }
+        passes = reader.layout.header.passes;
+        chrono::duration<double> restore_time = chrono::high_resolution_clock::now() - start;
+        logMessage(LOG_SUMMARY, "Restart: %s after pass %llu, %.1f MB in %.3f s (%.2f GB/s).", config.restart.c_str(),
+                   (unsigned long long)passes, reader.bytesRead() / 1e6, restore_time.count(),
+                   reader.bytesRead() / 1e9 / max(restore_time.count(), 1e-9));
+    }
 
-        #pragma omp section
-        noisePollutionMonitoring(noise_data);
+    // Snapshots are staged while the kernels wait and written in the background
+    CheckpointWriter checkpoint_writer;
+    uint64_t checkpointed = passes;
+    auto save_checkpoint = [&] {
+        TRACE_SCOPE("Checkpoint Stage", "io");
+        checkpoint_writer.begin(makeCheckpointHeader(config, passes));
+        checkpoint_state(checkpoint_writer);
+        if (checkpoint_writer.commit(config.checkpoint)) {
+            checkpointed = passes;
+            logMessage(LOG_SUMMARY, "Checkpoint: pass %llu, %.1f MB staged, kernels stalled %.3f ms.",
+                       (unsigned long long)passes, checkpoint_writer.lastStats().bytes / 1e6,
+                       1e3 * checkpoint_writer.lastStats().stall_seconds);
+        }
+    };
+
+    if (benchmark) {
+        function<CheckpointStats()> checkpoint;
+        if (!config.checkpoint.empty()) {
+            checkpoint = [&] {
+                save_checkpoint();
+                checkpoint_writer.wait();
+                return checkpoint_writer.lastStats();
+            };
+        }
+        runBenchmark(graph, config, checkpoint);
+        if (!config.trace.empty()) {
+            writeTrace(config.trace);
+        }
+        TelemetrySink::instance().stop();
+        return 0;
+    }
 
-        #pragma omp section
-        greenWaveSystem(traffic_lights);
+    chrono::duration<double> elapsed;
+    if (sensor_replay) {
+        auto start = chrono::high_resolution_clock::now();
+        runReplay(graph, city, replay, passes, [&] {
+            ++passes;
+            if (!config.checkpoint.empty() && config.checkpoint_every > 0 && passes % config.checkpoint_every == 0) {
+                save_checkpoint();
+            }
+        });
+        elapsed = chrono::high_resolution_clock::now() - start;
+    } else {
+        elapsed = chrono::duration<double>(graph.run());
+        ++passes;
+        graph.report(elapsed.count());
+    }
+    if (!config.checkpoint.empty() && (checkpointed != passes || passes == 0)) {
+        save_checkpoint();
+    }
+    checkpoint_writer.wait();
+    if (!config.trace.empty()) {
+        writeTrace(config.trace);
+    }
 
-        #pragma omp section
-        evChargingIntegration(charging_stations, ev_prioritization);
+    // Drain the log sink before reporting so the timing line comes last
+    TelemetrySink::instance().stop();
+    cout << "Execution Time: " << elapsed.count() << " seconds" << endl;
 
-        #pragma omp section
-        publicTransportIntegration(public_transport_data);
+    return 0;
+}
 
-        #pragma omp section
-        trafficSimulation(vehicle_data, incidents);
+// Times every kernel in isolation and then the whole graph, each after
+// `warmup` untimed runs, and prints or appends the results.
+void runBenchmark(TaskGraph& graph, const CityConfig& config, const function<CheckpointStats()>& checkpoint) {
+    vector<BenchmarkResult> results;
+    auto record = [&](const string& kernel, double elements, const vector<double>& samples, long allocations) {
+        BenchmarkResult result;
+        result.binary = "openmp";
+        result.kernel = kernel;
+        result.preset = config.preset;
+        result.threads = omp_get_max_threads();
+        result.elements = elements;
+        summarizeSamples(samples, result);
+        result.allocations = (double)allocations / max<size_t>(samples.size(), 1);
+        results.push_back(result);
+    };
+
+    long allocations = 0;
+    for (int i = 0; i < (int)graph.nodes.size(); ++i) {
+        vector<double> samples = measureKernel(config.warmup, config.repetitions, [&] { return graph.runOne(i); }, &allocations);
+        record(graph.nodes[i].name, graph.nodes[i].elements, samples, allocations);
+    }
+    // The kernels count different kinds of elements, so the whole graph
+    // reports time only
+    vector<double> samples = measureKernel(config.warmup, config.repetitions, [&] { return graph.run(); }, &allocations);
+    record("Task Graph", 0.0, samples, allocations);
+
+    // Snapshots of the state after the runs above, if --checkpoint is
+    // given: the stall the kernels see, and the complete write to disk.
+    // Elements are bytes, so elements/s is the bandwidth.
+    if (checkpoint) {
+        vector<double> stalls;
+        double bytes = 0.0;
+        samples = measureKernel(config.warmup, config.repetitions, [&] {
+            auto start = chrono::high_resolution_clock::now();
+            CheckpointStats stats = checkpoint();
+            stalls.push_back(stats.stall_seconds);
+            bytes = stats.bytes;
+            return chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+        }, &allocations);
+        stalls.erase(stalls.begin(), stalls.begin() + min(config.warmup, stalls.size()));
+        record("Checkpoint Stall", bytes, stalls, 0);
+        record("Checkpoint Write", bytes, samples, allocations);
+    }
 
-        #pragma omp section
-        matrixMultiplication(matrix_a, matrix_b, result);
+    printBenchmarkTable(results);
+    if (!config.report.empty()) {
+        appendBenchmarkReport(config.report, results);
     }
+}
 
-    auto end = chrono::high_resolution_clock::now();
-    chrono::duration<double> elapsed = end - start;
+// Streams the replay file through the task graph one frame at a time,
+// from first_frame on, and calls after_frame after each. The file is walked
+// in batches: the next batch is prefetched while the current one runs, and
+// released once it is done.
+void runReplay(TaskGraph& graph, CityState& city, const SensorReplayReader& replay, uint64_t first_frame,
+               const function<void()>& after_frame) {
+    size_t frames = replay.numFrames();
+    size_t batch = replay.batchFrames();
+    double ingest_seconds = 0.0;
+    double start = omp_get_wtime();
+
+    replay.prefetch(first_frame, first_frame + batch);
+    for (size_t first = first_frame; first < frames; first += batch) {
+        size_t last = min(frames, first + batch);
+        replay.prefetch(last, last + batch);
+        for (size_t f = first; f < last; ++f) {
+            double load_start = omp_get_wtime();
+            {
+                TRACE_SCOPE("Replay Ingest", "io");
+                replay.loadFrame(f, city);
+            }
+            ingest_seconds += omp_get_wtime() - load_start;
+            logMessage(LOG_VERBOSE, "Replay: frame %zu at %lld ms.", f, (long long)replay.timestamp(f));
+            graph.run();
+            after_frame();
+        }
+        replay.release(first, last);
+    }
 
-    cout << "Execution Time: " << elapsed.count() << " seconds" << endl;
+    double elapsed = omp_get_wtime() - start;
+    frames -= min<size_t>(first_frame, frames);
+    double bytes = (double)frames * replay.header.frame_bytes;
+    logMessage(LOG_SUMMARY, "Replay: %zu frames (%.1f MB) in batches of %zu, %.1f frames/s.", frames, bytes / 1e6, batch,
+               frames / max(elapsed, 1e-9));
+    logMessage(LOG_SUMMARY, "Replay: ingest %.3f s (%.2f GB/s), kernels %.3f s.", ingest_seconds,
+               bytes / 1e9 / max(ingest_seconds, 1e-9), elapsed - ingest_seconds);
+}
 
-    return 0;
+// Writes the spans recorded since the start of the run (--trace)
+void writeTrace(const string& path) {
+    Tracer& tracer = Tracer::instance();
+    tracer.stop();
+    if (Tracer::writeFile(path, tracer.events(0, "openmp_traffic_management"))) {
+        logMessage(LOG_SUMMARY, "Trace: %zu events from %zu threads written to %s (%zu dropped).", tracer.numEvents(),
+                   tracer.numThreads(), path.c_str(), tracer.dropped());
+    }
 }
 
 // Function implementations
-void trafficFlowMonitoring(vector<int>& vehicle_data) {
-    #pragma omp parallel for
+void trafficFlowMonitoring(CityState& city) {
+    auto& vehicle_data = city.vehicle_data;
+    #pragma omp taskloop default(shared)
     for (int i = 0; i < vehicle_data.size(); ++i) {
-        vehicle_data[i] = rand() % 100;
+        if (!sensor_replay) {
+            vehicle_data[i] = sensorValue(sensor_seed, STREAM_TRAFFIC_FLOW, i, 100);
+        }
         if (i % 100 == 0) {
-            cout << "Traffic Flow Monitoring: Processed " << i << " vehicles." << endl;
+            logMessage(LOG_VERBOSE, "Traffic Flow Monitoring: Processed %d vehicles.", i);
         }
     }
+    logMessage(LOG_SUMMARY, "Traffic Flow Monitoring: %zu vehicles processed.", vehicle_data.size());
 }
 
-void incidentDetection(vector<int>& incidents) {
-    #pragma omp parallel for
-    for (int i = 0; i < incidents.size(); ++i) {
-        incidents[i] = rand() % 2;
-        if (i % 50 == 0) {
-            cout << "Incident Detection: Processed " << i << " incidents." << endl;
-        }
+// Logs one detector frame: sensors flagged, flags raised, update throughput
+// and the time from the frame's arrival to its alerts
+void logDetectorFrame(const char* kernel, const char* flag, long flagged, long raised, size_t sensors,
+                      const DetectorFrame& frame, const SensorDetectors& detectors) {
+    logMessage(LOG_SUMMARY, "%s: %zu sensors, %ld %s (%ld raised), %.2f M updates/ms.", kernel, sensors, flagged, flag,
+               raised, sensors / max(frame.seconds, 1e-9) / 1e9);
+    if (raised > 0) {
+        logMessage(LOG_VERBOSE, "%s: alerts %.3f ms after arrival (mean %.3f ms, max %.3f ms).", kernel,
+                   frame.alert_latency * 1e3, detectors.meanAlertLatency() * 1e3, detectors.maxAlertLatency() * 1e3);
     }
 }
 
-void congestionMonitoring(vector<int>& traffic_density) {
-    #pragma omp parallel for
-    for (int i = 0; i < traffic_density.size(); ++i) {
-        traffic_density[i] = rand() % 100;
-        if (i % 50 == 0) {
-            cout << "Congestion Monitoring: Processed " << i << " traffic densities." << endl;
+// Occupancy loops are not part of the replay format, so their frames are
+// always synthesized, indexed by frame so each frame differs
+void incidentDetection(CityState& city, SensorDetectors& detectors) {
+    auto& occupancy = city.sensor_occupancy;
+    uint64_t frame_base = detectors.frames() * occupancy.size();
+    #pragma omp taskloop default(shared)
+    for (size_t i = 0; i < occupancy.size(); ++i) {
+        occupancy[i] = sensorValue(sensor_seed, STREAM_INCIDENTS, frame_base + i, 100);
+    }
+    DetectorFrame frame = detectors.update(occupancy.data(), chrono::steady_clock::now());
+    memcpy(city.incidents.data(), detectors.incident.data(), city.incidents.size());
+    logDetectorFrame("Incident Detection", "incidents", frame.incidents, frame.incident_alerts, occupancy.size(), frame,
+                     detectors);
+}
+
+void congestionMonitoring(CityState& city, SensorDetectors& detectors) {
+    auto& traffic_density = city.traffic_density;
+    if (!sensor_replay) {
+        uint64_t frame_base = detectors.frames() * traffic_density.size();
+        #pragma omp taskloop default(shared)
+        for (size_t i = 0; i < traffic_density.size(); ++i) {
+            traffic_density[i] = sensorValue(sensor_seed, STREAM_CONGESTION, frame_base + i, 100);
         }
     }
+    DetectorFrame frame = detectors.update(traffic_density.data(), chrono::steady_clock::now());
+    logDetectorFrame("Congestion Monitoring", "congested", frame.congested, frame.congestion_alerts,
+                     traffic_density.size(), frame, detectors);
 }
 
-void vehicleCounting(vector<int>& vehicle_data, int num_sections) {
-    #pragma omp parallel for
+void vehicleCounting(CityState& city, int num_sections) {
+    auto& vehicle_data = city.vehicle_data;
+    num_sections = min<int>(num_sections, vehicle_data.size());
+    #pragma omp taskloop default(shared)
     for (int i = 0; i < num_sections; ++i) {
-        vehicle_data[i] = rand() % 500;
+        if (!sensor_replay) {
+            vehicle_data[i] = sensorValue(sensor_seed, STREAM_VEHICLE_COUNT, i, 500);
+        }
         if (i % 50 == 0) {
-            cout << "Vehicle Counting: Processed section " << i << " of " << num_sections << "." << endl;
+            logMessage(LOG_VERBOSE, "Vehicle Counting: Processed section %d of %d.", i, num_sections);
         }
     }
+    logMessage(LOG_SUMMARY, "Vehicle Counting: %d sections processed.", num_sections);
 }
 
-void adaptiveSignalControl(vector<vector<int>>& traffic_lights, vector<int>& traffic_flow) {
-    #pragma omp parallel for
-    for (int i = 0; i < traffic_lights.size(); ++i) {
-        for (int j = 0; j < traffic_lights[i].size(); ++j) {
-            traffic_lights[i][j] = traffic_flow[j] % 3;
-        }
+// One controller tick: every intersection re-timed in a single sweep
+void adaptiveSignalControl(CityState& city, SignalController& controller) {
+    int num_intersections = city.num_intersections;
+    controller.readCameras(city.traffic_density.data(), city.traffic_density.size(), 0, num_intersections);
+    ControlStats stats = controller.update(city.signal_plans.draft());
+
+    const LightPhase* lights = city.signal_plans.draft();
+    for (int i = 0; i < num_intersections; i += 10) {
+        logMessage(LOG_VERBOSE, "Adaptive Signal Control: intersection %d, lights %d %d %d %d.", i,
+                   int(lights[i * NUM_APPROACHES]), int(lights[i * NUM_APPROACHES + 1]),
+                   int(lights[i * NUM_APPROACHES + 2]), int(lights[i * NUM_APPROACHES + 3]));
     }
+    logMessage(LOG_SUMMARY, "Adaptive Signal Control: %d intersections re-timed (%s), %ld on green-wave corridors, in %.3f ms, %.1f M/s.",
+               num_intersections, signalPolicyName(controller.signalPolicy()), stats.coordinated, 1e3 * stats.seconds,
+               num_intersections / max(stats.seconds, 1e-9) / 1e6);
+    logMessage(LOG_SUMMARY, "Adaptive Signal Control: %ld phase changes, %.1f veh queued per intersection, mean cycle %.0f s.",
+               stats.switches, stats.queued_mveh / 1e3 / max(num_intersections, 1),
+               (double)stats.cycle_seconds / max(num_intersections, 1));
+}
 
-    // Move the print statement outside the collapsed loop
-    #pragma omp parallel for
-    for (int i = 0; i < traffic_lights.size(); ++i) {
-        if (i % 10 == 0) {
-            cout << "Adaptive Signal Control: Adjusted signals for intersection " << i << "." << endl;
+// One night of forecasting. The first run records HISTORY_DAYS days of
+// history and fits the models; each later run appends the next day, refits
+// every FORECAST_REFIT_DAYS days and forecasts the coming week.
+void predictiveAnalytics(CityState& city, TrafficForecaster& forecaster) {
+    auto& history = city.historical_data;
+    size_t segments = history.size() / HISTORY_DAYS;
+    bool first_night = forecaster.days() == 0;
+    ForecastStats stats;
+    if (first_night) {
+        #pragma omp taskloop default(shared)
+        for (size_t s = 0; s < segments; ++s) {
+            for (uint64_t d = 0; d < HISTORY_DAYS; ++d) {
+                history[d * segments + s] = dailyVolume(sensor_seed, s, d);
+            }
+        }
+        stats = forecaster.fit(history.data(), segments, HISTORY_DAYS);
+    } else {
+        uint64_t day = forecaster.days();
+        VehicleCount* row = history.data() + (day % HISTORY_DAYS) * segments;
+        #pragma omp taskloop default(shared)
+        for (size_t s = 0; s < segments; ++s) {
+            row[s] = dailyVolume(sensor_seed, s, day);
+        }
+        stats = forecaster.addDay(row);
+        if (forecaster.days() % FORECAST_REFIT_DAYS == 0) {
+            stats.seconds += forecaster.fit(history.data(), segments, forecaster.days()).seconds;
         }
     }
-}
+    forecaster.predict(city.future_traffic.data(), segments, FORECAST_DAYS);
 
-void predictiveAnalytics(vector<int>& historical_data, vector<int>& future_traffic) {
-    #pragma omp parallel for
-    for (int i = 0; i < future_traffic.size(); ++i) {
-        future_traffic[i] = historical_data[i % historical_data.size()] + rand() % 10;
-        if (i % 2 == 0) {
-            cout << "Predictive Analytics: Predicted traffic for day " << i << "." << endl;
+    long tomorrow = 0;
+    for (size_t s = 0; s < segments; ++s) {
+        tomorrow += city.future_traffic[s];
+        if (s % 100 == 0) {
+            logMessage(LOG_VERBOSE, "Predictive Analytics: segment %zu, %d vehicles tomorrow.", s, city.future_traffic[s]);
         }
     }
+    logMessage(LOG_SUMMARY, "Predictive Analytics: %zu segments %s in %.3f s, RMSE %.1f vehicles/day, %ld vehicles tomorrow.",
+               segments, first_night ? "fitted" : "updated", stats.seconds,
+               sqrt(stats.squared_error / max(stats.samples, 1L)), tomorrow);
+}
+
+// Logs one map pass and the zone exposure it leaves
+void logEnvironmentPass(const char* kernel, const char* average, const char* unit, const EnvironmentPass& pass,
+                        const ExposureSummary& summary, size_t cells, size_t zones, float limit) {
+    logMessage(LOG_SUMMARY, "%s: %zu sensors onto %zux%zu cells in %.3f s (%.1f M cells/s).", kernel, pass.sensors,
+               cells, cells, pass.seconds, pass.cells / max(pass.seconds, 1e-9) / 1e6);
+    logMessage(LOG_SUMMARY, "%s: %zu zones, %s mean %.1f%s, max %.1f%s, L10 max %.1f%s, %ld above %.0f.", kernel,
+               zones, average, summary.mean, unit, summary.max, unit, summary.max_l10, unit, summary.exceeding, limit);
 }
 
-void airQualityMonitoring(vector<int>& air_quality_data) {
-    #pragma omp parallel for
+// Sensor frames are indexed by the map's sample count so each minute differs
+void airQualityMonitoring(CityState& city, EnvironmentMonitor& monitor) {
+    auto& air_quality_data = city.air_quality_data;
+    uint64_t frame_base = monitor.samples() * air_quality_data.size();
+    #pragma omp taskloop default(shared)
     for (int i = 0; i < air_quality_data.size(); ++i) {
-        air_quality_data[i] = rand() % 200;
+        if (!sensor_replay) {
+            air_quality_data[i] = sensorValue(sensor_seed, STREAM_AIR_QUALITY, frame_base + i, 200);
+        }
         if (i % 50 == 0) {
-            cout << "Air Quality Monitoring: Processed sensor " << i << "." << endl;
+            logMessage(LOG_VERBOSE, "Air Quality Monitoring: Processed sensor %d.", i);
         }
     }
+    EnvironmentPass pass = monitor.update(air_quality_data.data());
+    size_t zones = monitor.grid().zones();
+    ExposureSummary summary = summarizeExposure(monitor.averages(), monitor.l10(), zones * zones, ENV_AQI_LIMIT);
+    logEnvironmentPass("Air Quality Monitoring", "TWA AQI", "", pass, summary, monitor.grid().cells(), zones * zones,
+                       ENV_AQI_LIMIT);
 }
 
-void noisePollutionMonitoring(vector<int>& noise_data) {
-    #pragma omp parallel for
+void noisePollutionMonitoring(CityState& city, EnvironmentMonitor& monitor) {
+    auto& noise_data = city.noise_data;
+    uint64_t frame_base = monitor.samples() * noise_data.size();
+    #pragma omp taskloop default(shared)
     for (int i = 0; i < noise_data.size(); ++i) {
-        noise_data[i] = rand() % 100;
+        if (!sensor_replay) {
+            noise_data[i] = sensorValue(sensor_seed, STREAM_NOISE, frame_base + i, 100);
+        }
         if (i % 50 == 0) {
-            cout << "Noise Pollution Monitoring: Processed sensor " << i << "." << endl;
+            logMessage(LOG_VERBOSE, "Noise Pollution Monitoring: Processed sensor %d.", i);
         }
     }
+    EnvironmentPass pass = monitor.update(noise_data.data());
+    size_t zones = monitor.grid().zones();
+    ExposureSummary summary = summarizeExposure(monitor.averages(), monitor.l10(), zones * zones, ENV_NOISE_LIMIT);
+    logEnvironmentPass("Noise Pollution Monitoring", "Leq", " dB", pass, summary, monitor.grid().cells(),
+                       zones * zones, ENV_NOISE_LIMIT);
 }
 
-void greenWaveSystem(vector<vector<int>>& traffic_lights) {
-    #pragma omp parallel for
-    for (int i = 0; i < traffic_lights.size(); ++i) {
-        traffic_lights[i][0] = 1; // Simulating green wave
+void greenWaveSystem(CityState& city, GreenWaveOptimizer& green_wave) {
+    // Link speeds follow the congestion reading at the downstream intersection
+    auto& density = city.traffic_density;
+    for (size_t c = 0; c < green_wave.corridors.size(); ++c) {
+        const Corridor& corridor = green_wave.corridors[c];
+        for (size_t l = 0; l + 1 < corridor.size(); ++l) {
+            DensityPercent d = density[corridor.intersections[l + 1] % density.size()];
+            green_wave.setLinkSpeed(c, l, congestedSpeed(ROAD_SPEED_MPS, d));
+        }
     }
 
-    // Move the print statement outside the collapsed loop
-    #pragma omp parallel for
-    for (int i = 0; i < traffic_lights.size(); ++i) {
-        if (i % 10 == 0) {
-            cout << "Green Wave System: Adjusted traffic light at intersection " << i << "." << endl;
-        }
+    auto start = chrono::high_resolution_clock::now();
+    RetimeStats retimed = green_wave.retime();
+    chrono::duration<double> elapsed = chrono::high_resolution_clock::now() - start;
+
+    // Lights at the current signal time; one pass is one second
+    double t = city.signal_plans.currentEpoch();
+    LightPhase* lights = city.signal_plans.draft();
+    int num_corridors = green_wave.corridors.size();
+    #pragma omp taskloop default(shared)
+    for (int c = 0; c < num_corridors; ++c) {
+        green_wave.applyLights(c, t, lights);
     }
-}
 
-void evChargingIntegration(vector<int>& charging_stations, vector<int>& ev_prioritization) {
-    #pragma omp parallel for
-    for (int i = 0; i < charging_stations.size(); ++i) {
-        ev_prioritization[i] = charging_stations[i] % 2;
-        if (i % 10 == 0) {
-            cout << "EV Charging Integration: Processed station " << i << "." << endl;
-        }
+    for (int c = 0; c < num_corridors; c += 10) {
+        const CorridorPlan& plan = green_wave.plans[c];
+        logMessage(LOG_VERBOSE, "Green Wave System: corridor %d, cycle %.0f s, bands %.1f / %.1f s (efficiency %.2f).",
+                   c, plan.cycle, plan.outbound_band, plan.inbound_band, plan.efficiency());
     }
+    logMessage(LOG_SUMMARY, "Green Wave System: %d corridors, %d fully and %d incrementally re-timed in %.3f ms.",
+               num_corridors, retimed.full, retimed.incremental, 1e3 * elapsed.count());
 }
 
-void publicTransportIntegration(vector<int>& public_transport_data) {
-    #pragma omp parallel for
-    for (int i = 0; i < public_transport_data.size(); ++i) {
-        public_transport_data[i] = rand() % 50;
-        if (i % 20 == 0) {
-            cout << "Public Transport Integration: Processed data for route " << i << "." << endl;
-        }
+void evChargingIntegration(CityState& city, EvDispatcher& dispatcher) {
+    auto start = chrono::high_resolution_clock::now();
+    const vector<EvRequest>& requests = dispatcher.requestCharging(city.ev_prioritization.data());
+    DispatchStats stats = dispatcher.dispatch(requests.data(), requests.size(), city.charging_stations.data(),
+                                              city.ev_prioritization.data());
+    chrono::duration<double> elapsed = chrono::high_resolution_clock::now() - start;
+    int num_stations = dispatcher.numStations();
+    for (int s = 0; s < num_stations; s += 10) {
+        logMessage(LOG_VERBOSE, "EV Charging Integration: station %d, %d of %d ports busy, %zu waiting.", s,
+                   dispatcher.busy(s), dispatcher.ports(s), dispatcher.waiting(s));
     }
+    logMessage(LOG_SUMMARY, "EV Charging Integration: %ld requests, %ld started, %ld charging, %ld waiting in %.3f ms.",
+               stats.requests, stats.started, stats.charging, stats.waiting, 1e3 * elapsed.count());
+    logMessage(LOG_SUMMARY, "EV Charging Integration: mean trip %.0f m, mean wait %.0f s.",
+               (double)stats.distance_m / max(stats.requests, 1L), (double)stats.wait_seconds / max(stats.started, 1L));
 }
 
-void trafficSimulation(vector<int>& traffic_flow, vector<int>& incidents) {
-    #pragma omp parallel for
-    for (int i = 0; i < traffic_flow.size(); ++i) {
-        traffic_flow[i] = (rand() % 2 == 0) ? incidents[i % incidents.size()] : rand() % 100;
-        if (i % 1000 == 0) {
-            cout << "Traffic Simulation: Processed flow for vehicle " << i << "." << endl;
-        }
+// One tick of bus tracking: positions, boarding and signal priority requests
+void publicTransportIntegration(CityState& city, TransitTracker& tracker, const TransitFeed& feed) {
+    auto start = chrono::high_resolution_clock::now();
+    TransitTickStats stats = tracker.advance(city.transit_priority.data(), city.num_intersections);
+    long boarded = tracker.board(city.public_transport_data.data(), tracker.servedStops());
+    TransitTracker::applyPriority(city.transit_priority.data(), city.num_intersections, city.signal_plans.draft());
+    chrono::duration<double> elapsed = chrono::high_resolution_clock::now() - start;
+
+    int now = tracker.clock();
+    int num_stops = feed.numStops();
+    for (int s = 0; s < num_stops; s += 20) {
+        int trip = -1;
+        int next = feed.nextArrival(s, now, trip);
+        logMessage(LOG_VERBOSE, "Public Transport Integration: stop %d, %d waiting, next bus %02d:%02d (%s).", s,
+                   city.public_transport_data[s], next / 3600, next / 60 % 60, next < 0 ? "none" : feed.trip_ids[trip].c_str());
     }
+    logMessage(LOG_SUMMARY, "Public Transport Integration: %02d:%02d, %ld buses (%ld late), %ld priority requests, %ld boarded.",
+               now / 3600, now / 60 % 60, stats.active, stats.late, stats.requests, boarded);
+    logMessage(LOG_VERBOSE, "Public Transport Integration: mean delay %.0f s, tick in %.3f ms.",
+               (double)stats.delay_seconds / max(stats.active, 1L), 1e3 * elapsed.count());
 }
 
-void matrixMultiplication(vector<vector<int>>& matrix_a, vector<vector<int>>& matrix_b, vector<vector<int>>& result) {
-    #pragma omp parallel for collapse(2)
-    for (int i = 0; i < matrix_a.size(); ++i) {
-        for (int j = 0; j < matrix_b[0].size(); ++j) {
-            for (int k = 0; k < matrix_a[0].size(); ++k) {
-                result[i][j] += matrix_a[i][k] * matrix_b[k][j];
-            }
+void trafficSimulation(CityState& city, int ticks, TrafficSimulator& sim) {
+    SimulationStats stats;
+
+    // Signals follow the published plan, read without locking while the
+    // controllers draft the next one. Before the first plan is published, or
+    // once the snapshot's slot may have been reused, they run fixed time.
+    SignalSnapshot plan = city.signal_plans.snapshot();
+    AlignedVector<LightPhase> lights(city.signal_plans.size());
+    long fixed_ticks = 0;
+
+    auto start = chrono::high_resolution_clock::now();
+    // Heap allocations after the first tick. The count is process-wide, so
+    // in the task graph it includes kernels running alongside.
+    long warm_allocations = heapAllocations();
+    for (int t = 0; t < ticks; ++t) {
+        bool planned = plan.epoch > 0 && city.signal_plans.valid(plan);
+        fixed_ticks += !planned;
+        stats = sim.step(lights.data(), planned ? plan.lights : nullptr);
+        if (t == 0) {
+            warm_allocations = heapAllocations();
         }
-    }
-    // Print statement outside collapsed loop
-    #pragma omp parallel for
-    for (int i = 0; i < matrix_a.size(); ++i) {
-        if (i % 10 == 0) {
-            cout << "Matrix Multiplication: Processed row " << i << "." << endl;
+        if (t % 10 == 0) {
+            logMessage(LOG_VERBOSE, "Traffic Simulation: tick %ld, mean speed %.1f m/s, %ld transfers, %ld incidents.",
+                       stats.tick, stats.mean_speed_mps, stats.transfers, stats.active_incidents);
         }
     }
+    chrono::duration<double> elapsed = chrono::high_resolution_clock::now() - start;
+    long tick_allocations = heapAllocations() - warm_allocations;
+
+    // Publish each vehicle's current speed (km/h) as its flow reading
+    auto& traffic_flow = city.vehicle_data;
+    #pragma omp taskloop default(shared)
+    for (int i = 0; i < traffic_flow.size(); ++i) {
+        traffic_flow[i] = (int)(sim.vehicle_speed[i] * 3.6f + 0.5f);
+    }
+
+    double ticks_per_second = ticks / max(elapsed.count(), 1e-9);
+    logMessage(LOG_SUMMARY, "Traffic Simulation: %d ticks on %d intersections / %d roads, %ld of %zu vehicles on the network.",
+               ticks, sim.net.num_intersections, sim.net.numEdges(), stats.active_vehicles, traffic_flow.size());
+    logMessage(LOG_SUMMARY, "Traffic Simulation: %.1f ticks/s (%.1fx real time), %ld heap allocations after the first tick.",
+               ticks_per_second, ticks_per_second * TICK_SECONDS, tick_allocations);
+    logMessage(LOG_SUMMARY, "Traffic Simulation: signal plan %llu, %ld ticks on fixed-time signals.",
+               (unsigned long long)plan.epoch, fixed_ticks);
+    logMessage(LOG_SUMMARY, "Traffic Simulation: %ld edge speed changes, %ld reroutes (%ld diverted) in %.1f ms, %.0f reroutes/s, %ld trips.",
+               stats.route_changes, stats.reroutes, stats.diversions, 1e3 * stats.route_seconds,
+               stats.reroutes / max(stats.route_seconds, 1e-9), stats.trips);
+}
+
+// Multiplies the row-major n x n OD matrices with the cache-blocked SIMD
+// GEMM. The preset sizes run instantiations with n fixed at compile time;
+// any other size takes the runtime-sized path. The result is overwritten,
+// so every frame and repetition is one product.
+void matrixMultiplication(CityState& city) {
+    int n = city.matrix_size;
+    const int32_t* matrix_a = city.matrix_a.data();
+    const int32_t* matrix_b = city.matrix_b.data();
+    int32_t* result = city.result.data();
+
+    switch (n) {
+        case 200: gemmSquare<200>(matrix_a, matrix_b, result, false); break;
+        case 512: gemmSquare<512>(matrix_a, matrix_b, result, false); break;
+        case 1024: gemmSquare<1024>(matrix_a, matrix_b, result, false); break;
+        case 2048: gemmSquare<2048>(matrix_a, matrix_b, result, false); break;
+        default: gemmBlocked(matrix_a, matrix_b, result, n, n, n, false); break;
+    }
+    logMessage(LOG_SUMMARY, "Matrix Multiplication: %dx%d result computed.", n, n);
 }
 
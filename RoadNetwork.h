@@ -0,0 +1,138 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "CityState.h"
+
+// Road network as a directed graph in compressed sparse row (CSR) form.
+//
+// Intersections are vertices and road segments are directed edges. Outgoing
+// edges of intersection v are edge_target[out_offsets[v] .. out_offsets[v+1]),
+// and a second CSR (in_offsets / in_edges) lists the incoming edge ids so an
+// intersection can serve its approaches without scanning the whole graph.
+
+#define ROAD_LENGTH_M 250.0f
+#define ROAD_SPEED_MPS 13.9f // 50 km/h
+#define ROAD_LANES 2
+
+// Approach an edge arrives on at its target intersection, indexing the
+// NUM_APPROACHES signal heads of that intersection.
+enum Approach : uint8_t { APPROACH_NORTH = 0, APPROACH_EAST = 1, APPROACH_SOUTH = 2, APPROACH_WEST = 3 };
+
+struct RoadNetwork {
+    int num_intersections = 0;
+    int grid_width = 0;
+
+    AlignedVector<int32_t> out_offsets; // num_intersections + 1
+    AlignedVector<int32_t> in_offsets;  // num_intersections + 1
+    AlignedVector<int32_t> in_edges;    // edge ids grouped by target
+
+    // Per-intersection ownership. A network can be one band of a larger grid
+    // (see gridBand); then intersection_global maps local ids to ids in the
+    // whole city and ghost intersections belonging to a neighbouring band
+    // have intersection_owned = 0.
+    AlignedVector<int32_t> intersection_global;
+    AlignedVector<uint8_t> intersection_owned;
+
+    // Per-edge attributes, indexed by edge id
+    AlignedVector<int32_t> edge_source;
+    AlignedVector<int32_t> edge_target;
+    AlignedVector<int64_t> edge_key; // global source * 4 + direction, same in every band
+    AlignedVector<float> edge_length;
+    AlignedVector<float> edge_speed;
+    AlignedVector<uint8_t> edge_lanes;
+    AlignedVector<uint8_t> edge_approach;
+
+    int numEdges() const { return edge_target.size(); }
+
+    int outDegree(int v) const { return out_offsets[v + 1] - out_offsets[v]; }
+
+    static int gridWidth(int num_intersections) {
+        return std::max(1, (int)std::ceil(std::sqrt((double)num_intersections)));
+    }
+
+    static int gridRows(int num_intersections) {
+        int width = gridWidth(num_intersections);
+        return (num_intersections + width - 1) / width;
+    }
+
+    // Grid city: intersections laid out row-major on a grid of width
+    // ceil(sqrt(n)), with two-way roads between 4-neighbours. The last row may
+    // be partial so any intersection count is representable.
+    static RoadNetwork grid(int num_intersections) {
+        return gridBand(num_intersections, 0, gridRows(num_intersections));
+    }
+
+    // The rows [row_begin, row_end) of the grid city plus one ghost row on
+    // each side, keeping every edge with at least one owned endpoint. Edges
+    // between an owned and a ghost intersection are the band's boundary.
+    static RoadNetwork gridBand(int num_intersections, int row_begin, int row_end) {
+        RoadNetwork net;
+        int width = gridWidth(num_intersections);
+        int first = std::max(0, row_begin - 1) * width;
+        int last = std::min(num_intersections, (row_end + 1) * width);
+        int owned_first = row_begin * width;
+        int owned_last = std::min(num_intersections, row_end * width);
+        if (row_begin >= row_end) {
+            first = last = owned_first = owned_last = 0;
+        }
+
+        net.num_intersections = last - first;
+        net.grid_width = width;
+        net.out_offsets.assign(net.num_intersections + 1, 0);
+        for (int g = first; g < last; ++g) {
+            net.intersection_global.push_back(g);
+            net.intersection_owned.push_back(g >= owned_first && g < owned_last);
+        }
+
+        // Neighbour offsets and the approach a vehicle arriving from that
+        // direction uses: moving north arrives on the south approach, etc.
+        const int dx[4] = {0, 1, 0, -1};
+        const int dy[4] = {-1, 0, 1, 0};
+        const uint8_t arrives_on[4] = {APPROACH_SOUTH, APPROACH_WEST, APPROACH_NORTH, APPROACH_EAST};
+
+        for (int v = 0; v < net.num_intersections; ++v) {
+            int g = first + v;
+            int x = g % width, y = g / width;
+            for (int d = 0; d < 4; ++d) {
+                int nx = x + dx[d], ny = y + dy[d];
+                int u = ny * width + nx;
+                if (nx < 0 || nx >= width || ny < 0 || u < first || u >= last) {
+                    continue;
+                }
+                if (!net.intersection_owned[v] && !net.intersection_owned[u - first]) {
+                    continue;
+                }
+                net.edge_source.push_back(v);
+                net.edge_target.push_back(u - first);
+                net.edge_key.push_back((int64_t)g * 4 + d);
+                net.edge_length.push_back(ROAD_LENGTH_M);
+                net.edge_speed.push_back(ROAD_SPEED_MPS);
+                net.edge_lanes.push_back(ROAD_LANES);
+                net.edge_approach.push_back(arrives_on[d]);
+            }
+            net.out_offsets[v + 1] = net.edge_target.size();
+        }
+        net.buildIncoming();
+        return net;
+    }
+
+    // Counting sort of edge ids by target intersection.
+    void buildIncoming() {
+        in_offsets.assign(num_intersections + 1, 0);
+        for (int e = 0; e < numEdges(); ++e) {
+            ++in_offsets[edge_target[e] + 1];
+        }
+        for (int v = 0; v < num_intersections; ++v) {
+            in_offsets[v + 1] += in_offsets[v];
+        }
+        in_edges.resize(numEdges());
+        std::vector<int32_t> cursor(in_offsets.begin(), in_offsets.end() - 1);
+        for (int e = 0; e < numEdges(); ++e) {
+            in_edges[cursor[edge_target[e]]++] = e;
+        }
+    }
+};
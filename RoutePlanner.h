@@ -0,0 +1,446 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "RoadNetwork.h"
+#include "SensorRNG.h"
+
+// Shortest-path routing to destination hubs on the road network.
+//
+// ROUTE_DESTINATIONS intersections are hubs, and every vehicle drives to one
+// of them. Each hub has a shortest-path tree of the whole city by travel
+// time: for every intersection, the time to the hub and the next edge on
+// the way. A route is the chain of next edges, so the trees together answer
+// the many-to-many query of every intersection against every hub, and a
+// vehicle's next turn is one lookup.
+//
+// Trees are computed by delta-stepping on the reversed graph. Tentative
+// times sit in buckets `delta` wide (the shortest free-flow edge). The lowest
+// bucket is emptied by relaxing the light edges (no longer than delta) of
+// its intersections until it stays empty, then the heavy edges of all it
+// held. Buckets are intrusive lists over the intersections, so a search
+// allocates nothing. A batch of trees runs one tree per task, each with the
+// scratch space of the thread running it.
+//
+// Incidents change edge speeds. update() repairs every tree in place: an
+// intersection routed over an edge that got slower (the edge's subtree) is
+// reset and re-seeded from its unaffected neighbours, and an edge that got
+// faster relaxes its source. Both then run the same bucket loop, which only
+// reaches intersections whose routes change. Those are stamped with the
+// update's epoch, so a simulator finds the vehicles to reroute with one
+// lookup each (see TrafficSimulator).
+//
+// The planner covers the whole city. An MPI rank applies the changes of all
+// ranks, sorted by edge key, so the trees are the same everywhere.
+
+#define ROUTE_DESTINATIONS 64 // hubs, each with a shortest-path tree
+
+// New speed of one road segment, e.g. an incident starting or clearing
+struct EdgeSpeedChange {
+    int64_t key;   // RoadNetwork::edge_key
+    float speed;   // m/s
+};
+
+struct RouteUpdate {
+    long edges = 0;         // edges whose travel time changed
+    long intersections = 0; // (tree, intersection) routes that changed
+    double seconds = 0.0;
+};
+
+class RoutePlanner {
+public:
+    RoutePlanner(int num_intersections, uint64_t seed)
+        : net(RoadNetwork::grid(num_intersections)),
+          n(num_intersections),
+          num_trees(std::min(ROUTE_DESTINATIONS, num_intersections)) {
+        int num_edges = net.numEdges();
+        key_edge.assign((size_t)n * 4, -1);
+        weight.resize(num_edges);
+        free_weight.resize(num_edges);
+        delta = std::numeric_limits<int32_t>::max();
+        for (int e = 0; e < num_edges; ++e) {
+            key_edge[net.edge_key[e]] = e;
+            free_weight[e] = weight[e] = travelTime(e, net.edge_speed[e]);
+            delta = std::min(delta, weight[e]);
+        }
+        delta = std::max(delta, 1);
+        slower.reserve(num_edges);
+        faster.reserve(num_edges);
+
+        // Distinct hubs drawn from the seed
+        for (int d = 0; d < num_trees; ++d) {
+            SensorRNG rng(seed, STREAM_ROUTES, d);
+            int hub;
+            do {
+                hub = rng.uniform(n);
+            } while (std::find(hubs.begin(), hubs.end(), hub) != hubs.end());
+            hubs.push_back(hub);
+        }
+
+        size_t entries = (size_t)num_trees * n;
+        time.resize(entries);
+        next.resize(entries);
+        changed_epoch.assign(entries, 0);
+#ifdef _OPENMP
+        scratch.resize(omp_get_max_threads());
+#else
+        scratch.resize(1);
+#endif
+        for (Scratch& s : scratch) {
+            s.resize(n);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        forEachTree([&](int d) {
+            buildTree(d);
+            return 0L;
+        });
+        build_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        // The build stamped every route; none has changed yet
+        std::fill(changed_epoch.begin(), changed_epoch.end(), 0);
+        free_time = time;
+        free_next = next;
+        // Buckets for routes up to twice the longest free-flow one, so a
+        // repair rarely has to grow them
+        int32_t longest = 0;
+        for (int32_t t : time) {
+            longest = t == UNREACHED ? longest : std::max(longest, t);
+        }
+        for (Scratch& s : scratch) {
+            s.heads.resize(std::max<size_t>(s.heads.size(), 2 * (size_t)(longest / delta) + 2), -1);
+        }
+    }
+
+    int numDestinations() const { return num_trees; }
+    int numIntersections() const { return n; }
+    int hub(int d) const { return hubs[d]; }
+    double buildSeconds() const { return build_seconds; }
+
+    // Next edge from intersection v towards hub d (an edge of the whole-city
+    // grid), or -1 at the hub
+    int nextEdge(int d, int v) const { return next[(size_t)d * n + v]; }
+    int64_t edgeKey(int e) const { return net.edge_key[e]; }
+
+    // Travel time from intersection v to hub d, ms
+    int32_t travelTime(int d, int v) const { return time[(size_t)d * n + v]; }
+
+    // Whether the edge with the given key starts a shortest route to hub d
+    // (a tie with the tree's own next edge on a grid)
+    bool onShortestRoute(int d, int64_t key) const {
+        int e = key < (int64_t)key_edge.size() ? key_edge[key] : -1;
+        if (e < 0) {
+            return false;
+        }
+        int32_t t = time[(size_t)d * n + net.edge_target[e]];
+        return t != UNREACHED && (int64_t)t + weight[e] == time[(size_t)d * n + net.edge_source[e]];
+    }
+
+    // Whether the route from v to hub d changed in the last update()
+    bool changed(int d, int v) const { return changed_epoch[(size_t)d * n + v] == epoch; }
+
+    // Back to the free-flow trees. The simulator does this once, when it is
+    // built; the repaired trees then follow its incidents for the whole run.
+    void reset() {
+        if (dirty) {
+            std::copy(free_time.begin(), free_time.end(), time.begin());
+            std::copy(free_next.begin(), free_next.end(), next.begin());
+            std::copy(free_weight.begin(), free_weight.end(), weight.begin());
+            dirty = false;
+        }
+    }
+
+    // Checkpoint sections (Checkpoint.h): the edge weights and the trees as
+    // repaired so far, which a rebuild would not reproduce where routes tie.
+    // After a restore no route counts as changed.
+    template <typename Archive>
+    void checkpoint(Archive& archive) {
+        archive.whole("route.weight", weight.data(), weight.size());
+        archive.whole("route.time", time.data(), n, num_trees);
+        archive.whole("route.next", next.data(), n, num_trees);
+        if (archive.restoring()) {
+            dirty = weight != free_weight || time != free_time || next != free_next;
+            ++epoch;
+        }
+    }
+
+    // Applies new edge speeds and repairs every tree. Changes must be
+    // sorted by key; keys of edges outside the city are ignored.
+    RouteUpdate update(const EdgeSpeedChange* changes, size_t count) {
+        auto start = std::chrono::steady_clock::now();
+        slower.clear();
+        faster.clear();
+        for (size_t i = 0; i < count; ++i) {
+            if (changes[i].key < 0 || changes[i].key >= (int64_t)key_edge.size() || key_edge[changes[i].key] < 0) {
+                continue;
+            }
+            int e = key_edge[changes[i].key];
+            int32_t w = travelTime(e, changes[i].speed);
+            if (w > weight[e]) {
+                slower.push_back(e);
+            } else if (w < weight[e]) {
+                faster.push_back(e);
+            }
+            weight[e] = w;
+        }
+        RouteUpdate update;
+        update.edges = slower.size() + faster.size();
+        if (update.edges > 0) {
+            ++epoch;
+            dirty = true;
+            update.intersections = forEachTree([&](int d) { return repairTree(d); });
+        }
+        update.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return update;
+    }
+
+private:
+    static const int32_t UNREACHED = std::numeric_limits<int32_t>::max();
+
+    // Per-thread search state. Every bucket list is empty between searches.
+    struct Scratch {
+        std::vector<int32_t> bucket_of;   // bucket an intersection is queued in, or -1
+        std::vector<int32_t> bucket_prev; // intrusive doubly linked bucket lists
+        std::vector<int32_t> bucket_next;
+        std::vector<int32_t> heads;       // first intersection of each bucket, or -1
+        std::vector<int32_t> emptied;     // intersections taken from the current bucket
+        std::vector<uint32_t> emptied_mark;
+        std::vector<uint32_t> affected_mark;
+        std::vector<int32_t> affected;    // subtrees of slower edges
+        std::vector<int32_t> stack;
+        uint32_t stamp = 0;
+        size_t lowest = 0;
+        long queued = 0;
+
+        void resize(int n) {
+            bucket_of.assign(n, -1);
+            bucket_prev.assign(n, -1);
+            bucket_next.assign(n, -1);
+            emptied.reserve(n);
+            emptied_mark.assign(n, 0);
+            affected_mark.assign(n, 0);
+            affected.reserve(n);
+            stack.reserve(n);
+            lowest = std::numeric_limits<size_t>::max();
+        }
+    };
+
+    RoadNetwork net; // the whole city
+    int n;
+    int num_trees;
+    int32_t delta; // bucket width, ms
+    std::vector<int32_t> key_edge;
+    std::vector<int32_t> weight; // travel time per edge, ms
+    std::vector<int32_t> free_weight;
+    std::vector<int32_t> hubs;
+    // Tree-major: entry d * n + v is intersection v in the tree of hub d
+    std::vector<int32_t> time;
+    std::vector<int32_t> next;
+    std::vector<uint32_t> changed_epoch;
+    std::vector<int32_t> free_time;
+    std::vector<int32_t> free_next;
+    uint32_t epoch = 1; // changed_epoch 0 means never changed
+    bool dirty = false;
+    double build_seconds = 0.0;
+    std::vector<int32_t> slower; // edges changed by the current update
+    std::vector<int32_t> faster;
+    std::vector<Scratch> scratch;
+
+    int32_t travelTime(int e, float speed) const {
+        return std::max<int32_t>(1, (int32_t)std::lround(1000.0f * net.edge_length[e] / std::max(speed, 0.01f)));
+    }
+
+    static int threadIndex() {
+#ifdef _OPENMP
+        return omp_get_thread_num();
+#else
+        return 0;
+#endif
+    }
+
+    // Runs f(d) for every tree as a taskloop, in a parallel region of its
+    // own when called outside one; returns the sum of the results
+    template <typename F>
+    long forEachTree(F f) {
+        long total = 0;
+        auto trees = [&] {
+            #pragma omp taskloop default(shared) grainsize(1) reduction(+:total)
+            for (int d = 0; d < num_trees; ++d) {
+                total += f(d);
+            }
+        };
+#ifdef _OPENMP
+        if (!omp_in_parallel()) {
+            #pragma omp parallel
+            #pragma omp single
+            trees();
+            return total;
+        }
+#endif
+        trees();
+        return total;
+    }
+
+    void link(Scratch& s, int v, int32_t t) {
+        size_t b = t / delta;
+        if (b >= s.heads.size()) {
+            s.heads.resize(std::max(b + 1, 2 * s.heads.size()), -1);
+        }
+        s.bucket_of[v] = b;
+        s.bucket_prev[v] = -1;
+        s.bucket_next[v] = s.heads[b];
+        if (s.heads[b] >= 0) {
+            s.bucket_prev[s.heads[b]] = v;
+        }
+        s.heads[b] = v;
+        s.lowest = std::min(s.lowest, b);
+        ++s.queued;
+    }
+
+    void unlink(Scratch& s, int v) {
+        int b = s.bucket_of[v];
+        if (s.bucket_prev[v] >= 0) {
+            s.bucket_next[s.bucket_prev[v]] = s.bucket_next[v];
+        } else {
+            s.heads[b] = s.bucket_next[v];
+        }
+        if (s.bucket_next[v] >= 0) {
+            s.bucket_prev[s.bucket_next[v]] = s.bucket_prev[v];
+        }
+        s.bucket_of[v] = -1;
+        --s.queued;
+    }
+
+    // Lowers v's time to t over edge e if that is shorter; counts newly
+    // stamped intersections in `changes`
+    void relax(Scratch& s, int32_t* t_tree, int32_t* next_tree, uint32_t* stamp_tree, int v, int64_t t, int e,
+               long& changes) {
+        if (t >= t_tree[v]) {
+            return;
+        }
+        if (s.bucket_of[v] >= 0) {
+            unlink(s, v);
+        }
+        t_tree[v] = (int32_t)t;
+        next_tree[v] = e;
+        changes += stamp_tree[v] != epoch;
+        stamp_tree[v] = epoch;
+        link(s, v, t);
+    }
+
+    // The bucket loop: settles everything queued, lowest bucket first
+    void settle(Scratch& s, int d, long& changes) {
+        int32_t* t_tree = time.data() + (size_t)d * n;
+        int32_t* next_tree = next.data() + (size_t)d * n;
+        uint32_t* stamp_tree = changed_epoch.data() + (size_t)d * n;
+        auto relaxIncoming = [&](int v, bool light) {
+            for (int i = net.in_offsets[v]; i < net.in_offsets[v + 1]; ++i) {
+                int e = net.in_edges[i];
+                if ((weight[e] <= delta) == light) {
+                    relax(s, t_tree, next_tree, stamp_tree, net.edge_source[e], (int64_t)t_tree[v] + weight[e], e,
+                          changes);
+                }
+            }
+        };
+        size_t b = s.lowest;
+        while (s.queued > 0) {
+            while (s.heads[b] < 0) {
+                ++b;
+            }
+            ++s.stamp;
+            s.emptied.clear();
+            while (s.heads[b] >= 0) {
+                int v = s.heads[b];
+                unlink(s, v);
+                if (s.emptied_mark[v] != s.stamp) {
+                    s.emptied_mark[v] = s.stamp;
+                    s.emptied.push_back(v);
+                }
+                relaxIncoming(v, true);
+            }
+            for (int v : s.emptied) {
+                relaxIncoming(v, false);
+            }
+        }
+        s.lowest = std::numeric_limits<size_t>::max();
+    }
+
+    void buildTree(int d) {
+        Scratch& s = scratch[threadIndex()];
+        int32_t* t_tree = time.data() + (size_t)d * n;
+        std::fill(t_tree, t_tree + n, UNREACHED);
+        std::fill(next.data() + (size_t)d * n, next.data() + (size_t)(d + 1) * n, -1);
+        t_tree[hubs[d]] = 0;
+        link(s, hubs[d], 0);
+        long changes = 0;
+        settle(s, d, changes);
+    }
+
+    // Repairs tree d after the weights in `slower` and `faster` changed;
+    // returns the intersections whose routes changed
+    long repairTree(int d) {
+        Scratch& s = scratch[threadIndex()];
+        int32_t* t_tree = time.data() + (size_t)d * n;
+        int32_t* next_tree = next.data() + (size_t)d * n;
+        uint32_t* stamp_tree = changed_epoch.data() + (size_t)d * n;
+        long changes = 0;
+
+        // Intersections routed over a slower edge: walk down the tree from
+        // each edge's source through the incoming tree edges
+        ++s.stamp;
+        s.affected.clear();
+        for (int e : slower) {
+            int v = net.edge_source[e];
+            if (next_tree[v] != e || s.affected_mark[v] == s.stamp) {
+                continue;
+            }
+            s.affected_mark[v] = s.stamp;
+            s.stack.push_back(v);
+            while (!s.stack.empty()) {
+                int u = s.stack.back();
+                s.stack.pop_back();
+                s.affected.push_back(u);
+                for (int i = net.in_offsets[u]; i < net.in_offsets[u + 1]; ++i) {
+                    int in = net.in_edges[i];
+                    int w = net.edge_source[in];
+                    if (next_tree[w] == in && s.affected_mark[w] != s.stamp) {
+                        s.affected_mark[w] = s.stamp;
+                        s.stack.push_back(w);
+                    }
+                }
+            }
+        }
+        for (int v : s.affected) {
+            t_tree[v] = UNREACHED;
+            next_tree[v] = -1;
+            changes += stamp_tree[v] != epoch;
+            stamp_tree[v] = epoch;
+        }
+        // Re-seed them from their unaffected neighbours
+        for (int v : s.affected) {
+            for (int e = net.out_offsets[v]; e < net.out_offsets[v + 1]; ++e) {
+                int u = net.edge_target[e];
+                if (s.affected_mark[u] != s.stamp && t_tree[u] != UNREACHED) {
+                    relax(s, t_tree, next_tree, stamp_tree, v, (int64_t)t_tree[u] + weight[e], e, changes);
+                }
+            }
+        }
+        for (int e : faster) {
+            int u = net.edge_target[e];
+            if (t_tree[u] != UNREACHED) {
+                relax(s, t_tree, next_tree, stamp_tree, net.edge_source[e], (int64_t)t_tree[u] + weight[e], e,
+                      changes);
+            }
+        }
+        settle(s, d, changes);
+        return changes;
+    }
+};
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "CityState.h"
+
+// Incremental congestion and incident detectors over occupancy readings.
+//
+// Each sensor reports one occupancy percentage per frame. Per sensor the
+// detectors keep, all in O(1) per sample:
+//
+//   - a rolling window of the last DETECTOR_WINDOW samples with its running
+//     sum and sum of squares, giving the window mean and variance;
+//   - an EWMA of occupancy, which flags congestion above
+//     DETECTOR_CONGESTED_ON and clears it below DETECTOR_CONGESTED_OFF;
+//   - a one-sided CUSUM of the sample's deviation from the previous window
+//     mean in standard deviations, which flags an incident (a sudden rise in
+//     occupancy) above DETECTOR_CUSUM_LIMIT.
+//
+// State is structure-of-arrays and the window is a ring stored slot-major, so
+// one frame touches every array contiguously: update() is a taskloop over
+// blocks of sensors with a SIMD loop inside each block. Integer sums keep the
+// rolling statistics exact however long the stream runs.
+//
+// A detector object covers sensors [begin, end) of a column, so an MPI rank
+// keeps state only for its own block.
+
+#define DETECTOR_WINDOW 32
+#define DETECTOR_EWMA_ALPHA 0.2f
+#define DETECTOR_CONGESTED_ON 70.0f  // % occupancy
+#define DETECTOR_CONGESTED_OFF 60.0f // % occupancy
+#define DETECTOR_CUSUM_SLACK 0.5f    // standard deviations
+#define DETECTOR_CUSUM_LIMIT 8.0f    // standard deviations
+#define DETECTOR_MIN_SIGMA 1.0f      // % occupancy, added in quadrature for flat signals
+#define DETECTOR_BLOCK 4096          // sensors per task
+
+// 1 / sqrt(v) for v >= 1 without a library call: std::sqrt keeps an errno
+// branch unless built with -fno-math-errno, which stops the update loop from
+// vectorizing. A bit-level estimate refined by three Newton steps is exact
+// to float rounding over the occupancy range.
+inline float inverseSqrt(float v) {
+    int32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    bits = 0x5F3759DF - (bits >> 1);
+    float y;
+    memcpy(&y, &bits, sizeof(y));
+    for (int i = 0; i < 3; ++i) {
+        y = y * (1.5f - 0.5f * v * y * y);
+    }
+    return y;
+}
+
+struct DetectorFrame {
+    long congested = 0;       // sensors flagged congested after this frame
+    long incidents = 0;       // sensors flagged with an incident after this frame
+    long congestion_alerts = 0; // flags raised by this frame
+    long incident_alerts = 0;
+    double seconds = 0.0;     // update time for the frame
+    double alert_latency = 0.0; // s from sample arrival to alerts raised, 0 without alerts
+};
+
+class SensorDetectors {
+public:
+    // Output flags per sensor, 0 or 1, indexed from begin
+    AlignedVector<uint8_t> congested;
+    AlignedVector<uint8_t> incident;
+
+    SensorDetectors(size_t begin, size_t end)
+        : congested(end - begin, 0),
+          incident(end - begin, 0),
+          first(begin),
+          count(end - begin),
+          window(DETECTOR_WINDOW * (end - begin), 0),
+          sum(end - begin, 0),
+          sum_sq(end - begin, 0),
+          ewma(end - begin, 0.0f),
+          cusum(end - begin, 0.0f) {}
+
+    size_t begin() const { return first; }
+    size_t end() const { return first + count; }
+    uint64_t frames() const { return frame_count; }
+
+    // Pushes one frame; samples is the whole column, of which [begin, end)
+    // is read. arrival is when the frame's samples became available.
+    DetectorFrame update(const DensityPercent* samples, std::chrono::steady_clock::time_point arrival) {
+        auto start = std::chrono::steady_clock::now();
+        long congested_now = 0, incidents_now = 0, congestion_alerts = 0, incident_alerts = 0;
+        long num_blocks = (count + DETECTOR_BLOCK - 1) / DETECTOR_BLOCK;
+        #pragma omp taskloop default(shared) reduction(+:congested_now, incidents_now, congestion_alerts, incident_alerts)
+        for (long b = 0; b < num_blocks; ++b) {
+            size_t lo = b * DETECTOR_BLOCK;
+            size_t hi = std::min(count, lo + DETECTOR_BLOCK);
+            updateBlock(samples + first, lo, hi, congested_now, incidents_now, congestion_alerts, incident_alerts);
+        }
+        ++frame_count;
+
+        auto now = std::chrono::steady_clock::now();
+        DetectorFrame frame;
+        frame.congested = congested_now;
+        frame.incidents = incidents_now;
+        frame.congestion_alerts = congestion_alerts;
+        frame.incident_alerts = incident_alerts;
+        frame.seconds = std::chrono::duration<double>(now - start).count();
+        if (congestion_alerts + incident_alerts > 0) {
+            frame.alert_latency = std::chrono::duration<double>(now - arrival).count();
+            ++alert_frames;
+            latency_sum += frame.alert_latency;
+            latency_max = std::max(latency_max, frame.alert_latency);
+        }
+        return frame;
+    }
+
+    double meanAlertLatency() const { return alert_frames > 0 ? latency_sum / alert_frames : 0.0; }
+    double maxAlertLatency() const { return latency_max; }
+
+    // Checkpoint sections (Checkpoint.h) named `prefix`.*, of `total`
+    // sensors. The alert latency statistics are not carried over.
+    template <typename Archive>
+    void checkpoint(Archive& archive, const std::string& prefix, size_t total) {
+        size_t last = first + count;
+        archive.section(prefix + ".congested", congested.data(), total, first, last);
+        archive.section(prefix + ".incident", incident.data(), total, first, last);
+        archive.section(prefix + ".window", window.data(), total, first, last, DETECTOR_WINDOW, count);
+        archive.section(prefix + ".sum", sum.data(), total, first, last);
+        archive.section(prefix + ".sum_sq", sum_sq.data(), total, first, last);
+        archive.section(prefix + ".ewma", ewma.data(), total, first, last);
+        archive.section(prefix + ".cusum", cusum.data(), total, first, last);
+        archive.whole(prefix + ".frames", &frame_count, 1);
+    }
+
+private:
+    size_t first;
+    size_t count;
+    uint64_t frame_count = 0;
+
+    // Ring of the last DETECTOR_WINDOW frames, slot-major: slot s of sensor j
+    // is window[s * count + j]. Slots not yet filled hold 0.
+    AlignedVector<DensityPercent> window;
+    AlignedVector<int32_t> sum;
+    AlignedVector<int32_t> sum_sq;
+    AlignedVector<float> ewma;
+    AlignedVector<float> cusum;
+
+    long alert_frames = 0;
+    double latency_sum = 0.0;
+    double latency_max = 0.0;
+
+    void updateBlock(const DensityPercent* samples, size_t lo, size_t hi, long& congested_now, long& incidents_now,
+                     long& congestion_alerts, long& incident_alerts) {
+        DensityPercent* slot = window.data() + (frame_count % DETECTOR_WINDOW) * count;
+        // Statistics of the window before this sample; the CUSUM only runs
+        // once the window is full
+        uint64_t before = std::min<uint64_t>(frame_count, DETECTOR_WINDOW);
+        float inv_before = before > 0 ? 1.0f / before : 0.0f;
+        float warm_scale = frame_count >= DETECTOR_WINDOW ? 1.0f : 0.0f;
+        float alpha = frame_count == 0 ? 1.0f : DETECTOR_EWMA_ALPHA;
+        int c_now = 0, i_now = 0, c_raised = 0, i_raised = 0; // per block, 32-bit lanes
+
+        // Byte stores may alias anything, so the arrays are hoisted into
+        // locals; otherwise every iteration reloads the vectors' pointers
+        int32_t* sum_p = sum.data();
+        int32_t* sum_sq_p = sum_sq.data();
+        float* ewma_p = ewma.data();
+        float* cusum_p = cusum.data();
+        uint8_t* congested_p = congested.data();
+        uint8_t* incident_p = incident.data();
+
+        #pragma omp simd reduction(+:c_now, i_now, c_raised, i_raised)
+        for (size_t j = lo; j < hi; ++j) {
+            int32_t x = samples[j];
+            int32_t old = slot[j];
+
+            float mean = sum_p[j] * inv_before;
+            float variance = sum_sq_p[j] * inv_before - mean * mean;
+            float inv_sigma = inverseSqrt(variance + DETECTOR_MIN_SIGMA * DETECTOR_MIN_SIGMA);
+            float step = cusum_p[j] + (x - mean) * inv_sigma - DETECTOR_CUSUM_SLACK;
+            // Clamp and warm-up gate as multiplies: GCC turns a select on step
+            // into a branch, which keeps the loop scalar
+            float c = step * (float)(step > 0.0f) * warm_scale;
+            cusum_p[j] = c;
+
+            sum_p[j] += x - old;
+            sum_sq_p[j] += x * x - old * old;
+            slot[j] = x;
+
+            float e = ewma_p[j] + alpha * (x - ewma_p[j]);
+            ewma_p[j] = e;
+
+            uint8_t was_congested = congested_p[j];
+            // Bitwise rather than logical operators keep the loop branch-free
+            uint8_t is_congested = (e > DETECTOR_CONGESTED_ON) | (was_congested & (e > DETECTOR_CONGESTED_OFF));
+            uint8_t had_incident = incident_p[j];
+            uint8_t has_incident = c > DETECTOR_CUSUM_LIMIT;
+            congested_p[j] = is_congested;
+            incident_p[j] = has_incident;
+
+            c_now += is_congested;
+            i_now += has_incident;
+            c_raised += is_congested & (was_congested ^ 1);
+            i_raised += has_incident & (had_incident ^ 1);
+        }
+        congested_now += c_now;
+        incidents_now += i_now;
+        congestion_alerts += c_raised;
+        incident_alerts += i_raised;
+    }
+};
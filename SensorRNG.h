@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+
+// Counter-based random number generation for sensor synthesis.
+//
+// Every value is a pure function of (seed, stream, index), so there is no
+// shared generator state between threads or ranks. The same seed produces the
+// same sensor data for any thread count, schedule or MPI decomposition.
+
+#define DEFAULT_SENSOR_SEED 20240601ULL
+
+// One independent stream per kernel so that kernels sharing an index range
+// (e.g. vehicles) do not draw correlated values.
+enum SensorStream : uint64_t {
+    STREAM_TRAFFIC_FLOW = 1,
+    STREAM_INCIDENTS,
+    STREAM_CONGESTION,
+    STREAM_VEHICLE_COUNT,
+    STREAM_HISTORICAL,
+    STREAM_PREDICTION,
+    STREAM_AIR_QUALITY,
+    STREAM_NOISE,
+    STREAM_GREEN_WAVE,
+    STREAM_EV_STATIONS,
+    STREAM_PUBLIC_TRANSPORT,
+    STREAM_SIMULATION,
+    STREAM_SIM_INCIDENTS,
+    STREAM_SIM_TURNS,
+    STREAM_EV_FLEET,
+    STREAM_TRANSIT,
+    STREAM_ENV_SITES,
+    STREAM_ROUTES
+};
+
+// SplitMix64 finalizer: a bijective 64-bit mixer with full avalanche.
+inline uint64_t splitmix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+// Generator for a single (seed, stream, index) key. It lives on the stack of
+// the thread processing that index; successive draws advance a local counter.
+struct SensorRNG {
+    uint64_t key;
+    uint64_t counter;
+
+    SensorRNG(uint64_t seed, SensorStream stream, uint64_t index)
+        : key(splitmix64(splitmix64(seed ^ (uint64_t(stream) << 56)) ^ index)), counter(0) {}
+
+    uint64_t next() {
+        return splitmix64(key + 0xD1B54A32D192ED03ULL * ++counter);
+    }
+
+    // Uniform integer in [0, bound) using multiply-shift instead of modulo.
+    int uniform(int bound) {
+        return int(((next() >> 32) * uint64_t(bound)) >> 32);
+    }
+};
+
+// First draw of the generator for one index; what a kernel needs when it
+// synthesizes a single reading per sensor.
+inline int sensorValue(uint64_t seed, SensorStream stream, uint64_t index, int bound) {
+    return SensorRNG(seed, stream, index).uniform(bound);
+}
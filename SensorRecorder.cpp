@@ -0,0 +1,80 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include "SensorRNG.h"
+#include "CityState.h"
+#include "Config.h"
+#include "SensorReplay.h"
+
+using namespace std;
+
+// Writes a synthetic replay file: one frame of vehicle counts, camera
+// densities, AQI and noise per interval, sized from the usual city settings.
+// Frame 0 holds the same readings the kernels synthesize for the seed.
+//
+//   g++ -O3 SensorRecorder.cpp -o sensor_recorder
+//   ./sensor_recorder --preset district --frames 1440 --interval-ms 60000 --out day.replay
+
+void synthesizeFrame(CityState& city, uint64_t seed, uint64_t frame) {
+    auto fill = [&](auto& column, SensorStream stream, int bound) {
+        uint64_t first = frame * column.size();
+        for (size_t i = 0; i < column.size(); ++i) {
+            column[i] = sensorValue(seed, stream, first + i, bound);
+        }
+    };
+    fill(city.vehicle_data, STREAM_TRAFFIC_FLOW, 100);
+    fill(city.traffic_density, STREAM_CONGESTION, 100);
+    fill(city.air_quality_data, STREAM_AIR_QUALITY, 200);
+    fill(city.noise_data, STREAM_NOISE, 100);
+}
+
+int main(int argc, char* argv[]) {
+    CityConfig config;
+    string out = "sensors.replay";
+    size_t frames = 60;
+    int64_t interval_ms = 60000;
+    for (int i = 1; i < argc; i += 2) {
+        if (i + 1 == argc) {
+            fprintf(stderr, "Expected '--<setting> <value>', got '%s'\n", argv[i]);
+            return 1;
+        }
+        if (strcmp(argv[i], "--out") == 0) {
+            out = argv[i + 1];
+        } else if (strcmp(argv[i], "--frames") == 0) {
+            frames = strtoull(argv[i + 1], nullptr, 10);
+        } else if (strcmp(argv[i], "--interval-ms") == 0) {
+            interval_ms = strtoll(argv[i + 1], nullptr, 10);
+        } else if (strncmp(argv[i], "--", 2) != 0 || !applySetting(argv[i] + 2, argv[i + 1], config)) {
+            return 1;
+        }
+    }
+
+    CityState city(config.num_vehicles, config.num_sensors, config.num_cameras, 0, 0, 0, 0);
+    SensorReplayWriter writer;
+    if (!writer.open(out.c_str(), config.num_vehicles, config.num_cameras, config.num_sensors)) {
+        return 1;
+    }
+
+    auto start = chrono::high_resolution_clock::now();
+    for (size_t f = 0; f < frames; ++f) {
+        synthesizeFrame(city, config.seed, f);
+        if (!writer.writeFrame((int64_t)f * interval_ms, city)) {
+            fprintf(stderr, "Failed writing frame %zu to '%s'\n", f, out.c_str());
+            return 1;
+        }
+    }
+    if (!writer.close()) {
+        fprintf(stderr, "Failed finishing '%s'\n", out.c_str());
+        return 1;
+    }
+    chrono::duration<double> elapsed = chrono::high_resolution_clock::now() - start;
+
+    double bytes = sizeof(ReplayHeader) + (double)frames * writer.header.frame_bytes;
+    printf("Wrote %zu frames of %llu bytes to %s (%.1f MB, %.1f MB/s)\n", frames,
+           (unsigned long long)writer.header.frame_bytes, out.c_str(), bytes / 1e6, bytes / 1e6 / elapsed.count());
+    return 0;
+}
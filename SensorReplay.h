@@ -0,0 +1,264 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "CityState.h"
+
+// Binary replay files of timestamped sensor frames.
+//
+// A file is a 128-byte header followed by fixed-size frames. Each frame holds
+// a timestamp and one column per sensor kind, every column contiguous and
+// starting on a cache line, so a column maps straight onto the matching
+// CityState array:
+//
+//   header  | frame 0: timestamp | vehicle counts | density | AQI | noise | frame 1 ...
+//
+// The reader maps the file read-only and hands out pointers into the mapping,
+// so nothing is copied until a frame is loaded into CityState. Replay walks
+// the file in batches of about REPLAY_BATCH_BYTES: the next batch is
+// prefetched and the finished one released, which bounds resident memory
+// independently of the file size.
+
+#define REPLAY_MAGIC "TCSRPLY1"
+#define REPLAY_VERSION 1
+#define REPLAY_BATCH_BYTES (64u << 20)
+
+enum ReplayColumn {
+    REPLAY_VEHICLE_COUNT, // int32 per vehicle  -> vehicle_data
+    REPLAY_DENSITY,       // uint8 per camera   -> traffic_density
+    REPLAY_AIR_QUALITY,   // uint16 per sensor  -> air_quality_data
+    REPLAY_NOISE,         // uint8 per sensor   -> noise_data
+    REPLAY_COLUMNS
+};
+
+struct ReplayHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_bytes;
+    uint64_t num_frames;
+    uint64_t frame_bytes;
+    uint64_t num_vehicles;
+    uint64_t num_cameras;
+    uint64_t num_sensors;
+    uint64_t column_offset[REPLAY_COLUMNS]; // bytes from the start of a frame
+    uint64_t reserved[5];
+};
+static_assert(sizeof(ReplayHeader) == 128, "replay header is 128 bytes");
+
+inline uint64_t replayAlign(uint64_t bytes) {
+    return (bytes + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+}
+
+// Header for a city of the given size with an empty frame list.
+inline ReplayHeader makeReplayHeader(uint64_t vehicles, uint64_t cameras, uint64_t sensors) {
+    ReplayHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, REPLAY_MAGIC, sizeof(header.magic));
+    header.version = REPLAY_VERSION;
+    header.header_bytes = sizeof(ReplayHeader);
+    header.num_vehicles = vehicles;
+    header.num_cameras = cameras;
+    header.num_sensors = sensors;
+    uint64_t offset = CACHE_LINE_SIZE; // the timestamp gets a line of its own
+    const uint64_t column_bytes[REPLAY_COLUMNS] = {vehicles * sizeof(VehicleCount), cameras * sizeof(DensityPercent),
+                                                   sensors * sizeof(AirQualityIndex), sensors * sizeof(NoiseLevel)};
+    for (int c = 0; c < REPLAY_COLUMNS; ++c) {
+        header.column_offset[c] = offset;
+        offset += replayAlign(column_bytes[c]);
+    }
+    header.frame_bytes = offset;
+    return header;
+}
+
+// Appends frames to a new replay file. The frame count in the header is
+// written by close().
+class SensorReplayWriter {
+public:
+    ReplayHeader header;
+
+    ~SensorReplayWriter() {
+        close();
+    }
+
+    bool open(const char* path, uint64_t vehicles, uint64_t cameras, uint64_t sensors) {
+        header = makeReplayHeader(vehicles, cameras, sensors);
+        out = fopen(path, "wb");
+        if (out == nullptr) {
+            fprintf(stderr, "Cannot create replay file '%s'\n", path);
+            return false;
+        }
+        return fwrite(&header, sizeof(header), 1, out) == 1;
+    }
+
+    // Writes one frame from the CityState arrays the columns replay into.
+    bool writeFrame(int64_t timestamp_ms, const CityState& city) {
+        if (city.vehicle_data.size() != header.num_vehicles || city.traffic_density.size() != header.num_cameras ||
+            city.air_quality_data.size() != header.num_sensors || city.noise_data.size() != header.num_sensors) {
+            fprintf(stderr, "Replay frame does not match the file's city size\n");
+            return false;
+        }
+        bool ok = writePadded(&timestamp_ms, sizeof(timestamp_ms));
+        ok = ok && writePadded(city.vehicle_data.data(), city.vehicle_data.size() * sizeof(VehicleCount));
+        ok = ok && writePadded(city.traffic_density.data(), city.traffic_density.size() * sizeof(DensityPercent));
+        ok = ok && writePadded(city.air_quality_data.data(), city.air_quality_data.size() * sizeof(AirQualityIndex));
+        ok = ok && writePadded(city.noise_data.data(), city.noise_data.size() * sizeof(NoiseLevel));
+        if (ok) {
+            ++header.num_frames;
+        }
+        return ok;
+    }
+
+    bool close() {
+        if (out == nullptr) {
+            return true;
+        }
+        bool ok = fseek(out, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, out) == 1;
+        ok = fclose(out) == 0 && ok;
+        out = nullptr;
+        return ok;
+    }
+
+private:
+    FILE* out = nullptr;
+
+    bool writePadded(const void* data, size_t bytes) {
+        static const char zeros[CACHE_LINE_SIZE] = {};
+        size_t padding = replayAlign(bytes) - bytes;
+        return fwrite(data, 1, bytes, out) == bytes && fwrite(zeros, 1, padding, out) == padding;
+    }
+};
+
+// Read-only view of a replay file through one shared mapping.
+class SensorReplayReader {
+public:
+    ReplayHeader header;
+
+    ~SensorReplayReader() {
+        if (base != nullptr) {
+            munmap(base, mapped_bytes);
+        }
+    }
+
+    bool open(const char* path) {
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "Cannot open replay file '%s'\n", path);
+            return false;
+        }
+        struct stat st;
+        bool ok = fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(ReplayHeader);
+        if (ok) {
+            mapped_bytes = st.st_size;
+            void* mapping = mmap(nullptr, mapped_bytes, PROT_READ, MAP_SHARED, fd, 0);
+            ok = mapping != MAP_FAILED;
+            base = ok ? (uint8_t*)mapping : nullptr;
+        }
+        ::close(fd); // the mapping keeps the file open
+        if (!ok) {
+            fprintf(stderr, "Cannot map replay file '%s'\n", path);
+            return false;
+        }
+
+        memcpy(&header, base, sizeof(header));
+        if (memcmp(header.magic, REPLAY_MAGIC, sizeof(header.magic)) != 0 || header.version != REPLAY_VERSION) {
+            fprintf(stderr, "'%s' is not a version %d replay file\n", path, REPLAY_VERSION);
+            return false;
+        }
+        // The layout is a function of the city size, so a header whose frame
+        // size or column offsets differ is corrupt. No column can be larger
+        // than the file, which keeps the expected layout from overflowing.
+        bool sized = header.num_vehicles <= mapped_bytes && header.num_cameras <= mapped_bytes &&
+                     header.num_sensors <= mapped_bytes;
+        ReplayHeader expected = makeReplayHeader(header.num_vehicles, header.num_cameras, header.num_sensors);
+        bool consistent = sized && header.header_bytes == expected.header_bytes &&
+                          header.frame_bytes == expected.frame_bytes &&
+                          memcmp(header.column_offset, expected.column_offset, sizeof(header.column_offset)) == 0;
+        if (!consistent) {
+            fprintf(stderr, "Replay file '%s' has an inconsistent header\n", path);
+            return false;
+        }
+        // Divided rather than multiplied, so a huge frame count cannot wrap
+        if (header.num_frames > (mapped_bytes - header.header_bytes) / header.frame_bytes) {
+            fprintf(stderr, "Replay file '%s' is truncated\n", path);
+            return false;
+        }
+        madvise(base, mapped_bytes, MADV_SEQUENTIAL);
+        return true;
+    }
+
+    size_t numFrames() const { return header.num_frames; }
+
+    // Frames per batch so that a batch spans about REPLAY_BATCH_BYTES.
+    size_t batchFrames() const { return std::max<size_t>(1, REPLAY_BATCH_BYTES / header.frame_bytes); }
+
+    int64_t timestamp(size_t frame) const {
+        int64_t ts;
+        memcpy(&ts, frameBase(frame), sizeof(ts));
+        return ts;
+    }
+
+    template <typename T>
+    const T* column(size_t frame, ReplayColumn c) const {
+        return (const T*)(frameBase(frame) + header.column_offset[c]);
+    }
+
+    // Copies elements [begin, end) of one column of a frame into dst, which
+    // is indexed like the full column.
+    template <typename T>
+    void loadColumn(size_t frame, ReplayColumn c, T* dst, size_t begin, size_t end) const {
+        memcpy(dst + begin, column<T>(frame, c) + begin, (end - begin) * sizeof(T));
+    }
+
+    // Copies a whole frame into the CityState arrays it replays into.
+    void loadFrame(size_t frame, CityState& city) const {
+        loadColumn(frame, REPLAY_VEHICLE_COUNT, city.vehicle_data.data(), 0, city.vehicle_data.size());
+        loadColumn(frame, REPLAY_DENSITY, city.traffic_density.data(), 0, city.traffic_density.size());
+        loadColumn(frame, REPLAY_AIR_QUALITY, city.air_quality_data.data(), 0, city.air_quality_data.size());
+        loadColumn(frame, REPLAY_NOISE, city.noise_data.data(), 0, city.noise_data.size());
+    }
+
+    // Prefetch hint for frames [first, last).
+    void prefetch(size_t first, size_t last) const {
+        advise(first, last, MADV_WILLNEED);
+    }
+
+    // Drops frames [first, last) from this process's resident set; they are
+    // read back from the page cache or the file if touched again.
+    void release(size_t first, size_t last) const {
+        advise(first, last, MADV_DONTNEED);
+    }
+
+    // True if the file's city size is the one a CityState was built with.
+    bool matches(const CityState& city) const {
+        return city.vehicle_data.size() == header.num_vehicles && city.traffic_density.size() == header.num_cameras &&
+               city.air_quality_data.size() == header.num_sensors && city.noise_data.size() == header.num_sensors;
+    }
+
+private:
+    uint8_t* base = nullptr;
+    size_t mapped_bytes = 0;
+
+    const uint8_t* frameBase(size_t frame) const {
+        return base + header.header_bytes + frame * header.frame_bytes;
+    }
+
+    // madvise needs page-aligned starts; round the range outwards
+    void advise(size_t first, size_t last, int advice) const {
+        last = std::min(last, numFrames());
+        if (first >= last) {
+            return;
+        }
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t begin = (header.header_bytes + first * header.frame_bytes) / page * page;
+        size_t end = header.header_bytes + last * header.frame_bytes;
+        madvise(base + begin, end - begin, advice);
+    }
+};
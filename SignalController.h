@@ -0,0 +1,301 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "CityState.h"
+#include "RoadNetwork.h"
+
+// Adaptive signal control on the grid city.
+//
+// Each approach of each intersection keeps an estimate of its arrival rate,
+// smoothed from the camera reading for that approach, and of its queue,
+// advanced every one-second tick with a point-queue model: arrivals join,
+// and a green approach discharges at the saturation flow unless the queue it
+// feeds is full. Two policies pick the phase, north-south or east-west:
+//
+// - Max-pressure: after the minimum green, switch when the other phase's
+//   pressure (its queues minus the queues they discharge into) exceeds the
+//   current phase's by SIGNAL_PRESSURE_MARGIN.
+// - Webster: the cycle and the green split follow Webster's formulas from
+//   the critical flow ratio of each phase; a phase ends when its green runs
+//   out.
+//
+// A phase change starts with SIGNAL_YELLOW s of yellow and then all-red on
+// the old axis, SIGNAL_LOST_TIME s in total, before the new axis turns green.
+//
+// State is structure-of-arrays, one array per approach, so a tick is one
+// vectorized sweep over the intersections. Queues and rates are fixed point
+// (thousandths of a vehicle), so every thread count and MPI split makes the
+// same decisions. A controller updates a block of whole grid rows and reads
+// the queues one row past each end of its block, which an MPI rank fills in
+// from its neighbours (see boundaryRows() and setHaloRows()).
+//
+// Intersections marked with setCoordinated() belong to a green-wave
+// corridor: the controller leaves their lights alone and serves their
+// queues under the lights already in the plan.
+
+#define SIGNAL_SATURATION_FLOW 500 // mveh/s discharged from a green approach
+#define SIGNAL_ARRIVALS_PER_PERCENT 3 // mveh/s of arrivals per % camera occupancy
+#define SIGNAL_QUEUE_CAPACITY 40000 // mveh an approach link holds
+#define SIGNAL_MIN_GREEN 7 // s
+#define SIGNAL_YELLOW 3 // s
+#define SIGNAL_LOST_TIME 4 // s of yellow and all-red per phase change
+#define SIGNAL_MIN_CYCLE 40 // s, Webster
+#define SIGNAL_MAX_CYCLE 120 // s, Webster
+#define SIGNAL_PRESSURE_MARGIN 2000 // mveh, max-pressure hysteresis
+
+enum SignalPolicy : uint8_t { SIGNAL_MAX_PRESSURE, SIGNAL_WEBSTER };
+
+inline bool parseSignalPolicy(const std::string& name, SignalPolicy& policy) {
+    if (name == "max-pressure") {
+        policy = SIGNAL_MAX_PRESSURE;
+    } else if (name == "webster") {
+        policy = SIGNAL_WEBSTER;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+inline const char* signalPolicyName(SignalPolicy policy) {
+    return policy == SIGNAL_WEBSTER ? "webster" : "max-pressure";
+}
+
+struct ControlStats {
+    long switches = 0;       // phase changes started this tick
+    long queued_mveh = 0;    // vehicles queued after the tick, in thousandths
+    long cycle_seconds = 0;  // Webster cycle summed over the intersections
+    long coordinated = 0;    // intersections left to the green wave
+    double seconds = 0.0;    // controller latency for the tick
+};
+
+class SignalController {
+public:
+    // Controls intersections [begin, end), which must be whole grid rows
+    SignalController(int num_intersections, int begin, int end, SignalPolicy policy)
+        : n(num_intersections), width(RoadNetwork::gridWidth(num_intersections)), first(begin), last(end),
+          policy(policy), padded(num_intersections + 2 * RoadNetwork::gridWidth(num_intersections) + 2) {
+        for (int a = 0; a < NUM_APPROACHES; ++a) {
+            // One row (plus one) of zeros on each side stands for the empty
+            // roads beyond the grid's edge
+            queue[a].assign(padded, 0);
+            next_queue[a].assign(padded, 0);
+            arrivals[a].assign(num_intersections, 0);
+        }
+        readings.assign((size_t)num_intersections * NUM_APPROACHES, 0);
+        phase.assign(num_intersections, 0);
+        elapsed.assign(num_intersections, SIGNAL_LOST_TIME);
+        edges.assign(num_intersections, 0);
+        coordinated.assign(num_intersections, 0);
+        for (int i = 0; i < num_intersections; ++i) {
+            int x = i % width;
+            edges[i] = (x == 0 ? 1 : 0) | (x == width - 1 ? 2 : 0);
+        }
+    }
+
+    int begin() const { return first; }
+    int end() const { return last; }
+    SignalPolicy signalPolicy() const { return policy; }
+    uint64_t ticks() const { return tick_count; }
+
+    // Hands intersection i's lights to a coordinated plan (the green wave)
+    void setCoordinated(int i) { coordinated[i] = 1; }
+
+    // Camera occupancy per approach, NUM_APPROACHES per intersection
+    DensityPercent* approachReadings() { return readings.data(); }
+
+    // Fills the readings of intersections [from, to): approach a of
+    // intersection i reads camera (i * NUM_APPROACHES + a) mod num_cameras
+    void readCameras(const DensityPercent* cameras, size_t num_cameras, int from, int to) {
+        size_t camera = (size_t)from * NUM_APPROACHES % num_cameras;
+        for (size_t k = (size_t)from * NUM_APPROACHES; k < (size_t)to * NUM_APPROACHES; ++k) {
+            readings[k] = cameras[camera];
+            camera = camera + 1 == num_cameras ? 0 : camera + 1;
+        }
+    }
+
+    // Checkpoint sections (Checkpoint.h). The halo rows are not saved; they
+    // are exchanged again before the next update.
+    template <typename Archive>
+    void checkpoint(Archive& archive) {
+        static const char* const names[NUM_APPROACHES] = {"north", "east", "south", "west"};
+        for (int a = 0; a < NUM_APPROACHES; ++a) {
+            archive.section(std::string("signal.queue.") + names[a], q(a) + first, n, first, last);
+            archive.section(std::string("signal.arrivals.") + names[a], arrivals[a].data() + first, n, first, last);
+        }
+        archive.section("signal.phase", phase.data() + first, n, first, last);
+        archive.section("signal.elapsed", elapsed.data() + first, n, first, last);
+        archive.whole("signal.ticks", &tick_count, 1);
+    }
+
+    // Queue of approach a at intersection i, in mveh
+    int32_t queueAt(int a, int i) const { return queue[a][i + width + 1]; }
+
+    // The rows this block's neighbours read: the north approach queues of
+    // its first row and the south approach queues of its last row, `width`
+    // values each (zero-padded for a short last row).
+    void boundaryRows(int32_t* out) const {
+        std::fill(out, out + 2 * width, 0);
+        if (first < last) {
+            int last_row = (last - 1) / width * width;
+            std::copy(q(APPROACH_NORTH) + first, q(APPROACH_NORTH) + std::min(first + width, last), out);
+            std::copy(q(APPROACH_SOUTH) + last_row, q(APPROACH_SOUTH) + last, out + width);
+        }
+    }
+
+    // Halo rows from boundaryRows() of the blocks above and below; null
+    // where the block is at the edge of the grid
+    void setHaloRows(const int32_t* above, const int32_t* below) {
+        if (first >= last) {
+            return;
+        }
+        if (above != nullptr && first >= width) {
+            std::copy(above + width, above + 2 * width, q(APPROACH_SOUTH) + first - width);
+        }
+        if (below != nullptr && last < n) {
+            std::copy(below, below + std::min(width, n - last), q(APPROACH_NORTH) + last);
+        }
+    }
+
+    // One tick for the block: new arrival estimates from the approach
+    // readings, phase decisions, the lights written to `lights`
+    // (NUM_APPROACHES per intersection), and the queues served under them.
+    // Coordinated intersections keep the lights `lights` already holds.
+    ControlStats update(LightPhase* lights) {
+        auto start = std::chrono::steady_clock::now();
+        ControlStats stats;
+        long switches = 0, queued = 0, cycles = 0, held = 0;
+        int w = width;
+        const int32_t* qn = q(APPROACH_NORTH);
+        const int32_t* qe = q(APPROACH_EAST);
+        const int32_t* qs = q(APPROACH_SOUTH);
+        const int32_t* qw = q(APPROACH_WEST);
+        int32_t* nn = nq(APPROACH_NORTH);
+        int32_t* ne = nq(APPROACH_EAST);
+        int32_t* ns = nq(APPROACH_SOUTH);
+        int32_t* nw = nq(APPROACH_WEST);
+        int32_t* an = arrivals[APPROACH_NORTH].data();
+        int32_t* ae = arrivals[APPROACH_EAST].data();
+        int32_t* as = arrivals[APPROACH_SOUTH].data();
+        int32_t* aw = arrivals[APPROACH_WEST].data();
+        uint8_t* ph = phase.data();
+        int16_t* el = elapsed.data();
+        const uint8_t* edge = edges.data();
+        const uint8_t* coord = coordinated.data();
+        const DensityPercent* density = readings.data();
+        bool webster = policy == SIGNAL_WEBSTER;
+
+        #pragma omp taskloop simd default(shared) grainsize(4096) reduction(+:switches, queued, cycles, held)
+        for (int i = first; i < last; ++i) {
+            const DensityPercent* d = density + (size_t)i * NUM_APPROACHES;
+            int32_t ln = an[i] + (d[APPROACH_NORTH] * SIGNAL_ARRIVALS_PER_PERCENT - an[i]) / 4;
+            int32_t le = ae[i] + (d[APPROACH_EAST] * SIGNAL_ARRIVALS_PER_PERCENT - ae[i]) / 4;
+            int32_t ls = as[i] + (d[APPROACH_SOUTH] * SIGNAL_ARRIVALS_PER_PERCENT - as[i]) / 4;
+            int32_t lw = aw[i] + (d[APPROACH_WEST] * SIGNAL_ARRIVALS_PER_PERCENT - aw[i]) / 4;
+            an[i] = ln;
+            ae[i] = le;
+            as[i] = ls;
+            aw[i] = lw;
+
+            // Downstream queues: heading south from the north approach, and
+            // so on; nothing beyond the grid's edge
+            int32_t dn = qn[i + w];
+            int32_t ds = qs[i - w];
+            int32_t de = (edge[i] & 1) ? 0 : qe[i - 1];
+            int32_t dw = (edge[i] & 2) ? 0 : qw[i + 1];
+
+            // Webster: critical flow ratios, cycle and north-south green
+            int32_t crit_ns = std::max(ln, ls), crit_ew = std::max(le, lw);
+            int32_t y = std::min(crit_ns + crit_ew, SIGNAL_SATURATION_FLOW * 19 / 20);
+            int32_t lost = 2 * SIGNAL_LOST_TIME;
+            int32_t cycle = (3 * lost / 2 + 5) * SIGNAL_SATURATION_FLOW / (SIGNAL_SATURATION_FLOW - y);
+            cycle = std::min(std::max(cycle, SIGNAL_MIN_CYCLE), SIGNAL_MAX_CYCLE);
+            int32_t green_ns = crit_ns + crit_ew > 0 ? (cycle - lost) * crit_ns / (crit_ns + crit_ew) : (cycle - lost) / 2;
+            green_ns = std::max<int32_t>(green_ns, SIGNAL_MIN_GREEN);
+            int32_t green_ew = std::max<int32_t>(cycle - lost - green_ns, SIGNAL_MIN_GREEN);
+
+            // Max-pressure
+            int32_t pressure_ns = (qn[i] - dn) + (qs[i] - ds);
+            int32_t pressure_ew = (qe[i] - de) + (qw[i] - dw);
+
+            bool on_ns = ph[i] == 0;
+            bool corridor = coord[i] != 0;
+            int32_t green = el[i] - SIGNAL_LOST_TIME; // s of green so far
+            bool change = webster ? green >= (on_ns ? green_ns : green_ew)
+                                  : green >= SIGNAL_MIN_GREEN &&
+                                        (on_ns ? pressure_ew - pressure_ns : pressure_ns - pressure_ew) > SIGNAL_PRESSURE_MARGIN;
+            change = change && !corridor;
+            on_ns = change ? !on_ns : on_ns;
+            int16_t e = change ? 0 : el[i] + 1;
+            ph[i] = on_ns ? 0 : 1;
+            el[i] = std::min<int16_t>(e, 30000);
+            switches += change;
+            cycles += cycle;
+            held += corridor;
+
+            // Lights for the coming second: the old axis clears, then the
+            // new one turns green
+            bool clearing = e < SIGNAL_LOST_TIME;
+            LightPhase released = clearing ? (e < SIGNAL_YELLOW ? LightPhase::Yellow : LightPhase::Red) : LightPhase::Red;
+            LightPhase ns_light = on_ns ? (clearing ? LightPhase::Red : LightPhase::Green) : released;
+            LightPhase ew_light = on_ns ? released : (clearing ? LightPhase::Red : LightPhase::Green);
+            LightPhase* l = lights + (size_t)i * NUM_APPROACHES;
+            l[APPROACH_NORTH] = corridor ? l[APPROACH_NORTH] : ns_light;
+            l[APPROACH_SOUTH] = corridor ? l[APPROACH_SOUTH] : ns_light;
+            l[APPROACH_EAST] = corridor ? l[APPROACH_EAST] : ew_light;
+            l[APPROACH_WEST] = corridor ? l[APPROACH_WEST] : ew_light;
+
+            // Point queues: a green approach discharges unless the queue it
+            // feeds is full
+            bool serve_n = l[APPROACH_NORTH] == LightPhase::Green, serve_s = l[APPROACH_SOUTH] == LightPhase::Green;
+            bool serve_e = l[APPROACH_EAST] == LightPhase::Green, serve_w = l[APPROACH_WEST] == LightPhase::Green;
+            int32_t out_n = serve_n && dn < SIGNAL_QUEUE_CAPACITY ? std::min(qn[i] + ln, SIGNAL_SATURATION_FLOW) : 0;
+            int32_t out_s = serve_s && ds < SIGNAL_QUEUE_CAPACITY ? std::min(qs[i] + ls, SIGNAL_SATURATION_FLOW) : 0;
+            int32_t out_e = serve_e && de < SIGNAL_QUEUE_CAPACITY ? std::min(qe[i] + le, SIGNAL_SATURATION_FLOW) : 0;
+            int32_t out_w = serve_w && dw < SIGNAL_QUEUE_CAPACITY ? std::min(qw[i] + lw, SIGNAL_SATURATION_FLOW) : 0;
+            nn[i] = std::min(qn[i] + ln - out_n, SIGNAL_QUEUE_CAPACITY);
+            ns[i] = std::min(qs[i] + ls - out_s, SIGNAL_QUEUE_CAPACITY);
+            ne[i] = std::min(qe[i] + le - out_e, SIGNAL_QUEUE_CAPACITY);
+            nw[i] = std::min(qw[i] + lw - out_w, SIGNAL_QUEUE_CAPACITY);
+            queued += (long)nn[i] + ns[i] + ne[i] + nw[i];
+        }
+
+        for (int a = 0; a < NUM_APPROACHES; ++a) {
+            queue[a].swap(next_queue[a]);
+        }
+        ++tick_count;
+        stats.switches = switches;
+        stats.queued_mveh = queued;
+        stats.cycle_seconds = cycles;
+        stats.coordinated = held;
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return stats;
+    }
+
+private:
+    int n;
+    int width;
+    int first, last;
+    SignalPolicy policy;
+    size_t padded; // queue array length: the grid plus a padding row on each side
+    uint64_t tick_count = 0;
+
+    // Queues are indexed by intersection + width + 1, so the neighbours of
+    // every intersection are in bounds
+    AlignedVector<int32_t> queue[NUM_APPROACHES];
+    AlignedVector<int32_t> next_queue[NUM_APPROACHES];
+    AlignedVector<int32_t> arrivals[NUM_APPROACHES]; // smoothed, mveh/s
+    AlignedVector<DensityPercent> readings;
+    AlignedVector<uint8_t> phase;   // 0 north-south, 1 east-west
+    AlignedVector<int16_t> elapsed; // s since the last phase change
+    AlignedVector<uint8_t> edges;   // 1 west edge, 2 east edge
+    AlignedVector<uint8_t> coordinated; // lights set by the green wave
+
+    int32_t* q(int a) { return queue[a].data() + width + 1; }
+    const int32_t* q(int a) const { return queue[a].data() + width + 1; }
+    int32_t* nq(int a) { return next_queue[a].data() + width + 1; }
+};
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <omp.h>
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Telemetry.h"
+#include "Trace.h"
+
+// Dependency-aware scheduler for the OpenMP kernels.
+//
+// Each kernel is added with the buffers it reads and writes. A kernel depends
+// on every earlier kernel it conflicts with (read-after-write, write-after-
+// read, write-after-write), so the graph keeps the order kernels were added
+// in wherever it matters and nowhere else. run() turns the graph into OpenMP
+// tasks with depend clauses on one team; kernels parallelize their own loops
+// with taskloop, so independent kernels and the chunks of a large kernel
+// share the same threads instead of opening nested teams.
+
+struct TaskNode {
+    std::string name;
+    std::vector<const void*> reads;
+    std::vector<const void*> writes;
+    std::function<void()> body;
+    std::vector<int> predecessors;
+    double elements = 0.0; // work items per run, for throughput
+
+    // Filled by run(): seconds since the start of the run
+    double start = 0.0;
+    double finish = 0.0;
+    int thread = -1;
+
+    double seconds() const { return finish - start; }
+};
+
+class TaskGraph {
+public:
+    std::vector<TaskNode> nodes;
+
+    int add(const char* name, std::vector<const void*> reads, std::vector<const void*> writes, std::function<void()> body,
+            double elements = 0.0) {
+        TaskNode node;
+        node.name = name;
+        node.elements = elements;
+        node.reads = std::move(reads);
+        node.writes = std::move(writes);
+        node.body = std::move(body);
+        for (int j = 0; j < (int)nodes.size(); ++j) {
+            if (conflicts(node, nodes[j])) {
+                node.predecessors.push_back(j);
+            }
+        }
+        nodes.push_back(std::move(node));
+        return nodes.size() - 1;
+    }
+
+    // Runs every kernel once and returns the wall time in seconds.
+    double run() {
+        std::vector<char> tokens(nodes.size());
+        char* done = tokens.data(); // dependence tokens, one per node
+        (void)done; // only referenced from depend clauses
+        double origin = omp_get_wtime();
+
+        #pragma omp parallel
+        {
+            TRACE_THREAD("OpenMP thread", omp_get_thread_num());
+            #pragma omp single
+            for (int i = 0; i < (int)nodes.size(); ++i) {
+                TaskNode* node = &nodes[i];
+                const int* preds = node->predecessors.data();
+                int num_preds = node->predecessors.size();
+                #pragma omp task firstprivate(node) depend(iterator(j = 0:num_preds), in: done[preds[j]]) depend(out: done[i])
+                {
+                    TRACE_KERNEL(node->name.c_str());
+                    node->start = omp_get_wtime() - origin;
+                    node->thread = omp_get_thread_num();
+                    node->body();
+                    node->finish = omp_get_wtime() - origin;
+                }
+            }
+        }
+        return omp_get_wtime() - origin;
+    }
+
+    // Runs one kernel on its own team, ignoring the graph, and returns its
+    // wall time in seconds. Used to benchmark kernels in isolation.
+    double runOne(int i) {
+        double start = omp_get_wtime();
+        #pragma omp parallel
+        #pragma omp single
+        {
+            TRACE_KERNEL(nodes[i].name.c_str());
+            nodes[i].body();
+        }
+        return omp_get_wtime() - start;
+    }
+
+    // Longest chain of dependent kernels by measured time. Nodes are stored
+    // in a topological order, so one forward pass suffices.
+    std::vector<int> criticalPath(double* length = nullptr) const {
+        int n = nodes.size();
+        std::vector<double> longest(n, 0.0);
+        std::vector<int> via(n, -1);
+        int last = -1;
+        for (int i = 0; i < n; ++i) {
+            for (int p : nodes[i].predecessors) {
+                if (longest[p] > longest[i]) {
+                    longest[i] = longest[p];
+                    via[i] = p;
+                }
+            }
+            longest[i] += nodes[i].seconds();
+            if (last < 0 || longest[i] > longest[last]) {
+                last = i;
+            }
+        }
+        std::vector<int> path;
+        for (int i = last; i >= 0; i = via[i]) {
+            path.push_back(i);
+        }
+        std::reverse(path.begin(), path.end());
+        if (length != nullptr) {
+            *length = last >= 0 ? longest[last] : 0.0;
+        }
+        return path;
+    }
+
+    // Per-kernel timeline and the critical path against the total work.
+    void report(double wall_seconds) const {
+        double work = 0.0;
+        for (const TaskNode& node : nodes) {
+            work += node.seconds();
+            logMessage(LOG_VERBOSE, "Task Graph: %-28s thread %2d  %9.3f -> %9.3f ms  (after %zu)", node.name.c_str(),
+                       node.thread, 1e3 * node.start, 1e3 * node.finish, node.predecessors.size());
+        }
+        double length = 0.0;
+        std::vector<int> path = criticalPath(&length);
+        std::string chain;
+        for (int i : path) {
+            chain += (chain.empty() ? "" : " -> ") + nodes[i].name;
+        }
+        logMessage(LOG_SUMMARY, "Task Graph: %zu kernels, %.3f ms wall, %.3f ms work, critical path %.3f ms (parallelism %.2f).",
+                   nodes.size(), 1e3 * wall_seconds, 1e3 * work, 1e3 * length, length > 0.0 ? work / length : 0.0);
+        logMessage(LOG_SUMMARY, "Task Graph: critical path %s", chain.c_str());
+    }
+
+private:
+    static bool overlaps(const std::vector<const void*>& a, const std::vector<const void*>& b) {
+        for (const void* x : a) {
+            if (std::find(b.begin(), b.end(), x) != b.end()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool conflicts(const TaskNode& later, const TaskNode& earlier) {
+        return overlaps(later.reads, earlier.writes) || overlaps(later.writes, earlier.reads) ||
+               overlaps(later.writes, earlier.writes);
+    }
+};
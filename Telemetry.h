@@ -0,0 +1,237 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Asynchronous, batched log sink for the kernels.
+//
+// Each producing thread owns a single-producer/single-consumer ring of fixed
+// size records, so logging from inside a parallel loop is a snprintf plus two
+// atomic stores: no lock, no stream, no flush. A background writer thread
+// drains all rings, batches the text and writes it to stdout.
+//
+// A message longer than one record spills over consecutive records that are
+// published together; one longer than LOG_MESSAGE_SIZE ends in "...".
+// Messages logged while the writer is not running are printed by the next
+// start() or stop().
+
+enum LogLevel { LOG_OFF = 0, LOG_SUMMARY = 1, LOG_VERBOSE = 2 };
+
+#define LOG_RECORD_SIZE 128
+#define LOG_MESSAGE_SIZE 1024 // longest message before it is cut short
+#define LOG_RING_CAPACITY 4096 // records per thread, must be a power of two
+#define MAX_LOG_RINGS 1024
+
+struct LogRecord {
+    char text[LOG_RECORD_SIZE];
+    bool continued; // the message goes on in the next record
+};
+
+class LogRing {
+public:
+    // Producer side. Returns false without publishing when the ring has no
+    // room for the message; args is left unread so the caller can retry.
+    bool push(const char* fmt, va_list args) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        size_t free = LOG_RING_CAPACITY - (head - tail_.load(std::memory_order_acquire));
+        if (free == 0) {
+            return false;
+        }
+        // Common case: the message fits one record
+        LogRecord& record = records_[head & (LOG_RING_CAPACITY - 1)];
+        va_list copy;
+        va_copy(copy, args);
+        int length = vsnprintf(record.text, LOG_RECORD_SIZE, fmt, copy);
+        va_end(copy);
+        if (length < LOG_RECORD_SIZE) {
+            record.continued = false;
+            head_.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        char message[LOG_MESSAGE_SIZE];
+        va_copy(copy, args);
+        length = vsnprintf(message, LOG_MESSAGE_SIZE, fmt, copy);
+        va_end(copy);
+        if (length >= LOG_MESSAGE_SIZE) {
+            length = LOG_MESSAGE_SIZE - 1;
+            memcpy(message + length - 3, "...", 3);
+        }
+        size_t chunk = LOG_RECORD_SIZE - 1;
+        size_t records = (length + chunk - 1) / chunk;
+        if (records > free) {
+            return false;
+        }
+        for (size_t k = 0; k < records; ++k) {
+            LogRecord& part = records_[(head + k) & (LOG_RING_CAPACITY - 1)];
+            size_t bytes = std::min(chunk, (size_t)length - k * chunk);
+            memcpy(part.text, message + k * chunk, bytes);
+            part.text[bytes] = '\0';
+            part.continued = k + 1 < records;
+        }
+        head_.store(head + records, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side: the writer thread, or start() / stop() while it is not
+    // running.
+    void drain(std::string& out) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t head = head_.load(std::memory_order_acquire);
+        for (; tail != head; ++tail) {
+            const LogRecord& record = records_[tail & (LOG_RING_CAPACITY - 1)];
+            out += record.text;
+            if (!record.continued) {
+                out += '\n';
+            }
+        }
+        tail_.store(tail, std::memory_order_release);
+    }
+
+private:
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+    LogRecord records_[LOG_RING_CAPACITY];
+};
+
+class TelemetrySink {
+public:
+    static TelemetrySink& instance() {
+        static TelemetrySink sink;
+        return sink;
+    }
+
+    // Prints what was logged before, then starts the writer unless the
+    // level is LOG_OFF.
+    void start(LogLevel level) {
+        if (!running_.load(std::memory_order_acquire)) {
+            std::string batch;
+            drainAll(batch);
+        }
+        level_.store(level, std::memory_order_relaxed);
+        if (level != LOG_OFF && !running_.exchange(true)) {
+            writer_ = std::thread(&TelemetrySink::writerLoop, this);
+        }
+    }
+
+    // Stops the writer and prints everything logged so far.
+    void stop() {
+        if (running_.exchange(false)) {
+            writer_.join();
+        }
+        std::string batch;
+        drainAll(batch);
+        size_t dropped = dropped_.exchange(0);
+        if (dropped > 0) {
+            fprintf(stdout, "Telemetry: dropped %zu messages.\n", dropped);
+            fflush(stdout);
+        }
+    }
+
+    bool enabled(LogLevel level) const {
+        return level <= level_.load(std::memory_order_relaxed);
+    }
+
+    void log(LogLevel level, const char* fmt, va_list args) {
+        if (!enabled(level)) {
+            return;
+        }
+        LogRing* ring = localRing();
+        // A full ring means this thread is more than a ring ahead of the
+        // writer; yield until it catches up rather than losing the message.
+        while (ring == nullptr || !ring->push(fmt, args)) {
+            if (ring == nullptr || !running_.load(std::memory_order_acquire)) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+private:
+    TelemetrySink() = default;
+
+    ~TelemetrySink() {
+        stop();
+    }
+
+    // Registers the calling thread's ring on first use. This is the only
+    // locked path and runs once per thread.
+    LogRing* localRing() {
+        thread_local LogRing* ring = nullptr;
+        if (ring == nullptr) {
+            std::lock_guard<std::mutex> lock(registry_mutex_);
+            size_t count = ring_count_.load(std::memory_order_relaxed);
+            if (count == MAX_LOG_RINGS) {
+                return nullptr;
+            }
+            owned_.emplace_back(new LogRing());
+            ring = owned_.back().get();
+            rings_[count] = ring;
+            ring_count_.store(count + 1, std::memory_order_release);
+        }
+        return ring;
+    }
+
+    void drainAll(std::string& batch) {
+        size_t count = ring_count_.load(std::memory_order_acquire);
+        for (size_t i = 0; i < count; ++i) {
+            rings_[i]->drain(batch);
+        }
+        if (!batch.empty()) {
+            fwrite(batch.data(), 1, batch.size(), stdout);
+            fflush(stdout);
+            batch.clear();
+        }
+    }
+
+    void writerLoop() {
+        std::string batch;
+        batch.reserve(1 << 16);
+        while (running_.load(std::memory_order_acquire)) {
+            drainAll(batch);
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+        drainAll(batch);
+    }
+
+    std::atomic<int> level_{LOG_SUMMARY};
+    std::atomic<bool> running_{false};
+    std::atomic<size_t> dropped_{0};
+    std::atomic<size_t> ring_count_{0};
+    LogRing* rings_[MAX_LOG_RINGS] = {};
+    std::vector<std::unique_ptr<LogRing>> owned_;
+    std::mutex registry_mutex_;
+    std::thread writer_;
+};
+
+inline bool logEnabled(LogLevel level) {
+    return TelemetrySink::instance().enabled(level);
+}
+
+// printf-style logging; a no-op above the configured level.
+inline void logMessage(LogLevel level, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+inline void logMessage(LogLevel level, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    TelemetrySink::instance().log(level, fmt, args);
+    va_end(args);
+}
+
+// Parses "off", "summary" or "verbose"; anything else keeps the default.
+inline LogLevel parseLogLevel(const char* name, LogLevel fallback) {
+    if (strcmp(name, "off") == 0) return LOG_OFF;
+    if (strcmp(name, "summary") == 0) return LOG_SUMMARY;
+    if (strcmp(name, "verbose") == 0) return LOG_VERBOSE;
+    return fallback;
+}
@@ -0,0 +1,399 @@
+#pragma once
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Scoped spans and counters, written as Chrome trace / Perfetto JSON.
+//
+// Each thread records into its own fixed-size event buffer, registered on
+// first use as in Telemetry.h, so a span is two clock reads and a store: no
+// lock, no allocation, no formatting. The buffer of a thread that exits is
+// handed to the next new thread, so short-lived threads (the checkpoint
+// writer) share one buffer and one track. The buffers are turned into JSON
+// once, at the end of the run (--trace <file>); the MPI build gathers every
+// rank's events at rank 0, one trace process per rank. Open the file in
+// chrome://tracing or ui.perfetto.dev.
+//
+//   TRACE_KERNEL(name)              span of a kernel, with hardware counters
+//   TRACE_SCOPE(name, category)     span of the enclosing scope
+//   TRACE_MPI(name, kernel)         span of an MPI call issued for `kernel`
+//   TRACE_COUNTER(name, value)      counter sample
+//   TRACE_THREAD(name, index)       names the calling thread "name index"
+//
+// With --trace-counters 1 kernel spans also carry the cycles, instructions
+// and last-level cache misses of the recording thread (perf_event_open; the
+// counts of a kernel's taskloop chunks on other threads are not included).
+//
+// Spans are only recorded while tracing is on; otherwise a macro costs one
+// relaxed load. Compiling with -DNO_TRACING removes the macros entirely.
+
+#define TRACE_BUFFER_EVENTS (1 << 14) // per thread; later events are dropped
+#define MAX_TRACE_THREADS 1024
+#define TRACE_NAME_BYTES 32
+#define TRACE_HW_COUNTERS 3 // cycles, instructions, LLC misses
+
+struct TraceEvent {
+    const char* name;
+    const char* category;
+    const char* kernel; // issuing kernel of an MPI span, or null
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    int64_t value;      // counter sample
+    uint64_t hw[TRACE_HW_COUNTERS]; // deltas over the span, if read
+    char phase;         // 'X' span, 'C' counter
+    bool has_hw;
+};
+
+// One thread's cycle, instruction and cache-miss counters, read as a group
+class HardwareCounters {
+public:
+    ~HardwareCounters() {
+        reset();
+    }
+
+    void reset() {
+        for (int& fd : fds) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            fd = -1;
+        }
+    }
+
+    bool open() {
+        static const uint64_t events[TRACE_HW_COUNTERS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                           PERF_COUNT_HW_CACHE_MISSES};
+        for (int c = 0; c < TRACE_HW_COUNTERS; ++c) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = events[c];
+            attr.disabled = c == 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            fds[c] = syscall(SYS_perf_event_open, &attr, 0, -1, c == 0 ? -1 : fds[0], 0);
+            if (fds[c] < 0) {
+                return false;
+            }
+        }
+        return ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP) == 0;
+    }
+
+    bool read(uint64_t* values) const {
+        struct {
+            uint64_t count;
+            uint64_t values[TRACE_HW_COUNTERS];
+        } group;
+        if (::read(fds[0], &group, sizeof(group)) != sizeof(group)) {
+            return false;
+        }
+        memcpy(values, group.values, sizeof(group.values));
+        return true;
+    }
+
+private:
+    int fds[TRACE_HW_COUNTERS] = {-1, -1, -1};
+};
+
+struct TraceBuffer {
+    std::vector<TraceEvent> events; // reserved on registration, never grows
+    size_t dropped = 0;
+    int tid = 0;
+    char name[TRACE_NAME_BYTES] = "";
+    HardwareCounters counters;
+    int counters_state = 0; // 0 not opened yet, 1 open, -1 unavailable
+
+    void push(const TraceEvent& event) {
+        if (events.size() < events.capacity()) {
+            events.push_back(event);
+        } else {
+            ++dropped;
+        }
+    }
+};
+
+class Tracer {
+public:
+    static Tracer& instance() {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    // Starts recording; timestamps count from here. The calling thread is
+    // named "main". Reports on stderr if hardware counters are unavailable.
+    void start(bool hardware_counters) {
+#ifdef NO_TRACING
+        (void)hardware_counters;
+        fprintf(stderr, "Tracing was compiled out (NO_TRACING); no trace is recorded\n");
+#else
+        origin = std::chrono::steady_clock::now();
+        use_counters = hardware_counters;
+        nameThread("main");
+        if (use_counters && !threadCounters(localBuffer())) {
+            fprintf(stderr, "Hardware counters unavailable (perf_event_open); tracing without them\n");
+        }
+        active_.store(true, std::memory_order_relaxed);
+#endif
+    }
+
+    // Stops recording. The buffers are read afterwards, once the threads
+    // that filled them are idle.
+    void stop() {
+        active_.store(false, std::memory_order_relaxed);
+    }
+
+    bool active() const { return active_.load(std::memory_order_relaxed); }
+
+    uint64_t now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+    }
+
+    void nameThread(const char* name, int index = -1) {
+        TraceBuffer* buffer = localBuffer();
+        if (buffer != nullptr && buffer->name[0] == '\0') {
+            if (index < 0) {
+                snprintf(buffer->name, TRACE_NAME_BYTES, "%s", name);
+            } else {
+                snprintf(buffer->name, TRACE_NAME_BYTES, "%s %d", name, index);
+            }
+        }
+    }
+
+    void counter(const char* name, int64_t value) {
+        if (!active()) {
+            return;
+        }
+        TraceBuffer* buffer = localBuffer();
+        if (buffer != nullptr) {
+            buffer->push({name, "counter", nullptr, now(), 0, value, {}, 'C', false});
+        }
+    }
+
+    // The calling thread's buffer
+    TraceBuffer* localBuffer() {
+        struct Registration {
+            TraceBuffer* buffer = nullptr;
+            ~Registration() {
+                if (buffer != nullptr) {
+                    Tracer::instance().retire(buffer);
+                }
+            }
+        };
+        thread_local Registration local;
+        if (local.buffer == nullptr) {
+            local.buffer = acquire();
+        }
+        return local.buffer;
+    }
+
+    // The calling thread's counters, opened on first use if requested
+    bool threadCounters(TraceBuffer* buffer) {
+        if (!use_counters || buffer == nullptr) {
+            return false;
+        }
+        if (buffer->counters_state == 0) {
+            buffer->counters_state = buffer->counters.open() ? 1 : -1;
+        }
+        return buffer->counters_state > 0;
+    }
+
+    size_t numThreads() const { return buffer_count.load(std::memory_order_acquire); }
+
+    size_t numEvents() const {
+        size_t total = 0;
+        for (size_t i = 0; i < numThreads(); ++i) {
+            total += buffers[i]->events.size();
+        }
+        return total;
+    }
+
+    size_t dropped() const {
+        size_t total = 0;
+        for (size_t i = 0; i < numThreads(); ++i) {
+            total += buffers[i]->dropped;
+        }
+        return total;
+    }
+
+    // The recorded events as trace-event JSON objects, each followed by
+    // ",\n", under process `pid` named `process`
+    std::string events(int pid, const char* process) const {
+        std::string out;
+        char line[512];
+        snprintf(line, sizeof(line), "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+                 pid, process);
+        out += line;
+        for (size_t i = 0; i < numThreads(); ++i) {
+            const TraceBuffer& buffer = *buffers[i];
+            if (buffer.events.empty()) {
+                continue;
+            }
+            snprintf(line, sizeof(line),
+                     "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n", pid,
+                     buffer.tid, buffer.name[0] != '\0' ? buffer.name : "thread");
+            out += line;
+            for (const TraceEvent& e : buffer.events) {
+                int n = snprintf(line, sizeof(line), "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,",
+                                 e.name, e.category, e.phase, e.start_ns / 1e3);
+                if (e.phase == 'C') {
+                    n += snprintf(line + n, sizeof(line) - n, "\"pid\":%d,\"tid\":%d,\"args\":{\"value\":%lld}}", pid,
+                                  buffer.tid, (long long)e.value);
+                } else {
+                    n += snprintf(line + n, sizeof(line) - n, "\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{",
+                                  e.duration_ns / 1e3, pid, buffer.tid);
+                    const char* separator = "";
+                    if (e.kernel != nullptr) {
+                        n += snprintf(line + n, sizeof(line) - n, "\"kernel\":\"%s\"", e.kernel);
+                        separator = ",";
+                    }
+                    if (e.has_hw) {
+                        n += snprintf(line + n, sizeof(line) - n,
+                                      "%s\"cycles\":%llu,\"instructions\":%llu,\"llc_misses\":%llu,\"ipc\":%.2f",
+                                      separator, (unsigned long long)e.hw[0], (unsigned long long)e.hw[1],
+                                      (unsigned long long)e.hw[2], e.hw[0] > 0 ? (double)e.hw[1] / e.hw[0] : 0.0);
+                    }
+                    snprintf(line + n, sizeof(line) - n, "}}");
+                }
+                out += line;
+                out += ",\n";
+            }
+        }
+        return out;
+    }
+
+    // Writes events (as from events(), possibly of several processes) as a
+    // trace file
+    static bool writeFile(const std::string& path, const std::string& events) {
+        FILE* file = fopen(path.c_str(), "w");
+        if (file == nullptr) {
+            fprintf(stderr, "Cannot write trace '%s'\n", path.c_str());
+            return false;
+        }
+        size_t length = events.size() >= 2 ? events.size() - 2 : 0; // drop the last ",\n"
+        bool ok = fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file) >= 0 &&
+                  fwrite(events.data(), 1, length, file) == length && fputs("\n]}\n", file) >= 0;
+        ok = fclose(file) == 0 && ok;
+        if (!ok) {
+            fprintf(stderr, "Cannot write trace '%s'\n", path.c_str());
+        }
+        return ok;
+    }
+
+private:
+    Tracer() = default;
+
+    std::atomic<bool> active_{false};
+    bool use_counters = false;
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    std::atomic<size_t> buffer_count{0};
+    TraceBuffer* buffers[MAX_TRACE_THREADS] = {};
+    std::vector<std::unique_ptr<TraceBuffer>> owned;
+    std::vector<TraceBuffer*> retired; // of threads that exited
+    std::mutex registry_mutex;
+
+    // A retired buffer, or a new one. This is the only locked path and runs
+    // once per thread.
+    TraceBuffer* acquire() {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        if (!retired.empty()) {
+            TraceBuffer* buffer = retired.back();
+            retired.pop_back();
+            buffer->counters.reset(); // they counted the exited thread
+            buffer->counters_state = 0;
+            return buffer;
+        }
+        size_t count = buffer_count.load(std::memory_order_relaxed);
+        if (count == MAX_TRACE_THREADS) {
+            return nullptr;
+        }
+        owned.emplace_back(new TraceBuffer());
+        TraceBuffer* buffer = owned.back().get();
+        buffer->events.reserve(TRACE_BUFFER_EVENTS);
+        buffer->tid = count;
+        buffers[count] = buffer;
+        buffer_count.store(count + 1, std::memory_order_release);
+        return buffer;
+    }
+
+    void retire(TraceBuffer* buffer) {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        retired.push_back(buffer);
+    }
+};
+
+// Records the enclosing scope as one span on the calling thread
+class TraceScope {
+public:
+    TraceScope(const char* name, const char* category, const char* kernel = nullptr, bool hardware = false) {
+        Tracer& tracer = Tracer::instance();
+        if (!tracer.active()) {
+            return;
+        }
+        buffer = tracer.localBuffer();
+        if (buffer == nullptr) {
+            return;
+        }
+        event = {name, category, kernel, 0, 0, 0, {}, 'X', false};
+        event.has_hw = hardware && tracer.threadCounters(buffer) && buffer->counters.read(event.hw);
+        event.start_ns = tracer.now();
+    }
+
+    ~TraceScope() {
+        if (buffer == nullptr) {
+            return;
+        }
+        Tracer& tracer = Tracer::instance();
+        event.duration_ns = tracer.now() - event.start_ns;
+        uint64_t hw[TRACE_HW_COUNTERS];
+        if (event.has_hw && buffer->counters.read(hw)) {
+            for (int c = 0; c < TRACE_HW_COUNTERS; ++c) {
+                event.hw[c] = hw[c] - event.hw[c];
+            }
+        } else {
+            event.has_hw = false;
+        }
+        buffer->push(event);
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    TraceBuffer* buffer = nullptr;
+    TraceEvent event;
+};
+
+#ifndef NO_TRACING
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_KERNEL(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name, "kernel", nullptr, true)
+#define TRACE_SCOPE(name, category) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name, category)
+#define TRACE_MPI(name, kernel) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name, "mpi", kernel)
+#define TRACE_COUNTER(name, value) Tracer::instance().counter(name, value)
+#define TRACE_THREAD(name, index)                      \
+    do {                                               \
+        if (Tracer::instance().active()) {             \
+            Tracer::instance().nameThread(name, index); \
+        }                                              \
+    } while (0)
+#else
+#define TRACE_KERNEL(name) ((void)0)
+#define TRACE_SCOPE(name, category) ((void)0)
+#define TRACE_MPI(name, kernel) ((void)0)
+#define TRACE_COUNTER(name, value) ((void)0)
+#define TRACE_THREAD(name, index) ((void)0)
+#endif
@@ -0,0 +1,257 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+#include "CityState.h"
+#include "SensorRNG.h"
+
+// Holt-Winters forecasting of daily traffic volume per road segment.
+//
+// Every segment has an additive Holt-Winters model with a weekly season:
+//
+//   level  = alpha * (x - season[t]) + (1 - alpha) * (level + trend)
+//   trend  = beta * (level - previous level) + (1 - beta) * trend
+//   season[t] = gamma * (x - level) + (1 - gamma) * season[t]
+//
+// fit() picks alpha, beta and gamma per segment from a small grid by the
+// squared one-step forecast error over the recorded history. addDay() then
+// folds in each new day in O(1) per segment, and predict() writes the next
+// FORECAST_DAYS days for all segments.
+//
+// The recurrence is sequential in time but independent across segments, so
+// every pass runs a block of segments in lockstep: a taskloop over blocks
+// with a SIMD loop across the block's segments inside each day. The model
+// state is structure-of-arrays and the seasonal factors are stored
+// slot-major for the same reason.
+//
+// History is the HISTORY_DAYS x segments ring in CityState: day d is row
+// d % HISTORY_DAYS. A forecaster covers segments [begin, end) of a row, so an
+// MPI rank keeps models only for its own block.
+
+#define FORECAST_SEASON 7       // days
+#define FORECAST_REFIT_DAYS 7   // days between refits of the smoothing parameters
+#define FORECAST_BLOCK 256      // segments per task
+
+// Smoothing parameter grid searched by fit()
+static const float FORECAST_ALPHAS[] = {0.05f, 0.15f, 0.3f, 0.5f};
+static const float FORECAST_BETAS[] = {0.0f, 0.01f, 0.05f};
+static const float FORECAST_GAMMAS[] = {0.05f, 0.15f, 0.3f};
+
+// Synthetic daily volume of one segment: a base volume with a weekday
+// profile, slow growth and +-5% day-to-day noise
+inline VehicleCount dailyVolume(uint64_t seed, uint64_t segment, uint64_t day) {
+    static const float WEEKDAY[FORECAST_SEASON] = {1.0f, 1.04f, 1.05f, 1.07f, 1.12f, 0.78f, 0.62f};
+    float base = 2000 + sensorValue(seed, STREAM_HISTORICAL, segment, 18000);
+    float noise = 0.95f + 0.001f * sensorValue(seed, STREAM_PREDICTION, (day << 32) + segment, 100);
+    return VehicleCount(base * WEEKDAY[day % FORECAST_SEASON] * (1.0f + 0.0005f * day) * noise);
+}
+
+struct ForecastStats {
+    double squared_error = 0.0; // of one-step forecasts, vehicles^2
+    long samples = 0;           // forecasts scored
+    double seconds = 0.0;
+};
+
+class TrafficForecaster {
+public:
+    TrafficForecaster(size_t begin, size_t end)
+        : first(begin),
+          count(end - begin),
+          level(end - begin, 0.0f),
+          trend(end - begin, 0.0f),
+          season(FORECAST_SEASON * (end - begin), 0.0f),
+          alpha(end - begin, 0.0f),
+          beta(end - begin, 0.0f),
+          gamma(end - begin, 0.0f) {}
+
+    size_t begin() const { return first; }
+    size_t end() const { return first + count; }
+    uint64_t days() const { return day_count; }
+
+    // Fits every model to the last min(days, HISTORY_DAYS) days of the ring,
+    // of which at least two seasons are needed. history is the whole ring
+    // with rows of stride segments; days is the number of days recorded.
+    ForecastStats fit(const VehicleCount* history, size_t stride, uint64_t days) {
+        auto start = std::chrono::steady_clock::now();
+        size_t n = std::min<uint64_t>(days, HISTORY_DAYS);
+        day_count = days;
+        double squared_error = 0.0;
+        long num_blocks = (count + FORECAST_BLOCK - 1) / FORECAST_BLOCK;
+        #pragma omp taskloop default(shared) reduction(+:squared_error)
+        for (long b = 0; b < num_blocks; ++b) {
+            size_t lo = b * FORECAST_BLOCK;
+            size_t hi = std::min(count, lo + FORECAST_BLOCK);
+            squared_error += fitBlock(history, stride, n, lo, hi);
+        }
+        ForecastStats stats;
+        stats.squared_error = squared_error;
+        stats.samples = (long)count * (n - 2 * FORECAST_SEASON);
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return stats;
+    }
+
+    // Folds in the next day; volumes is the whole row. The stats score the
+    // forecasts made for that day.
+    ForecastStats addDay(const VehicleCount* volumes) {
+        auto start = std::chrono::steady_clock::now();
+        const VehicleCount* x = volumes + first;
+        float* season_now = season.data() + (day_count % FORECAST_SEASON) * count;
+        double squared_error = 0.0;
+        #pragma omp taskloop simd default(shared) reduction(+:squared_error)
+        for (size_t j = 0; j < count; ++j) {
+            float err = step(x[j], alpha[j], beta[j], gamma[j], level[j], trend[j], season_now[j]);
+            squared_error += err * err;
+        }
+        ++day_count;
+        ForecastStats stats;
+        stats.squared_error = squared_error;
+        stats.samples = count;
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return stats;
+    }
+
+    // Checkpoint sections (Checkpoint.h) of the models of `total` segments
+    template <typename Archive>
+    void checkpoint(Archive& archive, size_t total) {
+        size_t last = first + count;
+        archive.section("forecast.level", level.data(), total, first, last);
+        archive.section("forecast.trend", trend.data(), total, first, last);
+        archive.section("forecast.season", season.data(), total, first, last, FORECAST_SEASON, count);
+        archive.section("forecast.alpha", alpha.data(), total, first, last);
+        archive.section("forecast.beta", beta.data(), total, first, last);
+        archive.section("forecast.gamma", gamma.data(), total, first, last);
+        archive.whole("forecast.days", &day_count, 1);
+    }
+
+    // Writes the next `horizon` days; day h goes to forecast[h * stride + segment]
+    void predict(VehicleCount* forecast, size_t stride, int horizon) const {
+        for (int h = 0; h < horizon; ++h) {
+            const float* season_h = season.data() + ((day_count + h) % FORECAST_SEASON) * count;
+            VehicleCount* out = forecast + h * stride + first;
+            #pragma omp taskloop simd default(shared)
+            for (size_t j = 0; j < count; ++j) {
+                float v = level[j] + (h + 1) * trend[j] + season_h[j];
+                out[j] = VehicleCount(v * (float)(v > 0.0f) + 0.5f);
+            }
+        }
+    }
+
+private:
+    size_t first;
+    size_t count;
+    uint64_t day_count = 0;
+
+    // Model state per segment; season slot s of segment j is season[s * count + j]
+    AlignedVector<float> level;
+    AlignedVector<float> trend;
+    AlignedVector<float> season;
+    AlignedVector<float> alpha;
+    AlignedVector<float> beta;
+    AlignedVector<float> gamma;
+
+    // One Holt-Winters update; returns the error of the forecast for x
+    static float step(float x, float a, float b, float g, float& l, float& t, float& s) {
+        float err = x - (l + t + s);
+        float new_level = a * (x - s) + (1.0f - a) * (l + t);
+        t = b * (new_level - l) + (1.0f - b) * t;
+        s = g * (x - new_level) + (1.0f - g) * s;
+        l = new_level;
+        return err;
+    }
+
+    // Runs segments [lo, hi) over the last n days with per-segment
+    // parameters; the state arrays are block-local, slot-major for the season.
+    // Returns the squared errors from the third season on in sse.
+    void smooth(const VehicleCount* history, size_t stride, size_t n, size_t lo, size_t hi, const float* a,
+                const float* b, const float* g, float* l, float* t, float* s, float* sse) const {
+        size_t width = hi - lo;
+        uint64_t day0 = day_count - n;
+        auto row = [&](size_t i) { return history + ((day0 + i) % HISTORY_DAYS) * stride + first + lo; };
+
+        // Level and trend from the first two seasons, season from the first
+        const VehicleCount* week1[FORECAST_SEASON];
+        const VehicleCount* week2[FORECAST_SEASON];
+        for (int k = 0; k < FORECAST_SEASON; ++k) {
+            week1[k] = row(k);
+            week2[k] = row(k + FORECAST_SEASON);
+        }
+        #pragma omp simd
+        for (size_t j = 0; j < width; ++j) {
+            float mean1 = 0.0f, mean2 = 0.0f;
+            for (int k = 0; k < FORECAST_SEASON; ++k) {
+                mean1 += week1[k][j];
+                mean2 += week2[k][j];
+            }
+            mean1 *= 1.0f / FORECAST_SEASON;
+            mean2 *= 1.0f / FORECAST_SEASON;
+            l[j] = mean1;
+            t[j] = (mean2 - mean1) * (1.0f / FORECAST_SEASON);
+            sse[j] = 0.0f;
+        }
+        for (int k = 0; k < FORECAST_SEASON; ++k) {
+            float* s_k = s + ((day0 + k) % FORECAST_SEASON) * width;
+            #pragma omp simd
+            for (size_t j = 0; j < width; ++j) {
+                s_k[j] = week1[k][j] - l[j];
+            }
+        }
+        // The mean sits mid-season; move the level to its last day
+        for (size_t j = 0; j < width; ++j) {
+            l[j] += 0.5f * (FORECAST_SEASON - 1) * t[j];
+        }
+
+        for (size_t i = FORECAST_SEASON; i < n; ++i) {
+            const VehicleCount* x = row(i);
+            float* s_i = s + ((day0 + i) % FORECAST_SEASON) * width;
+            float scored = i >= 2 * FORECAST_SEASON ? 1.0f : 0.0f;
+            #pragma omp simd
+            for (size_t j = 0; j < width; ++j) {
+                float err = step(x[j], a[j], b[j], g[j], l[j], t[j], s_i[j]);
+                sse[j] += scored * err * err;
+            }
+        }
+    }
+
+    // Grid search for one block, then a final pass with the chosen
+    // parameters that leaves the state at the last recorded day
+    double fitBlock(const VehicleCount* history, size_t stride, size_t n, size_t lo, size_t hi) {
+        size_t width = hi - lo;
+        float a[FORECAST_BLOCK], b[FORECAST_BLOCK], g[FORECAST_BLOCK];
+        float l[FORECAST_BLOCK], t[FORECAST_BLOCK], s[FORECAST_SEASON * FORECAST_BLOCK], sse[FORECAST_BLOCK];
+        float best[FORECAST_BLOCK];
+        std::fill(best, best + width, 3.4e38f);
+
+        for (float alpha_k : FORECAST_ALPHAS) {
+            for (float beta_k : FORECAST_BETAS) {
+                for (float gamma_k : FORECAST_GAMMAS) {
+                    std::fill(a, a + width, alpha_k);
+                    std::fill(b, b + width, beta_k);
+                    std::fill(g, g + width, gamma_k);
+                    smooth(history, stride, n, lo, hi, a, b, g, l, t, s, sse);
+                    for (size_t j = 0; j < width; ++j) {
+                        if (sse[j] < best[j]) {
+                            best[j] = sse[j];
+                            alpha[lo + j] = alpha_k;
+                            beta[lo + j] = beta_k;
+                            gamma[lo + j] = gamma_k;
+                        }
+                    }
+                }
+            }
+        }
+
+        smooth(history, stride, n, lo, hi, alpha.data() + lo, beta.data() + lo, gamma.data() + lo, l, t, s, sse);
+        double squared_error = 0.0;
+        for (size_t j = 0; j < width; ++j) {
+            level[lo + j] = l[j];
+            trend[lo + j] = t[j];
+            squared_error += sse[j];
+        }
+        for (int k = 0; k < FORECAST_SEASON; ++k) {
+            std::copy(s + k * width, s + (k + 1) * width, season.data() + k * count + lo);
+        }
+        return squared_error;
+    }
+};
@@ -0,0 +1,781 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "Arena.h"
+#include "CityState.h"
+#include "RoadNetwork.h"
+#include "RoutePlanner.h"
+#include "SensorRNG.h"
+
+// Time-stepped microscopic traffic simulation on a RoadNetwork.
+//
+// Every lane is a FIFO queue of vehicle ids stored as a ring buffer in one
+// flat slot array; the front of the queue is the vehicle nearest the stop
+// line. A tick runs these phases, each a taskloop with a single writer per
+// element, so a simulator stepped from inside a TaskGraph task shares the
+// team with the other kernels (outside a parallel region it runs serially):
+//
+//   1. updateSignals     per intersection: the heads of a signal plan, or
+//                        fixed-time two-phase plans without one
+//   2. updateIncidents   per edge: start and clear incidents
+//   3. moveVehicles      per edge: car-following along each lane
+//      reroute           per vehicle: new routes around the incidents that
+//                        started or cleared (with a RoutePlanner)
+//   4. planExits         per intersection: pick a target lane for each
+//                        front vehicle waiting on a green approach
+//   5. acceptEntries     per intersection: append accepted vehicles to the
+//                        tails of its outgoing lanes
+//   6. completeTransfers per lane: pop accepted vehicles from the front
+//
+// Splitting a transfer into plan / accept / complete means a lane's tail is
+// only written by its source intersection and its head only by the lane
+// itself, so no phase needs locks or atomics.
+//
+// The network may be one band of a partitioned city (RoadNetwork::gridBand).
+// Lanes whose target intersection is a ghost are remote: they are owned by
+// the neighbouring band, their count and tail position are a snapshot set
+// with setRemoteLane, and vehicles accepted into them leave this simulator
+// through departures. step() runs a whole tick; a distributed driver calls
+// beginTick / finishTick and exchanges state in between.
+//
+// With a RoutePlanner every vehicle drives to a destination hub and takes
+// the planner's next edge at each intersection, drawing a new hub when it
+// arrives; without one it turns at random. Incidents that start or clear on
+// owned edges are listed in incident_changes. reroute() passes them to the
+// planner and, in the same tick, replans the vehicles whose route changed.
+//
+// The simulator lives for the whole run. checkpoint() saves a whole-city
+// simulator; saveVehicles / restoreVehicles and saveIncidents /
+// restoreIncidents name vehicles by global id and edges by approachKey, so
+// DistributedSimulation stores its bands in the same layout.
+
+#define TICK_SECONDS 1.0f
+#define JAM_SPACING_M 7.5f
+#define INITIAL_LANE_FILL 0.5f // fraction of lane capacity filled at start
+#define SIGNAL_CYCLE_TICKS 60
+#define SIGNAL_YELLOW_TICKS 3
+#define INCIDENT_START_PER_MILLION 20 // per edge per tick
+#define INCIDENT_DURATION_TICKS 300
+#define INCIDENT_SPEED_FACTOR 0.2f
+
+struct SimulationStats {
+    long tick = 0;
+    long active_vehicles = 0;
+    long parked_vehicles = 0;
+    long transfers = 0; // vehicles that crossed an intersection this tick
+    double speed_sum = 0.0;
+    long active_incidents = 0;
+    double mean_speed_mps = 0.0;
+    // Routing totals since the start of the run
+    long trips = 0;         // vehicles that reached their destination hub
+    long route_changes = 0; // edge speed changes applied to the planner
+    long reroutes = 0;      // vehicles replanned after a change
+    long diversions = 0;    // of those, vehicles given a different next edge
+    double route_seconds = 0.0;
+};
+
+class TrafficSimulator {
+public:
+    // A vehicle accepted into a remote lane during finishTick
+    struct Departure {
+        int64_t vehicle_id; // global id
+        int lane;           // local remote lane it entered
+        float speed;
+        int destination;    // RoutePlanner destination
+    };
+
+    // Checkpoint record of one vehicle
+    struct VehicleState {
+        int64_t vehicle_id;
+        int32_t edge;      // approachKey of its edge, or -1 when parked
+        int16_t lane;      // lane within the edge
+        int16_t queue;     // place in the lane queue, 0 being the front
+        float position;
+        float speed;
+        int32_t destination;
+        int32_t next_edge; // approachKey of the planned edge, or -1
+    };
+    static_assert(sizeof(VehicleState) == 32, "vehicle records have no padding");
+
+    // Places num_vehicles vehicles with global ids first_vehicle_id onwards.
+    // A router covering the whole city is reset to free flow.
+    TrafficSimulator(const RoadNetwork& network, size_t num_vehicles, uint64_t seed, int64_t first_vehicle_id = 0,
+                     RoutePlanner* router = nullptr)
+        : net(network), seed(seed), router(router), vehicle_slots(num_vehicles) {
+        int num_edges = net.numEdges();
+        lane_first.assign(num_edges + 1, 0);
+        for (int e = 0; e < num_edges; ++e) {
+            lane_first[e + 1] = lane_first[e] + net.edge_lanes[e];
+        }
+        int num_lanes = lane_first[num_edges];
+
+        lane_edge.resize(num_lanes);
+        lane_slot_offset.assign(num_lanes + 1, 0);
+        lane_capacity.resize(num_lanes);
+        for (int e = 0; e < num_edges; ++e) {
+            int capacity = std::max(1, (int)(net.edge_length[e] / JAM_SPACING_M));
+            for (int l = lane_first[e]; l < lane_first[e + 1]; ++l) {
+                lane_edge[l] = e;
+                lane_capacity[l] = capacity;
+                lane_slot_offset[l + 1] = lane_slot_offset[l] + capacity;
+            }
+        }
+        lane_remote.resize(num_lanes);
+        lane_remote_tail.assign(num_lanes, 0.0f);
+        for (int lane = 0; lane < num_lanes; ++lane) {
+            lane_remote[lane] = !net.intersection_owned[net.edge_target[lane_edge[lane]]];
+        }
+        lane_slots.assign(lane_slot_offset[num_lanes], -1);
+        lane_head.assign(num_lanes, 0);
+        lane_tail.assign(num_lanes, 0);
+        lane_exit_target.assign(num_lanes, -1);
+        lane_exit_accepted.assign(num_lanes, 0);
+        incident_ticks.assign(num_edges, 0);
+        incident_changed.assign(num_edges, 0);
+        incident_changes.reserve(num_edges);
+        // The router starts free-flow with the incidents. Both then live as
+        // long as the simulator, which runs every pass.
+        if (router) {
+            router->reset();
+        }
+
+        vehicle_edge.assign(num_vehicles, -1);
+        vehicle_position.assign(num_vehicles, 0.0f);
+        vehicle_speed.assign(num_vehicles, 0.0f);
+        vehicle_id.resize(num_vehicles);
+        vehicle_destination.assign(num_vehicles, 0);
+        vehicle_next_edge.assign(num_vehicles, -1);
+        for (size_t v = 0; v < num_vehicles; ++v) {
+            vehicle_id[v] = first_vehicle_id + v;
+        }
+        placeVehicles();
+
+        // Lanes whose front vehicle can turn into a remote lane
+        for (int lane = 0; lane < num_lanes; ++lane) {
+            int v = net.edge_target[lane_edge[lane]];
+            bool feeds_remote = false;
+            for (int o = net.out_offsets[v]; o < net.out_offsets[v + 1]; ++o) {
+                feeds_remote |= lane_remote[lane_first[o]] != 0;
+            }
+            if (feeds_remote && !lane_remote[lane]) {
+                boundary_feed_lanes.push_back(lane);
+            }
+        }
+        // At most one departure per feed lane and tick
+        departures.reserve(boundary_feed_lanes.size());
+        // A band also takes in vehicles. It never holds more than its own plus
+        // a full network, so the vehicle columns are reserved for that once.
+        if (!boundary_feed_lanes.empty()) {
+            size_t most = num_vehicles + lane_slots.size();
+            vehicle_edge.reserve(most);
+            vehicle_position.reserve(most);
+            vehicle_speed.reserve(most);
+            vehicle_id.reserve(most);
+            vehicle_destination.reserve(most);
+            vehicle_next_edge.reserve(most);
+            vehicle_slots.reserve(most);
+        }
+    }
+
+    // Advances the simulation by one tick. lights holds NUM_APPROACHES phases
+    // per intersection and is overwritten with this tick's signal states:
+    // those of plan, a city-wide plan indexed by global intersection, or
+    // fixed-time phases when plan is null.
+    SimulationStats step(LightPhase* lights, const LightPhase* plan = nullptr) {
+        beginTick(lights, plan);
+        reroute(incident_changes.data(), incident_changes.size());
+        long transfers = finishTick(lights);
+        SimulationStats stats = summarize();
+        stats.transfers = transfers;
+        return stats;
+    }
+
+    // Phases that only touch local lanes: signals, incidents, movement.
+    void beginTick(LightPhase* lights, const LightPhase* plan = nullptr) {
+        updateSignals(lights, plan);
+        updateIncidents();
+        moveVehicles();
+    }
+
+    // Intersection phases; remote lanes must hold a snapshot taken no later
+    // than the start of the tick. Returns the number of transfers and fills
+    // departures with vehicles that left for remote lanes.
+    long finishTick(const LightPhase* lights) {
+        planExits(lights);
+        acceptEntries();
+        collectDepartures();
+        long transfers = completeTransfers();
+        ++tick;
+        return transfers;
+    }
+
+    // Applies edge speed changes, sorted by key, to the router and replans
+    // the vehicles whose route changed. A distributed driver passes the
+    // changes of every band so that all routers stay the same. Returns the
+    // number of vehicles replanned.
+    long reroute(const EdgeSpeedChange* changes, size_t count) {
+        if (!router || count == 0) {
+            return 0;
+        }
+        auto start = std::chrono::steady_clock::now();
+        RouteUpdate update = router->update(changes, count);
+        route_changes += update.edges;
+        long replanned = 0, diverted = 0;
+        if (update.intersections > 0) {
+            size_t num_vehicles = vehicle_edge.size();
+            #pragma omp taskloop default(shared) reduction(+:replanned, diverted)
+            for (size_t v = 0; v < num_vehicles; ++v) {
+                int e = vehicle_edge[v];
+                if (e < 0 || !router->changed(vehicle_destination[v], net.intersection_global[net.edge_target[e]])) {
+                    continue;
+                }
+                int previous = vehicle_next_edge[v];
+                vehicle_next_edge[v] = routeFrom(net.edge_target[e], vehicle_destination[v]);
+                ++replanned;
+                diverted += vehicle_next_edge[v] != previous;
+            }
+        }
+        reroutes += replanned;
+        diversions += diverted;
+        route_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return replanned;
+    }
+
+    // Snapshot of a remote lane as seen by its owner.
+    void setRemoteLane(int lane, int count, float tail_position) {
+        lane_head[lane] = 0;
+        lane_tail[lane] = count;
+        lane_remote_tail[lane] = tail_position;
+    }
+
+    // Position of the last vehicle in a lane, or the lane length when empty.
+    float laneTailPosition(int lane) {
+        int count = laneCount(lane);
+        if (lane_remote[lane]) {
+            return lane_remote_tail[lane];
+        }
+        return count > 0 ? vehicle_position[laneSlot(lane, count - 1)] : net.edge_length[lane_edge[lane]];
+    }
+
+    // Appends a vehicle that crossed in from a neighbouring band. Always fits:
+    // the sender accepted it against an earlier, more conservative snapshot.
+    void addArrival(int lane, int64_t id, float speed, int destination) {
+        int v = vehicle_slots.acquire();
+        if (v == (int)vehicle_edge.size()) {
+            vehicle_edge.push_back(-1);
+            vehicle_position.push_back(0.0f);
+            vehicle_speed.push_back(0.0f);
+            vehicle_id.push_back(0);
+            vehicle_destination.push_back(0);
+            vehicle_next_edge.push_back(-1);
+        }
+        vehicle_edge[v] = lane_edge[lane];
+        vehicle_position[v] = 0.0f;
+        vehicle_speed[v] = speed;
+        vehicle_id[v] = id;
+        vehicle_destination[v] = destination;
+        trips += routeVehicle(v);
+        laneSlot(lane, laneCount(lane)) = v;
+        ++lane_tail[lane];
+    }
+
+    // Statistics over the vehicles and owned edges of this simulator.
+    SimulationStats summarize() const {
+        SimulationStats stats;
+        stats.tick = tick;
+        long active = 0;
+        double speed_sum = 0.0;
+        size_t num_vehicles = vehicle_edge.size();
+        #pragma omp taskloop default(shared) reduction(+:active, speed_sum)
+        for (size_t v = 0; v < num_vehicles; ++v) {
+            if (vehicle_edge[v] >= 0) {
+                ++active;
+                speed_sum += vehicle_speed[v];
+            }
+        }
+        long incidents = 0;
+        int num_edges = net.numEdges();
+        #pragma omp taskloop default(shared) reduction(+:incidents)
+        for (int e = 0; e < num_edges; ++e) {
+            incidents += incident_ticks[e] > 0 && net.intersection_owned[net.edge_target[e]];
+        }
+        stats.active_vehicles = active;
+        stats.parked_vehicles = num_vehicles - active - vehicle_slots.numFree();
+        stats.speed_sum = speed_sum;
+        stats.active_incidents = incidents;
+        stats.mean_speed_mps = active > 0 ? speed_sum / active : 0.0;
+        stats.trips = trips;
+        stats.route_changes = route_changes;
+        stats.reroutes = reroutes;
+        stats.diversions = diversions;
+        stats.route_seconds = route_seconds;
+        return stats;
+    }
+
+    // Checkpoint sections (Checkpoint.h) of a simulator of the whole city:
+    // the vehicles by id, the incidents by approachKey and the tick. The
+    // routing totals count from the restart.
+    template <typename Archive>
+    void checkpoint(Archive& archive) {
+        size_t num_vehicles = vehicle_edge.size();
+        size_t approaches = (size_t)net.num_intersections * NUM_APPROACHES;
+        std::vector<VehicleState> vehicles(num_vehicles);
+        std::vector<int32_t> incidents(approaches, 0);
+        if (!archive.restoring()) {
+            std::vector<VehicleState> held;
+            saveVehicles(held);
+            for (const VehicleState& state : held) {
+                vehicles[state.vehicle_id] = state;
+            }
+            saveIncidents(incidents.data(), 0);
+        }
+        archive.whole("sim.vehicles", vehicles.data(), num_vehicles);
+        archive.whole("sim.incident_ticks", incidents.data(), approaches);
+        archive.whole("sim.tick", &tick, 1);
+        if (archive.restoring()) {
+            restoreVehicles(vehicles.data(), num_vehicles);
+            restoreIncidents(incidents.data(), 0);
+        }
+    }
+
+    // Edge e named by its global target intersection and approach, the same
+    // in every band: the edges into an intersection have distinct approaches.
+    int32_t approachKey(int e) const {
+        return net.intersection_global[net.edge_target[e]] * NUM_APPROACHES + net.edge_approach[e];
+    }
+
+    // Appends the vehicles this simulator holds: those queued on its owned
+    // lanes, front first, and the parked ones.
+    void saveVehicles(std::vector<VehicleState>& out) const {
+        for (int lane = 0; lane < numLanes(); ++lane) {
+            if (lane_remote[lane]) {
+                continue;
+            }
+            int e = lane_edge[lane];
+            for (int k = 0; k < laneCount(lane); ++k) {
+                int v = lane_slots[lane_slot_offset[lane] + (lane_head[lane] + k) % lane_capacity[lane]];
+                int next = vehicle_next_edge[v];
+                out.push_back({vehicle_id[v], approachKey(e), (int16_t)(lane - lane_first[e]), (int16_t)k,
+                               vehicle_position[v], vehicle_speed[v], vehicle_destination[v],
+                               next >= 0 ? approachKey(next) : -1});
+            }
+        }
+        for (size_t v = 0; v < vehicle_edge.size(); ++v) {
+            if (vehicle_edge[v] == -1) {
+                out.push_back({vehicle_id[v], -1, 0, 0, vehicle_position[v], 0.0f, vehicle_destination[v], -1});
+            }
+        }
+    }
+
+    // Replaces every vehicle with the given ones, in slot order. A vehicle
+    // whose lane is not an owned lane of this network is parked.
+    void restoreVehicles(const VehicleState* states, size_t count) {
+        int first = net.num_intersections > 0 ? net.intersection_global[0] : 0;
+        std::vector<int32_t> approach_edge((size_t)net.num_intersections * NUM_APPROACHES, -1);
+        for (int e = 0; e < net.numEdges(); ++e) {
+            approach_edge[approachKey(e) - first * NUM_APPROACHES] = e;
+        }
+        auto local = [&](int32_t key) {
+            size_t k = (size_t)key - (size_t)first * NUM_APPROACHES;
+            return key >= 0 && k < approach_edge.size() ? approach_edge[k] : -1;
+        };
+
+        std::fill(lane_slots.begin(), lane_slots.end(), -1);
+        std::fill(lane_head.begin(), lane_head.end(), 0);
+        std::fill(lane_tail.begin(), lane_tail.end(), 0);
+        std::fill(lane_exit_target.begin(), lane_exit_target.end(), -1);
+        std::fill(lane_exit_accepted.begin(), lane_exit_accepted.end(), 0);
+        vehicle_edge.assign(count, -1);
+        vehicle_position.resize(count);
+        vehicle_speed.resize(count);
+        vehicle_id.resize(count);
+        vehicle_destination.resize(count);
+        vehicle_next_edge.assign(count, -1);
+        vehicle_slots = SlotPool(count); // every slot in use
+
+        long misplaced = 0;
+        for (size_t v = 0; v < count; ++v) {
+            const VehicleState& state = states[v];
+            vehicle_position[v] = state.position;
+            vehicle_speed[v] = state.speed;
+            vehicle_id[v] = state.vehicle_id;
+            vehicle_destination[v] = state.destination;
+            if (state.edge < 0) {
+                continue;
+            }
+            int e = local(state.edge);
+            int lane = e < 0 ? -1 : lane_first[e] + state.lane;
+            if (e < 0 || state.lane < 0 || lane >= lane_first[e + 1] || lane_remote[lane] || state.queue < 0 ||
+                state.queue >= lane_capacity[lane]) {
+                ++misplaced;
+                continue;
+            }
+            vehicle_edge[v] = e;
+            vehicle_next_edge[v] = local(state.next_edge);
+            lane_slots[lane_slot_offset[lane] + state.queue] = v;
+            lane_tail[lane] = std::max(lane_tail[lane], state.queue + 1);
+        }
+        if (misplaced > 0) {
+            fprintf(stderr, "Parked %ld restored vehicles that are not on this road network\n", misplaced);
+        }
+        if (!boundary_feed_lanes.empty()) {
+            size_t most = count + lane_slots.size();
+            vehicle_edge.reserve(most);
+            vehicle_position.reserve(most);
+            vehicle_speed.reserve(most);
+            vehicle_id.reserve(most);
+            vehicle_destination.reserve(most);
+            vehicle_next_edge.reserve(most);
+            vehicle_slots.reserve(most);
+        }
+    }
+
+    // Remaining incident ticks of the owned edges, at approachKey minus
+    // first * NUM_APPROACHES; other entries are left as they are.
+    void saveIncidents(int32_t* ticks, int first) const {
+        for (int e = 0; e < net.numEdges(); ++e) {
+            if (net.intersection_owned[net.edge_target[e]]) {
+                ticks[approachKey(e) - first * NUM_APPROACHES] = incident_ticks[e];
+            }
+        }
+    }
+
+    void restoreIncidents(const int32_t* ticks, int first) {
+        std::fill(incident_ticks.begin(), incident_ticks.end(), 0);
+        std::fill(incident_changed.begin(), incident_changed.end(), 0);
+        for (int e = 0; e < net.numEdges(); ++e) {
+            if (net.intersection_owned[net.edge_target[e]]) {
+                incident_ticks[e] = ticks[approachKey(e) - first * NUM_APPROACHES];
+            }
+        }
+        incident_changes.clear();
+    }
+
+    int numLanes() const { return lane_edge.size(); }
+
+    int laneCount(int lane) const { return lane_tail[lane] - lane_head[lane]; }
+
+    // Vehicle id at position k of a lane queue, 0 being the front.
+    int32_t& laneSlot(int lane, int k) {
+        return lane_slots[lane_slot_offset[lane] + (lane_head[lane] + k) % lane_capacity[lane]];
+    }
+
+    const RoadNetwork& net;
+    uint64_t seed;
+    RoutePlanner* router;
+    long tick = 0;
+
+    // Lanes of edge e are lane_first[e] .. lane_first[e + 1]
+    AlignedVector<int32_t> lane_first;
+    AlignedVector<int32_t> lane_edge;
+    AlignedVector<int32_t> lane_slot_offset;
+    AlignedVector<int32_t> lane_capacity;
+    AlignedVector<int32_t> lane_slots;
+    // Monotonic ring indices; head is only advanced by completeTransfers and
+    // tail only by acceptEntries, count is tail - head
+    AlignedVector<int32_t> lane_head;
+    AlignedVector<int32_t> lane_tail;
+    AlignedVector<int32_t> lane_exit_target;   // lane the front vehicle moves to, or -1
+    AlignedVector<uint8_t> lane_exit_accepted; // set by acceptEntries
+
+    AlignedVector<uint8_t> lane_remote;      // lane owned by a neighbouring band
+    AlignedVector<float> lane_remote_tail;   // tail position snapshot of a remote lane
+
+    AlignedVector<int32_t> incident_ticks; // remaining incident duration per edge
+    AlignedVector<uint8_t> incident_changed; // incident started or cleared this tick
+    // Owned edges whose incident started or cleared this tick, by key
+    std::vector<EdgeSpeedChange> incident_changes;
+
+    // Vehicles; vehicle_edge is -1 for vehicles that did not fit on the
+    // network (parked) and -2 for free slots of vehicles that left for
+    // another band
+    AlignedVector<int32_t> vehicle_edge;
+    AlignedVector<float> vehicle_position; // metres from the start of the edge
+    AlignedVector<float> vehicle_speed;
+    AlignedVector<int64_t> vehicle_id;     // global id, stable across bands
+    AlignedVector<int32_t> vehicle_destination; // RoutePlanner destination
+    AlignedVector<int32_t> vehicle_next_edge;   // edge to take at the end of this one, or -1
+
+    std::vector<Departure> departures;
+
+private:
+    std::vector<int32_t> boundary_feed_lanes;
+    // Slots of the vehicle columns; departed vehicles free theirs for arrivals
+    SlotPool vehicle_slots;
+    long trips = 0;
+    long route_changes = 0;
+    long reroutes = 0;
+    long diversions = 0;
+    double route_seconds = 0.0;
+
+    // Local out-edge of intersection v that the router takes towards
+    // destination d, or -1 when there is none
+    int routeFrom(int v, int d) const {
+        int e = router->nextEdge(d, net.intersection_global[v]);
+        if (e < 0) {
+            return -1;
+        }
+        int64_t key = router->edgeKey(e);
+        for (int o = net.out_offsets[v]; o < net.out_offsets[v + 1]; ++o) {
+            if (net.edge_key[o] == key) {
+                return o;
+            }
+        }
+        return -1;
+    }
+
+    // Plans the next edge of a vehicle that just entered vehicle_edge[v],
+    // first drawing a new destination when its target is the current one.
+    // Returns whether the vehicle completed a trip.
+    bool routeVehicle(int v) {
+        if (!router) {
+            return false;
+        }
+        int target = net.edge_target[vehicle_edge[v]];
+        int global = net.intersection_global[target];
+        bool arrived = router->hub(vehicle_destination[v]) == global;
+        if (arrived) {
+            int count = router->numDestinations();
+            SensorRNG rng(seed, STREAM_ROUTES, ((uint64_t)tick << 40) ^ (uint64_t)vehicle_id[v]);
+            int d = rng.uniform(count);
+            vehicle_destination[v] = router->hub(d) == global ? (d + 1) % count : d;
+        }
+        vehicle_next_edge[v] = routeFrom(target, vehicle_destination[v]);
+        return arrived;
+    }
+
+    // Fills every lane up to INITIAL_LANE_FILL of its capacity, round-robin
+    // over lanes, with vehicles queued back from the stop line.
+    void placeVehicles() {
+        int num_lanes = numLanes();
+        size_t placed = 0;
+        while (placed < vehicle_edge.size()) {
+            bool any = false;
+            for (int lane = 0; lane < num_lanes && placed < vehicle_edge.size(); ++lane) {
+                int k = laneCount(lane);
+                if (lane_remote[lane] || k >= (int)(lane_capacity[lane] * INITIAL_LANE_FILL)) {
+                    continue;
+                }
+                int e = lane_edge[lane];
+                int v = placed++;
+                laneSlot(lane, k) = v;
+                ++lane_tail[lane];
+                vehicle_edge[v] = e;
+                vehicle_position[v] = net.edge_length[e] - JAM_SPACING_M * (k + 0.5f);
+                if (router) {
+                    int count = router->numDestinations();
+                    vehicle_destination[v] = SensorRNG(seed, STREAM_ROUTES, (uint64_t)vehicle_id[v]).uniform(count);
+                    routeVehicle(v);
+                }
+                any = true;
+            }
+            if (!any) {
+                break;
+            }
+        }
+    }
+
+    // Lane of edge e with the fewest vehicles
+    int leastQueued(int e) {
+        int best = lane_first[e];
+        for (int l = best + 1; l < lane_first[e + 1]; ++l) {
+            if (laneCount(l) < laneCount(best)) {
+                best = l;
+            }
+        }
+        return best;
+    }
+
+    void updateSignals(LightPhase* lights, const LightPhase* plan) {
+        #pragma omp taskloop default(shared)
+        for (int v = 0; v < net.num_intersections; ++v) {
+            LightPhase* l = lights + (size_t)v * NUM_APPROACHES;
+            if (plan) {
+                const LightPhase* p = plan + (size_t)net.intersection_global[v] * NUM_APPROACHES;
+                std::copy(p, p + NUM_APPROACHES, l);
+                continue;
+            }
+            // Offset the cycle per intersection so the city is not in lockstep
+            int t = (tick + splitmix64(seed ^ net.intersection_global[v]) % SIGNAL_CYCLE_TICKS) % SIGNAL_CYCLE_TICKS;
+            int half = SIGNAL_CYCLE_TICKS / 2;
+            bool north_south = t < half;
+            int in_phase = north_south ? t : t - half;
+            LightPhase active = (in_phase < half - SIGNAL_YELLOW_TICKS) ? LightPhase::Green : LightPhase::Yellow;
+            l[APPROACH_NORTH] = l[APPROACH_SOUTH] = north_south ? active : LightPhase::Red;
+            l[APPROACH_EAST] = l[APPROACH_WEST] = north_south ? LightPhase::Red : active;
+        }
+    }
+
+    void updateIncidents() {
+        int num_edges = net.numEdges();
+        #pragma omp taskloop default(shared)
+        for (int e = 0; e < num_edges; ++e) {
+            if (incident_ticks[e] > 0) {
+                --incident_ticks[e];
+                incident_changed[e] = incident_ticks[e] == 0;
+            } else if (SensorRNG(seed, STREAM_SIM_INCIDENTS, ((uint64_t)tick << 40) ^ (uint64_t)net.edge_key[e]).uniform(1000000) < INCIDENT_START_PER_MILLION) {
+                incident_ticks[e] = INCIDENT_DURATION_TICKS;
+                incident_changed[e] = 1;
+            } else {
+                incident_changed[e] = 0;
+            }
+        }
+        // Serial: edges are in key order within a band
+        incident_changes.clear();
+        if (router) {
+            for (int e = 0; e < num_edges; ++e) {
+                if (incident_changed[e] && net.intersection_owned[net.edge_target[e]]) {
+                    float factor = incident_ticks[e] > 0 ? INCIDENT_SPEED_FACTOR : 1.0f;
+                    incident_changes.push_back({net.edge_key[e], net.edge_speed[e] * factor});
+                }
+            }
+        }
+    }
+
+    // Each vehicle drives at the edge speed but stops JAM_SPACING_M behind
+    // its leader; the front vehicle stops at the stop line.
+    void moveVehicles() {
+        int num_edges = net.numEdges();
+        #pragma omp taskloop default(shared)
+        for (int e = 0; e < num_edges; ++e) {
+            float speed = net.edge_speed[e] * (incident_ticks[e] > 0 ? INCIDENT_SPEED_FACTOR : 1.0f);
+            float length = net.edge_length[e];
+            for (int lane = lane_first[e]; lane < lane_first[e + 1]; ++lane) {
+                if (lane_remote[lane]) {
+                    continue;
+                }
+                float limit = length;
+                int count = laneCount(lane);
+                for (int k = 0; k < count; ++k) {
+                    int v = laneSlot(lane, k);
+                    float pos = vehicle_position[v];
+                    float next = std::max(pos, std::min(pos + speed * TICK_SECONDS, limit));
+                    vehicle_speed[v] = (next - pos) / TICK_SECONDS;
+                    vehicle_position[v] = next;
+                    limit = next - JAM_SPACING_M;
+                }
+            }
+        }
+    }
+
+    void planExits(const LightPhase* lights) {
+        #pragma omp taskloop default(shared) grainsize(256)
+        for (int v = 0; v < net.num_intersections; ++v) {
+            if (!net.intersection_owned[v]) {
+                continue;
+            }
+            int degree = net.outDegree(v);
+            for (int i = net.in_offsets[v]; i < net.in_offsets[v + 1]; ++i) {
+                int e = net.in_edges[i];
+                bool green = lights[(size_t)v * NUM_APPROACHES + net.edge_approach[e]] == LightPhase::Green;
+                for (int lane = lane_first[e]; lane < lane_first[e + 1]; ++lane) {
+                    lane_exit_target[lane] = -1;
+                    if (!green || degree == 0 || laneCount(lane) == 0) {
+                        continue;
+                    }
+                    int vehicle = laneSlot(lane, 0);
+                    if (vehicle_position[vehicle] < net.edge_length[e]) {
+                        continue;
+                    }
+                    // The planned edge, else a random turn avoiding a U-turn
+                    // when there is a choice
+                    int out = vehicle_next_edge[vehicle];
+                    if (out < 0) {
+                        SensorRNG rng(seed, STREAM_SIM_TURNS, ((uint64_t)tick << 40) ^ (uint64_t)vehicle_id[vehicle]);
+                        out = net.out_offsets[v] + rng.uniform(degree);
+                        if (degree > 1 && net.edge_target[out] == net.edge_source[e]) {
+                            out = net.out_offsets[v] + (out - net.out_offsets[v] + 1) % degree;
+                        }
+                    }
+                    int best = leastQueued(out);
+                    // Spread routed vehicles over equally short turns
+                    if (router && vehicle_next_edge[vehicle] >= 0) {
+                        for (int o = net.out_offsets[v]; o < net.out_offsets[v + 1]; ++o) {
+                            int l = leastQueued(o);
+                            if (o != out && laneCount(l) < laneCount(best) &&
+                                router->onShortestRoute(vehicle_destination[vehicle], net.edge_key[o])) {
+                                best = l;
+                            }
+                        }
+                    }
+                    lane_exit_target[lane] = best;
+                }
+            }
+        }
+    }
+
+    void acceptEntries() {
+        #pragma omp taskloop default(shared) grainsize(256)
+        for (int v = 0; v < net.num_intersections; ++v) {
+            if (!net.intersection_owned[v]) {
+                continue;
+            }
+            for (int o = net.out_offsets[v]; o < net.out_offsets[v + 1]; ++o) {
+                for (int target = lane_first[o]; target < lane_first[o + 1]; ++target) {
+                    int count = laneCount(target);
+                    float tail_position = laneTailPosition(target);
+                    for (int i = net.in_offsets[v]; i < net.in_offsets[v + 1]; ++i) {
+                        int e = net.in_edges[i];
+                        for (int lane = lane_first[e]; lane < lane_first[e + 1]; ++lane) {
+                            if (lane_exit_target[lane] != target) {
+                                continue;
+                            }
+                            bool fits = count < lane_capacity[target] && tail_position >= JAM_SPACING_M;
+                            lane_exit_accepted[lane] = fits;
+                            if (fits) {
+                                laneSlot(target, count) = laneSlot(lane, 0);
+                                ++lane_tail[target];
+                                ++count;
+                                tail_position = 0.0f;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Serial over the few lanes that can feed a remote lane.
+    void collectDepartures() {
+        departures.clear();
+        for (int lane : boundary_feed_lanes) {
+            int target = lane_exit_target[lane];
+            if (target < 0 || !lane_exit_accepted[lane] || !lane_remote[target]) {
+                continue;
+            }
+            int vehicle = laneSlot(lane, 0);
+            departures.push_back({vehicle_id[vehicle], target, vehicle_speed[vehicle], vehicle_destination[vehicle]});
+            vehicle_edge[vehicle] = -2;
+            vehicle_slots.release(vehicle);
+        }
+    }
+
+    long completeTransfers() {
+        int num_lanes = numLanes();
+        long transfers = 0, arrived = 0;
+        #pragma omp taskloop default(shared) reduction(+:transfers, arrived)
+        for (int lane = 0; lane < num_lanes; ++lane) {
+            int target = lane_exit_target[lane];
+            if (target < 0 || !lane_exit_accepted[lane]) {
+                continue;
+            }
+            int vehicle = laneSlot(lane, 0);
+            ++lane_head[lane];
+            if (!lane_remote[target]) {
+                vehicle_edge[vehicle] = lane_edge[target];
+                vehicle_position[vehicle] = 0.0f;
+                arrived += routeVehicle(vehicle);
+            }
+            lane_exit_target[lane] = -1;
+            lane_exit_accepted[lane] = 0;
+            ++transfers;
+        }
+        trips += arrived;
+        return transfers;
+    }
+};
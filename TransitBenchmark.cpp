@@ -0,0 +1,150 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <omp.h>
+#include "SensorRNG.h"
+#include "CityState.h"
+#include "Config.h"
+#include "TransitFeed.h"
+#include "TransitTracker.h"
+
+using namespace std;
+
+// Times transit feed loading, schedule lookups and bus tracking on a feed
+// sized from the usual city settings. The synthesized feed is written to
+// --feed (default transit_feed) and loaded back, unless --load-only 1 loads
+// an existing feed from there instead.
+//
+//   g++ -O3 -march=native -fopenmp TransitBenchmark.cpp -o transit_benchmark
+//   ./transit_benchmark --preset city [--feed transit_feed] [--queries 1000000]
+
+double secondsSince(chrono::high_resolution_clock::time_point start) {
+    return chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+}
+
+// The lookups the index replaces: every stop time of the day scanned
+int scanNextArrival(const TransitFeed& feed, int stop, int time) {
+    int best = -1;
+    for (size_t k = 0; k < feed.numStopTimes(); ++k) {
+        if (feed.st_stop[k] == stop && feed.st_arrival[k] >= time && (best < 0 || feed.st_arrival[k] < best)) {
+            best = feed.st_arrival[k];
+        }
+    }
+    return best;
+}
+
+int main(int argc, char* argv[]) {
+    CityConfig config;
+    string dir = "transit_feed";
+    size_t queries = 1000000;
+    bool load_only = false;
+    for (int i = 1; i < argc; i += 2) {
+        if (i + 1 == argc) {
+            fprintf(stderr, "Expected '--<setting> <value>', got '%s'\n", argv[i]);
+            return 1;
+        }
+        if (strcmp(argv[i], "--feed") == 0) {
+            dir = argv[i + 1];
+        } else if (strcmp(argv[i], "--queries") == 0) {
+            queries = strtoull(argv[i + 1], nullptr, 10);
+        } else if (strcmp(argv[i], "--load-only") == 0) {
+            load_only = atoi(argv[i + 1]) != 0;
+        } else if (strncmp(argv[i], "--", 2) != 0 || !applySetting(argv[i] + 2, argv[i + 1], config)) {
+            return 1;
+        }
+    }
+    int intersections = config.num_intersections;
+
+    if (!load_only) {
+        TransitFeed synthesized;
+        auto start = chrono::high_resolution_clock::now();
+        synthesizeTransitFeed(intersections, config.num_transit_stops, synthesized);
+        printf("Synthesized %zu stops, %zu trips, %zu stop times in %.3f s\n", synthesized.numStops(),
+               synthesized.numTrips(), synthesized.numStopTimes(), secondsSince(start));
+        start = chrono::high_resolution_clock::now();
+        if (!writeTransitFeed(dir, synthesized)) {
+            return 1;
+        }
+        printf("Wrote %s in %.3f s\n", dir.c_str(), secondsSince(start));
+    }
+
+    TransitFeed feed;
+    auto start = chrono::high_resolution_clock::now();
+    if (!loadTransitFeed(dir, intersections, feed)) {
+        return 1;
+    }
+    double load = secondsSince(start);
+    start = chrono::high_resolution_clock::now();
+    feed.buildIndex(intersections);
+    double index = secondsSince(start);
+    printf("Loaded %zu stops, %zu trips, %zu stop times in %.3f s (%.0f k stop times/s), index alone %.3f s\n",
+           feed.numStops(), feed.numTrips(), feed.numStopTimes(), load, feed.numStopTimes() / load / 1e3, index);
+    printf("  %zu intersection passes, %.1f MB of tables\n", feed.numPasses(),
+           (feed.numStopTimes() * 5 * sizeof(int32_t) + feed.numPasses() * (6 * sizeof(int32_t) + 1)) / 1e6);
+
+    // Random stops, intersections and times over the service day
+    vector<int> stops(queries), nodes(queries), times(queries);
+    for (size_t q = 0; q < queries; ++q) {
+        SensorRNG rng(config.seed, STREAM_TRANSIT, q);
+        stops[q] = rng.uniform(feed.numStops());
+        nodes[q] = rng.uniform(intersections);
+        times[q] = TRANSIT_SERVICE_START + rng.uniform(TRANSIT_SERVICE_END - TRANSIT_SERVICE_START);
+    }
+
+    long found = 0;
+    start = chrono::high_resolution_clock::now();
+    for (size_t q = 0; q < queries; ++q) {
+        int trip;
+        found += feed.nextArrival(stops[q], times[q], trip) >= 0;
+    }
+    double next_arrival = secondsSince(start);
+    printf("nextArrival:   %.0f ns/query (%ld of %zu found)\n", 1e9 * next_arrival / queries, found, queries);
+
+    long passes = 0;
+    start = chrono::high_resolution_clock::now();
+    for (size_t q = 0; q < queries; ++q) {
+        pair<int, int> range = feed.passesThrough(nodes[q], times[q], times[q] + 600);
+        passes += range.second - range.first;
+    }
+    double passes_through = secondsSince(start);
+    printf("passesThrough: %.0f ns/query (10 min window, %.2f buses on average)\n", 1e9 * passes_through / queries,
+           (double)passes / queries);
+
+    // The scan baseline on a few queries, checked against the index
+    size_t scans = min<size_t>(queries, 200);
+    long mismatches = 0;
+    start = chrono::high_resolution_clock::now();
+    for (size_t q = 0; q < scans; ++q) {
+        int trip;
+        mismatches += scanNextArrival(feed, stops[q], times[q]) != feed.nextArrival(stops[q], times[q], trip);
+    }
+    double scan = secondsSince(start);
+    printf("linear scan:   %.0f ns/query, %ld mismatches\n", 1e9 * scan / scans, mismatches);
+
+    // One hour of tracking from the start of the tracker's clock
+    AlignedVector<uint8_t> priority(intersections, 0);
+    AlignedVector<PassengerCount> waiting(feed.numStops(), 0);
+    AlignedVector<LightPhase> lights(intersections * NUM_APPROACHES, LightPhase::Red);
+    TransitTracker tracker(feed, 0, feed.numTrips(), config.seed);
+    int ticks = 3600 / TRANSIT_TICK_SECONDS;
+    long requests = 0, buses = 0, boarded = 0;
+    start = chrono::high_resolution_clock::now();
+    #pragma omp parallel
+    #pragma omp single
+    for (int t = 0; t < ticks; ++t) {
+        TransitTickStats stats = tracker.advance(priority.data(), intersections);
+        boarded += tracker.board(waiting.data(), tracker.servedStops());
+        TransitTracker::applyPriority(priority.data(), intersections, lights.data());
+        requests += stats.requests;
+        buses += stats.active;
+    }
+    double tracking = secondsSince(start);
+    printf("Tracking: %.3f ms/tick with %d threads, %.0f buses, %.1f priority requests and %.0f boardings per tick\n",
+           1e3 * tracking / ticks, omp_get_max_threads(), (double)buses / ticks, (double)requests / ticks,
+           (double)boarded / ticks);
+    return mismatches == 0 ? 0 : 1;
+}
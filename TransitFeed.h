@@ -0,0 +1,666 @@
+#pragma once
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "CityState.h"
+#include "RoadNetwork.h"
+
+// Transit schedule in the GTFS layout.
+//
+// A feed is a directory of CSV files with a header row; the columns used are
+//
+//   stops.txt       stop_id, stop_lat, stop_lon
+//   routes.txt      route_id
+//   trips.txt       route_id, trip_id
+//   stop_times.txt  trip_id, arrival_time, departure_time, stop_id, stop_sequence
+//
+// Other columns are ignored. Times are H:MM:SS and may pass 24:00:00 for
+// trips after midnight; an empty time is interpolated from its neighbours.
+//
+// String ids are interned while loading, and the tables are flat arrays
+// indexed by dense ids. Stops are projected onto the grid city, the north-west
+// corner of the feed at intersection 0, and a bus drives from stop to stop
+// along the grid, first east-west and then north-south. buildIndex() records
+// every intersection a trip passes and when, then builds two time-sorted
+// indexes:
+//
+//   stop -> (arrival, trip), so nextArrival() is one binary search
+//   intersection -> (time, pass), so passesThrough() is a binary search plus
+//   the passes in the window
+//
+// synthesizeTransitFeed() lays out bus routes along grid rows and columns
+// for runs without a feed, and writeTransitFeed() saves a feed for loading.
+
+#define TRANSIT_STOP_SPACING 2         // intersections between synthesized stops
+#define TRANSIT_HEADWAY 900            // s between synthesized trips per route and direction
+#define TRANSIT_SERVICE_START 18000    // first synthesized departure, 05:00
+#define TRANSIT_SERVICE_END 86400      // synthesized departures stop at midnight
+#define TRANSIT_BUS_SPEED_MPS 8.0f
+#define TRANSIT_DWELL 20               // s at each synthesized stop
+#define TRANSIT_ORIGIN_LAT 40.0        // north-west corner of synthesized feeds
+#define TRANSIT_ORIGIN_LON -75.0
+#define METERS_PER_DEGREE 111320.0
+
+struct TransitFeed {
+    // Stops; x runs east and y south from the north-west corner, in meters
+    std::vector<std::string> stop_ids;
+    AlignedVector<float> stop_x;
+    AlignedVector<float> stop_y;
+    AlignedVector<int32_t> stop_intersection;
+
+    std::vector<std::string> route_ids;
+
+    // Trips; the stop times of trip t are [trip_offsets[t], trip_offsets[t + 1])
+    // in stop sequence order
+    std::vector<std::string> trip_ids;
+    AlignedVector<int32_t> trip_route;
+    AlignedVector<int32_t> trip_offsets;
+
+    // Stop times, s after the midnight that starts the service day
+    AlignedVector<int32_t> st_stop;
+    AlignedVector<int32_t> st_arrival;
+    AlignedVector<int32_t> st_departure;
+
+    // Intersections passed between stops; those of trip t are
+    // [trip_pass_offsets[t], trip_pass_offsets[t + 1]) in time order
+    int num_intersections = 0;
+    AlignedVector<int32_t> trip_pass_offsets;
+    AlignedVector<int32_t> pass_intersection;
+    AlignedVector<int32_t> pass_time;
+    AlignedVector<int32_t> pass_trip;
+    AlignedVector<uint8_t> pass_approach; // signal head the bus arrives on
+
+    // Per-stop arrivals sorted by time
+    AlignedVector<int32_t> stop_arrival_offsets;
+    AlignedVector<int32_t> stop_arrival_time;
+    AlignedVector<int32_t> stop_arrival_trip;
+
+    // Per-intersection passes sorted by time (ids into the pass arrays)
+    AlignedVector<int32_t> intersection_pass_offsets;
+    AlignedVector<int32_t> intersection_pass_time;
+    AlignedVector<int32_t> intersection_pass;
+
+    size_t numStops() const { return stop_x.size(); }
+    size_t numTrips() const { return trip_route.size(); }
+    size_t numStopTimes() const { return st_stop.size(); }
+    size_t numPasses() const { return pass_trip.size(); }
+
+    int tripStart(int t) const { return st_departure[trip_offsets[t]]; }
+    int tripEnd(int t) const { return st_arrival[trip_offsets[t + 1] - 1]; }
+
+    // First arrival at `stop` at or after `time`: its time, and its trip in
+    // `trip`; -1 when none is left that day
+    int nextArrival(int stop, int time, int& trip) const {
+        const int32_t* first = stop_arrival_time.data() + stop_arrival_offsets[stop];
+        const int32_t* last = stop_arrival_time.data() + stop_arrival_offsets[stop + 1];
+        const int32_t* it = std::lower_bound(first, last, time);
+        if (it == last) {
+            return -1;
+        }
+        trip = stop_arrival_trip[it - stop_arrival_time.data()];
+        return *it;
+    }
+
+    // Passes through `intersection` in [from, to), as the range [first, last)
+    // of intersection_pass
+    std::pair<int, int> passesThrough(int intersection, int from, int to) const {
+        const int32_t* begin = intersection_pass_time.data() + intersection_pass_offsets[intersection];
+        const int32_t* end = intersection_pass_time.data() + intersection_pass_offsets[intersection + 1];
+        const int32_t* lo = std::lower_bound(begin, end, from);
+        const int32_t* hi = std::lower_bound(lo, end, to);
+        return {int(lo - intersection_pass_time.data()), int(hi - intersection_pass_time.data())};
+    }
+
+    // Maps the stops onto a grid city of num_intersections and rebuilds the
+    // passes and both indexes from the trip tables.
+    void buildIndex(int intersections) {
+        num_intersections = intersections;
+        int width = RoadNetwork::gridWidth(intersections);
+        int rows = RoadNetwork::gridRows(intersections);
+        stop_intersection.resize(numStops());
+        for (size_t s = 0; s < numStops(); ++s) {
+            int col = std::min(std::max((int)std::lround(stop_x[s] / ROAD_LENGTH_M), 0), width - 1);
+            int row = std::min(std::max((int)std::lround(stop_y[s] / ROAD_LENGTH_M), 0), rows - 1);
+            stop_intersection[s] = std::min(row * width + col, intersections - 1);
+        }
+
+        // Grid path between consecutive stops, one pass per intersection entered
+        trip_pass_offsets.assign(numTrips() + 1, 0);
+        pass_intersection.clear();
+        pass_time.clear();
+        pass_trip.clear();
+        pass_approach.clear();
+        for (size_t t = 0; t < numTrips(); ++t) {
+            for (int k = trip_offsets[t] + 1; k < trip_offsets[t + 1]; ++k) {
+                int from = stop_intersection[st_stop[k - 1]], to = stop_intersection[st_stop[k]];
+                int x = from % width, y = from / width, tx = to % width, ty = to / width;
+                int steps = std::abs(tx - x) + std::abs(ty - y);
+                int depart = st_departure[k - 1], arrive = st_arrival[k];
+                for (int step = 1; step <= steps; ++step) {
+                    uint8_t approach;
+                    if (x != tx) {
+                        approach = tx > x ? APPROACH_WEST : APPROACH_EAST;
+                        x += tx > x ? 1 : -1;
+                    } else {
+                        approach = ty > y ? APPROACH_NORTH : APPROACH_SOUTH;
+                        y += ty > y ? 1 : -1;
+                    }
+                    int v = y * width + x;
+                    if (v >= intersections) {
+                        continue; // the missing part of a partial last row
+                    }
+                    pass_intersection.push_back(v);
+                    pass_time.push_back(depart + (long)(arrive - depart) * step / steps);
+                    pass_trip.push_back(t);
+                    pass_approach.push_back(approach);
+                }
+            }
+            trip_pass_offsets[t + 1] = numPasses();
+        }
+
+        sortedIndex(numStops(), numStopTimes(), [&](int k) { return st_stop[k]; }, [&](int k) { return st_arrival[k]; },
+                    stop_arrival_offsets, stop_arrival_time, stop_arrival_trip);
+        // Stop arrivals hold stop time ids so far; report trips instead
+        for (int32_t& k : stop_arrival_trip) {
+            k = stopTimeTrip(k);
+        }
+        sortedIndex(intersections, numPasses(), [&](int p) { return pass_intersection[p]; },
+                    [&](int p) { return pass_time[p]; }, intersection_pass_offsets, intersection_pass_time,
+                    intersection_pass);
+    }
+
+private:
+    // Trip of a stop time, by binary search of the trip offsets
+    int stopTimeTrip(int k) const {
+        return int(std::upper_bound(trip_offsets.begin(), trip_offsets.end(), k) - trip_offsets.begin()) - 1;
+    }
+
+    // Groups items [0, n) by bucket with a counting sort and orders each
+    // bucket by time; ids[i] is the item at position i
+    template <typename Bucket, typename Time>
+    static void sortedIndex(size_t buckets, size_t n, Bucket bucket, Time time, AlignedVector<int32_t>& offsets,
+                            AlignedVector<int32_t>& times, AlignedVector<int32_t>& ids) {
+        offsets.assign(buckets + 1, 0);
+        for (size_t i = 0; i < n; ++i) {
+            ++offsets[bucket(i) + 1];
+        }
+        for (size_t b = 0; b < buckets; ++b) {
+            offsets[b + 1] += offsets[b];
+        }
+        std::vector<std::pair<int32_t, int32_t>> keyed(n);
+        std::vector<int32_t> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < n; ++i) {
+            keyed[fill[bucket(i)]++] = {time(i), (int32_t)i};
+        }
+        times.resize(n);
+        ids.resize(n);
+        for (size_t b = 0; b < buckets; ++b) {
+            auto first = keyed.begin() + offsets[b], last = keyed.begin() + offsets[b + 1];
+            if (!std::is_sorted(first, last)) {
+                std::sort(first, last);
+            }
+        }
+        for (size_t i = 0; i < n; ++i) {
+            times[i] = keyed[i].first;
+            ids[i] = keyed[i].second;
+        }
+    }
+};
+
+// One CSV file of a feed, read whole. Fields may be quoted; the quotes are
+// stripped but doubled quotes inside are kept as they are, which only
+// affects names.
+class CsvReader {
+public:
+    bool open(const std::string& path) {
+        FILE* file = fopen(path.c_str(), "rb");
+        if (file == nullptr) {
+            fprintf(stderr, "Cannot open transit feed file '%s'\n", path.c_str());
+            return false;
+        }
+        fseek(file, 0, SEEK_END);
+        text.resize(ftell(file));
+        fseek(file, 0, SEEK_SET);
+        size_t read = fread(&text[0], 1, text.size(), file);
+        fclose(file);
+        if (read != text.size()) {
+            fprintf(stderr, "Failed reading transit feed file '%s'\n", path.c_str());
+            return false;
+        }
+        name = path;
+        // A UTF-8 byte order mark may precede the header
+        pos = text.compare(0, 3, "\xEF\xBB\xBF") == 0 ? 3 : 0;
+        line_number = 0;
+        if (!next()) {
+            fprintf(stderr, "%s: missing header row\n", path.c_str());
+            return false;
+        }
+        header = fields;
+        return true;
+    }
+
+    // Index of a header column, or -1 with an error when it is missing
+    int column(const char* column_name) const {
+        for (size_t c = 0; c < header.size(); ++c) {
+            if (header[c] == column_name) {
+                return c;
+            }
+        }
+        fprintf(stderr, "%s: missing column '%s'\n", name.c_str(), column_name);
+        return -1;
+    }
+
+    // Advances to the next non-empty record
+    bool next() {
+        while (pos < text.size()) {
+            ++line_number;
+            fields.clear();
+            size_t start = pos;
+            while (true) {
+                size_t begin = pos, end;
+                if (pos < text.size() && text[pos] == '"') {
+                    begin = ++pos;
+                    while (pos < text.size() && !(text[pos] == '"' && (pos + 1 >= text.size() || text[pos + 1] != '"'))) {
+                        pos += text[pos] == '"' ? 2 : 1;
+                    }
+                    end = pos;
+                    pos = std::min(pos + 1, text.size());
+                    while (pos < text.size() && text[pos] != ',' && text[pos] != '\n') {
+                        ++pos;
+                    }
+                } else {
+                    while (pos < text.size() && text[pos] != ',' && text[pos] != '\n') {
+                        ++pos;
+                    }
+                    end = pos;
+                }
+                if (end > begin && text[end - 1] == '\r') {
+                    --end;
+                }
+                fields.emplace_back(text.data() + begin, end - begin);
+                if (pos >= text.size() || text[pos] == '\n') {
+                    break;
+                }
+                ++pos;
+            }
+            ++pos;
+            if (pos - start > 1 && !(fields.size() == 1 && fields[0].empty())) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::string_view field(int c) const { return c < (int)fields.size() ? fields[c] : std::string_view(); }
+    const std::string& path() const { return name; }
+    size_t line() const { return line_number; }
+
+private:
+    std::string text;
+    std::string name;
+    size_t pos = 0;
+    size_t line_number = 0;
+    std::vector<std::string_view> header;
+    std::vector<std::string_view> fields;
+};
+
+// Seconds of an H:MM:SS time, -1 for an empty field and -2 when malformed
+inline int parseTransitTime(std::string_view text) {
+    while (!text.empty() && text.front() == ' ') {
+        text.remove_prefix(1);
+    }
+    if (text.empty()) {
+        return -1;
+    }
+    int parts[3] = {0, 0, 0};
+    int part = 0;
+    bool digits = false;
+    for (char c : text) {
+        if (c >= '0' && c <= '9') {
+            parts[part] = parts[part] * 10 + (c - '0');
+            digits = true;
+        } else if (c == ':' && part < 2 && digits) {
+            ++part;
+            digits = false;
+        } else if (c != ' ') {
+            return -2;
+        }
+    }
+    return part == 2 && digits ? parts[0] * 3600 + parts[1] * 60 + parts[2] : -2;
+}
+
+inline double parseTransitNumber(std::string_view text, bool& ok) {
+    std::string copy(text);
+    char* end = nullptr;
+    double value = strtod(copy.c_str(), &end);
+    ok = end != copy.c_str();
+    return value;
+}
+
+// Dense id of a string id, assigned in order of first appearance
+class IdTable {
+public:
+    int intern(std::string_view id, std::vector<std::string>& names) {
+        key.assign(id.data(), id.size());
+        auto it = ids.find(key);
+        if (it != ids.end()) {
+            return it->second;
+        }
+        int dense = names.size();
+        ids.emplace(key, dense);
+        names.push_back(key);
+        return dense;
+    }
+
+    int find(std::string_view id) {
+        key.assign(id.data(), id.size());
+        auto it = ids.find(key);
+        return it == ids.end() ? -1 : it->second;
+    }
+
+private:
+    std::unordered_map<std::string, int> ids;
+    std::string key;
+};
+
+// Loads the feed in `dir` and indexes it for a grid of num_intersections.
+// Errors go to stderr.
+inline bool loadTransitFeed(const std::string& dir, int num_intersections, TransitFeed& feed) {
+    feed = TransitFeed();
+    IdTable stop_table, route_table, trip_table;
+    CsvReader csv;
+
+    if (!csv.open(dir + "/stops.txt")) {
+        return false;
+    }
+    int stop_id = csv.column("stop_id"), stop_lat = csv.column("stop_lat"), stop_lon = csv.column("stop_lon");
+    if (stop_id < 0 || stop_lat < 0 || stop_lon < 0) {
+        return false;
+    }
+    std::vector<double> lat, lon;
+    while (csv.next()) {
+        bool lat_ok, lon_ok;
+        double stop_lat_value = parseTransitNumber(csv.field(stop_lat), lat_ok);
+        double stop_lon_value = parseTransitNumber(csv.field(stop_lon), lon_ok);
+        if (!lat_ok || !lon_ok) {
+            fprintf(stderr, "%s:%zu: invalid stop position\n", csv.path().c_str(), csv.line());
+            return false;
+        }
+        if (stop_table.intern(csv.field(stop_id), feed.stop_ids) == (int)lat.size()) {
+            lat.push_back(stop_lat_value);
+            lon.push_back(stop_lon_value);
+        }
+    }
+    if (lat.empty()) {
+        fprintf(stderr, "%s: no stops\n", csv.path().c_str());
+        return false;
+    }
+    // Equirectangular projection from the north-west corner
+    double north = *std::max_element(lat.begin(), lat.end());
+    double west = *std::min_element(lon.begin(), lon.end());
+    double east_scale = METERS_PER_DEGREE * std::cos(north * M_PI / 180.0);
+    feed.stop_x.resize(lat.size());
+    feed.stop_y.resize(lat.size());
+    for (size_t s = 0; s < lat.size(); ++s) {
+        feed.stop_x[s] = (lon[s] - west) * east_scale;
+        feed.stop_y[s] = (north - lat[s]) * METERS_PER_DEGREE;
+    }
+
+    if (!csv.open(dir + "/routes.txt")) {
+        return false;
+    }
+    int route_id = csv.column("route_id");
+    if (route_id < 0) {
+        return false;
+    }
+    while (csv.next()) {
+        route_table.intern(csv.field(route_id), feed.route_ids);
+    }
+
+    if (!csv.open(dir + "/trips.txt")) {
+        return false;
+    }
+    int trip_route = csv.column("route_id"), trip_id = csv.column("trip_id");
+    if (trip_route < 0 || trip_id < 0) {
+        return false;
+    }
+    while (csv.next()) {
+        int route = route_table.find(csv.field(trip_route));
+        if (route < 0) {
+            fprintf(stderr, "%s:%zu: unknown route_id\n", csv.path().c_str(), csv.line());
+            return false;
+        }
+        if (trip_table.intern(csv.field(trip_id), feed.trip_ids) == (int)feed.trip_route.size()) {
+            feed.trip_route.push_back(route);
+        }
+    }
+
+    if (!csv.open(dir + "/stop_times.txt")) {
+        return false;
+    }
+    int st_trip = csv.column("trip_id"), st_arrival = csv.column("arrival_time");
+    int st_departure = csv.column("departure_time"), st_stop = csv.column("stop_id");
+    int st_sequence = csv.column("stop_sequence");
+    if (st_trip < 0 || st_arrival < 0 || st_departure < 0 || st_stop < 0 || st_sequence < 0) {
+        return false;
+    }
+    struct Row {
+        int32_t trip, sequence, stop, arrival, departure;
+    };
+    std::vector<Row> rows;
+    std::string_view last_trip_id;
+    int last_trip = -1;
+    while (csv.next()) {
+        Row row;
+        // Rows of a trip are usually consecutive, so the last lookup is reused
+        if (last_trip < 0 || csv.field(st_trip) != last_trip_id) {
+            last_trip_id = csv.field(st_trip);
+            last_trip = trip_table.find(last_trip_id);
+        }
+        row.trip = last_trip;
+        row.stop = stop_table.find(csv.field(st_stop));
+        row.sequence = 0;
+        for (char c : csv.field(st_sequence)) {
+            row.sequence = c >= '0' && c <= '9' ? row.sequence * 10 + (c - '0') : row.sequence;
+        }
+        row.arrival = parseTransitTime(csv.field(st_arrival));
+        row.departure = parseTransitTime(csv.field(st_departure));
+        if (row.trip < 0 || row.stop < 0 || row.arrival == -2 || row.departure == -2) {
+            fprintf(stderr, "%s:%zu: %s\n", csv.path().c_str(), csv.line(),
+                    row.trip < 0 ? "unknown trip_id" : row.stop < 0 ? "unknown stop_id" : "malformed time");
+            return false;
+        }
+        // Either time may stand in for a missing other
+        if (row.arrival < 0) {
+            row.arrival = row.departure;
+        }
+        if (row.departure < 0) {
+            row.departure = row.arrival;
+        }
+        rows.push_back(row);
+    }
+
+    // Counting sort by trip, then stop sequence within each trip
+    size_t num_trips = feed.trip_route.size();
+    feed.trip_offsets.assign(num_trips + 1, 0);
+    for (const Row& row : rows) {
+        ++feed.trip_offsets[row.trip + 1];
+    }
+    for (size_t t = 0; t < num_trips; ++t) {
+        feed.trip_offsets[t + 1] += feed.trip_offsets[t];
+    }
+    std::vector<Row> sorted(rows.size());
+    std::vector<int32_t> fill(feed.trip_offsets.begin(), feed.trip_offsets.end() - 1);
+    for (const Row& row : rows) {
+        sorted[fill[row.trip]++] = row;
+    }
+    auto by_sequence = [](const Row& a, const Row& b) { return a.sequence < b.sequence; };
+    for (size_t t = 0; t < num_trips; ++t) {
+        auto first = sorted.begin() + feed.trip_offsets[t], last = sorted.begin() + feed.trip_offsets[t + 1];
+        if (!std::is_sorted(first, last, by_sequence)) {
+            std::sort(first, last, by_sequence);
+        }
+        // Untimed stops between two timed ones, evenly spaced in time
+        int timed = -1;
+        for (auto it = first; it != last; ++it) {
+            if (it->arrival < 0) {
+                continue;
+            }
+            if (timed >= 0 && it - (first + timed) > 1) {
+                int gap = it - (first + timed);
+                int from = first[timed].departure;
+                for (int k = 1; k < gap; ++k) {
+                    first[timed + k].arrival = first[timed + k].departure = from + (it->arrival - from) * k / gap;
+                }
+            }
+            timed = it - first;
+        }
+        if (first != last && (first->arrival < 0 || (last - 1)->arrival < 0)) {
+            fprintf(stderr, "%s: trip '%s' has no time at its first or last stop\n", csv.path().c_str(),
+                    feed.trip_ids[t].c_str());
+            return false;
+        }
+    }
+    feed.st_stop.resize(sorted.size());
+    feed.st_arrival.resize(sorted.size());
+    feed.st_departure.resize(sorted.size());
+    for (size_t k = 0; k < sorted.size(); ++k) {
+        feed.st_stop[k] = sorted[k].stop;
+        feed.st_arrival[k] = sorted[k].arrival;
+        feed.st_departure[k] = sorted[k].departure;
+    }
+
+    feed.buildIndex(num_intersections);
+    return true;
+}
+
+// Bus routes alternating between grid rows and columns, a stop every
+// TRANSIT_STOP_SPACING intersections, until there are num_stops stops. Each
+// route runs both ways every TRANSIT_HEADWAY seconds through the service day.
+inline void synthesizeTransitFeed(int num_intersections, size_t num_stops, TransitFeed& feed) {
+    feed = TransitFeed();
+    int width = RoadNetwork::gridWidth(num_intersections);
+    int rows = RoadNetwork::gridRows(num_intersections);
+    int hop = (int)std::lround(TRANSIT_STOP_SPACING * ROAD_LENGTH_M / TRANSIT_BUS_SPEED_MPS) + TRANSIT_DWELL;
+    feed.trip_offsets.push_back(0);
+    for (int r = 0; feed.numStops() < num_stops; ++r) {
+        // Horizontal routes on even, vertical ones on odd route numbers,
+        // spread over every other row or column
+        bool horizontal = r % 2 == 0 || rows == 1;
+        int line = (r / 2 * 2) % (horizontal ? rows : width);
+        int length = horizontal ? width : rows;
+        if (horizontal && line == rows - 1) {
+            length = num_intersections - line * width; // partial last row
+        }
+        size_t first_stop = feed.numStops();
+        for (int k = 0; k < length && feed.numStops() < num_stops; k += TRANSIT_STOP_SPACING) {
+            feed.stop_ids.push_back("S" + std::to_string(feed.numStops()));
+            feed.stop_x.push_back((horizontal ? k : line) * ROAD_LENGTH_M);
+            feed.stop_y.push_back((horizontal ? line : k) * ROAD_LENGTH_M);
+        }
+        int route_stops = feed.numStops() - first_stop;
+        int route = feed.route_ids.size();
+        feed.route_ids.push_back("R" + std::to_string(route));
+        for (int start = TRANSIT_SERVICE_START; start < TRANSIT_SERVICE_END; start += TRANSIT_HEADWAY) {
+            for (int direction = 0; direction < 2; ++direction) {
+                feed.trip_ids.push_back(feed.route_ids.back() + (direction ? "-b-" : "-a-") + std::to_string(start));
+                feed.trip_route.push_back(route);
+                for (int k = 0; k < route_stops; ++k) {
+                    int stop = first_stop + (direction ? route_stops - 1 - k : k);
+                    feed.st_stop.push_back(stop);
+                    feed.st_arrival.push_back(start + k * hop);
+                    feed.st_departure.push_back(start + k * hop + (k + 1 < route_stops ? TRANSIT_DWELL : 0));
+                }
+                feed.trip_offsets.push_back(feed.numStopTimes());
+            }
+        }
+    }
+    feed.buildIndex(num_intersections);
+}
+
+// The feed in `dir`, or a synthesized one of num_stops stops when dir is
+// empty, indexed for a grid of num_intersections
+inline bool openTransitFeed(const std::string& dir, int num_intersections, size_t num_stops, TransitFeed& feed) {
+    if (dir.empty()) {
+        synthesizeTransitFeed(num_intersections, num_stops, feed);
+        return true;
+    }
+    return loadTransitFeed(dir, num_intersections, feed);
+}
+
+// Writes the feed's four tables to `dir`, creating it if needed. Stops are
+// placed south-east of TRANSIT_ORIGIN_LAT / TRANSIT_ORIGIN_LON.
+inline bool writeTransitFeed(const std::string& dir, const TransitFeed& feed) {
+    mkdir(dir.c_str(), 0755);
+    auto open = [&](const char* file) {
+        std::string path = dir + "/" + file;
+        FILE* out = fopen(path.c_str(), "w");
+        if (out == nullptr) {
+            fprintf(stderr, "Cannot create transit feed file '%s'\n", path.c_str());
+        }
+        return out;
+    };
+    auto time = [](int seconds, char* text) {
+        snprintf(text, 16, "%02d:%02d:%02d", seconds / 3600, seconds / 60 % 60, seconds % 60);
+        return text;
+    };
+
+    FILE* out = open("stops.txt");
+    if (out == nullptr) {
+        return false;
+    }
+    double east_scale = METERS_PER_DEGREE * std::cos(TRANSIT_ORIGIN_LAT * M_PI / 180.0);
+    fprintf(out, "stop_id,stop_name,stop_lat,stop_lon\n");
+    for (size_t s = 0; s < feed.numStops(); ++s) {
+        fprintf(out, "%s,Stop %zu,%.7f,%.7f\n", feed.stop_ids[s].c_str(), s,
+                TRANSIT_ORIGIN_LAT - feed.stop_y[s] / METERS_PER_DEGREE, TRANSIT_ORIGIN_LON + feed.stop_x[s] / east_scale);
+    }
+    bool ok = fclose(out) == 0;
+
+    if ((out = open("routes.txt")) == nullptr) {
+        return false;
+    }
+    fprintf(out, "route_id,route_short_name,route_type\n");
+    for (const std::string& route : feed.route_ids) {
+        fprintf(out, "%s,%s,3\n", route.c_str(), route.c_str());
+    }
+    ok = fclose(out) == 0 && ok;
+
+    if ((out = open("trips.txt")) == nullptr) {
+        return false;
+    }
+    fprintf(out, "route_id,service_id,trip_id\n");
+    for (size_t t = 0; t < feed.numTrips(); ++t) {
+        fprintf(out, "%s,daily,%s\n", feed.route_ids[feed.trip_route[t]].c_str(), feed.trip_ids[t].c_str());
+    }
+    ok = fclose(out) == 0 && ok;
+
+    if ((out = open("stop_times.txt")) == nullptr) {
+        return false;
+    }
+    fprintf(out, "trip_id,arrival_time,departure_time,stop_id,stop_sequence\n");
+    char arrival[16], departure[16];
+    for (size_t t = 0; t < feed.numTrips(); ++t) {
+        for (int k = feed.trip_offsets[t]; k < feed.trip_offsets[t + 1]; ++k) {
+            fprintf(out, "%s,%s,%s,%s,%d\n", feed.trip_ids[t].c_str(), time(feed.st_arrival[k], arrival),
+                    time(feed.st_departure[k], departure), feed.stop_ids[feed.st_stop[k]].c_str(),
+                    k - feed.trip_offsets[t] + 1);
+        }
+    }
+    ok = fclose(out) == 0 && ok;
+    if (!ok) {
+        fprintf(stderr, "Failed writing transit feed to '%s'\n", dir.c_str());
+    }
+    return ok;
+}
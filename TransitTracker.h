@@ -0,0 +1,262 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "CityState.h"
+#include "SensorRNG.h"
+#include "TransitFeed.h"
+
+// Bus tracking and transit signal priority (TSP).
+//
+// Every tick advances the service clock by TRANSIT_TICK_SECONDS and moves the
+// buses of a block of trips along their schedule. Each trip runs a fixed
+// delay behind its schedule, drawn per trip. A bus keeps cursors into its
+// trip's stop times and intersection passes, so advancing it costs only the
+// stops and intersections it covered since the last tick. Trips start in
+// order of their delayed departure, so starting them is a cursor as well.
+//
+// A bus at least TRANSIT_TSP_LATENESS behind schedule that will enter an
+// intersection within TRANSIT_TSP_HORIZON asks for priority there: the bit of
+// its approach in CityState::transit_priority. applyPriority() turns the
+// requests into green for the requested axis in the draft signal plan, and a
+// granted request takes TRANSIT_TSP_SAVING off the bus's delay.
+//
+// Passengers arrive at every stop each tick, and a bus that serves a stop
+// boards everyone waiting there. The served stops and priority requests are
+// flag arrays, so MPI ranks that track different trips can combine them with
+// a bitwise OR.
+
+#define TRANSIT_TICK_SECONDS 30
+#define TRANSIT_CLOCK_START 25200  // 07:00, the tracker's first tick
+#define TRANSIT_TSP_HORIZON 30     // s before entering an intersection a bus asks for priority
+#define TRANSIT_TSP_LATENESS 60    // s behind schedule from which a bus asks
+#define TRANSIT_TSP_SAVING 5       // s of delay a granted request saves
+#define TRANSIT_MAX_DELAY 300      // trip delays are drawn from [-60, 240) s
+
+struct TransitTickStats {
+    long active = 0;       // buses on the road after the tick
+    long late = 0;         // of which at least TRANSIT_TSP_LATENESS behind
+    long requests = 0;     // priority requests raised
+    long delay_seconds = 0; // summed over the active buses
+};
+
+class TransitTracker {
+public:
+    // Tracks trips [begin, end) of the feed
+    TransitTracker(const TransitFeed& feed, size_t begin, size_t end, uint64_t seed)
+        : feed(feed), seed(seed), first(begin), last(end), delay(feed.numTrips(), 0), stop_cursor(feed.numTrips(), 0),
+          pass_cursor(feed.numTrips(), 0), requested_pass(feed.numTrips(), -1), served(feed.numStops(), 0) {
+        for (size_t t = begin; t < end; ++t) {
+            delay[t] = sensorValue(seed, STREAM_TRANSIT, t, TRANSIT_MAX_DELAY) - 60;
+            stop_cursor[t] = feed.trip_offsets[t];
+            pass_cursor[t] = feed.trip_pass_offsets[t];
+            departures.push_back(t);
+        }
+        std::sort(departures.begin(), departures.end(), [&](int a, int b) {
+            return feed.tripStart(a) + delay[a] < feed.tripStart(b) + delay[b] ||
+                   (feed.tripStart(a) + delay[a] == feed.tripStart(b) + delay[b] && a < b);
+        });
+        active.reserve(end - begin);
+    }
+
+    int clock() const { return now; }
+    uint64_t ticks() const { return tick_count; }
+    size_t numActive() const { return active.size(); }
+    int activeTrip(size_t k) const { return active[k].trip; }
+    float busX(size_t k) const { return active[k].x; }
+    float busY(size_t k) const { return active[k].y; }
+
+    // Stops served in the last tick, one flag per stop
+    uint8_t* servedStops() { return served.data(); }
+
+    // Checkpoint sections (Checkpoint.h): the clock and the progress of this
+    // block's trips. A trip is saved as waiting, on the road or finished;
+    // the buses on the road are rebuilt from that in departure order, and
+    // their positions are recomputed by the next tick.
+    template <typename Archive>
+    void checkpoint(Archive& archive) {
+        size_t trips = feed.numTrips();
+        std::vector<uint8_t> state(last - first, TRIP_WAITING);
+        if (!archive.restoring()) {
+            for (size_t k = 0; k < next_departure; ++k) {
+                state[departures[k] - first] = TRIP_FINISHED;
+            }
+            for (const Bus& bus : active) {
+                state[bus.trip - first] = TRIP_ACTIVE;
+            }
+        }
+        archive.whole("transit.now", &now, 1);
+        archive.whole("transit.ticks", &tick_count, 1);
+        archive.section("transit.delay", delay.data() + first, trips, first, last);
+        archive.section("transit.stop_cursor", stop_cursor.data() + first, trips, first, last);
+        archive.section("transit.pass_cursor", pass_cursor.data() + first, trips, first, last);
+        archive.section("transit.requested_pass", requested_pass.data() + first, trips, first, last);
+        archive.section("transit.state", state.data(), trips, first, last);
+        if (archive.restoring()) {
+            // Trips leave in departure order, so the departed ones lead the list
+            next_departure = 0;
+            active.clear();
+            while (next_departure < departures.size() && state[departures[next_departure] - first] != TRIP_WAITING) {
+                int t = departures[next_departure++];
+                if (state[t - first] == TRIP_ACTIVE) {
+                    active.push_back({t, 0.0f, 0.0f, -1, stop_cursor[t], false});
+                }
+            }
+        }
+    }
+
+    // Moves the buses through the next tick. priority is cleared and gets
+    // the requests of this block's buses; servedStops() likewise.
+    TransitTickStats advance(uint8_t* priority, size_t num_intersections) {
+        now = TRANSIT_CLOCK_START + (int)tick_count * TRANSIT_TICK_SECONDS;
+        ++tick_count;
+        memset(priority, 0, num_intersections);
+        memset(served.data(), 0, served.size());
+        while (next_departure < departures.size()) {
+            int t = departures[next_departure];
+            if (feed.tripStart(t) + delay[t] > now) {
+                break;
+            }
+            ++next_departure;
+            // A trip already under way by the last tick (i.e. when the clock
+            // starts) joins where it is then, without serving earlier stops
+            int previous = now - TRANSIT_TICK_SECONDS - delay[t];
+            if (feed.tripEnd(t) <= previous) {
+                continue;
+            }
+            while (feed.st_arrival[stop_cursor[t]] <= previous) {
+                ++stop_cursor[t];
+            }
+            while (pass_cursor[t] < feed.trip_pass_offsets[t + 1] && feed.pass_time[pass_cursor[t]] <= previous) {
+                ++pass_cursor[t];
+            }
+            active.push_back({t, 0.0f, 0.0f, -1, 0, false});
+        }
+
+        int num_active = active.size();
+        #pragma omp taskloop default(shared)
+        for (int k = 0; k < num_active; ++k) {
+            moveBus(active[k]);
+        }
+
+        // Flags are ORed in serially; buses share stops and intersections
+        TransitTickStats stats;
+        size_t kept = 0;
+        for (Bus& bus : active) {
+            for (int k = bus.served_from; k < stop_cursor[bus.trip]; ++k) {
+                served[feed.st_stop[k]] = 1;
+            }
+            if (bus.request >= 0) {
+                priority[feed.pass_intersection[bus.request]] |= uint8_t(1 << feed.pass_approach[bus.request]);
+                ++stats.requests;
+            }
+            if (bus.done) {
+                continue;
+            }
+            stats.late += delay[bus.trip] >= TRANSIT_TSP_LATENESS;
+            stats.delay_seconds += delay[bus.trip];
+            active[kept++] = bus;
+        }
+        active.resize(kept);
+        stats.active = kept;
+        return stats;
+    }
+
+    // Passengers arriving at every stop this tick, and boarding at the stops
+    // in `served`. Returns the passengers boarded.
+    long board(PassengerCount* waiting, const uint8_t* stops_served) const {
+        long boarded = 0;
+        long num_stops = feed.numStops();
+        uint64_t first = (tick_count - 1) * num_stops;
+        #pragma omp taskloop default(shared) reduction(+:boarded)
+        for (long s = 0; s < num_stops; ++s) {
+            int arrivals = sensorValue(seed, STREAM_PUBLIC_TRANSPORT, first + s, 4);
+            int total = std::min(waiting[s] + arrivals, 65535);
+            boarded += stops_served[s] ? total : 0;
+            waiting[s] = PassengerCount(stops_served[s] ? 0 : total);
+        }
+        return boarded;
+    }
+
+    // Gives the requested axis (north-south before east-west) green and the
+    // cross axis red at every intersection with a request
+    static void applyPriority(const uint8_t* priority, size_t num_intersections, LightPhase* draft) {
+        const uint8_t north_south = 1 << APPROACH_NORTH | 1 << APPROACH_SOUTH;
+        #pragma omp taskloop simd default(shared)
+        for (size_t i = 0; i < num_intersections; ++i) {
+            if (priority[i] != 0) {
+                bool ns = (priority[i] & north_south) != 0;
+                LightPhase* lights = draft + i * NUM_APPROACHES;
+                lights[APPROACH_NORTH] = lights[APPROACH_SOUTH] = ns ? LightPhase::Green : LightPhase::Red;
+                lights[APPROACH_EAST] = lights[APPROACH_WEST] = ns ? LightPhase::Red : LightPhase::Green;
+            }
+        }
+    }
+
+private:
+    enum TripState : uint8_t { TRIP_WAITING, TRIP_ACTIVE, TRIP_FINISHED };
+
+    struct Bus {
+        int trip;
+        float x, y;
+        int request;     // pass asking for priority this tick, or -1
+        int served_from; // first stop time reached this tick
+        bool done;
+    };
+
+    const TransitFeed& feed;
+    uint64_t seed;
+    size_t first, last; // trips tracked
+    int now = TRANSIT_CLOCK_START;
+    uint64_t tick_count = 0;
+
+    // Per trip, indexed by trip id; only this block's entries are used
+    std::vector<int> delay; // s behind schedule
+    std::vector<int> stop_cursor; // next stop time not yet reached
+    std::vector<int> pass_cursor; // next intersection pass not yet made
+    std::vector<int> requested_pass;
+
+    std::vector<int> departures; // this block's trips by delayed departure
+    size_t next_departure = 0;
+    std::vector<Bus> active;
+    std::vector<uint8_t> served;
+
+    void moveBus(Bus& bus) {
+        int t = bus.trip;
+        int scheduled = now - delay[t];
+        bus.served_from = stop_cursor[t];
+        int last_stop = feed.trip_offsets[t + 1];
+        int& c = stop_cursor[t];
+        while (c < last_stop && feed.st_arrival[c] <= scheduled) {
+            ++c;
+        }
+        int last_pass = feed.trip_pass_offsets[t + 1];
+        int& p = pass_cursor[t];
+        while (p < last_pass && feed.pass_time[p] <= scheduled) {
+            ++p;
+        }
+
+        // Between the stop last reached and the next one
+        int from = feed.st_stop[std::max(c - 1, feed.trip_offsets[t])];
+        int to = feed.st_stop[std::min(c, last_stop - 1)];
+        float share = 0.0f;
+        if (c > feed.trip_offsets[t] && c < last_stop) {
+            int depart = feed.st_departure[c - 1], arrive = feed.st_arrival[c];
+            share = arrive > depart ? std::min(std::max(float(scheduled - depart) / (arrive - depart), 0.0f), 1.0f) : 0.0f;
+        }
+        bus.x = feed.stop_x[from] + share * (feed.stop_x[to] - feed.stop_x[from]);
+        bus.y = feed.stop_y[from] + share * (feed.stop_y[to] - feed.stop_y[from]);
+
+        bus.request = -1;
+        if (p < last_pass && p != requested_pass[t] && delay[t] >= TRANSIT_TSP_LATENESS &&
+            feed.pass_time[p] - scheduled <= TRANSIT_TSP_HORIZON) {
+            bus.request = p;
+            requested_pass[t] = p;
+            delay[t] -= TRANSIT_TSP_SAVING;
+        }
+        bus.done = c == last_stop;
+    }
+};
@@ -0,0 +1,57 @@
+#!/usr/bin/env bash
+# Strong- and weak-scaling sweeps for both binaries.
+#
+#   ./scaling.sh [preset] [max_workers] [repetitions]
+#
+# Runs ./openmp_traffic_management with 1, 2, 4, ... threads and
+# ./mpi_traffic_management with 1, 2, 4, ... ranks up to max_workers, in
+# benchmark mode. Strong scaling keeps the preset fixed; weak scaling
+# multiplies the per-worker sizes below by the worker count. Results are
+# appended to scaling-strong.csv and scaling-weak.csv (set OUT to change the
+# prefix; FORMAT=jsonl writes JSON Lines instead of CSV).
+#
+# The MPI ranks run one thread each. With HYBRID_THREADS=t the sweep also
+# runs the MPI binary (built with -fopenmp) as p/t ranks of t threads each
+# wherever t divides p.
+
+set -euo pipefail
+
+PRESET=${1:-district}
+MAX_WORKERS=${2:-$(nproc)}
+REPETITIONS=${3:-5}
+OUT=${OUT:-scaling}
+FORMAT=${FORMAT:-csv}
+MPIRUN=${MPIRUN:-mpirun} # may carry flags, e.g. "mpirun --oversubscribe"
+OPENMP_BIN=${OPENMP_BIN:-./openmp_traffic_management}
+MPI_BIN=${MPI_BIN:-./mpi_traffic_management}
+HYBRID_THREADS=${HYBRID_THREADS:-0}
+
+# Per-worker sizes for weak scaling
+WEAK_VEHICLES=${WEAK_VEHICLES:-250000}
+WEAK_SENSORS=${WEAK_SENSORS:-2500}
+WEAK_CAMERAS=${WEAK_CAMERAS:-500}
+WEAK_INTERSECTIONS=${WEAK_INTERSECTIONS:-1250}
+
+workers=()
+for ((p = 1; p < MAX_WORKERS; p *= 2)); do
+    workers+=("$p")
+done
+workers+=("$MAX_WORKERS")
+
+bench=(--preset "$PRESET" --repetitions "$REPETITIONS" --warmup 1)
+
+for p in "${workers[@]}"; do
+    weak=(--vehicles $((WEAK_VEHICLES * p)) --sensors $((WEAK_SENSORS * p))
+          --cameras $((WEAK_CAMERAS * p)) --intersections $((WEAK_INTERSECTIONS * p)))
+
+    echo "== $p worker(s)"
+    OMP_NUM_THREADS=$p "$OPENMP_BIN" "${bench[@]}" --report "$OUT-strong.$FORMAT"
+    OMP_NUM_THREADS=$p "$OPENMP_BIN" "${bench[@]}" "${weak[@]}" --report "$OUT-weak.$FORMAT"
+    OMP_NUM_THREADS=1 $MPIRUN -np "$p" "$MPI_BIN" "${bench[@]}" --report "$OUT-strong.$FORMAT"
+    OMP_NUM_THREADS=1 $MPIRUN -np "$p" "$MPI_BIN" "${bench[@]}" "${weak[@]}" --report "$OUT-weak.$FORMAT"
+    if ((HYBRID_THREADS > 1 && p % HYBRID_THREADS == 0)); then
+        ranks=$((p / HYBRID_THREADS))
+        OMP_NUM_THREADS=$HYBRID_THREADS $MPIRUN -np "$ranks" "$MPI_BIN" "${bench[@]}" --report "$OUT-strong.$FORMAT"
+        OMP_NUM_THREADS=$HYBRID_THREADS $MPIRUN -np "$ranks" "$MPI_BIN" "${bench[@]}" "${weak[@]}" --report "$OUT-weak.$FORMAT"
+    fi
+done